@@ -143,6 +143,8 @@ pub struct BufferedStream {
 
 impl BufferedStream {
     pub fn new(stream: TcpStream) -> Self {
+        // the I3C socket carries small, latency bound packets
+        let _ = stream.set_nodelay(true);
         Self {
             stream,
             read_buffer: VecDeque::new(),
@@ -36,117 +36,433 @@ Abstract:
 use crate::i3c::{
     I3cBusCommand, I3cBusResponse, I3cTcriCommand, I3cTcriCommandXfer, ResponseDescriptor,
 };
+use std::collections::VecDeque;
+use std::fmt;
 use std::io::{ErrorKind, Read, Write};
-use std::net::{SocketAddr, TcpListener, TcpStream};
-use std::sync::atomic::{AtomicBool, Ordering};
+use std::net::{TcpListener, TcpStream};
+use std::ops::Deref;
+use std::os::fd::AsRawFd;
+use std::os::unix::net::UnixStream;
+use std::sync::atomic::{AtomicBool, AtomicU64, Ordering};
 use std::sync::mpsc;
 use std::sync::mpsc::{Receiver, Sender};
-use std::time::Duration;
-use std::vec;
+use std::sync::{Arc, Mutex};
+use std::time::Instant;
 use zerocopy::{transmute, FromBytes, IntoBytes};
 
 pub const CRC8_SMBUS: crc::Crc<u8> = crc::Crc::<u8>::new(&crc::CRC_8_SMBUS);
 
+/// How long the socket thread waits for an event before checking `running` again.
+const POLL_TIMEOUT_MS: i32 = 100;
+
+const INCOMING_HEADER_LEN: usize = std::mem::size_of::<IncomingHeader>();
+
+/// Throughput and latency counters of the I3C socket, see [`I3C_SOCKET_STATS`].
+pub struct I3cSocketStats {
+    commands: AtomicU64,
+    responses: AtomicU64,
+    ibis: AtomicU64,
+    bytes_received: AtomicU64,
+    bytes_sent: AtomicU64,
+    wakeups: AtomicU64,
+    max_batch: AtomicU64,
+    latency_total_ns: AtomicU64,
+    latency_max_ns: AtomicU64,
+}
+
+/// Counters of the I3C socket at one point in time.
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub struct I3cSocketStatsSnapshot {
+    /// Commands received from the client and passed to the I3C controller
+    pub commands: u64,
+    /// Responses written to the client, not counting IBIs
+    pub responses: u64,
+    /// IBIs written to the client
+    pub ibis: u64,
+    pub bytes_received: u64,
+    pub bytes_sent: u64,
+    /// Times the socket thread woke up with work to do
+    pub wakeups: u64,
+    /// Most commands and responses handled in a single wakeup
+    pub max_batch: u64,
+    /// Sum over the responses and IBIs of the time from the I3C controller handing them
+    /// to the socket thread until they are written to the socket
+    pub latency_total_ns: u64,
+    pub latency_max_ns: u64,
+}
+
+/// Counters of the sockets started by [`start_i3c_socket`].
+pub static I3C_SOCKET_STATS: I3cSocketStats = I3cSocketStats::new();
+
+impl I3cSocketStats {
+    pub const fn new() -> Self {
+        Self {
+            commands: AtomicU64::new(0),
+            responses: AtomicU64::new(0),
+            ibis: AtomicU64::new(0),
+            bytes_received: AtomicU64::new(0),
+            bytes_sent: AtomicU64::new(0),
+            wakeups: AtomicU64::new(0),
+            max_batch: AtomicU64::new(0),
+            latency_total_ns: AtomicU64::new(0),
+            latency_max_ns: AtomicU64::new(0),
+        }
+    }
+
+    pub fn snapshot(&self) -> I3cSocketStatsSnapshot {
+        I3cSocketStatsSnapshot {
+            commands: self.commands.load(Ordering::Relaxed),
+            responses: self.responses.load(Ordering::Relaxed),
+            ibis: self.ibis.load(Ordering::Relaxed),
+            bytes_received: self.bytes_received.load(Ordering::Relaxed),
+            bytes_sent: self.bytes_sent.load(Ordering::Relaxed),
+            wakeups: self.wakeups.load(Ordering::Relaxed),
+            max_batch: self.max_batch.load(Ordering::Relaxed),
+            latency_total_ns: self.latency_total_ns.load(Ordering::Relaxed),
+            latency_max_ns: self.latency_max_ns.load(Ordering::Relaxed),
+        }
+    }
+
+    pub fn reset(&self) {
+        for counter in [
+            &self.commands,
+            &self.responses,
+            &self.ibis,
+            &self.bytes_received,
+            &self.bytes_sent,
+            &self.wakeups,
+            &self.max_batch,
+            &self.latency_total_ns,
+            &self.latency_max_ns,
+        ] {
+            counter.store(0, Ordering::Relaxed);
+        }
+    }
+
+    fn add(counter: &AtomicU64, n: u64) {
+        counter.fetch_add(n, Ordering::Relaxed);
+    }
+
+    fn record_latency(&self, queued: Instant) {
+        let ns = queued.elapsed().as_nanos() as u64;
+        self.latency_total_ns.fetch_add(ns, Ordering::Relaxed);
+        self.latency_max_ns.fetch_max(ns, Ordering::Relaxed);
+    }
+}
+
+impl Default for I3cSocketStats {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl I3cSocketStatsSnapshot {
+    /// Mean time a response or IBI waited in the socket thread before being written.
+    pub fn mean_latency_ns(&self) -> u64 {
+        self.latency_total_ns
+            .checked_div(self.responses + self.ibis)
+            .unwrap_or(0)
+    }
+}
+
+impl fmt::Display for I3cSocketStatsSnapshot {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        write!(
+            f,
+            "{} commands ({} bytes), {} responses and {} IBIs ({} bytes) in {} wakeups, \
+             at most {} per wakeup, response latency mean {} us max {} us",
+            self.commands,
+            self.bytes_received,
+            self.responses,
+            self.ibis,
+            self.bytes_sent,
+            self.wakeups,
+            self.max_batch,
+            self.mean_latency_ns() / 1000,
+            self.latency_max_ns / 1000
+        )
+    }
+}
+
 pub fn start_i3c_socket(
     running: &'static AtomicBool,
     port: u16,
 ) -> (Receiver<I3cBusCommand>, Sender<I3cBusResponse>) {
+    start_i3c_socket_with(running, &I3C_SOCKET_STATS, port, None)
+}
+
+/// Like [`start_i3c_socket`], for a socket with a `running` flag and `stats` of its own,
+/// e.g. one per emulator instance. If set, `input_waker` gets a byte whenever commands
+/// from the client are passed on, to wake a host that sleeps while the emulator is idle.
+pub fn start_i3c_socket_with<R, S>(
+    running: R,
+    stats: S,
+    port: u16,
+    input_waker: Option<UnixStream>,
+) -> (Receiver<I3cBusCommand>, Sender<I3cBusResponse>)
+where
+    R: Deref<Target = AtomicBool> + Send + 'static,
+    S: Deref<Target = I3cSocketStats> + Send + 'static,
+{
     let listener = TcpListener::bind(format!("127.0.0.1:{}", port))
         .expect("Failed to bind TCP socket for port");
 
     let (bus_command_tx, bus_command_rx) = mpsc::channel::<I3cBusCommand>();
     let (bus_response_tx, bus_response_rx) = mpsc::channel::<I3cBusResponse>();
     std::thread::spawn(move || {
-        handle_i3c_socket_loop(running, listener, bus_response_rx, bus_command_tx)
+        handle_i3c_socket_loop(
+            running,
+            stats,
+            listener,
+            bus_response_rx,
+            bus_command_tx,
+            input_waker,
+        )
     });
 
     (bus_command_rx, bus_response_tx)
 }
 
-pub fn handle_i3c_socket_loop(
-    running: &'static AtomicBool,
+/// Serve the I3C socket on `listener`, one client at a time, until `running` is cleared.
+///
+/// The socket thread sleeps in `poll()` until the client sends data or the I3C
+/// controller hands over responses, then passes every complete command it has received
+/// to `bus_command_tx` and writes every pending response and IBI at once. The traffic is
+/// counted in `stats`. If set, `input_waker` gets a byte for each batch of commands
+/// passed on.
+pub fn handle_i3c_socket_loop<R, S>(
+    running: R,
+    stats: S,
     listener: TcpListener,
-    mut bus_response_rx: Receiver<I3cBusResponse>,
-    mut bus_command_tx: Sender<I3cBusCommand>,
-) {
+    bus_response_rx: Receiver<I3cBusResponse>,
+    bus_command_tx: Sender<I3cBusCommand>,
+    input_waker: Option<UnixStream>,
+) where
+    R: Deref<Target = AtomicBool>,
+    S: Deref<Target = I3cSocketStats>,
+{
     listener
         .set_nonblocking(true)
         .expect("Could not set non-blocking");
-    while running.load(Ordering::Relaxed) {
-        match listener.accept() {
+    let (waker, waker_tx) = UnixStream::pair().expect("Could not create I3C socket waker");
+    waker
+        .set_nonblocking(true)
+        .expect("Could not set non-blocking");
+    waker_tx
+        .set_nonblocking(true)
+        .expect("Could not set non-blocking");
+    let pending: Arc<Mutex<VecDeque<(Instant, I3cBusResponse)>>> = Arc::default();
+    let signaled = Arc::new(AtomicBool::new(false));
+
+    let forward_pending = pending.clone();
+    let forward_signaled = signaled.clone();
+    // Keep the waker open while responses are forwarded, so waking never hits a closed
+    // socket once the loop below has returned.
+    let waker_keepalive = waker.try_clone().expect("Could not clone I3C socket waker");
+    std::thread::spawn(move || {
+        let _waker_keepalive = waker_keepalive;
+        forward_responses(bus_response_rx, forward_pending, forward_signaled, waker_tx)
+    });
+
+    I3cSocketReactor {
+        listener,
+        stream: None,
+        waker,
+        signaled,
+        pending,
+        bus_command_tx,
+        input_waker,
+        stats,
+        read_buf: vec![],
+        write_buf: vec![],
+        queued_bytes: 0,
+        sent_bytes: 0,
+        queued_responses: VecDeque::new(),
+    }
+    .run(&running);
+}
+
+/// Move the responses of the I3C controller to `pending` as they come and wake the
+/// socket thread, once for all the responses it has not picked up yet.
+fn forward_responses(
+    bus_response_rx: Receiver<I3cBusResponse>,
+    pending: Arc<Mutex<VecDeque<(Instant, I3cBusResponse)>>>,
+    signaled: Arc<AtomicBool>,
+    mut waker_tx: UnixStream,
+) {
+    while let Ok(response) = bus_response_rx.recv() {
+        {
+            let mut pending = pending.lock().unwrap();
+            pending.push_back((Instant::now(), response));
+            pending.extend(bus_response_rx.try_iter().map(|r| (Instant::now(), r)));
+        }
+        if !signaled.swap(true, Ordering::AcqRel) {
+            // a full waker already has a wakeup pending
+            let _ = waker_tx.write(&[0]);
+        }
+    }
+}
+
+struct I3cSocketReactor<S> {
+    listener: TcpListener,
+    stream: Option<TcpStream>,
+    waker: UnixStream,
+    signaled: Arc<AtomicBool>,
+    pending: Arc<Mutex<VecDeque<(Instant, I3cBusResponse)>>>,
+    bus_command_tx: Sender<I3cBusCommand>,
+    /// Written once per batch of commands passed on, see [`start_i3c_socket_with`]
+    input_waker: Option<UnixStream>,
+    stats: S,
+    /// Bytes received that do not form a complete command yet
+    read_buf: Vec<u8>,
+    /// Encoded responses not written to the socket yet
+    write_buf: Vec<u8>,
+    queued_bytes: u64,
+    sent_bytes: u64,
+    /// Stream offset where each response in `write_buf` ends and when it was handed over
+    queued_responses: VecDeque<(u64, Instant)>,
+}
+
+impl<S: Deref<Target = I3cSocketStats>> I3cSocketReactor<S> {
+    fn run(&mut self, running: &AtomicBool) {
+        while running.load(Ordering::Relaxed) {
+            let (socket_fd, socket_events) = match &self.stream {
+                Some(stream) if self.write_buf.is_empty() => (stream.as_raw_fd(), libc::POLLIN),
+                Some(stream) => (stream.as_raw_fd(), libc::POLLIN | libc::POLLOUT),
+                None => (self.listener.as_raw_fd(), libc::POLLIN),
+            };
+            let mut fds = [
+                libc::pollfd {
+                    fd: socket_fd,
+                    events: socket_events,
+                    revents: 0,
+                },
+                libc::pollfd {
+                    fd: self.waker.as_raw_fd(),
+                    events: libc::POLLIN,
+                    revents: 0,
+                },
+            ];
+            // SAFETY: `fds` is valid for the duration of the call and its length is passed
+            let ready =
+                unsafe { libc::poll(fds.as_mut_ptr(), fds.len() as libc::nfds_t, POLL_TIMEOUT_MS) };
+            if ready < 0 {
+                let err = std::io::Error::last_os_error();
+                if err.kind() == ErrorKind::Interrupted {
+                    continue;
+                }
+                panic!("Error polling I3C socket: {}", err);
+            }
+            if ready == 0 {
+                continue;
+            }
+            I3cSocketStats::add(&self.stats.wakeups, 1);
+
+            let mut batch = 0;
+            if fds[0].revents != 0 {
+                if self.stream.is_none() {
+                    self.accept();
+                } else {
+                    batch += self.read_commands();
+                }
+            }
+            if fds[1].revents != 0 {
+                self.clear_waker();
+            }
+            if self.stream.is_some() {
+                batch += self.queue_responses();
+                self.write_responses();
+            }
+            self.stats.max_batch.fetch_max(batch, Ordering::Relaxed);
+        }
+    }
+
+    fn accept(&mut self) {
+        match self.listener.accept() {
             Ok((stream, addr)) => {
                 println!("Accepting I3C socket connection from {:?}", addr);
-                handle_i3c_socket_connection(
-                    running,
-                    stream,
-                    addr,
-                    &mut bus_response_rx,
-                    &mut bus_command_tx,
-                );
-            }
-            Err(ref e) if e.kind() == ErrorKind::WouldBlock => {
-                std::thread::sleep(std::time::Duration::from_millis(10));
+                stream.set_nonblocking(true).unwrap();
+                // commands and responses are small and latency bound
+                stream.set_nodelay(true).unwrap();
+                self.stream = Some(stream);
             }
+            Err(ref e) if e.kind() == ErrorKind::WouldBlock => {}
             Err(e) => panic!("Error accepting connection: {}", e),
         }
     }
-}
 
-#[derive(FromBytes, IntoBytes)]
-#[repr(C, packed)]
-pub struct IncomingHeader {
-    pub to_addr: u8,
-    pub command: [u32; 2],
-}
+    fn disconnect(&mut self) {
+        self.stream = None;
+        self.read_buf.clear();
+        self.write_buf.clear();
+        self.sent_bytes = self.queued_bytes;
+        self.queued_responses.clear();
+    }
 
-#[derive(Clone, Copy, FromBytes, IntoBytes)]
-#[repr(C, packed)]
-pub struct OutgoingHeader {
-    pub ibi: u8,
-    pub from_addr: u8,
-    pub response_descriptor: ResponseDescriptor,
-}
+    fn clear_waker(&mut self) {
+        // clear the flag first so responses forwarded from now on wake the loop again
+        self.signaled.store(false, Ordering::Release);
+        let mut buf = [0u8; 64];
+        while matches!(self.waker.read(&mut buf), Ok(n) if n > 0) {}
+    }
 
-fn handle_i3c_socket_connection(
-    running: &'static AtomicBool,
-    mut stream: TcpStream,
-    _addr: SocketAddr,
-    bus_response_rx: &mut Receiver<I3cBusResponse>,
-    bus_command_tx: &mut Sender<I3cBusCommand>,
-) {
-    let stream = &mut stream;
-    stream.set_nonblocking(true).unwrap();
-
-    while running.load(Ordering::Relaxed) {
-        // try reading
-        let mut incoming_header_bytes = [0u8; 9];
-        match stream.read_exact(&mut incoming_header_bytes) {
-            Ok(()) => {
-                let incoming_header: IncomingHeader = transmute!(incoming_header_bytes);
-                let cmd: I3cTcriCommand = incoming_header.command.try_into().unwrap();
-                let mut data = vec![0u8; cmd.data_len()];
-                stream.set_nonblocking(false).unwrap();
-                stream
-                    .read_exact(&mut data)
-                    .expect("Failed to read message from socket");
-                stream.set_nonblocking(true).unwrap();
-                let bus_command = I3cBusCommand {
-                    addr: incoming_header.to_addr.into(),
-                    cmd: I3cTcriCommandXfer { cmd, data },
-                };
-                match bus_command_tx.send(bus_command) {
-                    Ok(_) => {}
-                    Err(e) => panic!("Failed to send I3C command to bus: {:?}", e),
+    /// Read everything the client has sent and pass on the complete commands.
+    fn read_commands(&mut self) -> u64 {
+        let Some(stream) = self.stream.as_mut() else {
+            return 0;
+        };
+        let mut closed = false;
+        let mut chunk = [0u8; 4096];
+        loop {
+            match stream.read(&mut chunk) {
+                Ok(0) => {
+                    println!("handle_i3c_socket_connection: Connection closed by client");
+                    closed = true;
+                    break;
+                }
+                Ok(n) => {
+                    I3cSocketStats::add(&self.stats.bytes_received, n as u64);
+                    self.read_buf.extend_from_slice(&chunk[..n]);
                 }
+                Err(ref e) if e.kind() == ErrorKind::WouldBlock => break,
+                Err(ref e) if e.kind() == ErrorKind::Interrupted => {}
+                Err(ref e) if e.kind() == ErrorKind::ConnectionReset => {
+                    println!("handle_i3c_socket_connection: Connection reset by client");
+                    closed = true;
+                    break;
+                }
+                Err(e) => panic!("Error reading message from socket: {}", e),
             }
-            Err(ref e) if e.kind() == ErrorKind::WouldBlock => {}
-            Err(ref e) if e.kind() == ErrorKind::ConnectionReset => {
-                println!("handle_i3c_socket_connection: Connection reset by client");
-                break;
+        }
+
+        let mut commands = 0;
+        let mut consumed = 0;
+        while let Some((bus_command, len)) = parse_command(&self.read_buf[consumed..]) {
+            consumed += len;
+            commands += 1;
+            I3cSocketStats::add(&self.stats.commands, 1);
+            match self.bus_command_tx.send(bus_command) {
+                Ok(_) => {}
+                Err(e) => panic!("Failed to send I3C command to bus: {:?}", e),
+            }
+        }
+        self.read_buf.drain(..consumed);
+        if commands > 0 {
+            if let Some(input_waker) = self.input_waker.as_mut() {
+                // the waker is non-blocking: if it is full, a wakeup is pending already
+                let _ = input_waker.write(&[0]);
             }
-            Err(e) => panic!("Error reading message from socket: {}", e),
         }
-        if let Ok(response) = bus_response_rx.recv_timeout(Duration::from_millis(10)) {
+        if closed {
+            self.disconnect();
+        }
+        commands
+    }
+
+    /// Encode the responses handed over by the I3C controller into `write_buf`.
+    fn queue_responses(&mut self) -> u64 {
+        let responses: Vec<_> = self.pending.lock().unwrap().drain(..).collect();
+        for (queued, response) in responses.iter() {
             let data_len = response.resp.resp.data_length() as usize;
             if data_len > 255 {
                 panic!("Cannot write more than 255 bytes to socket");
@@ -157,10 +473,171 @@ fn handle_i3c_socket_connection(
                 response_descriptor: response.resp.resp,
             };
             let header_bytes: [u8; 6] = transmute!(outgoing_header);
-            stream.write_all(&header_bytes).unwrap();
-            if data_len > 0 {
-                stream.write_all(&response.resp.data[..data_len]).unwrap();
+            self.write_buf.extend_from_slice(&header_bytes);
+            self.write_buf
+                .extend_from_slice(&response.resp.data[..data_len]);
+            self.queued_bytes += (header_bytes.len() + data_len) as u64;
+            self.queued_responses
+                .push_back((self.queued_bytes, *queued));
+            let counter = if response.ibi.is_some() {
+                &self.stats.ibis
+            } else {
+                &self.stats.responses
+            };
+            I3cSocketStats::add(counter, 1);
+        }
+        responses.len() as u64
+    }
+
+    /// Write as much of `write_buf` as the socket takes without blocking.
+    fn write_responses(&mut self) {
+        let Some(stream) = self.stream.as_mut() else {
+            return;
+        };
+        let mut written = 0;
+        while written < self.write_buf.len() {
+            match stream.write(&self.write_buf[written..]) {
+                Ok(n) => written += n,
+                Err(ref e) if e.kind() == ErrorKind::WouldBlock => break,
+                Err(ref e) if e.kind() == ErrorKind::Interrupted => {}
+                Err(ref e)
+                    if matches!(e.kind(), ErrorKind::ConnectionReset | ErrorKind::BrokenPipe) =>
+                {
+                    println!("handle_i3c_socket_connection: Connection reset by client");
+                    self.disconnect();
+                    return;
+                }
+                Err(e) => panic!("Error writing response to socket: {}", e),
             }
         }
+        self.write_buf.drain(..written);
+        self.sent_bytes += written as u64;
+        I3cSocketStats::add(&self.stats.bytes_sent, written as u64);
+        while let Some(&(end, queued)) = self.queued_responses.front() {
+            if end > self.sent_bytes {
+                break;
+            }
+            self.stats.record_latency(queued);
+            self.queued_responses.pop_front();
+        }
+    }
+}
+
+/// Decode the command at the start of `buf`, if it has been received completely, and
+/// return it with its length on the wire.
+fn parse_command(buf: &[u8]) -> Option<(I3cBusCommand, usize)> {
+    let incoming_header_bytes: [u8; INCOMING_HEADER_LEN] =
+        buf.get(..INCOMING_HEADER_LEN)?.try_into().unwrap();
+    let incoming_header: IncomingHeader = transmute!(incoming_header_bytes);
+    let cmd: I3cTcriCommand = incoming_header.command.try_into().unwrap();
+    let len = INCOMING_HEADER_LEN + cmd.data_len();
+    let data = buf.get(INCOMING_HEADER_LEN..len)?.to_vec();
+    Some((
+        I3cBusCommand {
+            addr: incoming_header.to_addr.into(),
+            cmd: I3cTcriCommandXfer { cmd, data },
+        },
+        len,
+    ))
+}
+
+#[derive(FromBytes, IntoBytes)]
+#[repr(C, packed)]
+pub struct IncomingHeader {
+    pub to_addr: u8,
+    pub command: [u32; 2],
+}
+
+#[derive(Clone, Copy, FromBytes, IntoBytes)]
+#[repr(C, packed)]
+pub struct OutgoingHeader {
+    pub ibi: u8,
+    pub from_addr: u8,
+    pub response_descriptor: ResponseDescriptor,
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+    use crate::i3c::I3cTcriResponseXfer;
+    use std::thread;
+
+    fn command_bytes(to_addr: u8, command: [u32; 2], data: &[u8]) -> Vec<u8> {
+        let mut bytes = IncomingHeader { to_addr, command }.as_bytes().to_vec();
+        bytes.extend_from_slice(data);
+        bytes
+    }
+
+    #[test]
+    fn test_batched_commands_and_responses() {
+        let listener = TcpListener::bind("127.0.0.1:0").unwrap();
+        let addr = listener.local_addr().unwrap();
+        let (bus_command_tx, bus_command_rx) = mpsc::channel();
+        let (bus_response_tx, bus_response_rx) = mpsc::channel();
+        let running = Arc::new(AtomicBool::new(true));
+        let stats = Arc::new(I3cSocketStats::new());
+        let (thread_running, thread_stats) = (running.clone(), stats.clone());
+        thread::spawn(move || {
+            handle_i3c_socket_loop(
+                thread_running,
+                thread_stats,
+                listener,
+                bus_response_rx,
+                bus_command_tx,
+                None,
+            )
+        });
+        let mut client = TcpStream::connect(addr).unwrap();
+
+        // an immediate command and a regular one with 3 bytes of data, in one write, and
+        // the first half of a third command
+        let mut bytes = command_bytes(8, [1, 0], &[]);
+        bytes.extend(command_bytes(9, [0, 3 << 16], &[1, 2, 3]));
+        let last = command_bytes(10, [0, 2 << 16], &[4, 5]);
+        bytes.extend_from_slice(&last[..5]);
+        client.write_all(&bytes).unwrap();
+        let first = bus_command_rx.recv().unwrap();
+        assert_eq!(u8::from(first.addr), 8);
+        assert!(first.cmd.data.is_empty());
+        let second = bus_command_rx.recv().unwrap();
+        assert_eq!(u8::from(second.addr), 9);
+        assert_eq!(second.cmd.data, [1, 2, 3]);
+
+        client.write_all(&last[5..]).unwrap();
+        let third = bus_command_rx.recv().unwrap();
+        assert_eq!(u8::from(third.addr), 10);
+        assert_eq!(third.cmd.data, [4, 5]);
+
+        let mut resp = ResponseDescriptor::default();
+        resp.set_data_length(2);
+        bus_response_tx
+            .send(I3cBusResponse {
+                ibi: None,
+                addr: 9.into(),
+                resp: I3cTcriResponseXfer {
+                    resp,
+                    data: vec![6, 7],
+                },
+            })
+            .unwrap();
+        bus_response_tx
+            .send(I3cBusResponse {
+                ibi: Some(0xae),
+                addr: 9.into(),
+                resp: I3cTcriResponseXfer::default(),
+            })
+            .unwrap();
+        let mut received = [0u8; 14];
+        client.read_exact(&mut received).unwrap();
+        assert_eq!(received[..2], [0, 9]);
+        assert_eq!(received[6..8], [6, 7]);
+        assert_eq!(received[8..10], [0xae, 9]);
+
+        let stats = stats.snapshot();
+        assert_eq!(stats.commands, 3);
+        assert_eq!(stats.responses, 1);
+        assert_eq!(stats.ibis, 1);
+        assert_eq!(stats.bytes_received, bytes.len() as u64 + 6);
+        running.store(false, Ordering::Relaxed);
     }
 }
@@ -6,6 +6,7 @@
 pub mod i3c;
 pub mod i3c_socket;
 pub mod i3c_socket_server;
+pub mod lockstep;
 pub mod mctp_transport;
 #[macro_use]
 pub mod mctp_util;
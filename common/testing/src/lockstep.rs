@@ -0,0 +1,557 @@
+// Licensed under the Apache-2.0 license
+
+//! Lockstep log of an MCU run: the accesses to the MCU peripherals and periodic
+//! architectural checkpoints of the MCU core.
+//!
+//! The emulator writes the log while it runs firmware. The log of another run, e.g. the
+//! replay of the peripheral accesses against the FPGA, is compared to it with
+//! [`first_divergence`] to find the first access or checkpoint that differs.
+//!
+//! The format is a magic followed by records. Each record starts with a tag byte, whose
+//! high nibble is the access size in bytes, and the cycle as a LEB128 delta from the
+//! previous record. Accesses then have the address and, unless the read faulted, the
+//! value. Checkpoints have the PC, a bitmap of the registers x1..x31 that changed since
+//! the previous checkpoint and the values of those registers.
+
+use std::fmt;
+use std::io::{self, ErrorKind, Read, Write};
+
+const MAGIC: &[u8; 8] = b"MCULOCK\x01";
+
+const TAG_READ: u8 = 0;
+const TAG_READ_FAULT: u8 = 1;
+const TAG_WRITE: u8 = 2;
+const TAG_CHECKPOINT: u8 = 3;
+
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum LockstepRecord {
+    /// A read of a peripheral; `val` is `None` if the read faulted
+    Read {
+        cycle: u64,
+        size: u8,
+        addr: u32,
+        val: Option<u32>,
+    },
+    /// A write to a peripheral
+    Write {
+        cycle: u64,
+        size: u8,
+        addr: u32,
+        val: u32,
+    },
+    /// PC and general purpose registers of the MCU core; `xregs[0]` is always 0
+    Checkpoint {
+        cycle: u64,
+        pc: u32,
+        xregs: [u32; 32],
+    },
+}
+
+impl LockstepRecord {
+    pub fn cycle(&self) -> u64 {
+        match *self {
+            Self::Read { cycle, .. }
+            | Self::Write { cycle, .. }
+            | Self::Checkpoint { cycle, .. } => cycle,
+        }
+    }
+
+    /// Address of an access, `None` for checkpoints.
+    pub fn addr(&self) -> Option<u32> {
+        match *self {
+            Self::Read { addr, .. } | Self::Write { addr, .. } => Some(addr),
+            Self::Checkpoint { .. } => None,
+        }
+    }
+
+    /// Returns true if both records are the same event, whatever cycle it happened on.
+    pub fn same_event(&self, other: &Self) -> bool {
+        match (*self, *other) {
+            (
+                Self::Read {
+                    size, addr, val, ..
+                },
+                Self::Read {
+                    size: s,
+                    addr: a,
+                    val: v,
+                    ..
+                },
+            ) => size == s && addr == a && val == v,
+            (
+                Self::Write {
+                    size, addr, val, ..
+                },
+                Self::Write {
+                    size: s,
+                    addr: a,
+                    val: v,
+                    ..
+                },
+            ) => size == s && addr == a && val == v,
+            (
+                Self::Checkpoint { pc, xregs, .. },
+                Self::Checkpoint {
+                    pc: p, xregs: x, ..
+                },
+            ) => pc == p && xregs == x,
+            _ => false,
+        }
+    }
+}
+
+impl fmt::Display for LockstepRecord {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        match *self {
+            Self::Read {
+                cycle,
+                size,
+                addr,
+                val: Some(val),
+            } => write!(f, "cycle {cycle}: read{size} *{addr:#010x} -> {val:#x}"),
+            Self::Read {
+                cycle,
+                size,
+                addr,
+                val: None,
+            } => write!(f, "cycle {cycle}: read{size} *{addr:#010x} -> fault"),
+            Self::Write {
+                cycle,
+                size,
+                addr,
+                val,
+            } => write!(f, "cycle {cycle}: write{size} *{addr:#010x} <- {val:#x}"),
+            Self::Checkpoint { cycle, pc, xregs } => {
+                write!(f, "cycle {cycle}: checkpoint pc={pc:#010x}")?;
+                for (i, x) in xregs.iter().enumerate().skip(1) {
+                    write!(f, " x{i}={x:#x}")?;
+                }
+                Ok(())
+            }
+        }
+    }
+}
+
+/// Write `val` as unsigned LEB128, the encoding of the cycle deltas.
+pub fn write_leb128(out: &mut impl Write, mut val: u64) -> io::Result<()> {
+    let mut buf = [0u8; 10];
+    let mut len = 0;
+    loop {
+        let byte = (val & 0x7f) as u8;
+        val >>= 7;
+        if val == 0 {
+            buf[len] = byte;
+            len += 1;
+            break;
+        }
+        buf[len] = byte | 0x80;
+        len += 1;
+    }
+    out.write_all(&buf[..len])
+}
+
+fn read_u8(input: &mut impl Read) -> io::Result<u8> {
+    let mut buf = [0u8; 1];
+    input.read_exact(&mut buf)?;
+    Ok(buf[0])
+}
+
+fn read_u32(input: &mut impl Read) -> io::Result<u32> {
+    let mut buf = [0u8; 4];
+    input.read_exact(&mut buf)?;
+    Ok(u32::from_le_bytes(buf))
+}
+
+/// Read an unsigned LEB128 value written by [`write_leb128`].
+pub fn read_leb128(input: &mut impl Read) -> io::Result<u64> {
+    let mut val = 0u64;
+    for shift in (0..64).step_by(7) {
+        let byte = read_u8(input)?;
+        val |= u64::from(byte & 0x7f) << shift;
+        if byte & 0x80 == 0 {
+            return Ok(val);
+        }
+    }
+    Err(io::Error::new(
+        ErrorKind::InvalidData,
+        "LEB128 value too long",
+    ))
+}
+
+/// Writes a lockstep log.
+pub struct LockstepWriter<W: Write> {
+    out: W,
+    last_cycle: u64,
+    last_xregs: [u32; 32],
+}
+
+impl<W: Write> LockstepWriter<W> {
+    pub fn new(mut out: W) -> io::Result<Self> {
+        out.write_all(MAGIC)?;
+        Ok(Self {
+            out,
+            last_cycle: 0,
+            last_xregs: [0; 32],
+        })
+    }
+
+    pub fn record(&mut self, record: &LockstepRecord) -> io::Result<()> {
+        let (tag, size) = match *record {
+            LockstepRecord::Read { size, val, .. } => (
+                if val.is_some() {
+                    TAG_READ
+                } else {
+                    TAG_READ_FAULT
+                },
+                size,
+            ),
+            LockstepRecord::Write { size, .. } => (TAG_WRITE, size),
+            LockstepRecord::Checkpoint { .. } => (TAG_CHECKPOINT, 0),
+        };
+        if size > 0xf {
+            return Err(io::Error::new(
+                ErrorKind::InvalidInput,
+                "access size too large",
+            ));
+        }
+        // records are in cycle order, but don't fail on a clock that went backwards
+        let cycle = record.cycle();
+        let delta = cycle.saturating_sub(self.last_cycle);
+        self.last_cycle = cycle;
+
+        self.out.write_all(&[tag | size << 4])?;
+        write_leb128(&mut self.out, delta)?;
+        match *record {
+            LockstepRecord::Read { addr, val, .. } => {
+                self.out.write_all(&addr.to_le_bytes())?;
+                if let Some(val) = val {
+                    self.out.write_all(&val.to_le_bytes())?;
+                }
+            }
+            LockstepRecord::Write { addr, val, .. } => {
+                self.out.write_all(&addr.to_le_bytes())?;
+                self.out.write_all(&val.to_le_bytes())?;
+            }
+            LockstepRecord::Checkpoint { pc, xregs, .. } => {
+                self.out.write_all(&pc.to_le_bytes())?;
+                let changed = (1..32)
+                    .filter(|&i| xregs[i] != self.last_xregs[i])
+                    .fold(0u32, |changed, i| changed | 1 << i);
+                self.out.write_all(&changed.to_le_bytes())?;
+                for i in (1..32).filter(|i| changed & (1 << i) != 0) {
+                    self.out.write_all(&xregs[i].to_le_bytes())?;
+                }
+                self.last_xregs = xregs;
+                self.last_xregs[0] = 0;
+            }
+        }
+        Ok(())
+    }
+
+    pub fn flush(&mut self) -> io::Result<()> {
+        self.out.flush()
+    }
+}
+
+/// Reads the records of a lockstep log.
+pub struct LockstepReader<R: Read> {
+    input: R,
+    cycle: u64,
+    xregs: [u32; 32],
+    done: bool,
+}
+
+impl<R: Read> LockstepReader<R> {
+    pub fn new(mut input: R) -> io::Result<Self> {
+        let mut magic = [0u8; 8];
+        input.read_exact(&mut magic)?;
+        if &magic != MAGIC {
+            return Err(io::Error::new(ErrorKind::InvalidData, "not a lockstep log"));
+        }
+        Ok(Self {
+            input,
+            cycle: 0,
+            xregs: [0; 32],
+            done: false,
+        })
+    }
+
+    fn read_record(&mut self, tag: u8) -> io::Result<LockstepRecord> {
+        let size = tag >> 4;
+        self.cycle += read_leb128(&mut self.input)?;
+        let cycle = self.cycle;
+        Ok(match tag & 0xf {
+            TAG_READ => LockstepRecord::Read {
+                cycle,
+                size,
+                addr: read_u32(&mut self.input)?,
+                val: Some(read_u32(&mut self.input)?),
+            },
+            TAG_READ_FAULT => LockstepRecord::Read {
+                cycle,
+                size,
+                addr: read_u32(&mut self.input)?,
+                val: None,
+            },
+            TAG_WRITE => LockstepRecord::Write {
+                cycle,
+                size,
+                addr: read_u32(&mut self.input)?,
+                val: read_u32(&mut self.input)?,
+            },
+            TAG_CHECKPOINT => {
+                let pc = read_u32(&mut self.input)?;
+                let changed = read_u32(&mut self.input)?;
+                for i in (1..32).filter(|i| changed & (1 << i) != 0) {
+                    self.xregs[i] = read_u32(&mut self.input)?;
+                }
+                LockstepRecord::Checkpoint {
+                    cycle,
+                    pc,
+                    xregs: self.xregs,
+                }
+            }
+            _ => {
+                return Err(io::Error::new(
+                    ErrorKind::InvalidData,
+                    format!("unknown lockstep record tag {tag:#x}"),
+                ))
+            }
+        })
+    }
+}
+
+impl<R: Read> Iterator for LockstepReader<R> {
+    type Item = io::Result<LockstepRecord>;
+
+    fn next(&mut self) -> Option<Self::Item> {
+        if self.done {
+            return None;
+        }
+        let mut tag = [0u8; 1];
+        let result = match self.input.read(&mut tag) {
+            Ok(0) => {
+                self.done = true;
+                return None;
+            }
+            Ok(_) => self.read_record(tag[0]),
+            Err(e) => Err(e),
+        };
+        if result.is_err() {
+            self.done = true;
+        }
+        Some(result)
+    }
+}
+
+/// The first point where two runs differ.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct Divergence {
+    /// Index of the differing access or checkpoint among the expected records
+    pub index: usize,
+    pub expected: Option<LockstepRecord>,
+    /// `None` if the actual run ended early
+    pub actual: Option<LockstepRecord>,
+    /// The last expected checkpoint before the divergence, to locate it in the firmware
+    pub last_checkpoint: Option<LockstepRecord>,
+}
+
+impl fmt::Display for Divergence {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        writeln!(f, "runs diverge at record {}", self.index)?;
+        match &self.expected {
+            Some(record) => writeln!(f, "  expected {record}")?,
+            None => writeln!(f, "  expected end of log")?,
+        }
+        match &self.actual {
+            Some(record) => writeln!(f, "  actual   {record}")?,
+            None => writeln!(f, "  actual   end of log")?,
+        }
+        if let Some(checkpoint) = &self.last_checkpoint {
+            writeln!(f, "  after    {checkpoint}")?;
+        }
+        Ok(())
+    }
+}
+
+/// Compare the records of two runs and return the first one that differs.
+///
+/// Cycles are ignored, since the same firmware does not run at the same speed on the
+/// emulator and on the FPGA. Checkpoints are only compared if the actual run has them:
+/// the n-th expected checkpoint is compared to the n-th actual one, and the accesses are
+/// compared in order.
+pub fn first_divergence(
+    expected: impl IntoIterator<Item = LockstepRecord>,
+    actual: impl IntoIterator<Item = LockstepRecord>,
+) -> Option<Divergence> {
+    let (actual_checkpoints, actual_accesses): (Vec<_>, Vec<_>) = actual
+        .into_iter()
+        .partition(|r| matches!(r, LockstepRecord::Checkpoint { .. }));
+    let mut checkpoints = actual_checkpoints.into_iter();
+    let mut accesses = actual_accesses.into_iter();
+    let compare_checkpoints = checkpoints.len() != 0;
+    let mut last_checkpoint = None;
+    let mut index = 0;
+
+    for record in expected {
+        let actual = match record {
+            LockstepRecord::Checkpoint { .. } if !compare_checkpoints => {
+                last_checkpoint = Some(record);
+                index += 1;
+                continue;
+            }
+            LockstepRecord::Checkpoint { .. } => checkpoints.next(),
+            _ => accesses.next(),
+        };
+        if !actual.is_some_and(|actual| actual.same_event(&record)) {
+            return Some(Divergence {
+                index,
+                expected: Some(record),
+                actual,
+                last_checkpoint,
+            });
+        }
+        if let LockstepRecord::Checkpoint { .. } = record {
+            last_checkpoint = Some(record);
+        }
+        index += 1;
+    }
+
+    // anything left over in the actual run did not happen in the expected one
+    accesses
+        .next()
+        .or_else(|| checkpoints.next())
+        .map(|actual| Divergence {
+            index,
+            expected: None,
+            actual: Some(actual),
+            last_checkpoint,
+        })
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn sample_log() -> Vec<LockstepRecord> {
+        let mut xregs = [0u32; 32];
+        xregs[1] = 0x2000_0000;
+        xregs[10] = 42;
+        let checkpoint = LockstepRecord::Checkpoint {
+            cycle: 100,
+            pc: 0x8000_0010,
+            xregs,
+        };
+        xregs[10] = 43;
+        vec![
+            LockstepRecord::Write {
+                cycle: 3,
+                size: 4,
+                addr: 0x2100_0000,
+                val: 0x1234,
+            },
+            LockstepRecord::Read {
+                cycle: 10,
+                size: 1,
+                addr: 0x2100_0004,
+                val: Some(0xff),
+            },
+            checkpoint,
+            LockstepRecord::Read {
+                cycle: 1 << 40,
+                size: 4,
+                addr: 0x7000_0000,
+                val: None,
+            },
+            LockstepRecord::Checkpoint {
+                cycle: (1 << 40) + 5,
+                pc: 0x8000_0020,
+                xregs,
+            },
+        ]
+    }
+
+    fn encode(records: &[LockstepRecord]) -> Vec<u8> {
+        let mut writer = LockstepWriter::new(Vec::new()).unwrap();
+        for record in records {
+            writer.record(record).unwrap();
+        }
+        writer.out
+    }
+
+    #[test]
+    fn test_round_trip() {
+        let records = sample_log();
+        let bytes = encode(&records);
+        let decoded: Vec<LockstepRecord> = LockstepReader::new(&bytes[..])
+            .unwrap()
+            .collect::<io::Result<_>>()
+            .unwrap();
+        assert_eq!(decoded, records);
+
+        // the second checkpoint only stores the one register that changed
+        let first = encode(&records[..4]).len();
+        assert_eq!(bytes.len() - first, 1 + 1 + 4 + 4 + 4);
+
+        assert!(LockstepReader::new(&b"MCULOCK\x02"[..]).is_err());
+        let mut truncated = LockstepReader::new(&bytes[..bytes.len() - 1]).unwrap();
+        assert!(truncated.by_ref().take(4).all(|r| r.is_ok()));
+        assert!(truncated.next().unwrap().is_err());
+        assert!(truncated.next().is_none());
+    }
+
+    #[test]
+    fn test_first_divergence() {
+        let expected = sample_log();
+        assert_eq!(first_divergence(expected.clone(), expected.clone()), None);
+
+        // accesses only, at other cycles, as replayed on the FPGA
+        let mut replay: Vec<LockstepRecord> = expected
+            .iter()
+            .filter(|r| r.addr().is_some())
+            .map(|r| match *r {
+                LockstepRecord::Read {
+                    size, addr, val, ..
+                } => LockstepRecord::Read {
+                    cycle: 0,
+                    size,
+                    addr,
+                    val,
+                },
+                other => other,
+            })
+            .collect();
+        assert_eq!(first_divergence(expected.clone(), replay.clone()), None);
+
+        replay[2] = LockstepRecord::Read {
+            cycle: 0,
+            size: 4,
+            addr: 0x7000_0000,
+            val: Some(0),
+        };
+        let divergence = first_divergence(expected.clone(), replay.clone()).unwrap();
+        assert_eq!(divergence.index, 3);
+        assert_eq!(divergence.expected, Some(expected[3]));
+        assert_eq!(divergence.last_checkpoint, Some(expected[2]));
+
+        replay.truncate(1);
+        let divergence = first_divergence(expected.clone(), replay).unwrap();
+        assert_eq!(divergence.index, 1);
+        assert_eq!(divergence.actual, None);
+
+        // a checkpoint with a different register
+        let mut other = expected.clone();
+        if let LockstepRecord::Checkpoint { xregs, .. } = &mut other[4] {
+            xregs[10] = 0;
+        }
+        let divergence = first_divergence(expected.clone(), other).unwrap();
+        assert_eq!(divergence.index, 4);
+
+        // an access that only happened in the actual run
+        let mut longer = expected.clone();
+        longer.push(expected[0]);
+        let divergence = first_divergence(expected, longer).unwrap();
+        assert_eq!(divergence.index, 5);
+        assert_eq!(divergence.expected, None);
+    }
+}
@@ -0,0 +1,73 @@
+/*++
+
+Licensed under the Apache-2.0 license.
+
+File Name:
+
+    bus_stats.rs
+
+Abstract:
+
+    File contains the periodic log of the MCU root bus access counters.
+
+--*/
+
+use emulator_registers_generated::root_bus::AutoRootBusAccessStats;
+use std::fs::File;
+use std::io::{self, BufWriter, Write};
+use std::path::Path;
+
+/// CSV log of the root bus access counters, written to `bus_stats.csv` with
+/// `--bus-stats-interval`.
+///
+/// Every dump appends one row per peripheral with the counters accumulated since the
+/// start, so the rate of e.g. polling reads is the difference between two dumps.
+pub struct BusStatsLog {
+    out: BufWriter<File>,
+    interval: u64,
+    next_dump: u64,
+}
+
+impl BusStatsLog {
+    /// Create the log in `log_dir`, dumping every `interval` cycles (0 to only dump on exit).
+    pub fn create(log_dir: &Path, interval: u64) -> io::Result<Self> {
+        let mut out = BufWriter::new(File::create(log_dir.join("bus_stats.csv"))?);
+        writeln!(
+            out,
+            "cycle,peripheral,reads,writes,bytes_read,bytes_written,poll_reads,poll_cycles"
+        )?;
+        Ok(Self {
+            out,
+            interval,
+            next_dump: interval,
+        })
+    }
+
+    /// Returns true if the periodic dump is due at `cycle`.
+    #[inline]
+    pub fn due(&self, cycle: u64) -> bool {
+        self.interval != 0 && cycle >= self.next_dump
+    }
+
+    /// Append the counters at `cycle` and schedule the next periodic dump.
+    pub fn dump(&mut self, cycle: u64, stats: &[(&str, AutoRootBusAccessStats)]) -> io::Result<()> {
+        for (name, s) in stats {
+            writeln!(
+                self.out,
+                "{},{},{},{},{},{},{},{}",
+                cycle,
+                name,
+                s.reads,
+                s.writes,
+                s.bytes_read,
+                s.bytes_written,
+                s.poll_reads,
+                s.poll_cycles
+            )?;
+        }
+        if self.interval != 0 {
+            self.next_dump = cycle - cycle % self.interval + self.interval;
+        }
+        self.out.flush()
+    }
+}
@@ -0,0 +1,122 @@
+/*++
+
+Licensed under the Apache-2.0 license.
+
+File Name:
+
+    dis_cache.rs
+
+Abstract:
+
+    File contains the cache of disassembled instructions used by the instruction trace.
+
+--*/
+
+use crate::dis;
+use std::io::Write;
+
+/// Direct-mapped cache of disassembled instructions, keyed by PC.
+///
+/// Each entry also records the instruction word it was decoded from and only hits if the
+/// word is unchanged, so code that is loaded or rewritten at runtime (firmware copied into
+/// SRAM, DCCM overlays) needs no invalidation hook on the bus.
+pub struct DisasmCache {
+    entries: Vec<Option<DisasmEntry>>,
+    hits: u64,
+    misses: u64,
+}
+
+struct DisasmEntry {
+    pc: u32,
+    instr: u32,
+    text: String,
+}
+
+impl DisasmCache {
+    /// Default number of entries, enough to cover the hot loops of ROM and runtime firmware.
+    pub const DEFAULT_ENTRIES: usize = 4096;
+
+    /// Create a new cache. `entries` is rounded up to the next power of two.
+    pub fn new(entries: usize) -> Self {
+        let entries = entries.max(1).next_power_of_two();
+        Self {
+            entries: (0..entries).map(|_| None).collect(),
+            hits: 0,
+            misses: 0,
+        }
+    }
+
+    /// Return the disassembly of `instr` at `pc`, decoding it only on a miss.
+    pub fn get(&mut self, pc: u32, instr: u32) -> &str {
+        // Instructions are at least 2-byte aligned
+        let index = (pc >> 1) as usize & (self.entries.len() - 1);
+        let slot = &mut self.entries[index];
+        match slot {
+            Some(entry) if entry.pc == pc && entry.instr == instr => self.hits += 1,
+            _ => {
+                self.misses += 1;
+                *slot = Some(DisasmEntry {
+                    pc,
+                    instr,
+                    text: disassemble(pc, instr),
+                });
+            }
+        }
+        slot.as_ref().map(|entry| entry.text.as_str()).unwrap()
+    }
+
+    /// Number of lookups served from the cache.
+    pub fn hits(&self) -> u64 {
+        self.hits
+    }
+
+    /// Number of lookups that had to decode the instruction.
+    pub fn misses(&self) -> u64 {
+        self.misses
+    }
+}
+
+impl Default for DisasmCache {
+    fn default() -> Self {
+        Self::new(Self::DEFAULT_ENTRIES)
+    }
+}
+
+pub fn disassemble(pc: u32, instr: u32) -> String {
+    let mut out = vec![];
+    let dis = dis::disasm_inst(dis::RvIsa::Rv32, pc as u64, instr as u64);
+    write!(&mut out, "0x{:08x}   {}", pc, dis).unwrap();
+
+    String::from_utf8(out).unwrap()
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    const ADDI_A0_A0_1: u32 = 0x0015_0513;
+    const ADDI_A0_A0_2: u32 = 0x0025_0513;
+
+    #[test]
+    fn test_hit_and_miss() {
+        let mut cache = DisasmCache::new(16);
+        let text = cache.get(0x100, ADDI_A0_A0_1).to_string();
+        assert_eq!(text, disassemble(0x100, ADDI_A0_A0_1));
+        assert_eq!(cache.get(0x100, ADDI_A0_A0_1), text);
+        assert_eq!((cache.hits(), cache.misses()), (1, 1));
+    }
+
+    #[test]
+    fn test_changed_code_is_redecoded() {
+        let mut cache = DisasmCache::new(16);
+        cache.get(0x100, ADDI_A0_A0_1);
+        assert_eq!(
+            cache.get(0x100, ADDI_A0_A0_2),
+            disassemble(0x100, ADDI_A0_A0_2)
+        );
+        // 0x140 maps to the same slot as 0x100 and evicts it
+        cache.get(0x140, ADDI_A0_A0_1);
+        cache.get(0x100, ADDI_A0_A0_2);
+        assert_eq!((cache.hits(), cache.misses()), (0, 4));
+    }
+}
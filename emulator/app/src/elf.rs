@@ -1,6 +1,6 @@
 // Licensed under the Apache-2.0 license
 
-use elf::abi::PT_LOAD;
+use elf::abi::{PT_LOAD, STT_FUNC};
 use elf::endian::AnyEndian;
 use elf::ElfBytes;
 use std::io::{Error, ErrorKind};
@@ -13,6 +13,46 @@ pub struct ElfExecutable {
     content: Vec<u8>,
 }
 
+/// Function symbol of an ELF executable
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct ElfSymbol {
+    pub name: String,
+    pub addr: u32,
+    pub size: u32,
+}
+
+/// Function symbols of `elf_bytes`, sorted by address.
+pub fn function_symbols(elf_bytes: &[u8]) -> Result<Vec<ElfSymbol>, Error> {
+    let elf_file = ElfBytes::<AnyEndian>::minimal_parse(elf_bytes).map_err(|e| {
+        Error::new(
+            ErrorKind::InvalidData,
+            format!("Failed to parse ELF file: {:?}", e),
+        )
+    })?;
+    let Some((symbols, strings)) = elf_file
+        .symbol_table()
+        .map_err(|e| Error::new(ErrorKind::InvalidData, e.to_string()))?
+    else {
+        return Ok(vec![]);
+    };
+    let mut result = vec![];
+    for sym in symbols.iter() {
+        if sym.st_symtype() != STT_FUNC || sym.is_undefined() {
+            continue;
+        }
+        let name = strings
+            .get(sym.st_name as usize)
+            .map_err(|e| Error::new(ErrorKind::InvalidData, e.to_string()))?;
+        result.push(ElfSymbol {
+            name: name.to_string(),
+            addr: sym.st_value as u32,
+            size: sym.st_size as u32,
+        });
+    }
+    result.sort_by_key(|sym| sym.addr);
+    Ok(result)
+}
+
 pub fn load_into_image(
     image: &mut Vec<u8>,
     image_base_addr: u32,
@@ -105,6 +145,11 @@ impl ElfExecutable {
     pub fn content(&self) -> &Vec<u8> {
         &self.content
     }
+
+    /// Executable content, without copying it
+    pub fn into_content(self) -> Vec<u8> {
+        self.content
+    }
 }
 
 #[cfg(test)]
@@ -12,13 +12,28 @@ Abstract:
 
 --*/
 
-use crate::dis;
+use crate::bus_stats::BusStatsLog;
 use crate::doe_mbox_fsm;
 use crate::elf;
+use crate::input_log::{size_in_bytes, InputEvent, InputRecorder, InputReplay};
+use crate::lockstep::{LockstepLog, DEFAULT_CHECKPOINT_INTERVAL};
+use crate::memory_map::{MemoryMap, MemoryMapOverrides};
+use crate::profile::Profiler;
+use crate::snapshot::{
+    CpuSnapshot, EmulatorSnapshot, PeripheralSnapshot, RegionSnapshot, CALIPTRA_DCCM_BASE,
+    CALIPTRA_ICCM_BASE, SNAPSHOT_CSRS, XREG_COUNT,
+};
 use crate::tests;
-use caliptra_emu_bus::{Bus, Clock, Timer};
+use crate::time_warp::{is_store, TimeWarp, TimeWarpStats};
+use crate::trace::{parse_trace_format, TraceCore, TraceFormat, TraceRecord, TraceSink};
+use crate::trace_thread::{
+    parse_trace_queue_policy, TraceQueuePolicy, TraceThread, DEFAULT_TRACE_QUEUE_RECORDS,
+};
+use caliptra_emu_bus::{Bus, BusError, Clock, Ram, Timer};
+use caliptra_emu_cpu::xreg_file::XReg;
 use caliptra_emu_cpu::{Cpu, Pic, RvInstr, StepAction};
 use caliptra_emu_periph::CaliptraRootBus as CaliptraMainRootBus;
+use caliptra_emu_types::RvSize;
 use caliptra_image_types::FwVerificationPqcKeyType;
 use clap::{ArgAction, Parser};
 use clap_num::maybe_hex;
@@ -30,27 +45,33 @@ use emulator_consts::{DEFAULT_CPU_ARGS, RAM_ORG, ROM_SIZE};
 #[allow(unused_imports)]
 use emulator_periph::MciMailboxRequester;
 use emulator_periph::{
-    CaliptraToExtBus, DoeMboxPeriph, DummyDoeMbox, DummyFlashCtrl, I3c, I3cController, LcCtrl, Mci,
-    McuRootBus, McuRootBusArgs, McuRootBusOffsets, Otp, OtpArgs,
+    CaliptraToExtBus, CopyOnWriteFlash, DoeMboxPeriph, DummyDoeMbox, DummyFlashCtrl,
+    ExternalBusControl, ExternalWrite, I3c, I3cController, LcCtrl, MappedImage, Mci, McuRootBus,
+    McuRootBusArgs, Otp, OtpArgs, UartOutputRing,
 };
 use emulator_registers_generated::axicdma::AxicdmaPeripheral;
-use emulator_registers_generated::root_bus::{AutoRootBus, AutoRootBusOffsets};
+use emulator_registers_generated::root_bus::{
+    AutoRootBus, AutoRootBusAccessStats, AutoRootBusFastRegion,
+};
+use mcu_testing_common::i3c::DynamicI3cAddress;
 use mcu_testing_common::i3c_socket;
-use mcu_testing_common::i3c_socket_server::start_i3c_socket;
+use mcu_testing_common::i3c_socket_server::{start_i3c_socket_with, I3cSocketStats};
 use mcu_testing_common::mctp_transport::MctpTransport;
 use mcu_testing_common::mctp_util::base_protocol::LOCAL_TEST_ENDPOINT_EID;
 use mcu_testing_common::{MCU_RUNNING, MCU_RUNTIME_STARTED, MCU_TICKS, TICK_COND};
 use pldm_fw_pkg::FirmwareManifest;
 use pldm_ua::daemon::PldmDaemon;
 use pldm_ua::transport::{EndpointId, PldmTransport};
-use std::cell::RefCell;
+use std::cell::{Cell, RefCell};
 use std::fs::File;
-use std::io::{self, IsTerminal, Read, Write};
+use std::io::{self, IsTerminal, Read};
 use std::ops::Range;
+use std::os::fd::{AsRawFd, RawFd};
+use std::os::unix::net::UnixStream;
 use std::path::{Path, PathBuf};
 use std::process::exit;
 use std::rc::Rc;
-use std::sync::atomic::Ordering;
+use std::sync::atomic::{AtomicBool, Ordering};
 use std::sync::{Arc, Mutex};
 use std::thread::JoinHandle;
 use tests::pldm_request_response_test::PldmRequestResponseTest;
@@ -103,6 +124,77 @@ pub struct EmulatorArgs {
     #[arg(short, long, default_value_t = false)]
     pub trace_instr: bool,
 
+    /// Instruction trace format: text (disassembled MCU instructions) or binary (both
+    /// cores, disassemble later with emulator-trace-dis)
+    #[arg(long, value_parser = parse_trace_format, default_value = "text")]
+    pub trace_format: TraceFormat,
+
+    /// Echo traced instructions of both cores to stdout.
+    #[arg(long, default_value_t = false)]
+    pub trace_stdout: bool,
+
+    /// What to do when the trace writer thread falls behind: block (complete trace),
+    /// drop (discard and count records) or sample (keep 1 in 64 until it catches up)
+    #[arg(long, value_parser = parse_trace_queue_policy, default_value = "block")]
+    pub trace_queue_policy: TraceQueuePolicy,
+
+    /// Capacity of the trace writer queue, in instructions.
+    #[arg(long, default_value_t = DEFAULT_TRACE_QUEUE_RECORDS)]
+    pub trace_queue_size: usize,
+
+    /// Profile the cycles spent per PC and function on both cores and write them to
+    /// profile.folded in the log directory on exit.
+    #[arg(long, default_value_t = false)]
+    pub profile: bool,
+
+    /// Sample the profiled PCs every N steps instead of on every step.
+    #[arg(long, default_value_t = 1)]
+    pub profile_interval: u64,
+
+    /// Additional MCU ELF files used to symbolize the profile. The MCU ROM and firmware
+    /// are used automatically if they are ELF files.
+    #[arg(long)]
+    pub profile_mcu_elf: Vec<PathBuf>,
+
+    /// Additional Caliptra ELF files used to symbolize the profile. The Caliptra ROM and
+    /// firmware are used automatically if they are ELF files.
+    #[arg(long)]
+    pub profile_caliptra_elf: Vec<PathBuf>,
+
+    /// Count the reads, writes and polling loops of each MCU peripheral and append them
+    /// to bus_stats.csv in the log directory every N cycles (0 = only on exit).
+    #[arg(long)]
+    pub bus_stats_interval: Option<u64>,
+
+    /// Record the MCU peripheral accesses and periodic checkpoints of the MCU PC and
+    /// registers to this file, to compare the run with another one such as the FPGA.
+    #[arg(long)]
+    pub lockstep_log: Option<PathBuf>,
+
+    /// Cycles between two checkpoints of the lockstep log (0 = accesses only).
+    #[arg(long, default_value_t = DEFAULT_CHECKPOINT_INTERVAL)]
+    pub lockstep_checkpoint_interval: u64,
+
+    /// Fast-forward the clocks while both cores are parked on wfi or the MCU spins in a
+    /// polling loop, by at most this many cycles at a time. Timer events may be delivered
+    /// up to that many cycles late.
+    #[arg(long)]
+    pub time_warp: Option<u64>,
+
+    /// Record the inputs from outside the emulator, i.e. the console bytes for the UART
+    /// RX, the I3C socket commands if --i3c-port is given and the external bus reads,
+    /// with their cycles to this file.
+    #[arg(long, conflicts_with = "replay_inputs")]
+    pub record_inputs: Option<PathBuf>,
+
+    /// Replay the inputs recorded with --record-inputs at the same cycles, instead of
+    /// reading the console, serving the I3C socket and calling the external read
+    /// callback. The other options must be the same as for the recording, except
+    /// --i3c-port: it is refused, since the recorded I3C commands are replayed without
+    /// the socket.
+    #[arg(long)]
+    pub replay_inputs: Option<PathBuf>,
+
     // These look backwards, but this is necessary so that the default is to capture stdin.
     /// Pass stdin to the MCU UART Rx.
     #[arg(long = "no-stdin-uart", action = ArgAction::SetFalse)]
@@ -154,102 +246,38 @@ pub struct EmulatorArgs {
     #[arg(long)]
     pub secondary_flash_image: Option<PathBuf>,
 
+    /// Backing file of the primary flash [default: primary_flash in the working directory]
+    #[arg(long)]
+    pub primary_flash_file: Option<PathBuf>,
+
+    /// Backing file of the secondary flash [default: secondary_flash in the working
+    /// directory]
+    #[arg(long)]
+    pub secondary_flash_file: Option<PathBuf>,
+
+    /// Map the flash images copy-on-write instead of copying them into the flash files.
+    /// Pages are loaded when first read, through the controller or the direct-read flash
+    /// window, and writes and erases stay in memory, so the image files are never modified.
+    #[arg(long, default_value_t = false)]
+    pub map_flash_images: bool,
+
     /// HW revision in semver format (e.g., "2.0.0")
     #[arg(long, value_parser = semver::Version::parse, default_value = "2.0.0")]
     pub hw_revision: semver::Version,
 
-    /// Override ROM offset
-    #[arg(long, value_parser=maybe_hex::<u32>)]
-    pub rom_offset: Option<u32>,
-    /// Override ROM size
-    #[arg(long, value_parser=maybe_hex::<u32>)]
-    pub rom_size: Option<u32>,
-    /// Override UART offset
-    #[arg(long, value_parser=maybe_hex::<u32>)]
-    pub uart_offset: Option<u32>,
-    /// Override UART size
-    #[arg(long, value_parser=maybe_hex::<u32>)]
-    pub uart_size: Option<u32>,
-    /// Override emulator control offset
-    #[arg(long, value_parser=maybe_hex::<u32>)]
-    pub ctrl_offset: Option<u32>,
-    /// Override emulator control size
-    #[arg(long, value_parser=maybe_hex::<u32>)]
-    pub ctrl_size: Option<u32>,
-    #[arg(long, value_parser=maybe_hex::<u32>)]
-    pub sram_offset: Option<u32>,
-    /// Override SRAM size
-    #[arg(long, value_parser=maybe_hex::<u32>)]
-    pub sram_size: Option<u32>,
-    /// Override PIC offset
-    #[arg(long, value_parser=maybe_hex::<u32>)]
-    pub pic_offset: Option<u32>,
-    /// Override external test SRAM offset
-    #[arg(long, value_parser=maybe_hex::<u32>)]
-    pub external_test_sram_offset: Option<u32>,
-    /// Override external test SRAM size
-    #[arg(long, value_parser=maybe_hex::<u32>)]
-    pub external_test_sram_size: Option<u32>,
-    /// Override DCCM offset
-    #[arg(long, value_parser=maybe_hex::<u32>)]
-    pub dccm_offset: Option<u32>,
-    /// Override DCCM size
-    #[arg(long, value_parser=maybe_hex::<u32>)]
-    pub dccm_size: Option<u32>,
-    /// Override I3C offset
-    #[arg(long, value_parser=maybe_hex::<u32>)]
-    pub i3c_offset: Option<u32>,
-    /// Override I3C size
-    #[arg(long, value_parser=maybe_hex::<u32>)]
-    pub i3c_size: Option<u32>,
-    /// Override primary flash offset
-    #[arg(long, value_parser=maybe_hex::<u32>)]
-    pub primary_flash_offset: Option<u32>,
-    /// Override primary flash size
-    #[arg(long, value_parser=maybe_hex::<u32>)]
-    pub primary_flash_size: Option<u32>,
-    /// Override secondary flash offset
-    #[arg(long, value_parser=maybe_hex::<u32>)]
-    pub secondary_flash_offset: Option<u32>,
-    /// Override secondary flash size
-    #[arg(long, value_parser=maybe_hex::<u32>)]
-    pub secondary_flash_size: Option<u32>,
-    /// Override MCI offset
-    #[arg(long, value_parser=maybe_hex::<u32>)]
-    pub mci_offset: Option<u32>,
-    /// Override MCI size
-    #[arg(long, value_parser=maybe_hex::<u32>)]
-    pub mci_size: Option<u32>,
-    /// Override DMA offset
-    #[arg(long, value_parser=maybe_hex::<u32>)]
-    pub dma_offset: Option<u32>,
-    /// Override DMA size
-    #[arg(long, value_parser=maybe_hex::<u32>)]
-    pub dma_size: Option<u32>,
-    /// Override Caliptra mailbox offset
-    #[arg(long, value_parser=maybe_hex::<u32>)]
-    pub mbox_offset: Option<u32>,
-    /// Override Caliptra mailbox size
-    #[arg(long, value_parser=maybe_hex::<u32>)]
-    pub mbox_size: Option<u32>,
-    /// Override Caliptra SoC interface offset
-    #[arg(long, value_parser=maybe_hex::<u32>)]
-    pub soc_offset: Option<u32>,
-    /// Override Caliptra SoC interface size
-    #[arg(long, value_parser=maybe_hex::<u32>)]
-    pub soc_size: Option<u32>,
-    /// Override OTP offset
-    #[arg(long, value_parser=maybe_hex::<u32>)]
-    pub otp_offset: Option<u32>,
-    /// Override OTP size
-    #[arg(long, value_parser=maybe_hex::<u32>)]
-    pub otp_size: Option<u32>,
-    /// Override LC offset
-    #[arg(long, value_parser=maybe_hex::<u32>)]
-    pub lc_offset: Option<u32>,
-    /// Override LC size
-    #[arg(long, value_parser=maybe_hex::<u32>)]
-    pub lc_size: Option<u32>,
+    /// Memory map to start from: a profile (`default`, `emulator` or `fpga`) or a TOML
+    /// memory map file. The region overrides below are applied on top of it.
+    #[arg(long)]
+    pub memory_map: Option<String>,
+
+    /// Memory map already loaded and validated by the caller, shared by all the emulators
+    /// it creates. Takes the place of `--memory-map`.
+    #[arg(skip)]
+    pub shared_memory_map: Option<Arc<MemoryMap>>,
+
+    #[command(flatten)]
+    pub memory_map_overrides: MemoryMapOverrides,
+
     /// SoC Manifest SVN Fuse Value
     #[arg(long, value_parser=maybe_hex::<u32>)]
     pub fuse_soc_manifest_svn: Option<u32>,
@@ -260,12 +288,45 @@ pub struct EmulatorArgs {
     pub fuse_vendor_hashes_prod_partition: Option<String>,
 }
 
+/// RISC-V `wfi` instruction encoding
+const WFI_INSTR: u32 = 0x1050_0073;
+
+/// Number of consecutive cycles in which neither core retired anything but `wfi`
+/// before the emulator is considered idle.
+const IDLE_THRESHOLD_CYCLES: u64 = 10_000;
+
+/// Machine interrupt enable and pending CSRs
+const CSR_MIE: u32 = 0x304;
+const CSR_MIP: u32 = 0x344;
+
+/// Opcode of the RISC-V `fence` and `fence.i` instructions
+const MISC_MEM_OPCODE: u32 = 0x0f;
+
+/// Names of the buses the MCU root bus delegates to, in the order of their counters after
+/// the peripherals in [`AutoRootBus::stats`]
+pub const MCU_BUS_DELEGATES: [&str; 3] = ["mcu_root_bus", "soc_to_caliptra", "caliptra_to_ext"];
+
+/// RAM on the MCU bus whose contents are saved and restored with snapshots.
+pub struct RamRegion {
+    pub base: u32,
+    pub ram: Rc<RefCell<Ram>>,
+}
+
 pub struct Emulator {
     pub mcu_cpu: Cpu<AutoRootBus>,
     pub caliptra_cpu: Cpu<CaliptraMainRootBus>,
     pub bmc: Option<Bmc>,
     pub timer: Timer,
-    pub trace_file: Option<File>,
+    pub trace: Option<TraceThread>,
+    pub profiler: Option<Profiler>,
+    profile_output: Option<PathBuf>,
+    bus_stats_log: Option<BusStatsLog>,
+    lockstep_log: Option<Rc<RefCell<LockstepLog>>>,
+    time_warp: Option<TimeWarp>,
+    input_recorder: Option<Rc<RefCell<InputRecorder>>>,
+    input_replay: Option<Rc<RefCell<InputReplay>>>,
+    /// Console bytes for the UART RX while inputs are recorded
+    console_rx: Option<Arc<Mutex<Option<u8>>>>,
     pub stdin_uart: Option<Arc<Mutex<Option<u8>>>>,
     pub sram_range: Range<u32>,
     #[allow(dead_code)]
@@ -273,13 +334,26 @@ pub struct Emulator {
     #[allow(dead_code)]
     pub pic: Rc<Pic>,
     #[allow(dead_code)]
-    pub uart_output: Option<Rc<RefCell<Vec<u8>>>>,
+    pub uart_output: Option<Rc<UartOutputRing>>,
     #[allow(dead_code)]
     pub i3c_controller: I3cController,
     #[allow(dead_code)]
     pub doe_mbox_fsm: doe_mbox_fsm::DoeMboxFsm,
     pub i3c_address: Option<u8>,
     pub i3c_controller_join_handle: Option<JoinHandle<()>>,
+    pub ram_regions: Vec<RamRegion>,
+    pub external_bus: Rc<ExternalBusControl>,
+    exit_request: Rc<Cell<Option<u32>>>,
+    /// Readable when the I3C socket has passed on commands, see [`Emulator::input_wait_fd`]
+    input_wait: Option<UnixStream>,
+    /// Cleared by [`Emulator::stop`] and on drop; the I3C socket thread runs while it is set
+    running: Arc<AtomicBool>,
+    i3c_socket_stats: Arc<I3cSocketStats>,
+    external_write_batching: bool,
+    publish_globals: bool,
+    runtime_started: bool,
+    idle_tracking: bool,
+    idle_cycles: u64,
 }
 
 impl Emulator {
@@ -301,6 +375,12 @@ impl Emulator {
         #[cfg(not(feature = "test-flash-based-boot"))]
         let is_flash_based_boot = cli.flash_based_boot;
 
+        let profiler = if cli.profile {
+            Some(create_profiler(&cli)?)
+        } else {
+            None
+        };
+
         let args_rom = &cli.rom;
         let args_log_dir = &cli.log_dir.unwrap_or_else(|| PathBuf::from("/tmp"));
 
@@ -347,110 +427,62 @@ impl Emulator {
         let clock = Rc::new(Clock::new());
 
         let uart_output = if capture_uart_output {
-            Some(Rc::new(RefCell::new(Vec::new())))
+            Some(Rc::new(UartOutputRing::new(
+                UartOutputRing::DEFAULT_CAPACITY,
+            )))
         } else {
             None
         };
 
-        let stdin_uart = if cli.stdin_uart && std::io::stdin().is_terminal() {
-            Some(Arc::new(Mutex::new(None)))
-        } else {
-            None
+        let input_recorder = match cli.record_inputs.as_ref() {
+            Some(path) => Some(Rc::new(RefCell::new(InputRecorder::create(path)?))),
+            None => None,
+        };
+        let input_replay = match cli.replay_inputs.as_ref() {
+            Some(path) => Some(Rc::new(RefCell::new(InputReplay::open(path)?))),
+            None => None,
         };
+        if input_replay.is_some() && cli.i3c_port.is_some() {
+            return Err(io::Error::new(
+                io::ErrorKind::InvalidInput,
+                "--replay-inputs replays the I3C commands, --i3c-port cannot be used with it",
+            ));
+        }
+
+        // the UART RX receives the replayed console bytes whether stdin is a terminal or not
+        let stdin_uart =
+            if input_replay.is_some() || (cli.stdin_uart && std::io::stdin().is_terminal()) {
+                Some(Arc::new(Mutex::new(None)))
+            } else {
+                None
+            };
         let pic = Rc::new(Pic::new());
 
-        let mut mcu_root_bus_offsets = McuRootBusOffsets::default();
-        let mut auto_root_bus_offsets = AutoRootBusOffsets::default();
+        let memory_map = match (&cli.shared_memory_map, &cli.memory_map) {
+            (Some(map), _) => map.clone(),
+            (None, Some(spec)) => Arc::new(MemoryMap::from_spec(spec)?),
+            (None, None) => Arc::new(MemoryMap::default()),
+        };
+        // Shared maps, profiles and map files are validated when they are built, so only
+        // a map moved by the CLI offset overrides has to be checked again
+        let memory_map = if cli.memory_map_overrides.is_empty() {
+            memory_map
+        } else {
+            let memory_map = (*memory_map)
+                .clone()
+                .with_overrides(&cli.memory_map_overrides);
+            memory_map.validate().map_err(|err| {
+                io::Error::new(
+                    io::ErrorKind::InvalidInput,
+                    format!("invalid memory map: {}", err),
+                )
+            })?;
+            Arc::new(memory_map)
+        };
+        let mcu_root_bus_offsets = memory_map.mcu.clone();
+        let auto_root_bus_offsets = memory_map.auto.clone();
 
-        // Apply all the CLI offset overrides
-        if let Some(rom_offset) = cli.rom_offset {
-            mcu_root_bus_offsets.rom_offset = rom_offset;
-        }
-        if let Some(rom_size) = cli.rom_size {
-            mcu_root_bus_offsets.rom_size = rom_size;
-        }
-        if let Some(sram_offset) = cli.sram_offset {
-            mcu_root_bus_offsets.ram_offset = sram_offset;
-        }
-        if let Some(uart_offset) = cli.uart_offset {
-            mcu_root_bus_offsets.uart_offset = uart_offset;
-        }
-        if let Some(uart_size) = cli.uart_size {
-            mcu_root_bus_offsets.uart_size = uart_size;
-        }
-        if let Some(ctrl_offset) = cli.ctrl_offset {
-            mcu_root_bus_offsets.ctrl_offset = ctrl_offset;
-        }
-        if let Some(ctrl_size) = cli.ctrl_size {
-            mcu_root_bus_offsets.ctrl_size = ctrl_size;
-        }
-        if let Some(pic_offset) = cli.pic_offset {
-            mcu_root_bus_offsets.pic_offset = pic_offset;
-            auto_root_bus_offsets.el2_pic_offset = pic_offset;
-        }
-        if let Some(external_test_sram_offset) = cli.external_test_sram_offset {
-            mcu_root_bus_offsets.external_test_sram_offset = external_test_sram_offset;
-        }
-        if let Some(external_test_sram_size) = cli.external_test_sram_size {
-            mcu_root_bus_offsets.external_test_sram_size = external_test_sram_size;
-        }
-        if let Some(sram_size) = cli.sram_size {
-            mcu_root_bus_offsets.ram_size = sram_size;
-        }
-        if let Some(dccm_offset) = cli.dccm_offset {
-            mcu_root_bus_offsets.rom_dedicated_ram_offset = dccm_offset;
-        }
-        if let Some(dccm_size) = cli.dccm_size {
-            mcu_root_bus_offsets.rom_dedicated_ram_size = dccm_size;
-        }
-        if let Some(i3c_offset) = cli.i3c_offset {
-            auto_root_bus_offsets.i3c_offset = i3c_offset;
-        }
-        if let Some(i3c_size) = cli.i3c_size {
-            auto_root_bus_offsets.i3c_size = i3c_size;
-        }
-        if let Some(primary_flash_offset) = cli.primary_flash_offset {
-            auto_root_bus_offsets.primary_flash_offset = primary_flash_offset;
-        }
-        if let Some(primary_flash_size) = cli.primary_flash_size {
-            auto_root_bus_offsets.primary_flash_size = primary_flash_size;
-        }
-        if let Some(secondary_flash_offset) = cli.secondary_flash_offset {
-            auto_root_bus_offsets.secondary_flash_offset = secondary_flash_offset;
-        }
-        if let Some(secondary_flash_size) = cli.secondary_flash_size {
-            auto_root_bus_offsets.secondary_flash_size = secondary_flash_size;
-        }
-        if let Some(mci_offset) = cli.mci_offset {
-            auto_root_bus_offsets.mci_offset = mci_offset;
-        }
-        if let Some(mci_size) = cli.mci_size {
-            auto_root_bus_offsets.mci_size = mci_size;
-        }
-        if let Some(mbox_offset) = cli.mbox_offset {
-            auto_root_bus_offsets.mbox_offset = mbox_offset;
-        }
-        if let Some(mbox_size) = cli.mbox_size {
-            auto_root_bus_offsets.mbox_size = mbox_size;
-        }
-        if let Some(soc_offset) = cli.soc_offset {
-            auto_root_bus_offsets.soc_offset = soc_offset;
-        }
-        if let Some(soc_size) = cli.soc_size {
-            auto_root_bus_offsets.soc_size = soc_size;
-        }
-        if let Some(otp_offset) = cli.otp_offset {
-            auto_root_bus_offsets.otp_offset = otp_offset;
-        }
-        if let Some(otp_size) = cli.otp_size {
-            auto_root_bus_offsets.otp_size = otp_size;
-        }
-        if let Some(lc_offset) = cli.lc_offset {
-            auto_root_bus_offsets.lc_offset = lc_offset;
-        }
-        if let Some(lc_size) = cli.lc_size {
-            auto_root_bus_offsets.lc_size = lc_size;
-        }
+        let exit_request = Rc::new(Cell::new(None));
 
         let bus_args = McuRootBusArgs {
             offsets: mcu_root_bus_offsets.clone(),
@@ -460,14 +492,64 @@ impl Emulator {
             uart_rx: stdin_uart.clone(),
             pic: pic.clone(),
             clock: clock.clone(),
+            exit_request: Some(exit_request.clone()),
+        };
+        let mut root_bus = McuRootBus::new(bus_args).unwrap();
+
+        const FLASH_SIZE: usize = DummyFlashCtrl::PAGE_SIZE * DummyFlashCtrl::MAX_PAGES as usize;
+        let map_flash_image = |flash_image_path: &PathBuf| -> io::Result<MappedImage> {
+            let image = MappedImage::open(flash_image_path)?;
+            if image.len() > FLASH_SIZE {
+                println!("Flash image size exceeds {} bytes", FLASH_SIZE);
+                exit(-1);
+            }
+            Ok(image)
+        };
+        // a mapped primary flash image also serves the direct-read window, so that the
+        // window shares its pages instead of holding a copy of the image
+        let primary_mapped_flash = match cli.primary_flash_image.as_ref() {
+            Some(flash_image_path) if cli.map_flash_images => {
+                println!("Mapping flash image from {}", flash_image_path.display());
+                let flash = Rc::new(RefCell::new(CopyOnWriteFlash::new(map_flash_image(
+                    flash_image_path,
+                )?)));
+                root_bus.map_direct_read_flash(flash.clone());
+                Some(flash)
+            }
+            _ => None,
         };
-        let root_bus = McuRootBus::new(bus_args).unwrap();
 
         // Create external communication bus
         let mut caliptra_to_ext = CaliptraToExtBus::new();
-
-        // Set external callbacks if provided
-        if let Some(read_callback) = external_read_callback {
+        let external_bus = caliptra_to_ext.control();
+
+        // Set external callbacks if provided; reads are answered from the input log when
+        // replaying, and recorded along with the faults of a missing callback otherwise
+        if let Some(replay) = input_replay.clone() {
+            caliptra_to_ext.set_read_callback(move |size, addr, buffer| {
+                match replay.borrow_mut().external_read(size_in_bytes(size), addr) {
+                    Some(val) => {
+                        *buffer = val;
+                        true
+                    }
+                    None => false,
+                }
+            });
+        } else if let Some(recorder) = input_recorder.clone() {
+            caliptra_to_ext.set_read_callback(move |size, addr, buffer| {
+                let ok = external_read_callback
+                    .as_ref()
+                    .is_some_and(|callback| callback(size, addr, buffer));
+                recorder
+                    .borrow_mut()
+                    .record_in_step(&InputEvent::ExternalRead {
+                        size: size_in_bytes(size),
+                        addr,
+                        val: ok.then_some(*buffer),
+                    });
+                ok
+            });
+        } else if let Some(read_callback) = external_read_callback {
             caliptra_to_ext.set_read_callback(read_callback);
         }
         if let Some(write_callback) = external_write_callback {
@@ -478,22 +560,61 @@ impl Emulator {
         let dma_rom_sram = root_bus.rom_sram.clone();
         let direct_read_flash = root_bus.direct_read_flash.clone();
 
+        let ram_regions = vec![
+            RamRegion {
+                base: mcu_root_bus_offsets.ram_offset,
+                ram: root_bus.ram.clone(),
+            },
+            RamRegion {
+                base: mcu_root_bus_offsets.rom_dedicated_ram_offset,
+                ram: root_bus.rom_sram.clone(),
+            },
+            RamRegion {
+                base: mcu_root_bus_offsets.external_test_sram_offset,
+                ram: root_bus.external_test_sram.clone(),
+            },
+            RamRegion {
+                base: mcu_root_bus_offsets.direct_read_flash_offset,
+                ram: root_bus.direct_read_flash.clone(),
+            },
+        ];
+
         let i3c_irq = pic.register_irq(McuRootBus::I3C_IRQ);
 
         println!("Starting I3C Socket, port {}", cli.i3c_port.unwrap_or(0));
 
+        // The socket thread of this instance runs until the emulator is dropped
+        let running = Arc::new(AtomicBool::new(true));
+        let i3c_socket_stats = Arc::new(I3cSocketStats::new());
+        let mut input_wait = None;
         let mut i3c_controller = if let Some(i3c_port) = cli.i3c_port {
-            let (rx, tx) = start_i3c_socket(&MCU_RUNNING, i3c_port);
+            let (wait, waker) = UnixStream::pair()?;
+            wait.set_nonblocking(true)?;
+            waker.set_nonblocking(true)?;
+            input_wait = Some(wait);
+            let (rx, tx) = start_i3c_socket_with(
+                running.clone(),
+                i3c_socket_stats.clone(),
+                i3c_port,
+                Some(waker),
+            );
             I3cController::new(rx, tx)
         } else {
             I3cController::default()
         };
-        let i3c = I3c::new(
+        let mut i3c = I3c::new(
             &clock.clone(),
             &mut i3c_controller,
             i3c_irq,
             cli.hw_revision.clone(),
         );
+        if let Some(recorder) = input_recorder.clone() {
+            i3c.set_command_observer(move |xfer| {
+                recorder
+                    .borrow_mut()
+                    .record_in_step(&InputEvent::i3c_command(xfer));
+            });
+        }
         let i3c_dynamic_address = i3c.get_dynamic_address().unwrap();
 
         let doe_event_irq = pic.register_irq(McuRootBus::DOE_MBOX_EVENT_IRQ);
@@ -593,7 +714,7 @@ impl Emulator {
         }
 
         let create_flash_controller =
-            |default_path: &str,
+            |path: PathBuf,
              error_irq: u8,
              event_irq: u8,
              initial_content: Option<&[u8]>,
@@ -618,7 +739,7 @@ impl Emulator {
                             .to_path_buf(),
                     )
                 } else {
-                    Some(PathBuf::from(default_path))
+                    Some(path)
                 };
 
                 DummyFlashCtrl::new(
@@ -632,11 +753,7 @@ impl Emulator {
                 .unwrap()
             };
 
-        let primary_flash_initial_content = if cli.primary_flash_image.is_some() {
-            let flash_image_path = cli.primary_flash_image.as_ref().unwrap();
-            println!("Loading flash image from {}", flash_image_path.display());
-            const FLASH_SIZE: usize =
-                DummyFlashCtrl::PAGE_SIZE * DummyFlashCtrl::MAX_PAGES as usize;
+        let read_flash_image = |flash_image_path: &PathBuf| -> io::Result<Vec<u8>> {
             let mut flash_image = vec![0; FLASH_SIZE];
             let mut file = File::open(flash_image_path)?;
             let bytes_read = file.read(&mut flash_image)?;
@@ -644,44 +761,69 @@ impl Emulator {
                 println!("Flash image size exceeds {} bytes", FLASH_SIZE);
                 exit(-1);
             }
-
-            Some(flash_image[..bytes_read].to_vec())
-        } else {
-            None
+            flash_image.truncate(bytes_read);
+            Ok(flash_image)
         };
+        let create_cow_flash_controller =
+            |error_irq: u8, event_irq: u8, flash: Rc<RefCell<CopyOnWriteFlash>>| {
+                DummyFlashCtrl::new_copy_on_write(
+                    &clock.clone(),
+                    flash,
+                    pic.register_irq(error_irq),
+                    pic.register_irq(event_irq),
+                )
+            };
 
-        let primary_flash_controller = create_flash_controller(
-            "primary_flash",
-            McuRootBus::PRIMARY_FLASH_CTRL_ERROR_IRQ,
-            McuRootBus::PRIMARY_FLASH_CTRL_EVENT_IRQ,
-            primary_flash_initial_content.as_deref(),
-            Some(direct_read_flash.clone()),
-        );
-
-        let secondary_flash_initial_content = if cli.secondary_flash_image.is_some() {
-            let flash_image_path = cli.secondary_flash_image.as_ref().unwrap();
-            const FLASH_SIZE: usize =
-                DummyFlashCtrl::PAGE_SIZE * DummyFlashCtrl::MAX_PAGES as usize;
-            let mut flash_image = vec![0; FLASH_SIZE];
-            let mut file = File::open(flash_image_path)?;
-            let bytes_read = file.read(&mut flash_image)?;
-            if bytes_read > FLASH_SIZE {
-                println!("Flash image size exceeds {} bytes", FLASH_SIZE);
-                exit(-1);
+        let primary_flash_controller = match primary_mapped_flash {
+            Some(flash) => create_cow_flash_controller(
+                McuRootBus::PRIMARY_FLASH_CTRL_ERROR_IRQ,
+                McuRootBus::PRIMARY_FLASH_CTRL_EVENT_IRQ,
+                flash,
+            ),
+            None => {
+                let initial_content = match cli.primary_flash_image.as_ref() {
+                    Some(flash_image_path) => {
+                        println!("Loading flash image from {}", flash_image_path.display());
+                        Some(read_flash_image(flash_image_path)?)
+                    }
+                    None => None,
+                };
+                create_flash_controller(
+                    cli.primary_flash_file
+                        .clone()
+                        .unwrap_or_else(|| PathBuf::from("primary_flash")),
+                    McuRootBus::PRIMARY_FLASH_CTRL_ERROR_IRQ,
+                    McuRootBus::PRIMARY_FLASH_CTRL_EVENT_IRQ,
+                    initial_content.as_deref(),
+                    Some(direct_read_flash.clone()),
+                )
             }
-
-            Some(flash_image[..bytes_read].to_vec())
-        } else {
-            None
         };
 
-        let secondary_flash_controller = create_flash_controller(
-            "secondary_flash",
-            McuRootBus::SECONDARY_FLASH_CTRL_ERROR_IRQ,
-            McuRootBus::SECONDARY_FLASH_CTRL_EVENT_IRQ,
-            secondary_flash_initial_content.as_deref(),
-            None,
-        );
+        let secondary_flash_controller = match cli.secondary_flash_image.as_ref() {
+            Some(flash_image_path) if cli.map_flash_images => create_cow_flash_controller(
+                McuRootBus::SECONDARY_FLASH_CTRL_ERROR_IRQ,
+                McuRootBus::SECONDARY_FLASH_CTRL_EVENT_IRQ,
+                Rc::new(RefCell::new(CopyOnWriteFlash::new(map_flash_image(
+                    flash_image_path,
+                )?))),
+            ),
+            flash_image_path => {
+                let initial_content = match flash_image_path {
+                    Some(flash_image_path) => Some(read_flash_image(flash_image_path)?),
+                    None => None,
+                };
+                create_flash_controller(
+                    cli.secondary_flash_file
+                        .clone()
+                        .unwrap_or_else(|| PathBuf::from("secondary_flash")),
+                    McuRootBus::SECONDARY_FLASH_CTRL_ERROR_IRQ,
+                    McuRootBus::SECONDARY_FLASH_CTRL_EVENT_IRQ,
+                    initial_content.as_deref(),
+                    None,
+                )
+            }
+        };
 
         let mut dma_ctrl = emulator_periph::AxiCDMA::new(
             &clock.clone(),
@@ -698,7 +840,9 @@ impl Emulator {
 
         let mcu_mailbox0 = root_bus.mcu_mailbox0.clone();
         let mcu_mailbox1 = root_bus.mcu_mailbox1.clone();
+        let fast_regions = root_bus.fast_regions();
 
+        // keep in sync with MCU_BUS_DELEGATES
         let delegates: Vec<Box<dyn Bus>> = vec![
             Box::new(root_bus),
             Box::new(soc_to_caliptra),
@@ -762,6 +906,8 @@ impl Emulator {
             None,
             Some(Box::new(dma_ctrl)),
         );
+        // SRAM, DCCM and ROM accesses skip the peripheral dispatch
+        auto_root_bus.set_fast_regions(fast_regions);
 
         // Set the DMA RAM for Primary Flash Controller
         auto_root_bus
@@ -904,7 +1050,12 @@ impl Emulator {
         }
 
         let instr_trace = if cli.trace_instr {
-            Some(args_log_dir.join("caliptra_instr_trace.txt"))
+            let sink = TraceSink::create(&args_log_dir, cli.trace_format, cli.trace_stdout)?;
+            Some(TraceThread::spawn(
+                sink,
+                cli.trace_queue_policy,
+                cli.trace_queue_size,
+            ))
         } else {
             None
         };
@@ -912,8 +1063,20 @@ impl Emulator {
         let sram_range = mcu_root_bus_offsets.ram_offset
             ..mcu_root_bus_offsets.ram_offset + mcu_root_bus_offsets.ram_size;
 
+        // read from the console in a separate thread to prevent blocking; while recording,
+        // the emulator hands the bytes to the UART itself so that it knows their cycle
+        let console_rx = match (&input_recorder, &input_replay) {
+            (_, Some(_)) => None,
+            (Some(_), None) => stdin_uart.as_ref().map(|_| Arc::new(Mutex::new(None))),
+            (None, None) => stdin_uart.clone(),
+        };
+        if console_rx.is_some() {
+            let console_rx_clone = console_rx.clone();
+            std::thread::spawn(move || read_console(console_rx_clone));
+        }
+
         // Create the emulator instance
-        Ok(Self::new(
+        let mut emulator = Self::new(
             cpu,
             caliptra_cpu,
             instr_trace,
@@ -927,38 +1090,70 @@ impl Emulator {
             doe_mbox_fsm,
             Some(i3c_dynamic_address.into()),
             i3c_controller_join_handle,
-        ))
+            ram_regions,
+            external_bus,
+            exit_request,
+        );
+        if let Some(profiler) = profiler {
+            emulator.profiler = Some(profiler);
+            emulator.profile_output = Some(args_log_dir.join("profile.folded"));
+        }
+        if let Some(interval) = cli.bus_stats_interval {
+            emulator.enable_bus_stats();
+            emulator.bus_stats_log = Some(BusStatsLog::create(args_log_dir, interval)?);
+        }
+        if let Some(path) = cli.lockstep_log.as_ref() {
+            emulator.enable_lockstep_log(path, cli.lockstep_checkpoint_interval)?;
+        }
+        if input_recorder.is_some() {
+            emulator.console_rx = console_rx;
+        }
+        emulator.input_recorder = input_recorder;
+        emulator.input_replay = input_replay;
+        emulator.input_wait = input_wait;
+        emulator.running = running;
+        emulator.i3c_socket_stats = i3c_socket_stats;
+        if let Some(max_cycles) = cli.time_warp {
+            emulator.set_time_warp(max_cycles);
+        }
+        Ok(emulator)
     }
 
     #[allow(clippy::too_many_arguments)]
     pub fn new(
         mcu_cpu: Cpu<AutoRootBus>,
         caliptra_cpu: Cpu<CaliptraMainRootBus>,
-        trace_path: Option<PathBuf>,
+        trace: Option<TraceThread>,
         stdin_uart: Option<Arc<Mutex<Option<u8>>>>,
         bmc: Option<Bmc>,
         sram_range: Range<u32>,
         clock: Rc<Clock>,
         pic: Rc<Pic>,
-        uart_output: Option<Rc<RefCell<Vec<u8>>>>,
+        uart_output: Option<Rc<UartOutputRing>>,
         i3c_controller: I3cController,
         doe_mbox_fsm: doe_mbox_fsm::DoeMboxFsm,
         i3c_address: Option<u8>,
         i3c_controller_join_handle: Option<JoinHandle<()>>,
+        ram_regions: Vec<RamRegion>,
+        external_bus: Rc<ExternalBusControl>,
+        exit_request: Rc<Cell<Option<u32>>>,
     ) -> Self {
-        // read from the console in a separate thread to prevent blocking
-        let stdin_uart_clone = stdin_uart.clone();
-        std::thread::spawn(move || read_console(stdin_uart_clone));
-
         let timer = Timer::new(&mcu_cpu.clock.clone());
-        let trace_file = trace_path.map(|path| File::create(path).unwrap());
 
         Self {
             mcu_cpu,
             caliptra_cpu,
             bmc,
             timer,
-            trace_file,
+            trace,
+            profiler: None,
+            profile_output: None,
+            bus_stats_log: None,
+            lockstep_log: None,
+            time_warp: None,
+            input_recorder: None,
+            input_replay: None,
+            console_rx: None,
             stdin_uart,
             sram_range,
             clock,
@@ -968,6 +1163,17 @@ impl Emulator {
             doe_mbox_fsm,
             i3c_address,
             i3c_controller_join_handle,
+            ram_regions,
+            external_bus,
+            exit_request,
+            input_wait: None,
+            running: Arc::new(AtomicBool::new(true)),
+            i3c_socket_stats: Arc::new(I3cSocketStats::new()),
+            external_write_batching: false,
+            publish_globals: true,
+            runtime_started: false,
+            idle_tracking: false,
+            idle_cycles: 0,
         }
     }
 
@@ -982,14 +1188,24 @@ impl Emulator {
     }
 
     pub fn step(&mut self) -> StepAction {
-        if !MCU_RUNNING.load(Ordering::Relaxed) {
+        if !self.running.load(Ordering::Relaxed) || !MCU_RUNNING.load(Ordering::Relaxed) {
             return StepAction::Break;
         }
 
-        let now = self.mcu_cpu.clock.now();
-        MCU_TICKS.store(now, Ordering::Relaxed);
-        if now % 1000 == 0 {
-            TICK_COND.notify_all();
+        if self.exit_request.get().is_some() {
+            return StepAction::Break;
+        }
+
+        if self.publish_globals {
+            let now = self.mcu_cpu.clock.now();
+            MCU_TICKS.store(now, Ordering::Relaxed);
+            if now % 1000 == 0 {
+                TICK_COND.notify_all();
+            }
+        }
+
+        if self.input_recorder.is_some() || self.input_replay.is_some() {
+            self.step_inputs();
         }
 
         if let Some(ref stdin_uart) = self.stdin_uart {
@@ -998,44 +1214,122 @@ impl Emulator {
             }
         }
 
-        let action = if let Some(ref mut trace_file) = self.trace_file {
-            let trace_fn: &mut dyn FnMut(u32, RvInstr) = &mut |pc, instr| match instr {
-                RvInstr::Instr32(instr32) => {
-                    let _ = writeln!(trace_file, "{}", disassemble(pc, instr32));
-                    println!("{{mcu cpu}}      {}", disassemble(pc, instr32));
-                }
-                RvInstr::Instr16(instr16) => {
-                    let _ = writeln!(trace_file, "{}", disassemble(pc, instr16 as u32));
-                    println!("{{mcu cpu}}      {}", disassemble(pc, instr16 as u32));
-                }
+        // set if either core retires an instruction other than wfi this cycle
+        let mut busy = false;
+        let track_idle = self.idle_tracking;
+        // set if the MCU retires a fence, which flushes posted external writes
+        let mut fence = false;
+        let track_fence = self.external_write_batching;
+        // what the MCU retired this cycle, for the time warp
+        let track_warp = self.time_warp.is_some();
+        let mut mcu_wfi = false;
+        let mut retired_pc = 0;
+        let mut stored = false;
+        // the profiler follows calls and returns on every step, even unsampled ones
+        let profiling = self.profiler.is_some();
+        let mut mcu_instr = None;
+
+        let cycle = self.mcu_cpu.clock.now();
+        let profile = self.profiler.as_mut().is_some_and(|p| p.sample_due());
+        let mcu_pc = profiling.then(|| self.mcu_cpu.read_pc());
+        let action = if let Some(ref mut trace) = self.trace {
+            let trace_fn: &mut dyn FnMut(u32, RvInstr) = &mut |pc, instr| {
+                busy |= !is_wfi(&instr);
+                fence |= is_fence(&instr);
+                mcu_wfi |= is_wfi(&instr);
+                retired_pc = pc;
+                stored |= is_store(&instr);
+                mcu_instr = Some(instr);
+                trace.record(&trace_record(TraceCore::Mcu, cycle, pc, instr));
             };
             self.mcu_cpu.step(Some(trace_fn))
+        } else if track_idle || track_fence || track_warp || profiling {
+            let retire_fn: &mut dyn FnMut(u32, RvInstr) = &mut |pc, instr| {
+                busy |= !is_wfi(&instr);
+                fence |= is_fence(&instr);
+                mcu_wfi |= is_wfi(&instr);
+                retired_pc = pc;
+                stored |= is_store(&instr);
+                mcu_instr = Some(instr);
+            };
+            self.mcu_cpu.step(Some(retire_fn))
         } else {
             self.mcu_cpu.step(None)
         };
 
+        if let (Some(pc), Some(profiler)) = (mcu_pc, self.profiler.as_mut()) {
+            if profile {
+                profiler.record(TraceCore::Mcu, pc, self.mcu_cpu.clock.now() - cycle);
+            }
+            profiler.retired(TraceCore::Mcu, pc, mcu_instr, self.mcu_cpu.read_pc());
+        }
+        let mcu_busy = busy;
+
+        if let Some(log) = self.lockstep_log.as_ref() {
+            let now = self.mcu_cpu.clock.now();
+            if log.borrow().checkpoint_due(now) {
+                let xregs = std::array::from_fn(|idx| {
+                    self.mcu_cpu.read_xreg(XReg::from(idx as u16)).unwrap()
+                });
+                log.borrow_mut()
+                    .checkpoint(now, self.mcu_cpu.read_pc(), xregs);
+            }
+        }
+
+        if track_fence {
+            if fence {
+                self.external_bus.flush();
+            } else {
+                self.external_bus.flush_if_due(self.mcu_cpu.clock.now());
+            }
+        }
+
         if action != StepAction::Continue {
             return action;
         }
 
-        if self.sram_range.contains(&self.mcu_cpu.read_pc()) {
-            MCU_RUNTIME_STARTED.store(true, Ordering::Relaxed);
+        if self.exit_request.get().is_some() {
+            return StepAction::Break;
+        }
+
+        if !self.runtime_started && self.sram_range.contains(&self.mcu_cpu.read_pc()) {
+            self.runtime_started = true;
+            if self.publish_globals {
+                MCU_RUNTIME_STARTED.store(true, Ordering::Relaxed);
+            }
         }
 
-        let caliptra_action = if self.trace_file.is_some() {
+        let caliptra_start =
+            profiling.then(|| (self.caliptra_cpu.read_pc(), self.caliptra_cpu.clock.now()));
+        let mut caliptra_busy = false;
+        let mut caliptra_instr = None;
+        let caliptra_action = if let Some(ref mut trace) = self.trace {
             let caliptra_trace_fn: &mut dyn FnMut(u32, caliptra_emu_cpu::RvInstr) =
-                &mut |pc, instr| match instr {
-                    caliptra_emu_cpu::RvInstr::Instr32(instr32) => {
-                        println!("{{caliptra cpu}} {}", disassemble(pc, instr32));
-                    }
-                    caliptra_emu_cpu::RvInstr::Instr16(instr16) => {
-                        println!("{{caliptra cpu}} {}", disassemble(pc, instr16 as u32));
-                    }
+                &mut |pc, instr| {
+                    caliptra_busy |= !is_wfi(&instr);
+                    caliptra_instr = Some(instr);
+                    trace.record(&trace_record(TraceCore::Caliptra, cycle, pc, instr));
                 };
             self.caliptra_cpu.step(Some(caliptra_trace_fn))
+        } else if track_idle || track_warp || profiling {
+            let idle_fn: &mut dyn FnMut(u32, caliptra_emu_cpu::RvInstr) = &mut |_, instr| {
+                caliptra_busy |= !is_wfi(&instr);
+                caliptra_instr = Some(instr);
+            };
+            self.caliptra_cpu.step(Some(idle_fn))
         } else {
             self.caliptra_cpu.step(None)
         };
+        busy |= caliptra_busy;
+
+        if let (Some((pc, start)), Some(profiler)) = (caliptra_start, self.profiler.as_mut()) {
+            if profile {
+                let cycles = self.caliptra_cpu.clock.now() - start;
+                profiler.record(TraceCore::Caliptra, pc, cycles);
+            }
+            let next_pc = self.caliptra_cpu.read_pc();
+            profiler.retired(TraceCore::Caliptra, pc, caliptra_instr, next_pc);
+        }
 
         match caliptra_action {
             StepAction::Continue => {}
@@ -1048,22 +1342,636 @@ impl Emulator {
             bmc.step();
         }
 
+        if track_idle {
+            self.idle_cycles = if busy {
+                0
+            } else {
+                self.idle_cycles.saturating_add(1)
+            };
+        }
+
+        if let Some(time_warp) = self.time_warp.as_mut() {
+            let mcu_cpu = &self.mcu_cpu;
+            let warp = time_warp.after_step(
+                mcu_wfi && !mcu_busy,
+                retired_pc,
+                stored,
+                mcu_cpu.read_pc(),
+                !caliptra_busy,
+                || std::array::from_fn(|idx| mcu_cpu.read_xreg(XReg::from(idx as u16)).unwrap()),
+            );
+            if let Some(cycles) = warp {
+                let fired = self.warp_clocks(cycles);
+                if let Some(time_warp) = self.time_warp.as_mut() {
+                    time_warp.warped(cycles, fired);
+                }
+            }
+        }
+
+        if let Some(log) = self.bus_stats_log.as_ref() {
+            if log.due(self.mcu_cpu.clock.now()) {
+                self.dump_bus_stats();
+            }
+        }
+
         action
     }
 
+    /// Deliver the inputs of this step: while recording, hand the next console byte to
+    /// the UART RX and log it; while replaying, deliver the logged UART and I3C inputs
+    /// due at this cycle.
+    fn step_inputs(&mut self) {
+        let now = self.mcu_cpu.clock.now();
+        if let Some(recorder) = self.input_recorder.as_ref() {
+            let mut recorder = recorder.borrow_mut();
+            recorder.begin_step(now);
+            if let (Some(console), Some(uart)) =
+                (self.console_rx.as_ref(), self.stdin_uart.as_ref())
+            {
+                let mut uart = uart.lock().unwrap();
+                if uart.is_none() {
+                    if let Some(byte) = console.lock().unwrap().take() {
+                        *uart = Some(byte);
+                        recorder.record(now, &InputEvent::UartRx(byte));
+                    }
+                }
+            }
+        }
+
+        let Some(replay) = self.input_replay.clone() else {
+            return;
+        };
+        let mut replay = replay.borrow_mut();
+        while let Some(event) = replay.next_due(now) {
+            match event {
+                InputEvent::UartRx(byte) => {
+                    if let Some(uart) = self.stdin_uart.as_ref() {
+                        *uart.lock().unwrap() = Some(byte);
+                    }
+                }
+                InputEvent::I3cCommand { .. } => {
+                    let addr = self
+                        .i3c_address
+                        .and_then(|addr| DynamicI3cAddress::new(addr).ok());
+                    if let (Some(addr), Some(xfer)) = (addr, event.i3c_xfer()) {
+                        let _ = self.i3c_controller.tcri_send(addr, xfer);
+                    }
+                    // nobody reads the responses without the socket
+                    self.i3c_controller.run_once();
+                }
+                InputEvent::ExternalRead { .. } => {}
+            }
+        }
+    }
+
+    /// Queue `byte` for the MCU UART RX as if it was typed on the console. Returns `None`
+    /// if the UART RX is not enabled, and false if the previous byte has not been read
+    /// yet or the inputs are replayed from a log.
+    pub fn send_uart_rx(&mut self, byte: u8) -> Option<bool> {
+        let uart = self.stdin_uart.as_ref()?;
+        if self.input_replay.is_some() {
+            return Some(false);
+        }
+        let mut uart = uart.lock().unwrap();
+        if uart.is_some() {
+            return Some(false);
+        }
+        *uart = Some(byte);
+        if let Some(recorder) = self.input_recorder.as_ref() {
+            // delivered at the start of the next step
+            recorder
+                .borrow_mut()
+                .record(self.mcu_cpu.clock.now(), &InputEvent::UartRx(byte));
+        }
+        Some(true)
+    }
+
+    /// Enable or disable tracking of whether both cores are parked on `wfi`.
+    ///
+    /// Tracking is off by default since it requires an instruction callback on every step.
+    pub fn set_idle_tracking(&mut self, enabled: bool) {
+        if enabled != self.idle_tracking {
+            self.idle_tracking = enabled;
+            self.idle_cycles = 0;
+        }
+    }
+
+    /// Returns true if idle tracking is enabled, neither core has retired an instruction
+    /// other than `wfi` for the last `IDLE_THRESHOLD_CYCLES` cycles and nothing is about
+    /// to wake them: no enabled interrupt is pending and, with the time warp, the warps
+    /// have grown to their maximum without a timer action coming due.
+    ///
+    /// Without the time warp the next timer action is not known, so one that comes due
+    /// later in an idle period is only seen once the host steps the emulator again.
+    pub fn is_idle(&self) -> bool {
+        self.idle_tracking
+            && self.idle_cycles >= IDLE_THRESHOLD_CYCLES
+            && self.time_warp.as_ref().map_or(true, TimeWarp::saturated)
+            && !interrupt_pending(&self.mcu_cpu)
+            && !interrupt_pending(&self.caliptra_cpu)
+    }
+
+    /// Stop this instance: [`Emulator::step`] returns `Break` from now on and the I3C
+    /// socket closes. Unlike clearing the process-wide `MCU_RUNNING`, this leaves other
+    /// instances in the process running.
+    pub fn stop(&self) {
+        self.running.store(false, Ordering::Relaxed);
+    }
+
+    /// Counters of this instance's I3C socket (`--i3c-port`).
+    pub fn i3c_socket_stats(&self) -> &I3cSocketStats {
+        &self.i3c_socket_stats
+    }
+
+    /// Descriptor that becomes readable when the I3C socket passes on commands from its
+    /// client, for hosts that poll it with their other input while the emulator is idle.
+    /// It is non-blocking; read it empty before polling again.
+    pub fn input_wait_fd(&self) -> Option<RawFd> {
+        self.input_wait.as_ref().map(|wait| wait.as_raw_fd())
+    }
+
+    /// Restart the idle window, e.g. after the host has waited for external input.
+    pub fn reset_idle(&mut self) {
+        self.idle_cycles = 0;
+    }
+
+    /// Fast-forward the clocks through idle periods by at most `max_cycles` at a time, or
+    /// stop doing so if `max_cycles` is 0; see [`TimeWarp`].
+    ///
+    /// Has no effect while inputs are recorded or replayed: a warp that delivers an I3C
+    /// command in a poll would reach it one step earlier in the replay.
+    pub fn set_time_warp(&mut self, max_cycles: u64) {
+        if self.input_recorder.is_some() || self.input_replay.is_some() {
+            println!("The time warp is not used while inputs are recorded or replayed");
+            return;
+        }
+        self.time_warp = (max_cycles != 0).then(|| TimeWarp::new(max_cycles));
+    }
+
+    /// Cycles skipped by the time warp since it was enabled, if it is.
+    pub fn time_warp_stats(&self) -> Option<TimeWarpStats> {
+        self.time_warp.as_ref().map(TimeWarp::stats)
+    }
+
+    /// Move both clocks `cycles` forward as if the cores had idled through them and
+    /// return true if any timer action came due. The actions the cores handle, such as
+    /// interrupts, are rescheduled for the next cycle so the cores still see them.
+    fn warp_clocks(&mut self, cycles: u64) -> bool {
+        let mcu_actions = self
+            .mcu_cpu
+            .clock
+            .increment_and_process_timer_actions(cycles, &mut self.mcu_cpu.bus);
+        let caliptra_actions = self
+            .caliptra_cpu
+            .clock
+            .increment_and_process_timer_actions(cycles, &mut self.caliptra_cpu.bus);
+        let fired = !mcu_actions.is_empty() || !caliptra_actions.is_empty();
+        for action in mcu_actions {
+            self.timer.schedule_action_in(1, action);
+        }
+        let caliptra_timer = Timer::new(&self.caliptra_cpu.clock);
+        for action in caliptra_actions {
+            caliptra_timer.schedule_action_in(1, action);
+        }
+        if self.publish_globals {
+            MCU_TICKS.store(self.mcu_cpu.clock.now(), Ordering::Relaxed);
+            TICK_COND.notify_all();
+        }
+        fired
+    }
+
+    /// Deliver writes to the external bus in batches through `callback` instead of one
+    /// call per access. See [`ExternalBusControl`] for when batches are flushed; a
+    /// `flush_interval` of 0 disables the periodic flush.
+    pub fn enable_external_write_batching<F>(&mut self, callback: F, flush_interval: u64)
+    where
+        F: Fn(&[ExternalWrite]) -> bool + 'static,
+    {
+        self.external_bus
+            .enable_write_batching(callback, flush_interval);
+        self.external_write_batching = true;
+    }
+
+    /// Deliver the queued external writes and go back to one callback call per access.
+    /// Returns false if the batch callback rejected the last batch.
+    pub fn disable_external_write_batching(&mut self) -> bool {
+        self.external_write_batching = false;
+        self.external_bus.disable_write_batching()
+    }
+
+    /// Start counting the accesses to each MCU peripheral; see [`Emulator::bus_stats`].
+    ///
+    /// Accesses to SRAM, DCCM and ROM take the fast path of the root bus and are counted
+    /// per region, without polling detection. Restarts the counters if they are already
+    /// enabled.
+    pub fn enable_bus_stats(&mut self) {
+        let clock = self.mcu_cpu.clock.clone();
+        self.mcu_cpu.bus.enable_stats(clock);
+    }
+
+    /// Access counters of the MCU peripherals, of the other buses mounted on the MCU root
+    /// bus (see [`MCU_BUS_DELEGATES`]) and of the fast regions, if enabled.
+    ///
+    /// The MCU mailboxes are counted apart from the rest of MCI, and accesses to the fast
+    /// regions that fall back to the regular dispatch count under `mcu_root_bus`.
+    pub fn bus_stats(&self) -> Option<Vec<(&'static str, AutoRootBusAccessStats)>> {
+        let bus = &self.mcu_cpu.bus;
+        let names = AutoRootBus::PERIPHERALS
+            .iter()
+            .chain(MCU_BUS_DELEGATES.iter())
+            .copied()
+            .zip(bus.stats()?.iter().copied());
+        let fast = bus
+            .fast_regions()
+            .iter()
+            .map(|region| region.name)
+            .zip(bus.fast_region_stats()?.iter().copied());
+        Some(names.chain(fast).collect())
+    }
+
+    fn dump_bus_stats(&mut self) {
+        let Some(stats) = self.bus_stats() else {
+            return;
+        };
+        let cycle = self.mcu_cpu.clock.now();
+        if let Some(log) = self.bus_stats_log.as_mut() {
+            if let Err(err) = log.dump(cycle, &stats) {
+                println!("Failed to write bus statistics: {}", err);
+                self.bus_stats_log = None;
+            }
+        }
+    }
+
+    /// Start recording the lockstep log of the MCU to `path`, with a checkpoint of the
+    /// MCU PC and registers every `checkpoint_interval` cycles; see [`LockstepLog`].
+    ///
+    /// Replaces the log being recorded, if any, and enables the bus statistics the
+    /// accesses are observed through.
+    pub fn enable_lockstep_log(&mut self, path: &Path, checkpoint_interval: u64) -> io::Result<()> {
+        if let Some(log) = self.lockstep_log.take() {
+            log.borrow_mut().finish();
+        }
+        let log = Rc::new(RefCell::new(LockstepLog::create(
+            path,
+            checkpoint_interval,
+        )?));
+        let clock = self.mcu_cpu.clock.clone();
+        let observer_log = log.clone();
+        let observer_clock = clock.clone();
+        self.mcu_cpu.bus.set_access_observer(
+            clock,
+            Box::new(move |access| {
+                if LockstepLog::records_target(access.target) {
+                    observer_log
+                        .borrow_mut()
+                        .record_access(observer_clock.now(), access);
+                }
+            }),
+        );
+        self.lockstep_log = Some(log);
+        Ok(())
+    }
+
+    /// Start profiling both cores, sampling every `interval` steps (1 counts every step).
+    ///
+    /// Restarts the profile if one is already running. Load symbols with
+    /// [`Profiler::add_elf_symbols`] and write the result with [`Profiler::save_folded`].
+    pub fn enable_profiling(&mut self, interval: u64) {
+        self.profiler = Some(Profiler::new(interval));
+    }
+
+    /// Exit code written by the MCU firmware to the emulator control register, if any.
+    ///
+    /// Once set, `step()` returns `StepAction::Break` without executing anything.
+    pub fn exit_code(&self) -> Option<u32> {
+        self.exit_request.get()
+    }
+
+    /// Returns true once the MCU has started executing runtime firmware from SRAM.
+    pub fn runtime_started(&self) -> bool {
+        self.runtime_started
+    }
+
+    /// Choose whether this instance publishes its progress to the process-wide
+    /// `MCU_TICKS`, `TICK_COND` and `MCU_RUNTIME_STARTED` used by the socket and test
+    /// threads. Enabled by default; disable it when several emulators share a process.
+    pub fn set_publish_globals(&mut self, enabled: bool) {
+        self.publish_globals = enabled;
+    }
+
     /// Get the current program counter (PC) of the MCU CPU
     pub fn get_pc(&self) -> u32 {
         self.mcu_cpu.read_pc()
     }
+
+    /// Capture the cycle count, PC, general purpose registers and machine CSRs of both
+    /// cores, the contents of the MCU RAM regions and the Caliptra ICCM and DCCM, and the
+    /// state of the MCU peripherals that keep any (MCI and its mailboxes, I3C, OTP and the
+    /// flash controllers). Posted external writes are flushed first.
+    ///
+    /// This is not a full image of the device. The Caliptra peripherals, the DOE mailbox,
+    /// the LC controller, the contents of a flash file (which already persists them) and
+    /// commands queued on the I3C socket stay as they are in the emulator the snapshot is
+    /// restored into. Pending timers can't be read back: the peripherals record which of
+    /// theirs are armed and re-arm them on restore, the machine timer at its exact compare
+    /// value and the others with their full delay. A snapshot is therefore best taken at a
+    /// quiescent point, e.g. once Caliptra has finished booting and is parked on `wfi`.
+    /// Restore it into the emulator it was taken from, or into one started with the same
+    /// configuration.
+    pub fn snapshot(&self) -> EmulatorSnapshot {
+        self.external_bus.flush();
+        let caliptra_bus = &self.caliptra_cpu.bus;
+        EmulatorSnapshot {
+            mcu: cpu_snapshot(&self.mcu_cpu),
+            caliptra: cpu_snapshot(&self.caliptra_cpu),
+            regions: self
+                .ram_regions
+                .iter()
+                .map(|region| RegionSnapshot {
+                    base: region.base,
+                    data: region.ram.borrow().data().to_vec(),
+                })
+                .collect(),
+            caliptra_regions: vec![
+                RegionSnapshot {
+                    base: CALIPTRA_ICCM_BASE,
+                    data: caliptra_bus.iccm.ram().borrow().data().to_vec(),
+                },
+                RegionSnapshot {
+                    base: CALIPTRA_DCCM_BASE,
+                    data: caliptra_bus.dccm.data().to_vec(),
+                },
+            ],
+            peripherals: self
+                .mcu_cpu
+                .bus
+                .save_state()
+                .into_iter()
+                .map(|(name, state)| PeripheralSnapshot {
+                    name: name.into(),
+                    state,
+                })
+                .collect(),
+        }
+    }
+
+    /// Restore state previously captured with [`Emulator::snapshot`] and continue from it
+    /// on the next step.
+    ///
+    /// Clocks only run forward: one behind the snapshot is advanced to it, processing the
+    /// timer actions that come due on the way as [`Emulator::step`] would, and one ahead
+    /// keeps its cycle count.
+    ///
+    /// Fails without modifying the emulator if the snapshot's RAM regions, ICCM or DCCM do
+    /// not match this emulator's memory layout, or if it holds a CSR the cores here do not
+    /// implement. A peripheral state this emulator can't load fails the restore part way.
+    pub fn restore(&mut self, snapshot: &EmulatorSnapshot) -> io::Result<()> {
+        let layout_matches = snapshot.regions.len() == self.ram_regions.len()
+            && snapshot
+                .regions
+                .iter()
+                .zip(self.ram_regions.iter())
+                .all(|(saved, region)| {
+                    saved.base == region.base
+                        && saved.data.len() == region.ram.borrow().len() as usize
+                });
+        let caliptra_layout_matches = match snapshot.caliptra_regions.as_slice() {
+            [iccm, dccm] => {
+                iccm.base == CALIPTRA_ICCM_BASE
+                    && iccm.data.len() == self.caliptra_cpu.bus.iccm.ram().borrow().data().len()
+                    && dccm.base == CALIPTRA_DCCM_BASE
+                    && dccm.data.len() == self.caliptra_cpu.bus.dccm.data().len()
+            }
+            _ => false,
+        };
+        if !layout_matches || !caliptra_layout_matches {
+            Err(io::Error::new(
+                io::ErrorKind::InvalidInput,
+                "snapshot memory layout does not match the emulator",
+            ))?;
+        }
+        let csrs_match = snapshot
+            .mcu
+            .csrs
+            .iter()
+            .all(|(addr, _)| self.mcu_cpu.read_csr_machine(*addr).is_ok())
+            && snapshot
+                .caliptra
+                .csrs
+                .iter()
+                .all(|(addr, _)| self.caliptra_cpu.read_csr_machine(*addr).is_ok());
+        if !csrs_match {
+            Err(io::Error::new(
+                io::ErrorKind::InvalidInput,
+                "snapshot CSRs do not match the emulator",
+            ))?;
+        }
+
+        self.external_bus.flush();
+        // Advance the clocks before the peripherals re-arm their timers from the restored
+        // cycle.
+        self.advance_clocks_to(snapshot.mcu.cycle, snapshot.caliptra.cycle);
+        for periph in snapshot.peripherals.iter() {
+            self.mcu_cpu
+                .bus
+                .restore_state(&periph.name, &periph.state)?;
+        }
+        for (saved, region) in snapshot.regions.iter().zip(self.ram_regions.iter()) {
+            region
+                .ram
+                .borrow_mut()
+                .data_mut()
+                .copy_from_slice(&saved.data);
+        }
+        let caliptra_bus = &mut self.caliptra_cpu.bus;
+        caliptra_bus
+            .iccm
+            .ram()
+            .borrow_mut()
+            .data_mut()
+            .copy_from_slice(&snapshot.caliptra_regions[0].data);
+        caliptra_bus
+            .dccm
+            .data_mut()
+            .copy_from_slice(&snapshot.caliptra_regions[1].data);
+        restore_cpu(&mut self.mcu_cpu, &snapshot.mcu)?;
+        restore_cpu(&mut self.caliptra_cpu, &snapshot.caliptra)?;
+        self.idle_cycles = 0;
+        if let Some(time_warp) = self.time_warp.as_mut() {
+            time_warp.reset();
+        }
+        Ok(())
+    }
+
+    /// Advance each core's clock that is behind the given cycle to it, like
+    /// [`Emulator::warp_clocks`].
+    fn advance_clocks_to(&mut self, mcu_cycle: u64, caliptra_cycle: u64) {
+        let mcu_behind = mcu_cycle.saturating_sub(self.mcu_cpu.clock.now());
+        if mcu_behind > 0 {
+            let actions = self
+                .mcu_cpu
+                .clock
+                .increment_and_process_timer_actions(mcu_behind, &mut self.mcu_cpu.bus);
+            for action in actions {
+                self.timer.schedule_action_in(1, action);
+            }
+        }
+        let caliptra_behind = caliptra_cycle.saturating_sub(self.caliptra_cpu.clock.now());
+        if caliptra_behind > 0 {
+            let actions = self
+                .caliptra_cpu
+                .clock
+                .increment_and_process_timer_actions(caliptra_behind, &mut self.caliptra_cpu.bus);
+            let caliptra_timer = Timer::new(&self.caliptra_cpu.clock);
+            for action in actions {
+                caliptra_timer.schedule_action_in(1, action);
+            }
+        }
+        if self.publish_globals {
+            MCU_TICKS.store(self.mcu_cpu.clock.now(), Ordering::Relaxed);
+            TICK_COND.notify_all();
+        }
+    }
+
+    /// Read `data.len()` bytes of the MCU address space starting at `addr`.
+    ///
+    /// RAM-backed ranges are copied straight out of the backing memory; anything else
+    /// (MMIO) is read through the bus a word at a time, or a byte at a time where the
+    /// range is not word aligned.
+    pub fn read_memory(&mut self, addr: u32, data: &mut [u8]) -> Result<(), BusError> {
+        let mut pos = 0;
+        while pos < data.len() {
+            let cur = addr.wrapping_add(pos as u32);
+            let remaining = data.len() - pos;
+            if let Some((region, offset, len)) =
+                fast_span(self.mcu_cpu.bus.fast_regions(), cur, remaining, false)
+            {
+                data[pos..pos + len]
+                    .copy_from_slice(&region.ram.borrow().data()[offset..offset + len]);
+                pos += len;
+            } else if cur % 4 == 0 && remaining >= 4 {
+                let word = self.mcu_cpu.bus.read(RvSize::Word, cur)?;
+                data[pos..pos + 4].copy_from_slice(&word.to_le_bytes());
+                pos += 4;
+            } else {
+                data[pos] = self.mcu_cpu.bus.read(RvSize::Byte, cur)? as u8;
+                pos += 1;
+            }
+        }
+        Ok(())
+    }
+
+    /// Write `data` to the MCU address space starting at `addr`.
+    ///
+    /// Writable RAM-backed ranges are copied straight into the backing memory; anything
+    /// else goes through the bus like [`Emulator::read_memory`]. Stops at the first bus
+    /// error, leaving the preceding bytes written.
+    pub fn write_memory(&mut self, addr: u32, data: &[u8]) -> Result<(), BusError> {
+        let mut pos = 0;
+        while pos < data.len() {
+            let cur = addr.wrapping_add(pos as u32);
+            let remaining = data.len() - pos;
+            if let Some((region, offset, len)) =
+                fast_span(self.mcu_cpu.bus.fast_regions(), cur, remaining, true)
+            {
+                region.ram.borrow_mut().data_mut()[offset..offset + len]
+                    .copy_from_slice(&data[pos..pos + len]);
+                pos += len;
+            } else if cur % 4 == 0 && remaining >= 4 {
+                let word = u32::from_le_bytes(data[pos..pos + 4].try_into().unwrap());
+                self.mcu_cpu.bus.write(RvSize::Word, cur, word)?;
+                pos += 4;
+            } else {
+                self.mcu_cpu
+                    .bus
+                    .write(RvSize::Byte, cur, data[pos] as u32)?;
+                pos += 1;
+            }
+        }
+        Ok(())
+    }
+}
+
+/// Find the fast region containing `addr` and return it with the offset into its RAM and
+/// how many of the `len` bytes it can serve.
+fn fast_span(
+    regions: &[AutoRootBusFastRegion],
+    addr: u32,
+    len: usize,
+    write: bool,
+) -> Option<(&AutoRootBusFastRegion, usize, usize)> {
+    let region = regions
+        .iter()
+        .find(|region| addr.wrapping_sub(region.start) < region.len)?;
+    if write && !region.writable {
+        return None;
+    }
+    let offset = (addr - region.start) as usize;
+    let end = (region.len as usize).min(region.ram.borrow().len() as usize);
+    if offset >= end {
+        return None;
+    }
+    Some((region, offset, len.min(end - offset)))
+}
+
+/// Returns true if `cpu` has an enabled interrupt pending, which takes it out of `wfi`.
+fn interrupt_pending<TBus: Bus>(cpu: &Cpu<TBus>) -> bool {
+    let csr = |addr| cpu.read_csr_machine(addr).unwrap_or(0);
+    csr(CSR_MIP) & csr(CSR_MIE) != 0
+}
+
+/// Architectural state of `cpu` for a snapshot.
+fn cpu_snapshot<TBus: Bus>(cpu: &Cpu<TBus>) -> CpuSnapshot {
+    CpuSnapshot {
+        cycle: cpu.clock.now(),
+        pc: cpu.read_pc(),
+        xregs: std::array::from_fn(|idx| cpu.read_xreg(XReg::from(idx as u16)).unwrap()),
+        csrs: SNAPSHOT_CSRS
+            .iter()
+            .filter_map(|addr| Some((*addr, cpu.read_csr_machine(*addr).ok()?)))
+            .collect(),
+    }
 }
 
-fn disassemble(pc: u32, instr: u32) -> String {
-    let mut out = vec![];
-    // TODO: we should replace this with something more efficient.
-    let dis = dis::disasm_inst(dis::RvIsa::Rv32, pc as u64, instr as u64);
-    write!(&mut out, "0x{:08x}   {}", pc, dis).unwrap();
+/// Load `saved` into `cpu`. The CSRs must have been checked to exist on `cpu`.
+fn restore_cpu<TBus: Bus>(cpu: &mut Cpu<TBus>, saved: &CpuSnapshot) -> io::Result<()> {
+    // x0 is hardwired to zero
+    for idx in 1..XREG_COUNT {
+        cpu.write_xreg(XReg::from(idx as u16), saved.xregs[idx])
+            .unwrap();
+    }
+    for (addr, value) in saved.csrs.iter() {
+        cpu.write_csr_machine(*addr, *value).map_err(|err| {
+            io::Error::new(
+                io::ErrorKind::InvalidInput,
+                format!("failed to restore CSR {addr:#x}: {err:?}"),
+            )
+        })?;
+    }
+    cpu.write_pc(saved.pc);
+    Ok(())
+}
 
-    String::from_utf8(out).unwrap()
+fn is_wfi(instr: &RvInstr) -> bool {
+    matches!(instr, RvInstr::Instr32(WFI_INSTR))
+}
+
+fn trace_record(core: TraceCore, cycle: u64, pc: u32, instr: RvInstr) -> TraceRecord {
+    let (instr, compressed) = match instr {
+        RvInstr::Instr32(instr32) => (instr32, false),
+        RvInstr::Instr16(instr16) => (instr16 as u32, true),
+    };
+    TraceRecord {
+        core,
+        cycle,
+        pc,
+        instr,
+        compressed,
+    }
+}
+
+fn is_fence(instr: &RvInstr) -> bool {
+    matches!(instr, RvInstr::Instr32(instr32) if instr32 & 0x7f == MISC_MEM_OPCODE)
 }
 
 fn read_console(stdin_uart: Option<Arc<Mutex<Option<u8>>>>) {
@@ -1107,33 +2015,103 @@ fn read_console(stdin_uart: Option<Arc<Mutex<Option<u8>>>>) {
     }
 }
 
-fn read_binary(path: &PathBuf, expect_load_addr: u32) -> io::Result<Vec<u8>> {
-    let mut file = File::open(path)?;
-    let mut buffer = Vec::new();
-    file.read_to_end(&mut buffer)?;
-
-    // Check if this is an ELF
-    if buffer.starts_with(&[0x7f, 0x45, 0x4c, 0x46]) {
-        println!("Loading ELF executable {}", path.display());
-        let elf = elf::ElfExecutable::new(&buffer).unwrap();
-        if elf.load_addr() != expect_load_addr {
-            Err(io::Error::new(
-                io::ErrorKind::InvalidInput,
-                format!(
-                    "ELF executable has non-0x{:x} load address, which is not supported (got 0x{:x})",
-                    expect_load_addr, elf.load_addr()
-                ),
-            ))?;
+impl Drop for Emulator {
+    fn drop(&mut self) {
+        // posted writes must reach the device even if nothing flushed them yet
+        self.external_bus.flush();
+        if self.bus_stats_log.is_some() {
+            self.dump_bus_stats();
         }
-        // TBF files have an entry point offset by 0x20
-        if elf.entry_point() != expect_load_addr && elf.entry_point() != elf.load_addr() + 0x20 {
-            Err(io::Error::new(
-                io::ErrorKind::InvalidInput,
-                format!("ELF executable has non-0x{:x} entry point, which is not supported (got 0x{:x})", expect_load_addr, elf.entry_point()),
-            ))?;
+        if let Some(log) = self.lockstep_log.as_ref() {
+            log.borrow_mut().finish();
+        }
+        if let Some(stats) = self.time_warp_stats() {
+            println!(
+                "Time warp skipped {} cycles in {} warps",
+                stats.cycles, stats.warps
+            );
+        }
+        if let Some(recorder) = self.input_recorder.as_ref() {
+            recorder.borrow_mut().finish();
+        }
+        if let Some(replay) = self.input_replay.as_ref() {
+            replay.borrow().finish();
+        }
+        self.running.store(false, Ordering::Relaxed);
+        if self.i3c_controller_join_handle.is_some() {
+            let i3c_stats = self.i3c_socket_stats.snapshot();
+            if i3c_stats.commands > 0 {
+                println!("I3C socket: {}", i3c_stats);
+            }
+        }
+        if let (Some(profiler), Some(path)) = (self.profiler.as_ref(), self.profile_output.as_ref())
+        {
+            match profiler.save_folded(path) {
+                Ok(()) => println!("Wrote profile to {}", path.display()),
+                Err(err) => println!("Failed to write profile to {}: {}", path.display(), err),
+            }
         }
-        buffer = elf.content().clone();
     }
+}
 
-    Ok(buffer)
+/// Create the profiler for `--profile`, symbolized with every ELF input of each core.
+fn create_profiler(cli: &EmulatorArgs) -> io::Result<Profiler> {
+    let mut profiler = Profiler::new(cli.profile_interval);
+    let mcu_elfs = [&cli.rom, &cli.firmware]
+        .into_iter()
+        .filter(|path| is_elf(path))
+        .chain(cli.profile_mcu_elf.iter());
+    for path in mcu_elfs {
+        profiler.add_elf_symbols(TraceCore::Mcu, path)?;
+    }
+    let caliptra_elfs = [&cli.caliptra_rom, &cli.caliptra_firmware]
+        .into_iter()
+        .filter(|path| is_elf(path))
+        .chain(cli.profile_caliptra_elf.iter());
+    for path in caliptra_elfs {
+        profiler.add_elf_symbols(TraceCore::Caliptra, path)?;
+    }
+    Ok(profiler)
+}
+
+fn is_elf(path: &Path) -> bool {
+    let mut magic = [0u8; 4];
+    File::open(path)
+        .and_then(|mut file| file.read_exact(&mut magic))
+        .is_ok()
+        && magic == [0x7f, 0x45, 0x4c, 0x46]
+}
+
+fn read_binary(path: &PathBuf, expect_load_addr: u32) -> io::Result<Vec<u8>> {
+    // Raw binaries are read straight into the buffer the caller keeps
+    if !is_elf(path) {
+        return std::fs::read(path);
+    }
+
+    // ELF files are parsed straight out of the mapping without copying the whole file
+    println!("Loading ELF executable {}", path.display());
+    let image = MappedImage::open(path)?;
+    let elf = elf::ElfExecutable::new(&image).unwrap();
+    if elf.load_addr() != expect_load_addr {
+        Err(io::Error::new(
+            io::ErrorKind::InvalidInput,
+            format!(
+                "ELF executable has non-0x{:x} load address, which is not supported (got 0x{:x})",
+                expect_load_addr,
+                elf.load_addr()
+            ),
+        ))?;
+    }
+    // TBF files have an entry point offset by 0x20
+    if elf.entry_point() != expect_load_addr && elf.entry_point() != elf.load_addr() + 0x20 {
+        Err(io::Error::new(
+            io::ErrorKind::InvalidInput,
+            format!(
+                "ELF executable has non-0x{:x} entry point, which is not supported (got 0x{:x})",
+                expect_load_addr,
+                elf.entry_point()
+            ),
+        ))?;
+    }
+    Ok(elf.into_content())
 }
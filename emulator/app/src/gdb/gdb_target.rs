@@ -101,6 +101,9 @@ impl GdbTarget {
                             }
                         }
                         SystemStepAction::Break => {
+                            if let Some(code) = self.emulator.exit_code() {
+                                return SingleThreadStopReason::Exited(code as u8);
+                            }
                             let watch = self.emulator.mcu_cpu.get_watchptr_hit().unwrap();
                             return SingleThreadStopReason::Watch {
                                 tid: (),
@@ -0,0 +1,477 @@
+/*++
+
+Licensed under the Apache-2.0 license.
+
+File Name:
+
+    input_log.rs
+
+Abstract:
+
+    File contains the recording and replay of the inputs the emulator takes from
+    outside the emulated system.
+
+--*/
+
+use caliptra_emu_types::RvSize;
+use mcu_testing_common::i3c::{I3cTcriCommand, I3cTcriCommandXfer};
+use mcu_testing_common::lockstep::{read_leb128, write_leb128};
+use std::collections::VecDeque;
+use std::fs::File;
+use std::io::{self, BufReader, BufWriter, ErrorKind, Read, Write};
+use std::path::{Path, PathBuf};
+
+const MAGIC: &[u8; 8] = b"MCUINPT\x01";
+
+const TAG_UART_RX: u8 = 0;
+const TAG_I3C_COMMAND: u8 = 1;
+const TAG_EXTERNAL_READ: u8 = 2;
+const TAG_EXTERNAL_READ_FAULT: u8 = 3;
+
+/// An input from outside the emulated system.
+///
+/// Inputs are logged at the MCU cycle of the emulator step they are delivered in.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub enum InputEvent {
+    /// A byte for the MCU UART RX, from the console or `emulator_send_uart_char`
+    UartRx(u8),
+    /// A command the MCU I3C target took from the I3C socket: the raw command
+    /// descriptor and the data
+    I3cCommand { desc: u64, data: Vec<u8> },
+    /// The result of an external bus read callback; `val` is `None` if the read faulted
+    ExternalRead {
+        size: u8,
+        addr: u32,
+        val: Option<u32>,
+    },
+}
+
+impl InputEvent {
+    pub fn i3c_command(xfer: &I3cTcriCommandXfer) -> Self {
+        Self::I3cCommand {
+            desc: u64::from(xfer.cmd.clone()),
+            data: xfer.data.clone(),
+        }
+    }
+
+    /// The I3C transfer of an `I3cCommand`, `None` for other events or a descriptor
+    /// that is not a valid command.
+    pub fn i3c_xfer(&self) -> Option<I3cTcriCommandXfer> {
+        match self {
+            Self::I3cCommand { desc, data } => Some(I3cTcriCommandXfer {
+                cmd: I3cTcriCommand::try_from([*desc as u32, (*desc >> 32) as u32]).ok()?,
+                data: data.clone(),
+            }),
+            _ => None,
+        }
+    }
+}
+
+/// Size in bytes of an access of `size`, 0 if it is not a valid size.
+pub fn size_in_bytes(size: RvSize) -> u8 {
+    match size {
+        RvSize::Byte => 1,
+        RvSize::HalfWord => 2,
+        RvSize::Word => 4,
+        _ => 0,
+    }
+}
+
+/// Writes an input log.
+///
+/// The format is a magic followed by records. Each record starts with a tag byte, whose
+/// high nibble is the access size of external reads, and the cycle as a LEB128 delta
+/// from the previous record. UART inputs then have the byte; I3C commands the 8 byte
+/// descriptor, the LEB128 data length and the data; external reads the address and,
+/// unless the read faulted, the value.
+pub struct InputWriter<W: Write> {
+    out: W,
+    last_cycle: u64,
+}
+
+impl<W: Write> InputWriter<W> {
+    pub fn new(mut out: W) -> io::Result<Self> {
+        out.write_all(MAGIC)?;
+        Ok(Self { out, last_cycle: 0 })
+    }
+
+    pub fn record(&mut self, cycle: u64, event: &InputEvent) -> io::Result<()> {
+        let tag = match *event {
+            InputEvent::UartRx(_) => TAG_UART_RX,
+            InputEvent::I3cCommand { .. } => TAG_I3C_COMMAND,
+            InputEvent::ExternalRead { size, val, .. } => {
+                if size > 0xf {
+                    return Err(io::Error::new(
+                        ErrorKind::InvalidInput,
+                        "access size too large",
+                    ));
+                }
+                let tag = if val.is_some() {
+                    TAG_EXTERNAL_READ
+                } else {
+                    TAG_EXTERNAL_READ_FAULT
+                };
+                tag | size << 4
+            }
+        };
+        let delta = cycle.saturating_sub(self.last_cycle);
+        self.last_cycle = cycle;
+
+        self.out.write_all(&[tag])?;
+        write_leb128(&mut self.out, delta)?;
+        match event {
+            InputEvent::UartRx(byte) => self.out.write_all(&[*byte])?,
+            InputEvent::I3cCommand { desc, data } => {
+                self.out.write_all(&desc.to_le_bytes())?;
+                write_leb128(&mut self.out, data.len() as u64)?;
+                self.out.write_all(data)?;
+            }
+            InputEvent::ExternalRead { addr, val, .. } => {
+                self.out.write_all(&addr.to_le_bytes())?;
+                if let Some(val) = val {
+                    self.out.write_all(&val.to_le_bytes())?;
+                }
+            }
+        }
+        Ok(())
+    }
+
+    pub fn flush(&mut self) -> io::Result<()> {
+        self.out.flush()
+    }
+}
+
+/// Reads the records of an input log as `(cycle, event)`.
+pub struct InputReader<R: Read> {
+    input: R,
+    cycle: u64,
+    done: bool,
+}
+
+impl<R: Read> InputReader<R> {
+    pub fn new(mut input: R) -> io::Result<Self> {
+        let mut magic = [0u8; 8];
+        input.read_exact(&mut magic)?;
+        if &magic != MAGIC {
+            return Err(io::Error::new(ErrorKind::InvalidData, "not an input log"));
+        }
+        Ok(Self {
+            input,
+            cycle: 0,
+            done: false,
+        })
+    }
+
+    fn read_u32(&mut self) -> io::Result<u32> {
+        let mut buf = [0u8; 4];
+        self.input.read_exact(&mut buf)?;
+        Ok(u32::from_le_bytes(buf))
+    }
+
+    fn read_record(&mut self, tag: u8) -> io::Result<(u64, InputEvent)> {
+        self.cycle += read_leb128(&mut self.input)?;
+        let event = match tag & 0xf {
+            TAG_UART_RX => {
+                let mut byte = [0u8; 1];
+                self.input.read_exact(&mut byte)?;
+                InputEvent::UartRx(byte[0])
+            }
+            TAG_I3C_COMMAND => {
+                let mut desc = [0u8; 8];
+                self.input.read_exact(&mut desc)?;
+                let len = read_leb128(&mut self.input)?;
+                let mut data = vec![];
+                (&mut self.input).take(len).read_to_end(&mut data)?;
+                if data.len() as u64 != len {
+                    return Err(ErrorKind::UnexpectedEof.into());
+                }
+                let event = InputEvent::I3cCommand {
+                    desc: u64::from_le_bytes(desc),
+                    data,
+                };
+                if event.i3c_xfer().is_none() {
+                    return Err(io::Error::new(
+                        ErrorKind::InvalidData,
+                        "invalid I3C command descriptor",
+                    ));
+                }
+                event
+            }
+            TAG_EXTERNAL_READ => InputEvent::ExternalRead {
+                size: tag >> 4,
+                addr: self.read_u32()?,
+                val: Some(self.read_u32()?),
+            },
+            TAG_EXTERNAL_READ_FAULT => InputEvent::ExternalRead {
+                size: tag >> 4,
+                addr: self.read_u32()?,
+                val: None,
+            },
+            _ => {
+                return Err(io::Error::new(
+                    ErrorKind::InvalidData,
+                    format!("unknown input record tag {tag:#x}"),
+                ))
+            }
+        };
+        Ok((self.cycle, event))
+    }
+}
+
+impl<R: Read> Iterator for InputReader<R> {
+    type Item = io::Result<(u64, InputEvent)>;
+
+    fn next(&mut self) -> Option<Self::Item> {
+        if self.done {
+            return None;
+        }
+        let mut tag = [0u8; 1];
+        let result = match self.input.read(&mut tag) {
+            Ok(0) => {
+                self.done = true;
+                return None;
+            }
+            Ok(_) => self.read_record(tag[0]),
+            Err(e) => Err(e),
+        };
+        if result.is_err() {
+            self.done = true;
+        }
+        Some(result)
+    }
+}
+
+/// Input log written with `--record-inputs`.
+///
+/// Writing stops at the first error, which is reported when the log is finished.
+pub struct InputRecorder {
+    writer: InputWriter<BufWriter<File>>,
+    path: PathBuf,
+    /// MCU cycle at the start of the current emulator step
+    step_cycle: u64,
+    events: u64,
+    error: Option<io::Error>,
+}
+
+impl InputRecorder {
+    pub fn create(path: &Path) -> io::Result<Self> {
+        Ok(Self {
+            writer: InputWriter::new(BufWriter::new(File::create(path)?))?,
+            path: path.to_path_buf(),
+            step_cycle: 0,
+            events: 0,
+            error: None,
+        })
+    }
+
+    pub fn begin_step(&mut self, cycle: u64) {
+        self.step_cycle = cycle;
+    }
+
+    pub fn record(&mut self, cycle: u64, event: &InputEvent) {
+        if self.error.is_none() {
+            self.events += 1;
+            if let Err(err) = self.writer.record(cycle, event) {
+                self.error = Some(err);
+            }
+        }
+    }
+
+    /// Record `event` at the start of the current step, for inputs the peripherals pick
+    /// up while the cores step.
+    pub fn record_in_step(&mut self, event: &InputEvent) {
+        self.record(self.step_cycle, event);
+    }
+
+    /// Flush the log and report the first error that stopped it, if any.
+    pub fn finish(&mut self) {
+        let result = match self.error.take() {
+            Some(err) => Err(err),
+            None => self.writer.flush(),
+        };
+        match result {
+            Ok(()) => println!("Recorded {} inputs to {}", self.events, self.path.display()),
+            Err(err) => println!(
+                "Failed to record inputs to {}: {}",
+                self.path.display(),
+                err
+            ),
+        }
+    }
+}
+
+/// Input log replayed with `--replay-inputs`.
+///
+/// UART and I3C inputs are handed out at the start of the step at their cycle. External
+/// reads are answered in order; a read that does not match the log, or an input that
+/// comes due after its cycle, means the run took another path than the recorded one,
+/// which is reported once.
+pub struct InputReplay {
+    path: PathBuf,
+    /// MCU cycle at the start of the current emulator step
+    step_cycle: u64,
+    timed: VecDeque<(u64, InputEvent)>,
+    external_reads: VecDeque<(u64, InputEvent)>,
+    delivered: u64,
+    diverged: bool,
+}
+
+impl InputReplay {
+    pub fn open(path: &Path) -> io::Result<Self> {
+        let reader = InputReader::new(BufReader::new(File::open(path)?))?;
+        let mut timed = VecDeque::new();
+        let mut external_reads = VecDeque::new();
+        for record in reader {
+            let record = record?;
+            match record.1 {
+                InputEvent::ExternalRead { .. } => external_reads.push_back(record),
+                _ => timed.push_back(record),
+            }
+        }
+        Ok(Self {
+            path: path.to_path_buf(),
+            step_cycle: 0,
+            timed,
+            external_reads,
+            delivered: 0,
+            diverged: false,
+        })
+    }
+
+    fn diverge(&mut self, what: impl FnOnce() -> String) {
+        if !self.diverged {
+            self.diverged = true;
+            println!(
+                "Input replay diverged from {} at cycle {}: {}",
+                self.path.display(),
+                self.step_cycle,
+                what()
+            );
+        }
+    }
+
+    /// Returns the next UART or I3C input due at the step starting at `cycle`.
+    pub fn next_due(&mut self, cycle: u64) -> Option<InputEvent> {
+        self.step_cycle = cycle;
+        if self.timed.front()?.0 > cycle {
+            return None;
+        }
+        let (due, event) = self.timed.pop_front()?;
+        if due < cycle {
+            self.diverge(|| format!("input due at cycle {due} delivered late"));
+        }
+        self.delivered += 1;
+        Some(event)
+    }
+
+    /// Returns the result of the external read of `size` bytes at `addr`, `None` if it
+    /// faults.
+    pub fn external_read(&mut self, size: u8, addr: u32) -> Option<u32> {
+        let Some((cycle, event)) = self.external_reads.pop_front() else {
+            self.diverge(|| format!("external read of {addr:#010x} not in the log"));
+            return None;
+        };
+        self.delivered += 1;
+        match event {
+            InputEvent::ExternalRead {
+                size: s,
+                addr: a,
+                val,
+            } if s == size && a == addr => {
+                if cycle != self.step_cycle {
+                    self.diverge(|| format!("external read of {addr:#010x} logged at {cycle}"));
+                }
+                val
+            }
+            event => {
+                self.diverge(|| format!("external read of {addr:#010x}, logged {event:x?}"));
+                None
+            }
+        }
+    }
+
+    pub fn finish(&self) {
+        let left = self.timed.len() + self.external_reads.len();
+        println!(
+            "Replayed {} inputs from {}, {} left",
+            self.delivered,
+            self.path.display(),
+            left
+        );
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn sample_log() -> Vec<(u64, InputEvent)> {
+        vec![
+            (10, InputEvent::UartRx(b'a')),
+            (
+                12,
+                InputEvent::ExternalRead {
+                    size: 4,
+                    addr: 0xb000_0000,
+                    val: Some(0x1234_5678),
+                },
+            ),
+            (
+                12,
+                InputEvent::ExternalRead {
+                    size: 1,
+                    addr: 0xb000_0004,
+                    val: None,
+                },
+            ),
+            (
+                300_000,
+                // immediate transfer with a data byte
+                InputEvent::I3cCommand {
+                    desc: 0x0000_0055_0000_0001,
+                    data: vec![],
+                },
+            ),
+            (
+                300_001,
+                // regular transfer of 3 bytes
+                InputEvent::I3cCommand {
+                    desc: 0x0003_0000_0000_0000,
+                    data: vec![1, 2, 3],
+                },
+            ),
+        ]
+    }
+
+    #[test]
+    fn test_round_trip() {
+        let mut writer = InputWriter::new(vec![]).unwrap();
+        for (cycle, event) in sample_log() {
+            writer.record(cycle, &event).unwrap();
+        }
+        let encoded = writer.out;
+        // the magic, then the UART input in 3 bytes
+        assert_eq!(encoded[8..11], [TAG_UART_RX, 10, b'a']);
+        let records: Vec<_> = InputReader::new(&encoded[..])
+            .unwrap()
+            .collect::<io::Result<_>>()
+            .unwrap();
+        assert_eq!(records, sample_log());
+
+        // truncated log
+        let result: io::Result<Vec<_>> = InputReader::new(&encoded[..encoded.len() - 1])
+            .unwrap()
+            .collect();
+        assert!(result.is_err());
+        assert!(InputReader::new(&b"MCULOCK\x01"[..]).is_err());
+    }
+
+    #[test]
+    fn test_i3c_xfer() {
+        let event = &sample_log()[4].1;
+        let xfer = event.i3c_xfer().unwrap();
+        assert_eq!(xfer.data, [1, 2, 3]);
+        assert_eq!(&InputEvent::i3c_command(&xfer), event);
+        assert!(InputEvent::UartRx(0).i3c_xfer().is_none());
+    }
+}
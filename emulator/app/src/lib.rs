@@ -12,12 +12,24 @@ Abstract:
 
 --*/
 
+pub mod bus_stats;
 pub mod dis;
+pub mod dis_cache;
 pub mod dis_test;
 pub mod doe_mbox_fsm;
 pub mod elf;
 pub mod emulator;
 pub mod gdb;
+pub mod input_log;
+pub mod lockstep;
+pub mod memory_map;
+pub mod profile;
+pub mod snapshot;
 pub mod tests;
+pub mod time_warp;
+pub mod trace;
+pub mod trace_thread;
 
 pub use emulator::{Emulator, EmulatorArgs, ExternalReadCallback, ExternalWriteCallback};
+pub use memory_map::{MemoryMap, MemoryMapOverrides};
+pub use snapshot::EmulatorSnapshot;
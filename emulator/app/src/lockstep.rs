@@ -0,0 +1,120 @@
+/*++
+
+Licensed under the Apache-2.0 license.
+
+File Name:
+
+    lockstep.rs
+
+Abstract:
+
+    File contains the recording of the lockstep log of MCU peripheral accesses and
+    checkpoints.
+
+--*/
+
+use caliptra_emu_types::RvSize;
+use emulator_registers_generated::root_bus::{AutoRootBus, AutoRootBusAccess};
+use mcu_testing_common::lockstep::{LockstepRecord, LockstepWriter};
+use std::fs::File;
+use std::io::{self, BufWriter};
+use std::path::{Path, PathBuf};
+
+/// Default number of cycles between two checkpoints of `--lockstep-log`.
+pub const DEFAULT_CHECKPOINT_INTERVAL: u64 = 10_000;
+
+/// Lockstep log written with `--lockstep-log`, see [`mcu_testing_common::lockstep`].
+///
+/// Records every access to the MCU peripherals and to the Caliptra and external buses,
+/// and a checkpoint of the MCU PC and registers every `interval` cycles. Accesses to
+/// SRAM, DCCM and ROM are not recorded. Writing stops at the first error, which is
+/// reported when the log is finished.
+pub struct LockstepLog {
+    writer: LockstepWriter<BufWriter<File>>,
+    path: PathBuf,
+    interval: u64,
+    next_checkpoint: u64,
+    error: Option<io::Error>,
+}
+
+impl LockstepLog {
+    /// Create the log at `path`, taking a checkpoint every `interval` cycles (0 to only
+    /// record accesses).
+    pub fn create(path: &Path, interval: u64) -> io::Result<Self> {
+        Ok(Self {
+            writer: LockstepWriter::new(BufWriter::new(File::create(path)?))?,
+            path: path.to_path_buf(),
+            interval,
+            next_checkpoint: 0,
+            error: None,
+        })
+    }
+
+    /// Returns true if an access to the root bus target `target` is recorded.
+    ///
+    /// The first delegate is the MCU root bus, whose accesses that miss the fast regions
+    /// are memory or emulator-only devices.
+    pub fn records_target(target: usize) -> bool {
+        target != AutoRootBus::PERIPHERALS.len()
+    }
+
+    pub fn record_access(&mut self, cycle: u64, access: &AutoRootBusAccess) {
+        let size = match access.size {
+            RvSize::Byte => 1,
+            RvSize::HalfWord => 2,
+            RvSize::Word => 4,
+            _ => 0,
+        };
+        let record = match access.val {
+            Some(val) if access.write => LockstepRecord::Write {
+                cycle,
+                size,
+                addr: access.addr,
+                val,
+            },
+            val => LockstepRecord::Read {
+                cycle,
+                size,
+                addr: access.addr,
+                val,
+            },
+        };
+        self.record(&record);
+    }
+
+    /// Returns true if the periodic checkpoint is due at `cycle`.
+    #[inline]
+    pub fn checkpoint_due(&self, cycle: u64) -> bool {
+        self.interval != 0 && cycle >= self.next_checkpoint
+    }
+
+    /// Record a checkpoint at `cycle` and schedule the next one.
+    pub fn checkpoint(&mut self, cycle: u64, pc: u32, xregs: [u32; 32]) {
+        self.record(&LockstepRecord::Checkpoint { cycle, pc, xregs });
+        self.next_checkpoint = cycle - cycle % self.interval + self.interval;
+    }
+
+    fn record(&mut self, record: &LockstepRecord) {
+        if self.error.is_none() {
+            if let Err(err) = self.writer.record(record) {
+                self.error = Some(err);
+            }
+        }
+    }
+
+    /// Flush the log and report the first error that stopped it, if any.
+    pub fn finish(&mut self) {
+        let result = match self.error.take() {
+            Some(err) => Err(err),
+            None => self.writer.flush(),
+        };
+        match result {
+            Ok(()) => println!("Wrote lockstep log to {}", self.path.display()),
+            Err(err) => println!(
+                "Failed to write lockstep log to {}: {}",
+                self.path.display(),
+                err
+            ),
+        }
+    }
+}
@@ -19,10 +19,11 @@ use mcu_testing_common::MCU_RUNNING;
 use std::cell::RefCell;
 use std::io;
 use std::io::IsTerminal;
+use std::process::exit;
 use std::rc::Rc;
 
 // CPU Main Loop (free_run no GDB)
-fn free_run(mut emulator: Emulator) {
+fn free_run(mut emulator: Emulator) -> Option<u32> {
     while MCU_RUNNING.load(std::sync::atomic::Ordering::Relaxed) {
         match emulator.step() {
             StepAction::Break => break,
@@ -30,6 +31,7 @@ fn free_run(mut emulator: Emulator) {
             _ => {}
         }
     }
+    emulator.exit_code()
 }
 
 fn main() -> io::Result<()> {
@@ -55,18 +57,24 @@ fn run(cli: EmulatorArgs, capture_uart_output: bool) -> io::Result<Vec<u8>> {
     let emulator = Emulator::from_args(cli.clone(), capture_uart_output)?;
 
     // Check if Optional GDB Port is passed
-    match cli.gdb_port {
+    let exit_code = match cli.gdb_port {
         Some(port) => {
             // Create GDB Target Instance
             let mut gdb_target = gdb::gdb_target::GdbTarget::new(emulator);
 
             // Execute CPU through GDB State Machine
             gdb::gdb_state::wait_for_gdb_run(&mut gdb_target, port);
+            gdb_target.emulator().exit_code()
         }
         _ => {
             // Create the emulator with all the setup
-            free_run(emulator);
+            free_run(emulator)
         }
+    };
+
+    // The firmware requested an exit through the emulator control register
+    if let Some(code) = exit_code {
+        exit(code as i32);
     }
 
     Ok(uart_output.map(|o| o.borrow().clone()).unwrap_or_default())
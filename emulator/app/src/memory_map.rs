@@ -0,0 +1,424 @@
+/*++
+
+Licensed under the Apache-2.0 license.
+
+File Name:
+
+    memory_map.rs
+
+Abstract:
+
+    File contains the named memory map profiles of the emulator and their overrides.
+
+--*/
+
+use clap::Args;
+use clap_num::maybe_hex;
+use emulator_periph::McuRootBusOffsets;
+use emulator_registers_generated::root_bus::AutoRootBusOffsets;
+use mcu_config::McuMemoryMap;
+use mcu_config_emulator::EMULATOR_MEMORY_MAP;
+use mcu_config_fpga::FPGA_MEMORY_MAP;
+use serde::Deserialize;
+use std::io;
+use std::path::Path;
+
+/// Built-in profiles accepted by [`MemoryMap::profile`].
+pub const PROFILES: [&str; 3] = ["default", "emulator", "fpga"];
+
+/// Where every peripheral and memory of the MCU is mapped.
+///
+/// A map is built once, from a profile or a TOML file, validated and can then be shared by
+/// any number of emulators through an `Arc`.
+#[derive(Clone, Debug, Default)]
+pub struct MemoryMap {
+    pub mcu: McuRootBusOffsets,
+    pub auto: AutoRootBusOffsets,
+}
+
+impl MemoryMap {
+    /// The built-in profile called `name`:
+    ///
+    /// * `default` - the emulator's own defaults
+    /// * `emulator` - the layout the emulator platform firmware is linked for
+    /// * `fpga` - the layout of the FPGA platform
+    pub fn profile(name: &str) -> Option<Self> {
+        match name {
+            "default" => Some(Self::default()),
+            "emulator" => Some(Self::default().with_mcu_memory_map(&EMULATOR_MEMORY_MAP)),
+            "fpga" => Some(Self::default().with_mcu_memory_map(&FPGA_MEMORY_MAP)),
+            _ => None,
+        }
+    }
+
+    /// A profile name or the path of a TOML memory map file, see [`MemoryMap::from_toml`].
+    pub fn from_spec(spec: &str) -> io::Result<Self> {
+        match Self::profile(spec) {
+            Some(map) => Ok(map),
+            None => Self::load(Path::new(spec)),
+        }
+    }
+
+    /// Load the TOML memory map file at `path`.
+    pub fn load(path: &Path) -> io::Result<Self> {
+        Self::from_toml(&std::fs::read_to_string(path)?)
+    }
+
+    /// Parse and validate a TOML memory map: an optional `profile` to start from
+    /// (`default` if absent) and any of the region overrides of the command line, e.g.
+    ///
+    /// ```toml
+    /// profile = "fpga"
+    /// sram_size = 0x100000
+    /// ```
+    pub fn from_toml(text: &str) -> io::Result<Self> {
+        let mut table: toml::Table = toml::from_str(text).map_err(invalid_data)?;
+        let profile = match table.remove("profile") {
+            Some(toml::Value::String(profile)) => profile,
+            Some(_) => return Err(invalid_data("profile must be a string")),
+            None => "default".into(),
+        };
+        let base = Self::profile(&profile)
+            .ok_or_else(|| invalid_data(format!("unknown memory map profile {}", profile)))?;
+        let overrides: MemoryMapOverrides =
+            toml::Value::Table(table).try_into().map_err(invalid_data)?;
+        let map = base.with_overrides(&overrides);
+        map.validate().map_err(invalid_data)?;
+        Ok(map)
+    }
+
+    /// Move the regions described by a platform memory map.
+    pub fn with_mcu_memory_map(mut self, map: &McuMemoryMap) -> Self {
+        self.mcu.rom_offset = map.rom_offset;
+        self.mcu.rom_size = map.rom_size;
+        self.mcu.ram_offset = map.sram_offset;
+        self.mcu.ram_size = map.sram_size;
+        self.mcu.rom_dedicated_ram_offset = map.dccm_offset;
+        self.mcu.rom_dedicated_ram_size = map.dccm_size;
+        self.mcu.pic_offset = map.pic_offset;
+        self.auto.el2_pic_offset = map.pic_offset;
+        self.auto.i3c_offset = map.i3c_offset;
+        self.auto.i3c_size = map.i3c_size;
+        self.auto.mci_offset = map.mci_offset;
+        self.auto.mci_size = map.mci_size;
+        self.auto.mbox_offset = map.mbox_offset;
+        self.auto.mbox_size = map.mbox_size;
+        self.auto.soc_offset = map.soc_offset;
+        self.auto.soc_size = map.soc_size;
+        self.auto.otp_offset = map.otp_offset;
+        self.auto.otp_size = map.otp_size;
+        self.auto.lc_offset = map.lc_offset;
+        self.auto.lc_size = map.lc_size;
+        self
+    }
+
+    /// Apply the regions set in `overrides`.
+    pub fn with_overrides(mut self, overrides: &MemoryMapOverrides) -> Self {
+        let o = overrides;
+        let (mcu, auto) = (&mut self.mcu, &mut self.auto);
+        for (value, dst) in [
+            (o.rom_offset, &mut mcu.rom_offset),
+            (o.rom_size, &mut mcu.rom_size),
+            (o.uart_offset, &mut mcu.uart_offset),
+            (o.uart_size, &mut mcu.uart_size),
+            (o.ctrl_offset, &mut mcu.ctrl_offset),
+            (o.ctrl_size, &mut mcu.ctrl_size),
+            (o.sram_offset, &mut mcu.ram_offset),
+            (o.sram_size, &mut mcu.ram_size),
+            (o.pic_offset, &mut mcu.pic_offset),
+            (o.pic_offset, &mut auto.el2_pic_offset),
+            (
+                o.external_test_sram_offset,
+                &mut mcu.external_test_sram_offset,
+            ),
+            (o.external_test_sram_size, &mut mcu.external_test_sram_size),
+            (o.dccm_offset, &mut mcu.rom_dedicated_ram_offset),
+            (o.dccm_size, &mut mcu.rom_dedicated_ram_size),
+            (o.i3c_offset, &mut auto.i3c_offset),
+            (o.i3c_size, &mut auto.i3c_size),
+            (o.primary_flash_offset, &mut auto.primary_flash_offset),
+            (o.primary_flash_size, &mut auto.primary_flash_size),
+            (o.secondary_flash_offset, &mut auto.secondary_flash_offset),
+            (o.secondary_flash_size, &mut auto.secondary_flash_size),
+            (o.mci_offset, &mut auto.mci_offset),
+            (o.mci_size, &mut auto.mci_size),
+            (o.dma_offset, &mut auto.axicdma_offset),
+            (o.dma_size, &mut auto.axicdma_size),
+            (o.mbox_offset, &mut auto.mbox_offset),
+            (o.mbox_size, &mut auto.mbox_size),
+            (o.soc_offset, &mut auto.soc_offset),
+            (o.soc_size, &mut auto.soc_size),
+            (o.otp_offset, &mut auto.otp_offset),
+            (o.otp_size, &mut auto.otp_size),
+            (o.lc_offset, &mut auto.lc_offset),
+            (o.lc_size, &mut auto.lc_size),
+        ] {
+            if let Some(value) = value {
+                *dst = value;
+            }
+        }
+        self
+    }
+
+    /// The regions decoded by the root buses, as (name, offset, size).
+    ///
+    /// The external test SRAM is left out: it sits behind the ROM on the bus and the
+    /// platform layouts place the ROM on top of it.
+    fn regions(&self) -> [(&'static str, u32, u32); 18] {
+        let (mcu, auto) = (&self.mcu, &self.auto);
+        [
+            ("rom", mcu.rom_offset, mcu.rom_size),
+            ("uart", mcu.uart_offset, mcu.uart_size),
+            ("ctrl", mcu.ctrl_offset, mcu.ctrl_size),
+            ("sram", mcu.ram_offset, mcu.ram_size),
+            (
+                "dccm",
+                mcu.rom_dedicated_ram_offset,
+                mcu.rom_dedicated_ram_size,
+            ),
+            (
+                "direct_read_flash",
+                mcu.direct_read_flash_offset,
+                mcu.direct_read_flash_size,
+            ),
+            ("pic", auto.el2_pic_offset, auto.el2_pic_size),
+            ("i3c", auto.i3c_offset, auto.i3c_size),
+            (
+                "primary_flash",
+                auto.primary_flash_offset,
+                auto.primary_flash_size,
+            ),
+            (
+                "secondary_flash",
+                auto.secondary_flash_offset,
+                auto.secondary_flash_size,
+            ),
+            ("mci", auto.mci_offset, auto.mci_size),
+            ("doe_mbox", auto.doe_mbox_offset, auto.doe_mbox_size),
+            ("otp", auto.otp_offset, auto.otp_size),
+            ("lc", auto.lc_offset, auto.lc_size),
+            ("mbox", auto.mbox_offset, auto.mbox_size),
+            ("sha512_acc", auto.sha512_acc_offset, auto.sha512_acc_size),
+            ("soc", auto.soc_offset, auto.soc_size),
+            ("axicdma", auto.axicdma_offset, auto.axicdma_size),
+        ]
+    }
+
+    /// Check that no region runs past the end of the address space or overlaps another.
+    pub fn validate(&self) -> Result<(), String> {
+        let mut regions: Vec<_> = self
+            .regions()
+            .into_iter()
+            .filter(|(_, _, size)| *size != 0)
+            .collect();
+        for (name, offset, size) in &regions {
+            if offset.checked_add(size - 1).is_none() {
+                return Err(format!(
+                    "{} region 0x{:08x} of 0x{:x} bytes runs past the end of the address space",
+                    name, offset, size
+                ));
+            }
+        }
+        regions.sort_by_key(|(_, offset, _)| *offset);
+        for pair in regions.windows(2) {
+            let ((a, a_offset, a_size), (b, b_offset, _)) = (pair[0], pair[1]);
+            if b_offset - a_offset < a_size {
+                return Err(format!(
+                    "{} region at 0x{:08x} overlaps {} region at 0x{:08x}",
+                    b, b_offset, a, a_offset
+                ));
+            }
+        }
+        Ok(())
+    }
+}
+
+/// Per-region overrides of the memory map, from the command line or a memory map file.
+#[derive(Args, Clone, Debug, Default, Deserialize, PartialEq, Eq)]
+#[serde(deny_unknown_fields)]
+pub struct MemoryMapOverrides {
+    /// Override ROM offset
+    #[arg(long, value_parser=maybe_hex::<u32>)]
+    pub rom_offset: Option<u32>,
+    /// Override ROM size
+    #[arg(long, value_parser=maybe_hex::<u32>)]
+    pub rom_size: Option<u32>,
+    /// Override UART offset
+    #[arg(long, value_parser=maybe_hex::<u32>)]
+    pub uart_offset: Option<u32>,
+    /// Override UART size
+    #[arg(long, value_parser=maybe_hex::<u32>)]
+    pub uart_size: Option<u32>,
+    /// Override emulator control offset
+    #[arg(long, value_parser=maybe_hex::<u32>)]
+    pub ctrl_offset: Option<u32>,
+    /// Override emulator control size
+    #[arg(long, value_parser=maybe_hex::<u32>)]
+    pub ctrl_size: Option<u32>,
+    #[arg(long, value_parser=maybe_hex::<u32>)]
+    pub sram_offset: Option<u32>,
+    /// Override SRAM size
+    #[arg(long, value_parser=maybe_hex::<u32>)]
+    pub sram_size: Option<u32>,
+    /// Override PIC offset
+    #[arg(long, value_parser=maybe_hex::<u32>)]
+    pub pic_offset: Option<u32>,
+    /// Override external test SRAM offset
+    #[arg(long, value_parser=maybe_hex::<u32>)]
+    pub external_test_sram_offset: Option<u32>,
+    /// Override external test SRAM size
+    #[arg(long, value_parser=maybe_hex::<u32>)]
+    pub external_test_sram_size: Option<u32>,
+    /// Override DCCM offset
+    #[arg(long, value_parser=maybe_hex::<u32>)]
+    pub dccm_offset: Option<u32>,
+    /// Override DCCM size
+    #[arg(long, value_parser=maybe_hex::<u32>)]
+    pub dccm_size: Option<u32>,
+    /// Override I3C offset
+    #[arg(long, value_parser=maybe_hex::<u32>)]
+    pub i3c_offset: Option<u32>,
+    /// Override I3C size
+    #[arg(long, value_parser=maybe_hex::<u32>)]
+    pub i3c_size: Option<u32>,
+    /// Override primary flash offset
+    #[arg(long, value_parser=maybe_hex::<u32>)]
+    pub primary_flash_offset: Option<u32>,
+    /// Override primary flash size
+    #[arg(long, value_parser=maybe_hex::<u32>)]
+    pub primary_flash_size: Option<u32>,
+    /// Override secondary flash offset
+    #[arg(long, value_parser=maybe_hex::<u32>)]
+    pub secondary_flash_offset: Option<u32>,
+    /// Override secondary flash size
+    #[arg(long, value_parser=maybe_hex::<u32>)]
+    pub secondary_flash_size: Option<u32>,
+    /// Override MCI offset
+    #[arg(long, value_parser=maybe_hex::<u32>)]
+    pub mci_offset: Option<u32>,
+    /// Override MCI size
+    #[arg(long, value_parser=maybe_hex::<u32>)]
+    pub mci_size: Option<u32>,
+    /// Override AXI DMA controller offset
+    #[arg(long, value_parser=maybe_hex::<u32>)]
+    pub dma_offset: Option<u32>,
+    /// Override AXI DMA controller size
+    #[arg(long, value_parser=maybe_hex::<u32>)]
+    pub dma_size: Option<u32>,
+    /// Override Caliptra mailbox offset
+    #[arg(long, value_parser=maybe_hex::<u32>)]
+    pub mbox_offset: Option<u32>,
+    /// Override Caliptra mailbox size
+    #[arg(long, value_parser=maybe_hex::<u32>)]
+    pub mbox_size: Option<u32>,
+    /// Override Caliptra SoC interface offset
+    #[arg(long, value_parser=maybe_hex::<u32>)]
+    pub soc_offset: Option<u32>,
+    /// Override Caliptra SoC interface size
+    #[arg(long, value_parser=maybe_hex::<u32>)]
+    pub soc_size: Option<u32>,
+    /// Override OTP offset
+    #[arg(long, value_parser=maybe_hex::<u32>)]
+    pub otp_offset: Option<u32>,
+    /// Override OTP size
+    #[arg(long, value_parser=maybe_hex::<u32>)]
+    pub otp_size: Option<u32>,
+    /// Override LC offset
+    #[arg(long, value_parser=maybe_hex::<u32>)]
+    pub lc_offset: Option<u32>,
+    /// Override LC size
+    #[arg(long, value_parser=maybe_hex::<u32>)]
+    pub lc_size: Option<u32>,
+}
+
+impl MemoryMapOverrides {
+    /// Returns true if no region is overridden.
+    pub fn is_empty(&self) -> bool {
+        *self == Self::default()
+    }
+}
+
+fn invalid_data(err: impl ToString) -> io::Error {
+    io::Error::new(io::ErrorKind::InvalidData, err.to_string())
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    #[test]
+    fn test_profiles_are_valid() {
+        for name in PROFILES {
+            let map = MemoryMap::profile(name).unwrap();
+            assert_eq!(map.validate(), Ok(()), "profile {}", name);
+        }
+        assert!(MemoryMap::profile("asic").is_none());
+    }
+
+    #[test]
+    fn test_from_toml() {
+        let map = MemoryMap::from_toml("profile = \"fpga\"\nsram_size = 0x100000\n").unwrap();
+        let fpga = MemoryMap::profile("fpga").unwrap();
+        assert_eq!(map.mcu.rom_offset, fpga.mcu.rom_offset);
+        assert_eq!(map.mcu.ram_offset, fpga.mcu.ram_offset);
+        assert_eq!(map.mcu.ram_size, 0x10_0000);
+
+        let map = MemoryMap::from_toml("pic_offset = 0x60100000").unwrap();
+        assert_eq!(map.mcu.pic_offset, 0x6010_0000);
+        assert_eq!(map.auto.el2_pic_offset, 0x6010_0000);
+
+        let map = MemoryMap::from_toml("dma_offset = 0xa4090000\ndma_size = 0x40").unwrap();
+        assert_eq!(map.auto.axicdma_offset, 0xa409_0000);
+        assert_eq!(map.auto.axicdma_size, 0x40);
+    }
+
+    #[test]
+    fn test_from_toml_errors() {
+        assert!(MemoryMap::from_toml("profile = \"asic\"").is_err());
+        assert!(MemoryMap::from_toml("rom_ofset = 0").is_err());
+        assert!(MemoryMap::from_toml("rom_offset = -1").is_err());
+        // the ROM would cover the UART
+        assert!(MemoryMap::from_toml("rom_size = 0x10002000").is_err());
+        assert!(MemoryMap::from_toml("sram_offset = 0xffff0000").is_err());
+        // the DMA controller would cover the SoC interface
+        let soc_offset = MemoryMap::default().auto.soc_offset;
+        assert!(MemoryMap::from_toml(&format!("dma_offset = {}", soc_offset)).is_err());
+    }
+
+    #[test]
+    fn test_validate_rejects_overlapping_overrides() {
+        // Overrides like these used to be applied without any check
+        let default = MemoryMap::default();
+        let overrides = MemoryMapOverrides {
+            uart_offset: Some(default.mcu.rom_offset),
+            ..Default::default()
+        };
+        assert!(!overrides.is_empty());
+        let err = default
+            .clone()
+            .with_overrides(&overrides)
+            .validate()
+            .unwrap_err();
+        assert!(err.contains("overlaps"), "{}", err);
+
+        let overrides = MemoryMapOverrides {
+            sram_offset: Some(0xffff_f000),
+            sram_size: Some(0x2000),
+            ..Default::default()
+        };
+        let err = default
+            .clone()
+            .with_overrides(&overrides)
+            .validate()
+            .unwrap_err();
+        assert!(err.contains("past the end"), "{}", err);
+
+        assert!(MemoryMapOverrides::default().is_empty());
+        assert_eq!(
+            default
+                .with_overrides(&MemoryMapOverrides::default())
+                .validate(),
+            Ok(())
+        );
+    }
+}
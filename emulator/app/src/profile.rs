@@ -0,0 +1,533 @@
+/*++
+
+Licensed under the Apache-2.0 license.
+
+File Name:
+
+    profile.rs
+
+Abstract:
+
+    File contains the per-PC and per-call-stack cycle profiler for the MCU and Caliptra
+    firmware.
+
+--*/
+
+use crate::elf::{self, ElfSymbol};
+use crate::trace::TraceCore;
+use caliptra_emu_cpu::RvInstr;
+use std::collections::{BTreeMap, HashMap};
+use std::fs::File;
+use std::io::{self, BufWriter, Write};
+use std::path::Path;
+
+/// Code is counted in pages of this many bytes, one counter per 16-bit parcel.
+const PAGE_SHIFT: u32 = 12;
+const PAGE_SLOTS: usize = 1 << (PAGE_SHIFT - 1);
+
+/// Deepest call stack tracked; deeper calls are counted in their caller.
+const MAX_STACK_DEPTH: u32 = 64;
+
+/// How a retired instruction moves between functions, by the RISC-V calling convention:
+/// calls link through `ra` or `t0` and returns jump through them.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+enum Flow {
+    Call,
+    Return,
+    /// Indirect jump through another register, as for a tail call
+    TailCall,
+    /// Jump or branch within the function
+    Local,
+    /// `ecall` or `ebreak`
+    Trap,
+    /// `mret`
+    TrapReturn,
+    Sequential,
+}
+
+fn is_link(reg: u32) -> bool {
+    reg == 1 || reg == 5
+}
+
+fn flow(instr: RvInstr) -> Flow {
+    match instr {
+        RvInstr::Instr32(instr) => {
+            let rd = (instr >> 7) & 0x1f;
+            let rs1 = (instr >> 15) & 0x1f;
+            match instr & 0x7f {
+                // jal
+                0x6f if is_link(rd) => Flow::Call,
+                0x6f => Flow::Local,
+                // jalr
+                0x67 if is_link(rd) => Flow::Call,
+                0x67 if rd == 0 && is_link(rs1) => Flow::Return,
+                0x67 => Flow::TailCall,
+                // branches
+                0x63 => Flow::Local,
+                _ if instr == 0x0000_0073 || instr == 0x0010_0073 => Flow::Trap,
+                _ if instr == 0x3020_0073 => Flow::TrapReturn,
+                _ => Flow::Sequential,
+            }
+        }
+        RvInstr::Instr16(instr) => {
+            let instr = instr as u32;
+            let rs1 = (instr >> 7) & 0x1f;
+            let rs2 = (instr >> 2) & 0x1f;
+            match (instr & 3, instr >> 13) {
+                // c.jal
+                (1, 0b001) => Flow::Call,
+                // c.j, c.beqz, c.bnez
+                (1, 0b101..=0b111) => Flow::Local,
+                (2, 0b100) if rs2 == 0 => match ((instr >> 12) & 1, rs1) {
+                    // c.ebreak
+                    (1, 0) => Flow::Trap,
+                    // c.jalr
+                    (1, _) => Flow::Call,
+                    // c.jr
+                    (0, rs1) if is_link(rs1) => Flow::Return,
+                    _ => Flow::TailCall,
+                },
+                _ => Flow::Sequential,
+            }
+        }
+    }
+}
+
+/// Frame of a [`CallTree`]: the function entered at `entry` from `parent`.
+struct Frame {
+    parent: u32,
+    entry: u32,
+    /// Address the outermost frames were entered from, to name the function at the root
+    caller: u32,
+    depth: u32,
+    /// Entered by a trap instead of a call, and left with `mret`
+    trap: bool,
+    /// Number of trap frames from the root to this frame, inclusive
+    traps: u32,
+}
+
+/// Shadow call stacks of one core, kept as a tree of frames so that a stack is a single
+/// node index. Frame 0 is the root, the code that ran before the first tracked call.
+///
+/// Calls, returns and tail calls are taken from the instructions the core retires. A
+/// jump to an address other than the next instruction without a control flow
+/// instruction, or `ecall`, is taken as a trap entry, and `mret` returns from the
+/// latest trap frame. Code that switches stacks without these, such as a kernel
+/// resuming a process, leaves the tracked stack off until it returns to the root.
+struct CallTree {
+    frames: Vec<Frame>,
+    /// Frame of each `(parent, entry, trap, caller)`, with the caller only set at the root
+    children: HashMap<(u32, u32, bool, u32), u32>,
+    current: u32,
+    /// Calls past `MAX_STACK_DEPTH`, popped before the tracked frames
+    overflow: u32,
+}
+
+impl Default for CallTree {
+    fn default() -> Self {
+        Self {
+            frames: vec![Frame {
+                parent: 0,
+                entry: 0,
+                caller: 0,
+                depth: 0,
+                trap: false,
+                traps: 0,
+            }],
+            children: HashMap::new(),
+            current: 0,
+            overflow: 0,
+        }
+    }
+}
+
+impl CallTree {
+    /// Enter the function at `entry` from the instruction at `caller`.
+    fn push(&mut self, entry: u32, trap: bool, caller: u32) {
+        let parent = &self.frames[self.current as usize];
+        if parent.depth >= MAX_STACK_DEPTH {
+            self.overflow += 1;
+            return;
+        }
+        let (depth, traps) = (parent.depth + 1, parent.traps + trap as u32);
+        let caller = if self.current == 0 { caller } else { 0 };
+        let next = self.frames.len() as u32;
+        let current = self.current;
+        self.current = *self
+            .children
+            .entry((current, entry, trap, caller))
+            .or_insert(next);
+        if self.current == next {
+            self.frames.push(Frame {
+                parent: current,
+                entry,
+                caller,
+                depth,
+                trap,
+                traps,
+            });
+        }
+    }
+
+    fn pop(&mut self) {
+        if self.overflow > 0 {
+            self.overflow -= 1;
+        } else {
+            self.current = self.frames[self.current as usize].parent;
+        }
+    }
+
+    /// Leave the latest trap frame and everything called from it.
+    fn pop_trap(&mut self) {
+        self.overflow = 0;
+        if self.frames[self.current as usize].traps == 0 {
+            return;
+        }
+        loop {
+            let frame = &self.frames[self.current as usize];
+            self.current = frame.parent;
+            if frame.trap {
+                break;
+            }
+        }
+    }
+
+    /// Addresses in the functions of the stack of `node`, outermost first: the caller of
+    /// the outermost frame and then the entry of each frame.
+    fn addresses(&self, mut node: u32) -> Vec<u32> {
+        let mut addresses = vec![];
+        while node != 0 {
+            let frame = &self.frames[node as usize];
+            addresses.push(frame.entry);
+            if frame.parent == 0 {
+                addresses.push(frame.caller);
+            }
+            node = frame.parent;
+        }
+        addresses.reverse();
+        addresses
+    }
+}
+
+/// Cycle counts of one core, indexed by PC and by call stack.
+///
+/// Counters live in flat per-page arrays that are allocated the first time the core
+/// executes from that page, so only code that actually runs costs memory. The page of
+/// the last sample is remembered since consecutive samples almost always share it.
+#[derive(Default)]
+pub struct CoreProfile {
+    pages: Vec<(u32, Box<[u64]>)>,
+    page_index: HashMap<u32, usize>,
+    last_page: usize,
+    symbols: Vec<ElfSymbol>,
+    calls: CallTree,
+    /// Cycles per call stack node and PC
+    stacks: HashMap<(u32, u32), u64>,
+}
+
+impl CoreProfile {
+    /// Add `cycles` to the instruction at `pc` in the current call stack.
+    #[inline]
+    pub fn record(&mut self, pc: u32, cycles: u64) {
+        let page = pc >> PAGE_SHIFT;
+        let slot = (pc as usize & ((1 << PAGE_SHIFT) - 1)) >> 1;
+        if self.pages.get(self.last_page).map(|p| p.0) != Some(page) {
+            self.last_page = self.page(page);
+        }
+        self.pages[self.last_page].1[slot] += cycles;
+        *self.stacks.entry((self.calls.current, pc)).or_default() += cycles;
+    }
+
+    /// Follow calls and returns: the core retired `instr` starting at `pc`, or took a
+    /// step without retiring anything if it is `None`, and continues at `next_pc`.
+    #[inline]
+    pub fn retired(&mut self, pc: u32, instr: Option<RvInstr>, next_pc: u32) {
+        let (flow, len) = match instr {
+            Some(instr @ RvInstr::Instr32(_)) => (flow(instr), 4),
+            Some(instr @ RvInstr::Instr16(_)) => (flow(instr), 2),
+            None => (Flow::Sequential, 0),
+        };
+        match flow {
+            Flow::Call => self.calls.push(next_pc, false, pc),
+            Flow::Return => self.calls.pop(),
+            Flow::TailCall => {
+                if self.calls.current != 0 {
+                    self.calls.pop();
+                }
+                self.calls.push(next_pc, false, pc);
+            }
+            Flow::Trap => self.calls.push(next_pc, true, pc),
+            Flow::TrapReturn => self.calls.pop_trap(),
+            Flow::Local => {}
+            // an interrupt or exception; `wfi` may stay at its own address
+            Flow::Sequential if next_pc != pc.wrapping_add(len) && next_pc != pc => {
+                self.calls.push(next_pc, true, pc)
+            }
+            Flow::Sequential => {}
+        }
+    }
+
+    fn page(&mut self, page: u32) -> usize {
+        if let Some(&index) = self.page_index.get(&page) {
+            return index;
+        }
+        self.pages
+            .push((page, vec![0; PAGE_SLOTS].into_boxed_slice()));
+        self.page_index.insert(page, self.pages.len() - 1);
+        self.pages.len() - 1
+    }
+
+    /// Use the function symbols of `symbols` to name sampled PCs.
+    pub fn add_symbols(&mut self, mut symbols: Vec<ElfSymbol>) {
+        self.symbols.append(&mut symbols);
+        self.symbols.sort_by_key(|sym| sym.addr);
+    }
+
+    /// Sampled PCs and their cycle counts, in address order.
+    pub fn samples(&self) -> impl Iterator<Item = (u32, u64)> + '_ {
+        let mut pages: Vec<_> = self.pages.iter().collect();
+        pages.sort_by_key(|p| p.0);
+        pages.into_iter().flat_map(|(page, slots)| {
+            slots
+                .iter()
+                .enumerate()
+                .filter(|(_, &cycles)| cycles != 0)
+                .map(move |(slot, &cycles)| ((page << PAGE_SHIFT) | (slot as u32) << 1, cycles))
+        })
+    }
+
+    /// Total cycles recorded.
+    pub fn total(&self) -> u64 {
+        self.pages.iter().flat_map(|p| p.1.iter()).sum()
+    }
+
+    /// Name of the function containing `pc`, if the symbols cover it.
+    pub fn symbolize(&self, pc: u32) -> Option<&str> {
+        let index = self.symbols.partition_point(|sym| sym.addr <= pc);
+        let sym = self.symbols.get(index.checked_sub(1)?)?;
+        // symbols without a size extend to the next symbol
+        (sym.size == 0 || pc - sym.addr < sym.size).then_some(sym.name.as_str())
+    }
+
+    fn function_name(&self, pc: u32) -> String {
+        match self.symbolize(pc) {
+            Some(function) => function.to_string(),
+            None => format!("0x{:08x}", pc),
+        }
+    }
+
+    /// Cycles per call stack, each given as the function names from the caller of the
+    /// outermost tracked call to the function that was running.
+    pub fn stacks(&self) -> BTreeMap<Vec<String>, u64> {
+        let mut stacks = BTreeMap::new();
+        for (&(node, pc), &cycles) in self.stacks.iter() {
+            let mut names: Vec<String> = vec![];
+            for name in self
+                .calls
+                .addresses(node)
+                .into_iter()
+                .map(|addr| self.function_name(addr))
+            {
+                // a local jump taken as a tail call enters the same function again
+                if names.last() != Some(&name) {
+                    names.push(name);
+                }
+            }
+            // the innermost frame usually is the function of the PC already
+            let leaf = self.function_name(pc);
+            if names.last() != Some(&leaf) {
+                names.push(leaf);
+            }
+            *stacks.entry(names).or_default() += cycles;
+        }
+        stacks
+    }
+}
+
+/// Exact or sampled cycle profile of both cores.
+///
+/// With an interval of N, the PCs of both cores are sampled every Nth step and each
+/// sample is weighted by N. An interval of 1 counts every step.
+pub struct Profiler {
+    pub mcu: CoreProfile,
+    pub caliptra: CoreProfile,
+    interval: u64,
+    countdown: u64,
+}
+
+impl Profiler {
+    pub fn new(interval: u64) -> Self {
+        let interval = interval.max(1);
+        Self {
+            mcu: CoreProfile::default(),
+            caliptra: CoreProfile::default(),
+            interval,
+            countdown: interval,
+        }
+    }
+
+    pub fn core(&mut self, core: TraceCore) -> &mut CoreProfile {
+        match core {
+            TraceCore::Mcu => &mut self.mcu,
+            TraceCore::Caliptra => &mut self.caliptra,
+        }
+    }
+
+    /// Load the function symbols of the ELF executable at `path` for `core`.
+    pub fn add_elf_symbols(&mut self, core: TraceCore, path: &Path) -> io::Result<()> {
+        let symbols = elf::function_symbols(&std::fs::read(path)?)?;
+        self.core(core).add_symbols(symbols);
+        Ok(())
+    }
+
+    /// Returns true if this step should be sampled.
+    #[inline]
+    pub fn sample_due(&mut self) -> bool {
+        self.countdown -= 1;
+        if self.countdown == 0 {
+            self.countdown = self.interval;
+            true
+        } else {
+            false
+        }
+    }
+
+    /// Record a sampled step of `core` that started at `pc` and took `cycles`.
+    #[inline]
+    pub fn record(&mut self, core: TraceCore, pc: u32, cycles: u64) {
+        let weight = cycles.max(1) * self.interval;
+        self.core(core).record(pc, weight);
+    }
+
+    /// Track the call stack of `core` across every step, sampled or not; see
+    /// [`CoreProfile::retired`].
+    #[inline]
+    pub fn retired(&mut self, core: TraceCore, pc: u32, instr: Option<RvInstr>, next_pc: u32) {
+        self.core(core).retired(pc, instr, next_pc);
+    }
+
+    /// Write the profile in the folded stack format used by flame graph tools: one
+    /// `core;caller;...;function cycles` line per call stack, with unsymbolized
+    /// functions as `0x<address>`.
+    pub fn write_folded(&self, out: &mut impl Write) -> io::Result<()> {
+        for (name, profile) in [("mcu", &self.mcu), ("caliptra", &self.caliptra)] {
+            for (stack, cycles) in profile.stacks() {
+                writeln!(out, "{};{} {}", name, stack.join(";"), cycles)?;
+            }
+        }
+        Ok(())
+    }
+
+    /// Write the folded profile to the file at `path`.
+    pub fn save_folded(&self, path: &Path) -> io::Result<()> {
+        let mut out = BufWriter::new(File::create(path)?);
+        self.write_folded(&mut out)?;
+        out.flush()
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    fn symbol(name: &str, addr: u32, size: u32) -> ElfSymbol {
+        ElfSymbol {
+            name: name.into(),
+            addr,
+            size,
+        }
+    }
+
+    #[test]
+    fn test_record_and_samples() {
+        let mut profile = CoreProfile::default();
+        profile.record(0x4000_0002, 1);
+        profile.record(0x8000_0000, 3);
+        profile.record(0x4000_0002, 2);
+        profile.record(0x4000_1ffe, 4);
+        assert_eq!(
+            profile.samples().collect::<Vec<_>>(),
+            vec![(0x4000_0002, 3), (0x4000_1ffe, 4), (0x8000_0000, 3)]
+        );
+        assert_eq!(profile.total(), 10);
+    }
+
+    #[test]
+    fn test_symbolize() {
+        let mut profile = CoreProfile::default();
+        profile.add_symbols(vec![symbol("main", 0x100, 0x20), symbol("start", 0x0, 0)]);
+        assert_eq!(profile.symbolize(0x10), Some("start"));
+        assert_eq!(profile.symbolize(0x11e), Some("main"));
+        assert_eq!(profile.symbolize(0x120), None);
+    }
+
+    #[test]
+    fn test_folded_output() {
+        let mut profiler = Profiler::new(2);
+        profiler.mcu.add_symbols(vec![symbol("main", 0x100, 0x20)]);
+        assert!(!profiler.sample_due());
+        assert!(profiler.sample_due());
+        profiler.record(TraceCore::Mcu, 0x100, 1);
+        profiler.record(TraceCore::Mcu, 0x104, 1);
+        profiler.record(TraceCore::Caliptra, 0x200, 3);
+        let mut out = vec![];
+        profiler.write_folded(&mut out).unwrap();
+        assert_eq!(
+            String::from_utf8(out).unwrap(),
+            "mcu;main 4\ncaliptra;0x00000200 6\n"
+        );
+    }
+
+    #[test]
+    fn test_flow() {
+        // jal ra / j
+        assert_eq!(flow(RvInstr::Instr32(0x0100_00ef)), Flow::Call);
+        assert_eq!(flow(RvInstr::Instr32(0x0100_006f)), Flow::Local);
+        // jalr ra, 0(a5) / ret / jr t1
+        assert_eq!(flow(RvInstr::Instr32(0x0007_80e7)), Flow::Call);
+        assert_eq!(flow(RvInstr::Instr32(0x0000_8067)), Flow::Return);
+        assert_eq!(flow(RvInstr::Instr32(0x0003_0067)), Flow::TailCall);
+        // c.jal / c.jalr a5 / c.jr ra / c.jr a5 / c.ebreak / c.mv
+        assert_eq!(flow(RvInstr::Instr16(0x2001)), Flow::Call);
+        assert_eq!(flow(RvInstr::Instr16(0x9782)), Flow::Call);
+        assert_eq!(flow(RvInstr::Instr16(0x8082)), Flow::Return);
+        assert_eq!(flow(RvInstr::Instr16(0x8782)), Flow::TailCall);
+        assert_eq!(flow(RvInstr::Instr16(0x9002)), Flow::Trap);
+        assert_eq!(flow(RvInstr::Instr16(0x853e)), Flow::Sequential);
+        // ecall / mret / wfi
+        assert_eq!(flow(RvInstr::Instr32(0x0000_0073)), Flow::Trap);
+        assert_eq!(flow(RvInstr::Instr32(0x3020_0073)), Flow::TrapReturn);
+        assert_eq!(flow(RvInstr::Instr32(0x1050_0073)), Flow::Sequential);
+    }
+
+    #[test]
+    fn test_call_stacks() {
+        const NOP: RvInstr = RvInstr::Instr32(0x0000_0013);
+        const WFI: RvInstr = RvInstr::Instr32(0x1050_0073);
+        let mut profiler = Profiler::new(1);
+        profiler.mcu.add_symbols(vec![
+            symbol("main", 0x100, 0x40),
+            symbol("helper", 0x200, 0x20),
+            symbol("isr", 0x300, 0x10),
+        ]);
+        let mut step = |pc, cycles, instr, next_pc| {
+            profiler.record(TraceCore::Mcu, pc, cycles);
+            profiler.retired(TraceCore::Mcu, pc, instr, next_pc);
+        };
+        // main calls helper, which is interrupted and returns to main
+        step(0x100, 1, Some(RvInstr::Instr32(0x1000_00ef)), 0x200);
+        step(0x200, 2, Some(NOP), 0x204);
+        step(0x204, 1, Some(NOP), 0x300);
+        step(0x300, 5, Some(RvInstr::Instr32(0x3020_0073)), 0x208);
+        step(0x208, 1, Some(RvInstr::Instr16(0x8082)), 0x104);
+        step(0x104, 1, Some(WFI), 0x104);
+        step(0x104, 1, None, 0x104);
+
+        let mut out = vec![];
+        profiler.write_folded(&mut out).unwrap();
+        assert_eq!(
+            String::from_utf8(out).unwrap(),
+            "mcu;main 3\nmcu;main;helper 4\nmcu;main;helper;isr 5\n"
+        );
+    }
+}
@@ -0,0 +1,321 @@
+/*++
+
+Licensed under the Apache-2.0 license.
+
+File Name:
+
+    snapshot.rs
+
+Abstract:
+
+    File contains the serializable snapshot of the emulator state used to
+    fork many test cases from a single boot.
+
+--*/
+
+use std::io::{Error, ErrorKind};
+
+const SNAPSHOT_MAGIC: &[u8; 8] = b"MCUSNAP\0";
+const SNAPSHOT_VERSION: u32 = 3;
+
+/// Granularity at which RAM regions are stored. Pages that are entirely zero are omitted.
+pub const SNAPSHOT_PAGE_SIZE: usize = 4096;
+
+/// Base addresses of the Caliptra ICCM and DCCM, which identify them in
+/// [`EmulatorSnapshot::caliptra_regions`].
+pub const CALIPTRA_ICCM_BASE: u32 = 0x4000_0000;
+pub const CALIPTRA_DCCM_BASE: u32 = 0x5000_0000;
+
+/// Number of general purpose registers saved per core.
+pub const XREG_COUNT: usize = 32;
+
+/// Machine-mode CSRs saved per core, if the core implements them: the trap setup and
+/// handling registers and the PMP configuration.
+pub const SNAPSHOT_CSRS: &[u32] = &[
+    0x300, // mstatus
+    0x304, // mie
+    0x305, // mtvec
+    0x340, // mscratch
+    0x341, // mepc
+    0x342, // mcause
+    0x343, // mtval
+    0x3a0, 0x3a1, 0x3a2, 0x3a3, // pmpcfg0-3
+    0x3b0, 0x3b1, 0x3b2, 0x3b3, 0x3b4, 0x3b5, 0x3b6, 0x3b7, // pmpaddr0-7
+    0x3b8, 0x3b9, 0x3ba, 0x3bb, 0x3bc, 0x3bd, 0x3be, 0x3bf, // pmpaddr8-15
+];
+
+/// Architectural state of a single core.
+#[derive(Clone, Debug, Default, PartialEq, Eq)]
+pub struct CpuSnapshot {
+    /// Cycle count of the core's clock
+    pub cycle: u64,
+    pub pc: u32,
+    pub xregs: [u32; XREG_COUNT],
+    /// `(address, value)` of each CSR in [`SNAPSHOT_CSRS`] the core implements
+    pub csrs: Vec<(u32, u32)>,
+}
+
+/// Contents of a RAM region, identified by its base address on the bus of its core.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct RegionSnapshot {
+    pub base: u32,
+    pub data: Vec<u8>,
+}
+
+/// Opaque state of an MCU peripheral, as returned by its `save_state`.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct PeripheralSnapshot {
+    pub name: String,
+    pub state: Vec<u8>,
+}
+
+/// Snapshot of the emulator state.
+///
+/// Serialized little-endian as the magic and version, the MCU and Caliptra core state
+/// (cycle count, PC, general purpose registers and the count and `(address, value)`
+/// pairs of the CSRs), the MCU RAM regions and the Caliptra ICCM and DCCM, each as its
+/// base address, length and the list of its non-zero pages, and then each peripheral
+/// state as its name and state bytes, both prefixed with their length.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct EmulatorSnapshot {
+    pub mcu: CpuSnapshot,
+    pub caliptra: CpuSnapshot,
+    pub regions: Vec<RegionSnapshot>,
+    pub caliptra_regions: Vec<RegionSnapshot>,
+    pub peripherals: Vec<PeripheralSnapshot>,
+}
+
+impl EmulatorSnapshot {
+    pub fn to_bytes(&self) -> Vec<u8> {
+        let mut out = Vec::new();
+        out.extend_from_slice(SNAPSHOT_MAGIC);
+        out.extend_from_slice(&SNAPSHOT_VERSION.to_le_bytes());
+        for cpu in [&self.mcu, &self.caliptra] {
+            out.extend_from_slice(&cpu.cycle.to_le_bytes());
+            out.extend_from_slice(&cpu.pc.to_le_bytes());
+            for xreg in cpu.xregs {
+                out.extend_from_slice(&xreg.to_le_bytes());
+            }
+            out.extend_from_slice(&(cpu.csrs.len() as u32).to_le_bytes());
+            for (addr, value) in cpu.csrs.iter() {
+                out.extend_from_slice(&addr.to_le_bytes());
+                out.extend_from_slice(&value.to_le_bytes());
+            }
+        }
+
+        for regions in [&self.regions, &self.caliptra_regions] {
+            out.extend_from_slice(&(regions.len() as u32).to_le_bytes());
+            for region in regions.iter() {
+                out.extend_from_slice(&region.base.to_le_bytes());
+                out.extend_from_slice(&(region.data.len() as u32).to_le_bytes());
+                let pages: Vec<(usize, &[u8])> = region
+                    .data
+                    .chunks(SNAPSHOT_PAGE_SIZE)
+                    .enumerate()
+                    .filter(|(_, page)| page.iter().any(|b| *b != 0))
+                    .collect();
+                out.extend_from_slice(&(pages.len() as u32).to_le_bytes());
+                for (index, page) in pages {
+                    out.extend_from_slice(&(index as u32).to_le_bytes());
+                    out.extend_from_slice(page);
+                }
+            }
+        }
+
+        out.extend_from_slice(&(self.peripherals.len() as u32).to_le_bytes());
+        for periph in self.peripherals.iter() {
+            for bytes in [periph.name.as_bytes(), &periph.state] {
+                out.extend_from_slice(&(bytes.len() as u32).to_le_bytes());
+                out.extend_from_slice(bytes);
+            }
+        }
+        out
+    }
+
+    pub fn from_bytes(bytes: &[u8]) -> Result<Self, Error> {
+        let mut reader = Reader { bytes, pos: 0 };
+        if reader.take(SNAPSHOT_MAGIC.len())? != SNAPSHOT_MAGIC {
+            Err(invalid("not an emulator snapshot"))?;
+        }
+        let version = reader.u32()?;
+        if version != SNAPSHOT_VERSION {
+            Err(invalid(&format!(
+                "unsupported snapshot version {}",
+                version
+            )))?;
+        }
+        let mcu = reader.cpu()?;
+        let caliptra = reader.cpu()?;
+        let regions = reader.regions()?;
+        let caliptra_regions = reader.regions()?;
+
+        let periph_count = reader.u32()?;
+        let mut peripherals = vec![];
+        for _ in 0..periph_count {
+            let name = String::from_utf8(reader.bytes()?.to_vec())
+                .map_err(|_| invalid("invalid peripheral name in snapshot"))?;
+            let state = reader.bytes()?.to_vec();
+            peripherals.push(PeripheralSnapshot { name, state });
+        }
+
+        if reader.pos != bytes.len() {
+            Err(invalid("trailing data after snapshot"))?;
+        }
+
+        Ok(Self {
+            mcu,
+            caliptra,
+            regions,
+            caliptra_regions,
+            peripherals,
+        })
+    }
+}
+
+fn invalid(msg: &str) -> Error {
+    Error::new(ErrorKind::InvalidData, msg)
+}
+
+struct Reader<'a> {
+    bytes: &'a [u8],
+    pos: usize,
+}
+
+impl<'a> Reader<'a> {
+    fn take(&mut self, len: usize) -> Result<&'a [u8], Error> {
+        if self.bytes.len() - self.pos < len {
+            Err(invalid("truncated snapshot"))?;
+        }
+        let slice = &self.bytes[self.pos..self.pos + len];
+        self.pos += len;
+        Ok(slice)
+    }
+
+    fn u32(&mut self) -> Result<u32, Error> {
+        Ok(u32::from_le_bytes(self.take(4)?.try_into().unwrap()))
+    }
+
+    fn u64(&mut self) -> Result<u64, Error> {
+        Ok(u64::from_le_bytes(self.take(8)?.try_into().unwrap()))
+    }
+
+    fn bytes(&mut self) -> Result<&'a [u8], Error> {
+        let len = self.u32()? as usize;
+        self.take(len)
+    }
+
+    fn cpu(&mut self) -> Result<CpuSnapshot, Error> {
+        let mut cpu = CpuSnapshot {
+            cycle: self.u64()?,
+            pc: self.u32()?,
+            ..Default::default()
+        };
+        for xreg in cpu.xregs.iter_mut() {
+            *xreg = self.u32()?;
+        }
+        let csr_count = self.u32()?;
+        if csr_count as usize > SNAPSHOT_CSRS.len() {
+            Err(invalid("too many CSRs in snapshot"))?;
+        }
+        for _ in 0..csr_count {
+            cpu.csrs.push((self.u32()?, self.u32()?));
+        }
+        Ok(cpu)
+    }
+
+    fn regions(&mut self) -> Result<Vec<RegionSnapshot>, Error> {
+        let region_count = self.u32()?;
+        let mut regions = vec![];
+        for _ in 0..region_count {
+            let base = self.u32()?;
+            let len = self.u32()? as usize;
+            let mut data = vec![0u8; len];
+            let page_count = self.u32()?;
+            for _ in 0..page_count {
+                let start = self.u32()? as usize * SNAPSHOT_PAGE_SIZE;
+                if start >= len {
+                    Err(invalid("snapshot page out of range"))?;
+                }
+                let end = (start + SNAPSHOT_PAGE_SIZE).min(len);
+                data[start..end].copy_from_slice(self.take(end - start)?);
+            }
+            regions.push(RegionSnapshot { base, data });
+        }
+        Ok(regions)
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    #[test]
+    fn test_round_trip() {
+        let mut sram = vec![0u8; 3 * SNAPSHOT_PAGE_SIZE + 100];
+        sram[5] = 0xaa;
+        sram[3 * SNAPSHOT_PAGE_SIZE + 99] = 0x55;
+        let snapshot = EmulatorSnapshot {
+            mcu: CpuSnapshot {
+                cycle: 1 << 33,
+                pc: 0x4000_0000,
+                xregs: [7; XREG_COUNT],
+                csrs: vec![(0x300, 0x1888), (0x305, 0x4000_0100)],
+            },
+            caliptra: CpuSnapshot {
+                cycle: 12345,
+                pc: 0x40,
+                xregs: [9; XREG_COUNT],
+                csrs: vec![],
+            },
+            regions: vec![
+                RegionSnapshot {
+                    base: 0x4000_0000,
+                    data: sram,
+                },
+                RegionSnapshot {
+                    base: 0x5000_0000,
+                    data: vec![0; 16],
+                },
+            ],
+            caliptra_regions: vec![RegionSnapshot {
+                base: 0x4000_0000,
+                data: vec![0x13; 64],
+            }],
+            peripherals: vec![
+                PeripheralSnapshot {
+                    name: "mci".into(),
+                    state: vec![1, 2, 3],
+                },
+                PeripheralSnapshot {
+                    name: "otp".into(),
+                    state: vec![],
+                },
+            ],
+        };
+
+        let bytes = snapshot.to_bytes();
+        // the two all-zero pages in the middle and the zero region are not stored
+        assert!(bytes.len() < 3 * SNAPSHOT_PAGE_SIZE);
+        assert_eq!(EmulatorSnapshot::from_bytes(&bytes).unwrap(), snapshot);
+    }
+
+    #[test]
+    fn test_rejects_truncated() {
+        let snapshot = EmulatorSnapshot {
+            mcu: CpuSnapshot::default(),
+            caliptra: CpuSnapshot::default(),
+            regions: vec![RegionSnapshot {
+                base: 0,
+                data: vec![1; 8],
+            }],
+            caliptra_regions: vec![],
+            peripherals: vec![PeripheralSnapshot {
+                name: "i3c".into(),
+                state: vec![4; 4],
+            }],
+        };
+        let bytes = snapshot.to_bytes();
+        assert!(EmulatorSnapshot::from_bytes(&bytes[..bytes.len() - 1]).is_err());
+        assert!(EmulatorSnapshot::from_bytes(b"garbage").is_err());
+    }
+}
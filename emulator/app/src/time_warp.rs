@@ -0,0 +1,242 @@
+/*++
+
+Licensed under the Apache-2.0 license.
+
+File Name:
+
+    time_warp.rs
+
+Abstract:
+
+    File contains the detection of idle periods the emulator can fast-forward through.
+
+--*/
+
+use caliptra_emu_cpu::RvInstr;
+
+/// Largest backward jump, in bytes, whose target is taken as the head of a polling loop.
+const MAX_POLL_LOOP_BYTES: u32 = 256;
+
+/// Cycles skipped by `--time-warp`.
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub struct TimeWarpStats {
+    /// Number of times the clocks were moved forward
+    pub warps: u64,
+    /// Total number of cycles skipped
+    pub cycles: u64,
+}
+
+/// Decides when the clocks can move forward without stepping the cores, see
+/// `--time-warp`.
+///
+/// A warp is taken when Caliptra is parked on `wfi` and the MCU is either parked on
+/// `wfi` too or spinning in a polling loop: a short loop that went around without a
+/// store and came back to its head with the same registers, so it keeps going around
+/// until a timer action or a device changes what it reads. The cores cannot tell when
+/// the next timer action is due, so warps start at one cycle and double while nothing
+/// fires, up to `max_cycles`; an event is delivered at most that many cycles late.
+pub struct TimeWarp {
+    max_cycles: u64,
+    chunk: u64,
+    /// Head of the loop the MCU is in and the registers at the last visit of the head
+    head: Option<(u32, [u32; 32])>,
+    /// Address of the jump back to `head`
+    loop_end: u32,
+    /// Set if the MCU retired a store since the last visit of `head`
+    stored: bool,
+    stats: TimeWarpStats,
+}
+
+impl TimeWarp {
+    pub fn new(max_cycles: u64) -> Self {
+        Self {
+            max_cycles: max_cycles.max(1),
+            chunk: 1,
+            head: None,
+            loop_end: 0,
+            stored: false,
+            stats: TimeWarpStats::default(),
+        }
+    }
+
+    pub fn stats(&self) -> TimeWarpStats {
+        self.stats
+    }
+
+    /// Forget the polling loop and start the next warp from one cycle again, e.g. after
+    /// the MCU state was restored from a snapshot.
+    pub fn reset(&mut self) {
+        self.chunk = 1;
+        self.head = None;
+        self.stored = false;
+    }
+
+    /// Returns true if the warps have doubled up to `max_cycles` since a timer action
+    /// last came due, so none is due within the last warp.
+    pub fn saturated(&self) -> bool {
+        self.chunk == self.max_cycles
+    }
+
+    /// Returns the number of cycles to warp after an emulator step, if any.
+    ///
+    /// * `mcu_wfi` - the MCU only retired `wfi` in this step
+    /// * `retired_pc` - address of the last instruction the MCU retired
+    /// * `stored` - the MCU retired a store in this step
+    /// * `pc` - MCU PC after the step
+    /// * `caliptra_idle` - Caliptra retired nothing but `wfi` in this step
+    /// * `xregs` - reads the MCU registers, only called at loop heads
+    pub fn after_step(
+        &mut self,
+        mcu_wfi: bool,
+        retired_pc: u32,
+        stored: bool,
+        pc: u32,
+        caliptra_idle: bool,
+        xregs: impl FnOnce() -> [u32; 32],
+    ) -> Option<u64> {
+        self.stored |= stored;
+        if !caliptra_idle {
+            self.reset();
+            return None;
+        }
+        if mcu_wfi {
+            return Some(self.chunk);
+        }
+        if pc < retired_pc && retired_pc - pc <= MAX_POLL_LOOP_BYTES {
+            let xregs = xregs();
+            let polling =
+                !self.stored && self.loop_end == retired_pc && self.head == Some((pc, xregs));
+            self.head = Some((pc, xregs));
+            self.loop_end = retired_pc;
+            self.stored = false;
+            if polling {
+                return Some(self.chunk);
+            }
+            self.chunk = 1;
+            return None;
+        }
+        match self.head {
+            Some((head, _)) if (head..=self.loop_end).contains(&pc) => {}
+            _ => self.reset(),
+        }
+        None
+    }
+
+    /// Record a warp of `cycles` returned by [`TimeWarp::after_step`]; `fired` is set if
+    /// any timer action came due during it.
+    pub fn warped(&mut self, cycles: u64, fired: bool) {
+        self.stats.warps += 1;
+        self.stats.cycles += cycles;
+        self.chunk = if fired {
+            1
+        } else {
+            (self.chunk * 2).min(self.max_cycles)
+        };
+    }
+}
+
+/// Returns true if `instr` writes memory: a store, a compressed store or an atomic.
+pub fn is_store(instr: &RvInstr) -> bool {
+    match *instr {
+        RvInstr::Instr32(instr32) => matches!(instr32 & 0x7f, 0x23 | 0x27 | 0x2f),
+        // c.fsd, c.sw and c.fsw, in quadrants 0 and 2
+        RvInstr::Instr16(instr16) => instr16 & 1 == 0 && instr16 >> 13 >= 5,
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    const XREGS: [u32; 32] = [7; 32];
+
+    #[test]
+    fn test_is_store() {
+        // sw a0, 0(a1)
+        assert!(is_store(&RvInstr::Instr32(0x00a5_a023)));
+        // lw a0, 0(a1)
+        assert!(!is_store(&RvInstr::Instr32(0x0005_a503)));
+        // amoswap.w a0, a2, (a1)
+        assert!(is_store(&RvInstr::Instr32(0x08c5_a52f)));
+        // c.sw a0, 0(a1) and c.swsp a0, 0(sp)
+        assert!(is_store(&RvInstr::Instr16(0xc188)));
+        assert!(is_store(&RvInstr::Instr16(0xc02a)));
+        // c.lw a0, 0(a1) and c.bnez a0
+        assert!(!is_store(&RvInstr::Instr16(0x4188)));
+        assert!(!is_store(&RvInstr::Instr16(0xe101)));
+    }
+
+    #[test]
+    fn test_wfi_warps_double() {
+        let mut warp = TimeWarp::new(6);
+        let mut chunks = vec![];
+        for _ in 0..5 {
+            let cycles = warp.after_step(true, 0x100, false, 0x104, true, || XREGS);
+            chunks.push(cycles.unwrap());
+            warp.warped(cycles.unwrap(), false);
+        }
+        assert_eq!(chunks, [1, 2, 4, 6, 6]);
+        assert!(warp.saturated());
+        warp.warped(6, true);
+        assert!(!warp.saturated());
+        assert_eq!(
+            warp.after_step(true, 0x100, false, 0x104, true, || XREGS),
+            Some(1)
+        );
+        assert_eq!(
+            warp.stats(),
+            TimeWarpStats {
+                warps: 6,
+                cycles: 25
+            }
+        );
+
+        // Caliptra working
+        assert_eq!(
+            warp.after_step(true, 0x100, false, 0x104, false, || XREGS),
+            None
+        );
+    }
+
+    /// One iteration of `lw`, `andi`, `beqz` back to the `lw` at 0x200.
+    fn iteration(warp: &mut TimeWarp, xregs: [u32; 32], stored: bool) -> Option<u64> {
+        assert_eq!(
+            warp.after_step(false, 0x200, false, 0x204, true, || xregs),
+            None
+        );
+        assert_eq!(
+            warp.after_step(false, 0x204, stored, 0x208, true, || xregs),
+            None
+        );
+        warp.after_step(false, 0x208, false, 0x200, true, || xregs)
+    }
+
+    #[test]
+    fn test_polling_loop() {
+        let mut warp = TimeWarp::new(100);
+        assert_eq!(iteration(&mut warp, XREGS, false), None);
+        assert_eq!(iteration(&mut warp, XREGS, false), Some(1));
+        warp.warped(1, false);
+        assert_eq!(iteration(&mut warp, XREGS, false), Some(2));
+
+        // the loop stored something: not polling
+        assert_eq!(iteration(&mut warp, XREGS, true), None);
+        assert_eq!(iteration(&mut warp, XREGS, false), Some(1));
+
+        // a register changed, e.g. a timeout counter
+        let mut counter = XREGS;
+        counter[10] += 1;
+        assert_eq!(iteration(&mut warp, counter, false), None);
+        assert_eq!(iteration(&mut warp, counter, false), Some(1));
+
+        // leaving the loop forgets it
+        assert_eq!(
+            warp.after_step(false, 0x208, false, 0x20c, true, || XREGS),
+            None
+        );
+        assert_eq!(
+            warp.after_step(false, 0x208, false, 0x200, true, || XREGS),
+            None
+        );
+    }
+}
@@ -0,0 +1,411 @@
+/*++
+
+Licensed under the Apache-2.0 license.
+
+File Name:
+
+    trace.rs
+
+Abstract:
+
+    File contains the instruction trace sink and the compact binary trace format.
+
+--*/
+
+use crate::dis_cache::DisasmCache;
+use std::fs::File;
+use std::io::{self, BufRead, BufWriter, Error, ErrorKind, Read, Write};
+use std::path::Path;
+
+const TRACE_MAGIC: &[u8; 8] = b"MCUTRACE";
+const TRACE_VERSION: u32 = 1;
+
+/// Size of the buffer between the stepping loop and the trace file.
+const TRACE_BUFFER_SIZE: usize = 1 << 20;
+
+// Record header bits
+const HEADER_CALIPTRA: u8 = 1 << 0;
+const HEADER_COMPRESSED: u8 = 1 << 1;
+/// The PC directly follows the previous instruction of the same core and is not stored.
+const HEADER_SEQUENTIAL: u8 = 1 << 2;
+const HEADER_CYCLE_SHIFT: u8 = 3;
+const HEADER_CYCLE_MASK: u8 = 0x3 << HEADER_CYCLE_SHIFT;
+/// Same cycle as the previous record
+const CYCLE_SAME: u8 = 0;
+/// One cycle after the previous record
+const CYCLE_NEXT: u8 = 1;
+/// Cycle delta stored as a varint
+const CYCLE_DELTA: u8 = 2;
+
+/// Format of the instruction trace written with `--trace-instr`.
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub enum TraceFormat {
+    /// Disassembled MCU instructions, one per line
+    #[default]
+    Text,
+    /// Compact binary records of both cores, see [`TraceWriter`]
+    Binary,
+}
+
+pub fn parse_trace_format(s: &str) -> Result<TraceFormat, String> {
+    match s.to_lowercase().trim() {
+        "text" => Ok(TraceFormat::Text),
+        "binary" => Ok(TraceFormat::Binary),
+        _ => Err(format!(
+            "Invalid trace format: {}. Supported formats are 'text' and 'binary'.",
+            s
+        )),
+    }
+}
+
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum TraceCore {
+    Mcu,
+    Caliptra,
+}
+
+impl TraceCore {
+    fn index(self) -> usize {
+        match self {
+            TraceCore::Mcu => 0,
+            TraceCore::Caliptra => 1,
+        }
+    }
+}
+
+/// A retired instruction.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct TraceRecord {
+    pub core: TraceCore,
+    pub cycle: u64,
+    pub pc: u32,
+    pub instr: u32,
+    /// 16-bit compressed instruction
+    pub compressed: bool,
+}
+
+impl TraceRecord {
+    fn len(&self) -> u32 {
+        if self.compressed {
+            2
+        } else {
+            4
+        }
+    }
+}
+
+/// Delta state shared by the writer and reader.
+#[derive(Default)]
+struct TraceState {
+    next_pc: [u32; 2],
+    cycle: u64,
+}
+
+/// Writer for the binary trace format.
+///
+/// The file starts with the magic `MCUTRACE` and a little-endian u32 version. Each record
+/// is a header byte holding the core, whether the instruction is compressed, whether the
+/// PC follows the core's previous instruction and how the cycle relates to the previous
+/// record, followed by the optional zigzag varint PC delta, the optional varint cycle
+/// delta and the raw 2 or 4 byte instruction. Straight-line code costs 3 or 5 bytes per
+/// instruction.
+pub struct TraceWriter<W: Write> {
+    out: W,
+    state: TraceState,
+    buf: Vec<u8>,
+}
+
+impl<W: Write> TraceWriter<W> {
+    pub fn new(mut out: W) -> io::Result<Self> {
+        out.write_all(TRACE_MAGIC)?;
+        out.write_all(&TRACE_VERSION.to_le_bytes())?;
+        Ok(Self {
+            out,
+            state: TraceState::default(),
+            buf: Vec::with_capacity(32),
+        })
+    }
+
+    pub fn record(&mut self, record: &TraceRecord) -> io::Result<()> {
+        let core = record.core.index();
+        let mut header = if record.core == TraceCore::Caliptra {
+            HEADER_CALIPTRA
+        } else {
+            0
+        };
+        if record.compressed {
+            header |= HEADER_COMPRESSED;
+        }
+        let sequential = record.pc == self.state.next_pc[core];
+        if sequential {
+            header |= HEADER_SEQUENTIAL;
+        }
+        let cycle_delta = record.cycle.wrapping_sub(self.state.cycle);
+        let cycle_code = match cycle_delta {
+            0 => CYCLE_SAME,
+            1 => CYCLE_NEXT,
+            _ => CYCLE_DELTA,
+        };
+        header |= cycle_code << HEADER_CYCLE_SHIFT;
+
+        self.buf.clear();
+        self.buf.push(header);
+        if !sequential {
+            let delta = record.pc.wrapping_sub(self.state.next_pc[core]) as i32;
+            write_varint(&mut self.buf, ((delta << 1) ^ (delta >> 31)) as u32 as u64);
+        }
+        if cycle_code == CYCLE_DELTA {
+            write_varint(&mut self.buf, cycle_delta);
+        }
+        if record.compressed {
+            self.buf
+                .extend_from_slice(&(record.instr as u16).to_le_bytes());
+        } else {
+            self.buf.extend_from_slice(&record.instr.to_le_bytes());
+        }
+
+        self.state.next_pc[core] = record.pc.wrapping_add(record.len());
+        self.state.cycle = record.cycle;
+        self.out.write_all(&self.buf)
+    }
+
+    pub fn flush(&mut self) -> io::Result<()> {
+        self.out.flush()
+    }
+}
+
+/// Reader for traces written by [`TraceWriter`], yielding one record per instruction.
+pub struct TraceReader<R: BufRead> {
+    input: R,
+    state: TraceState,
+}
+
+impl<R: BufRead> TraceReader<R> {
+    pub fn new(mut input: R) -> io::Result<Self> {
+        let mut magic = [0u8; 12];
+        input.read_exact(&mut magic)?;
+        if &magic[..8] != TRACE_MAGIC {
+            Err(invalid("not an instruction trace"))?;
+        }
+        let version = u32::from_le_bytes(magic[8..].try_into().unwrap());
+        if version != TRACE_VERSION {
+            Err(invalid(&format!("unsupported trace version {}", version)))?;
+        }
+        Ok(Self {
+            input,
+            state: TraceState::default(),
+        })
+    }
+
+    fn read_record(&mut self, header: u8) -> io::Result<TraceRecord> {
+        let core = if header & HEADER_CALIPTRA != 0 {
+            TraceCore::Caliptra
+        } else {
+            TraceCore::Mcu
+        };
+        let compressed = header & HEADER_COMPRESSED != 0;
+        let mut pc = self.state.next_pc[core.index()];
+        if header & HEADER_SEQUENTIAL == 0 {
+            let zigzag = read_varint(&mut self.input)? as u32;
+            let delta = ((zigzag >> 1) as i32) ^ -((zigzag & 1) as i32);
+            pc = pc.wrapping_add(delta as u32);
+        }
+        let cycle = match (header & HEADER_CYCLE_MASK) >> HEADER_CYCLE_SHIFT {
+            CYCLE_SAME => self.state.cycle,
+            CYCLE_NEXT => self.state.cycle.wrapping_add(1),
+            CYCLE_DELTA => self.state.cycle.wrapping_add(read_varint(&mut self.input)?),
+            _ => Err(invalid("invalid trace record header"))?,
+        };
+        let instr = if compressed {
+            let mut bytes = [0u8; 2];
+            self.input.read_exact(&mut bytes)?;
+            u16::from_le_bytes(bytes) as u32
+        } else {
+            let mut bytes = [0u8; 4];
+            self.input.read_exact(&mut bytes)?;
+            u32::from_le_bytes(bytes)
+        };
+
+        let record = TraceRecord {
+            core,
+            cycle,
+            pc,
+            instr,
+            compressed,
+        };
+        self.state.next_pc[core.index()] = pc.wrapping_add(record.len());
+        self.state.cycle = cycle;
+        Ok(record)
+    }
+}
+
+impl<R: BufRead> Iterator for TraceReader<R> {
+    type Item = io::Result<TraceRecord>;
+
+    fn next(&mut self) -> Option<Self::Item> {
+        let mut header = [0u8; 1];
+        match self.input.read(&mut header) {
+            Ok(0) => None,
+            Ok(_) => Some(self.read_record(header[0]).map_err(|err| {
+                if err.kind() == ErrorKind::UnexpectedEof {
+                    invalid("truncated trace record")
+                } else {
+                    err
+                }
+            })),
+            Err(err) => Some(Err(err)),
+        }
+    }
+}
+
+fn write_varint(out: &mut Vec<u8>, mut val: u64) {
+    while val >= 0x80 {
+        out.push(val as u8 | 0x80);
+        val >>= 7;
+    }
+    out.push(val as u8);
+}
+
+fn read_varint(input: &mut impl Read) -> io::Result<u64> {
+    let mut val = 0u64;
+    for shift in (0..64).step_by(7) {
+        let mut byte = [0u8; 1];
+        input.read_exact(&mut byte)?;
+        val |= ((byte[0] & 0x7f) as u64) << shift;
+        if byte[0] & 0x80 == 0 {
+            return Ok(val);
+        }
+    }
+    Err(invalid("varint too long"))
+}
+
+fn invalid(msg: &str) -> Error {
+    Error::new(ErrorKind::InvalidData, msg)
+}
+
+enum TraceOutput {
+    /// Disassembled MCU instructions; Caliptra instructions are only echoed to stdout
+    Text(BufWriter<File>),
+    Binary(TraceWriter<BufWriter<File>>),
+}
+
+/// Destination of the instruction trace written with `--trace-instr`.
+pub struct TraceSink {
+    output: TraceOutput,
+    stdout: bool,
+    mcu_disasm_cache: DisasmCache,
+    caliptra_disasm_cache: DisasmCache,
+}
+
+impl TraceSink {
+    /// Create the trace file for `format` in `log_dir`, optionally echoing every
+    /// instruction to stdout.
+    pub fn create(log_dir: &Path, format: TraceFormat, stdout: bool) -> io::Result<Self> {
+        let output = match format {
+            TraceFormat::Text => TraceOutput::Text(BufWriter::with_capacity(
+                TRACE_BUFFER_SIZE,
+                File::create(log_dir.join("caliptra_instr_trace.txt"))?,
+            )),
+            TraceFormat::Binary => {
+                TraceOutput::Binary(TraceWriter::new(BufWriter::with_capacity(
+                    TRACE_BUFFER_SIZE,
+                    File::create(log_dir.join("instr_trace.bin"))?,
+                ))?)
+            }
+        };
+        Ok(Self {
+            output,
+            stdout,
+            mcu_disasm_cache: DisasmCache::default(),
+            caliptra_disasm_cache: DisasmCache::default(),
+        })
+    }
+
+    /// Record a retired instruction, disassembling it only if the format or the stdout
+    /// echo needs it.
+    pub fn record(&mut self, record: &TraceRecord) {
+        let disasm_cache = match record.core {
+            TraceCore::Mcu => &mut self.mcu_disasm_cache,
+            TraceCore::Caliptra => &mut self.caliptra_disasm_cache,
+        };
+        let _ = match &mut self.output {
+            TraceOutput::Text(out) if record.core == TraceCore::Mcu => {
+                writeln!(out, "{}", disasm_cache.get(record.pc, record.instr))
+            }
+            TraceOutput::Text(_) => Ok(()),
+            TraceOutput::Binary(writer) => writer.record(record),
+        };
+        if self.stdout {
+            let text = disasm_cache.get(record.pc, record.instr);
+            match record.core {
+                TraceCore::Mcu => println!("{{mcu cpu}}      {}", text),
+                TraceCore::Caliptra => println!("{{caliptra cpu}} {}", text),
+            }
+        }
+    }
+
+    pub fn flush(&mut self) -> io::Result<()> {
+        match &mut self.output {
+            TraceOutput::Text(out) => out.flush(),
+            TraceOutput::Binary(writer) => writer.flush(),
+        }
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    #[test]
+    fn test_round_trip() {
+        let records = [
+            TraceRecord {
+                core: TraceCore::Mcu,
+                cycle: 0,
+                pc: 0x4000_0000,
+                instr: 0x0015_0513,
+                compressed: false,
+            },
+            TraceRecord {
+                core: TraceCore::Caliptra,
+                cycle: 0,
+                pc: 0x0,
+                instr: 0x4501,
+                compressed: true,
+            },
+            TraceRecord {
+                core: TraceCore::Mcu,
+                cycle: 1,
+                pc: 0x4000_0004,
+                instr: 0xffdf_f06f,
+                compressed: false,
+            },
+            TraceRecord {
+                core: TraceCore::Mcu,
+                cycle: 1_000_000,
+                pc: 0x4000_0000,
+                instr: 0x0015_0513,
+                compressed: false,
+            },
+        ];
+
+        let mut writer = TraceWriter::new(vec![]).unwrap();
+        for record in records.iter() {
+            writer.record(record).unwrap();
+        }
+        let bytes = writer.out;
+        // sequential instructions in the same or next cycle are 3 or 5 bytes
+        assert_eq!(bytes.len(), 12 + 10 + 3 + 5 + 9);
+
+        let read: Vec<TraceRecord> = TraceReader::new(&bytes[..])
+            .unwrap()
+            .collect::<io::Result<_>>()
+            .unwrap();
+        assert_eq!(read, records);
+
+        let truncated: Vec<io::Result<TraceRecord>> = TraceReader::new(&bytes[..bytes.len() - 1])
+            .unwrap()
+            .collect();
+        assert!(truncated.last().unwrap().is_err());
+    }
+}
@@ -0,0 +1,73 @@
+/*++
+
+Licensed under the Apache-2.0 license.
+
+File Name:
+
+    trace_dis.rs
+
+Abstract:
+
+    File contains the offline disassembler for binary instruction traces.
+
+--*/
+
+use clap::Parser;
+use emulator::dis_cache::DisasmCache;
+use emulator::trace::{TraceCore, TraceReader};
+use std::fs::File;
+use std::io::{self, BufReader, BufWriter, Write};
+use std::path::PathBuf;
+
+/// Disassemble an instruction trace written with `--trace-instr --trace-format binary`.
+#[derive(Parser, Debug)]
+#[command(version, about, long_about = None, name = "Caliptra MCU Emulator Trace Disassembler")]
+struct Args {
+    /// Binary trace file (instr_trace.bin in the log directory)
+    trace: PathBuf,
+
+    /// Only print instructions of this core: mcu or caliptra
+    #[arg(long)]
+    core: Option<String>,
+
+    /// Prefix each instruction with the cycle it retired in
+    #[arg(long, default_value_t = false)]
+    cycles: bool,
+}
+
+fn main() -> io::Result<()> {
+    let args = Args::parse();
+    let core = match args.core.as_deref().map(|core| core.to_lowercase()) {
+        None => None,
+        Some(core) if core == "mcu" => Some(TraceCore::Mcu),
+        Some(core) if core == "caliptra" => Some(TraceCore::Caliptra),
+        Some(core) => {
+            eprintln!(
+                "Invalid core: {}. Supported cores are 'mcu' and 'caliptra'.",
+                core
+            );
+            std::process::exit(1);
+        }
+    };
+
+    let reader = TraceReader::new(BufReader::with_capacity(1 << 20, File::open(&args.trace)?))?;
+    let mut out = BufWriter::new(io::stdout().lock());
+    let mut mcu_cache = DisasmCache::default();
+    let mut caliptra_cache = DisasmCache::default();
+
+    for record in reader {
+        let record = record?;
+        if core.is_some_and(|core| core != record.core) {
+            continue;
+        }
+        let (prefix, cache) = match record.core {
+            TraceCore::Mcu => ("{mcu cpu}     ", &mut mcu_cache),
+            TraceCore::Caliptra => ("{caliptra cpu}", &mut caliptra_cache),
+        };
+        if args.cycles {
+            write!(out, "{:>12} ", record.cycle)?;
+        }
+        writeln!(out, "{} {}", prefix, cache.get(record.pc, record.instr))?;
+    }
+    out.flush()
+}
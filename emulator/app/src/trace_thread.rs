@@ -0,0 +1,270 @@
+/*++
+
+Licensed under the Apache-2.0 license.
+
+File Name:
+
+    trace_thread.rs
+
+Abstract:
+
+    File contains the background writer thread for the instruction trace and the
+    bounded lock-free queue that feeds it.
+
+--*/
+
+use crate::trace::{TraceRecord, TraceSink};
+use std::cell::UnsafeCell;
+use std::mem::MaybeUninit;
+use std::sync::atomic::{AtomicBool, AtomicUsize, Ordering};
+use std::sync::Arc;
+use std::thread::{self, JoinHandle};
+use std::time::Duration;
+
+/// Default queue capacity in records (24 MiB).
+pub const DEFAULT_TRACE_QUEUE_RECORDS: usize = 1 << 20;
+
+/// While sampling, one in this many records is queued.
+const SAMPLE_INTERVAL: u64 = 64;
+
+/// How long the writer thread sleeps when the queue is empty.
+const WRITER_IDLE: Duration = Duration::from_millis(1);
+
+/// What the stepping thread does when the trace queue is full.
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub enum TraceQueuePolicy {
+    /// Wait for the writer thread; the trace is complete
+    #[default]
+    Block,
+    /// Discard the record and count it
+    Drop,
+    /// Keep one in `SAMPLE_INTERVAL` records until the queue is half empty again
+    Sample,
+}
+
+pub fn parse_trace_queue_policy(s: &str) -> Result<TraceQueuePolicy, String> {
+    match s.to_lowercase().trim() {
+        "block" => Ok(TraceQueuePolicy::Block),
+        "drop" => Ok(TraceQueuePolicy::Drop),
+        "sample" => Ok(TraceQueuePolicy::Sample),
+        _ => Err(format!(
+            "Invalid trace queue policy: {}. Supported policies are 'block', 'drop' and 'sample'.",
+            s
+        )),
+    }
+}
+
+/// Single-producer single-consumer ring of trace records.
+struct TraceQueue {
+    slots: Box<[UnsafeCell<MaybeUninit<TraceRecord>>]>,
+    /// Next slot the producer writes; only the producer stores it
+    head: AtomicUsize,
+    /// Next slot the consumer reads; only the consumer stores it
+    tail: AtomicUsize,
+    closed: AtomicBool,
+}
+
+// SAFETY: slots in [tail, head) are only read by the consumer and slots outside it are only
+// written by the producer; the release/acquire pairs on head and tail order the accesses.
+unsafe impl Sync for TraceQueue {}
+
+impl TraceQueue {
+    fn new(capacity: usize) -> Self {
+        let capacity = capacity.max(2).next_power_of_two();
+        Self {
+            slots: (0..capacity)
+                .map(|_| UnsafeCell::new(MaybeUninit::uninit()))
+                .collect(),
+            head: AtomicUsize::new(0),
+            tail: AtomicUsize::new(0),
+            closed: AtomicBool::new(false),
+        }
+    }
+
+    fn capacity(&self) -> usize {
+        self.slots.len()
+    }
+
+    fn len(&self) -> usize {
+        self.head
+            .load(Ordering::Acquire)
+            .wrapping_sub(self.tail.load(Ordering::Acquire))
+    }
+
+    /// Producer side. Returns false if the queue is full.
+    fn push(&self, record: &TraceRecord) -> bool {
+        let head = self.head.load(Ordering::Relaxed);
+        if head.wrapping_sub(self.tail.load(Ordering::Acquire)) == self.capacity() {
+            return false;
+        }
+        // SAFETY: the slot is outside [tail, head), so the consumer is not reading it
+        unsafe { (*self.slots[head & (self.capacity() - 1)].get()).write(*record) };
+        self.head.store(head.wrapping_add(1), Ordering::Release);
+        true
+    }
+
+    /// Consumer side. Hands every queued record to `f` and returns how many there were.
+    fn pop_all(&self, mut f: impl FnMut(&TraceRecord)) -> usize {
+        let tail = self.tail.load(Ordering::Relaxed);
+        let head = self.head.load(Ordering::Acquire);
+        let count = head.wrapping_sub(tail);
+        for i in 0..count {
+            let index = tail.wrapping_add(i) & (self.capacity() - 1);
+            // SAFETY: the slot is within [tail, head) and was initialized by `push`
+            f(unsafe { (*self.slots[index].get()).assume_init_ref() });
+        }
+        self.tail.store(head, Ordering::Release);
+        count
+    }
+}
+
+/// Instruction trace sink running on a dedicated writer thread.
+///
+/// The stepping thread only copies records into a bounded lock-free queue; disassembly,
+/// formatting and file I/O happen on the writer thread. Dropping it drains the queue,
+/// flushes the trace file and reports any records lost to the queue policy.
+pub struct TraceThread {
+    queue: Arc<TraceQueue>,
+    policy: TraceQueuePolicy,
+    writer: Option<JoinHandle<()>>,
+    sampling: bool,
+    sample_count: u64,
+    dropped: u64,
+}
+
+impl TraceThread {
+    pub fn spawn(mut sink: TraceSink, policy: TraceQueuePolicy, capacity: usize) -> Self {
+        let queue = Arc::new(TraceQueue::new(capacity));
+        let writer_queue = queue.clone();
+        let writer = thread::Builder::new()
+            .name("trace-writer".into())
+            .spawn(move || {
+                loop {
+                    if writer_queue.pop_all(|record| sink.record(record)) == 0 {
+                        // anything pushed before `closed` was set is visible now
+                        if writer_queue.closed.load(Ordering::Acquire) {
+                            writer_queue.pop_all(|record| sink.record(record));
+                            break;
+                        }
+                        thread::park_timeout(WRITER_IDLE);
+                    }
+                }
+                let _ = sink.flush();
+            })
+            .expect("failed to start the trace writer thread");
+        Self {
+            queue,
+            policy,
+            writer: Some(writer),
+            sampling: false,
+            sample_count: 0,
+            dropped: 0,
+        }
+    }
+
+    /// Queue a retired instruction, applying the queue policy if the queue is full.
+    #[inline]
+    pub fn record(&mut self, record: &TraceRecord) {
+        if self.sampling {
+            if self.queue.len() < self.queue.capacity() / 2 {
+                self.sampling = false;
+            } else {
+                self.sample_count += 1;
+                if self.sample_count % SAMPLE_INTERVAL != 0 {
+                    self.dropped += 1;
+                    return;
+                }
+            }
+        }
+        while !self.queue.push(record) {
+            match self.policy {
+                TraceQueuePolicy::Block => {
+                    if let Some(writer) = self.writer.as_ref() {
+                        writer.thread().unpark();
+                    }
+                    thread::yield_now();
+                }
+                TraceQueuePolicy::Drop => {
+                    self.dropped += 1;
+                    return;
+                }
+                TraceQueuePolicy::Sample => {
+                    self.sampling = true;
+                    self.dropped += 1;
+                    return;
+                }
+            }
+        }
+    }
+
+    /// Number of records discarded by the `Drop` and `Sample` policies.
+    pub fn dropped(&self) -> u64 {
+        self.dropped
+    }
+}
+
+impl Drop for TraceThread {
+    fn drop(&mut self) {
+        self.queue.closed.store(true, Ordering::Release);
+        if let Some(writer) = self.writer.take() {
+            writer.thread().unpark();
+            let _ = writer.join();
+        }
+        if self.dropped != 0 {
+            println!(
+                "Instruction trace: {} records not written ({:?} policy)",
+                self.dropped, self.policy
+            );
+        }
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+    use crate::trace::TraceCore;
+
+    fn record(pc: u32) -> TraceRecord {
+        TraceRecord {
+            core: TraceCore::Mcu,
+            cycle: pc as u64,
+            pc,
+            instr: 0x0015_0513,
+            compressed: false,
+        }
+    }
+
+    #[test]
+    fn test_queue_full_and_wrap() {
+        let queue = TraceQueue::new(4);
+        for round in 0..3 {
+            for i in 0..4 {
+                assert!(queue.push(&record(round * 4 + i)));
+            }
+            assert!(!queue.push(&record(99)));
+            let mut pcs = vec![];
+            assert_eq!(queue.pop_all(|r| pcs.push(r.pc)), 4);
+            assert_eq!(pcs, (round * 4..round * 4 + 4).collect::<Vec<_>>());
+        }
+        assert_eq!(queue.len(), 0);
+    }
+
+    #[test]
+    fn test_cross_thread_order() {
+        let queue = Arc::new(TraceQueue::new(64));
+        let consumer_queue = queue.clone();
+        let consumer = thread::spawn(move || {
+            let mut pcs = vec![];
+            while pcs.len() < 10_000 {
+                consumer_queue.pop_all(|r| pcs.push(r.pc));
+            }
+            pcs
+        });
+        for pc in 0..10_000 {
+            while !queue.push(&record(pc)) {
+                thread::yield_now();
+            }
+        }
+        assert_eq!(consumer.join().unwrap(), (0..10_000).collect::<Vec<_>>());
+    }
+}
@@ -30,12 +30,13 @@ Build Instructions:
 
 --*/
 
-#define _DEFAULT_SOURCE  // For usleep on some systems
+#define _DEFAULT_SOURCE  // For select and termios extensions on some systems
 #include "emulator_cbinding.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 
 #ifdef _WIN32
     #include <windows.h>
@@ -82,6 +83,11 @@ Build Instructions:
     #include <termios.h>
     #include <fcntl.h>
     #include <sys/select.h>
+    #include <pthread.h>
+    #include <sched.h>
+    #include <stdatomic.h>
+    #include <limits.h>
+    #include <sys/stat.h>
 #endif
 
 #ifdef _WIN32
@@ -221,13 +227,11 @@ int getopt_long(int argc, char * const argv[], const char *optstring,
     return c;
 }
 
-// Windows sleep function (usleep equivalent)
-void usleep(unsigned int microseconds) {
-    if (microseconds >= 1000) {
-        Sleep(microseconds / 1000); // Sleep takes milliseconds
-    } else if (microseconds > 0) {
-        Sleep(1); // Minimum 1ms sleep for sub-millisecond requests
-    }
+// Windows version of waiting for console input with a timeout. There is no I3C socket
+// descriptor to wait on here.
+void wait_for_input(int input_fd, unsigned int timeout_us) {
+    (void)input_fd;
+    WaitForSingleObject(GetStdHandle(STD_INPUT_HANDLE), (timeout_us + 999) / 1000);
 }
 
 // Windows version of kbhit check
@@ -259,13 +263,47 @@ int getch_char() {
     return getchar();
 }
 
+// Block until console input is available, the emulator's input descriptor (see
+// emulator_get_input_fd, -1 if none) is readable or the timeout expires
+void wait_for_input(int input_fd, unsigned int timeout_us) {
+    fd_set read_fds;
+    struct timeval timeout;
+    int max_fd = STDIN_FILENO;
+
+    FD_ZERO(&read_fds);
+    FD_SET(STDIN_FILENO, &read_fds);
+    if (input_fd >= 0) {
+        FD_SET(input_fd, &read_fds);
+        if (input_fd > max_fd) {
+            max_fd = input_fd;
+        }
+    }
+    timeout.tv_sec = timeout_us / 1000000;
+    timeout.tv_usec = timeout_us % 1000000;
+
+    if (select(max_fd + 1, &read_fds, NULL, NULL, &timeout) > 0 &&
+        input_fd >= 0 && FD_ISSET(input_fd, &read_fds)) {
+        // The descriptor only signals that I3C commands are queued; read it empty so that
+        // the next wait blocks again
+        char buf[64];
+        while (read(input_fd, buf, sizeof(buf)) > 0) {
+        }
+    }
+}
+
 #endif
 
 // Global emulator pointer for signal handler
 static struct CEmulator* global_emulator = NULL;
+static const struct CMemoryMap* global_memory_map = NULL;
 
 // Function declarations
-void free_run(struct CEmulator* emulator);
+int free_run(struct CEmulator* emulator);
+size_t drain_uart_ring(struct CUartRing* ring);
+int run_host(const struct CEmulatorConfig* config, int instance_count, int worker_count,
+             unsigned long long max_cycles);
+int run_bench(const struct CEmulatorConfig* config, const char* output_path,
+              unsigned long long iterations, unsigned long long max_boot_cycles);
 
 // Terminal settings for raw input
 #ifdef _WIN32
@@ -356,6 +394,8 @@ void signal_handler(int sig) {
 // atexit handler to ensure terminal is always restored
 void cleanup_on_exit(void) {
     disable_raw_mode();
+    emulator_memory_map_free(global_memory_map);
+    global_memory_map = NULL;
 }
 
 void print_usage(const char* program_name) {
@@ -373,6 +413,9 @@ void print_usage(const char* program_name) {
     printf("  -g, --gdb-port <GDB_PORT>            GDB Debugger Port\n");
     printf("  -l, --log-dir <LOG_DIR>              Directory in which to log execution artifacts\n");
     printf("  -t, --trace-instr                    Trace instructions\n");
+    printf("      --trace-format <FORMAT>          Instruction trace format: text or binary (default: text)\n");
+    printf("      --trace-stdout                   Echo traced instructions to stdout\n");
+    printf("      --trace-queue-policy <POLICY>    When the trace writer falls behind: block, drop or sample (default: block)\n");
     printf("      --no-stdin-uart                  Don't pass stdin to the MCU UART Rx\n");
     printf("      --i3c-port <I3C_PORT>            I3C socket port\n");
     printf("      --manufacturing-mode             Enable manufacturing mode\n");
@@ -385,7 +428,18 @@ void print_usage(const char* program_name) {
     printf("                                       Primary flash image path\n");
     printf("      --secondary-flash-image <SECONDARY_FLASH_IMAGE>\n");
     printf("                                       Secondary flash image path\n");
+    printf("      --map-flash-images               Map flash images copy-on-write instead of copying them into the flash files\n");
+    printf("      --primary-flash-file <FILE>      Primary flash backing file (default: primary_flash)\n");
+    printf("      --secondary-flash-file <FILE>    Secondary flash backing file (default: secondary_flash)\n");
     printf("      --hw-revision <HW_REVISION>      HW revision in semver format (default: 2.0.0)\n");
+    printf("      --time-warp <MAX_CYCLES>         Skip idle periods, warping the clocks by at most MAX_CYCLES at a time\n");
+    printf("      --memory-map <PROFILE|FILE>      Memory map profile (default, emulator, fpga) or TOML file,\n");
+    printf("                                       combined with the overrides below and shared by all instances\n");
+    printf("      --instances <N>                  Run N independent emulators in this process\n");
+    printf("      --threads <N>                    Worker threads for --instances (default: CPU count)\n");
+    printf("      --max-cycles <N>                 Per-instance cycle limit for --instances, boot cycle limit for --bench\n");
+    printf("      --bench <JSON_FILE>              Boot to MCU runtime, time the C API hot paths and write JSON (- for stdout)\n");
+    printf("      --bench-iterations <N>           Calls per timed loop for --bench (default: 1000000)\n");
     printf("  -h, --help                           Print help\n");
     printf("  -V, --version                        Print version\n");
     printf("\nMemory layout overrides (use hex values like 0x40000000):\n");
@@ -420,93 +474,610 @@ void print_usage(const char* program_name) {
     printf("      --mbox-size <MBOX_SIZE>          Override Caliptra mailbox size\n");
 }
 
+// Write all pending bytes in the UART output ring to stderr and consume them.
+// The ring is drained in place, without copying through an intermediate buffer.
+size_t drain_uart_ring(struct CUartRing* ring) {
+    if (!ring) {
+        return 0;
+    }
+
+    unsigned int head = ring->head;
+    unsigned int tail = ring->tail;
+    size_t drained = 0;
+    while (tail != head) {
+        unsigned int index = tail & (ring->capacity - 1);
+        unsigned int chunk = head - tail;
+        if (chunk > ring->capacity - index) {
+            chunk = ring->capacity - index; // Stop at the end of the ring, wrap next time round
+        }
+        // Print UART output to stderr to match Rust emulator behavior
+        fwrite(ring->data + index, 1, chunk, stderr);
+        tail += chunk;
+        drained += chunk;
+    }
+    ring->tail = tail;
+
+    if (drained > 0) {
+        fflush(stderr);
+    }
+    return drained;
+}
+
 // Free run function similar to main.rs
-void free_run(struct CEmulator* emulator) {
+// Returns the process exit status: non-zero if the firmware reported a failure.
+int free_run(struct CEmulator* emulator) {
     printf("Running emulator in normal mode...\n");
     printf("Console input enabled - type characters to send to UART RX\n");
 
     // Enable raw terminal mode for immediate character input
     enable_raw_mode();
 
-    // Buffer for UART output (streaming mode)
-    const size_t uart_buffer_size = 1024;
-    char* uart_buffer = malloc(uart_buffer_size);
-    if (!uart_buffer) {
-        fprintf(stderr, "Failed to allocate UART buffer\n");
-        disable_raw_mode();
-        return;
+    // UART output is drained straight from the emulator's ring buffer (NULL if not captured)
+    struct CUartRing* uart_ring = emulator_get_uart_ring(emulator);
+    if (uart_ring) {
+        printf("Mapped UART output ring: %u bytes\n", uart_ring->capacity);
     }
 
-    printf("Allocated UART buffer: %zu bytes\n", uart_buffer_size);
+    // Run in batches inside Rust, returning early whenever both cores are parked on wfi.
+    // There is no sleep while work is pending. The ring holds more than one batch can
+    // produce, so output is drained once per batch.
+    const unsigned long long batch_cycles = 10000;
+    // How long to block on console and I3C input once the emulator reports that it is idle.
+    // Idle is not reported while an interrupt is pending, or while the time warp (if
+    // enabled) still finds timer actions coming due.
+    const unsigned int idle_wait_us = 1000;
+    const int input_fd = emulator_get_input_fd(emulator);
+    struct CRunConditions conditions = {
+        .stop_on_uart_output = 0,
+        .stop_on_pc = 0,
+        .stop_pc = 0,
+        .stop_on_idle = 1,
+    };
 
-    int step_count = 0;
+    unsigned long long step_count = 0;
     while (1) {
         // Check for console input and send to UART RX if available
-        // Only check input every 100 steps to reduce overhead
-        if (step_count % 100 == 0) {
+        // Only check input once per batch to reduce overhead
 #ifdef _WIN32
-            if (kbhit_available()) {
-                char input_char = (char)getch_char();
+        if (kbhit_available()) {
+            char input_char = (char)getch_char();
 #else
-            char input_char;
-            if (read(STDIN_FILENO, &input_char, 1) == 1) {
+        char input_char;
+        if (read(STDIN_FILENO, &input_char, 1) == 1) {
 #endif
-                // Handle special characters
-                if (input_char == 3) { // Ctrl+C
-                    break;
-                } else if (input_char == 127) { // Backspace
-                    input_char = 8; // Convert to ASCII backspace
-                }
+            // Handle special characters
+            if (input_char == 3) { // Ctrl+C
+                break;
+            } else if (input_char == 127) { // Backspace
+                input_char = 8; // Convert to ASCII backspace
+            }
 
-                // Try to send character to UART RX
-                if (emulator_uart_rx_ready(emulator)) {
-                    emulator_send_uart_char(emulator, input_char);
-                    // No local echo - let the UART output handle display
-                }
+            // Try to send character to UART RX
+            if (emulator_uart_rx_ready(emulator)) {
+                emulator_send_uart_char(emulator, input_char);
+                // No local echo - let the UART output handle display
             }
         }
 
-        enum CStepAction action = emulator_step(emulator);
+        unsigned long long cycles = 0;
+        enum CStepAction action = emulator_run_until(emulator, batch_cycles, &conditions, &cycles);
+        step_count += cycles;
 
-        // Check for UART output (streaming mode)
-        int uart_len = emulator_get_uart_output_streaming(emulator, uart_buffer, uart_buffer_size);
-        if (uart_len > 0) {
-            // Print UART output to stderr to match Rust emulator behavior
-            fprintf(stderr, "%.*s", uart_len, uart_buffer);
-            fflush(stderr);
-        }
+        drain_uart_ring(uart_ring);
 
         switch (action) {
+            case Idle:
+                // Nothing to run until an interrupt arrives; block on input instead of spinning
+                wait_for_input(input_fd, idle_wait_us);
+                break;
+
             case Continue:
-                step_count++;
-                // Yield occasionally to avoid busy waiting
-                if (step_count % 1000 == 0) {
-                    usleep(100); // 0.1ms sleep every 1000 steps
-                }
+            case UartOutput:
+            case PcMatch:
                 break;
 
             case Break:
-                printf("\nEmulator hit breakpoint after %d steps\n", step_count);
+                printf("\nEmulator hit breakpoint after %llu steps\n", step_count);
                 disable_raw_mode();
-                free(uart_buffer);
-                return;
+                return 0;
 
             case ExitSuccess:
-                printf("\nEmulator finished successfully after %d steps\n", step_count);
+                printf("\nEmulator finished successfully after %llu steps\n", step_count);
                 disable_raw_mode();
-                free(uart_buffer);
-                return;
+                return 0;
 
             case ExitFailure:
-                printf("\nEmulator exited with failure after %d steps\n", step_count);
+                printf("\nEmulator exited with failure after %llu steps\n", step_count);
                 disable_raw_mode();
-                free(uart_buffer);
-                return;
+                return 1;
         }
     }
 
     disable_raw_mode();
-    free(uart_buffer);
+    return 0;
+}
+
+#ifndef _WIN32
+// Multi-instance host mode.
+//
+// Runs several independent emulators over a pool of worker threads. An emulator may only
+// be used from the thread that created it, so the load is balanced when instances start:
+// each worker takes the next instance that has not started from a shared index, creates
+// it, runs it one quantum at a time until it stops, destroys it and takes the next one.
+// A worker whose instances finish early thus picks up the instances left to the others.
+//
+// Each instance gets a directory of its own, <log dir>/instance-<i>, that holds its logs,
+// its flash backing files and, with --otp, a private copy of the OTP fuse file.
+
+#define HOST_QUANTUM_CYCLES 100000ULL
+
+struct host_instance {
+    struct CEmulator* emulator; // NULL unless the instance is running
+    unsigned long long cycles;
+    enum CStepAction result;
+    int started; // Set once the instance was created
+    int running;
+    int at_line_start; // UART output prefixing state
+};
+
+struct host {
+    const struct CEmulatorConfig* config; // Shared by all instances, except for the paths
+    const char* dir;                      // Parent of the instance directories
+    struct host_instance* instances;
+    int instance_count;
+    atomic_int next_instance;             // Index of the next instance to start
+    int worker_count;
+    unsigned long long max_cycles;
+    pthread_mutex_t output_lock;
+};
+
+struct host_worker {
+    struct host* host;
+    int index;
+    pthread_t thread;
+};
+
+// Copy `from` to `to`, replacing it. A missing `from` is not an error, the emulator then
+// creates a blank fuse file just as it would for the original path.
+static int host_copy_file(const char* from, const char* to) {
+    FILE* in = fopen(from, "rb");
+    if (!in) {
+        return errno == ENOENT ? 0 : -1;
+    }
+    FILE* out = fopen(to, "wb");
+    if (!out) {
+        fclose(in);
+        return -1;
+    }
+    char buffer[65536];
+    size_t len;
+    int status = 0;
+    while ((len = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+        if (fwrite(buffer, 1, len, out) != len) {
+            status = -1;
+            break;
+        }
+    }
+    if (ferror(in)) {
+        status = -1;
+    }
+    fclose(in);
+    if (fclose(out) != 0) {
+        status = -1;
+    }
+    return status;
+}
+
+// Create `path` and any missing parent directories, like mkdir -p
+static int host_make_dirs(const char* path) {
+    char dir[PATH_MAX];
+    if (snprintf(dir, sizeof(dir), "%s", path) >= (int)sizeof(dir)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    for (char* p = dir + 1; *p; p++) {
+        if (*p != '/') {
+            continue;
+        }
+        *p = '\0';
+        if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+            return -1;
+        }
+        *p = '/';
+    }
+    return mkdir(dir, 0755) != 0 && errno != EEXIST ? -1 : 0;
+}
+
+// Create instance `index` with its own log directory, flash files and OTP file.
+// Must be called on the worker thread that runs the instance.
+static int host_instance_create(struct host* host, int index) {
+    struct host_instance* instance = &host->instances[index];
+    struct CEmulatorConfig config = *host->config;
+    char dir[PATH_MAX];
+    char primary_flash[PATH_MAX];
+    char secondary_flash[PATH_MAX];
+    char otp[PATH_MAX];
+
+    snprintf(dir, sizeof(dir), "%s/instance-%d", host->dir, index);
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Failed to create %s for instance %d: %s\n", dir, index, strerror(errno));
+        return -1;
+    }
+    snprintf(primary_flash, sizeof(primary_flash), "%s/primary_flash", dir);
+    snprintf(secondary_flash, sizeof(secondary_flash), "%s/secondary_flash", dir);
+    config.log_dir_path = dir;
+    config.primary_flash_file_path = primary_flash;
+    config.secondary_flash_file_path = secondary_flash;
+    if (config.otp_path) {
+        snprintf(otp, sizeof(otp), "%s/otp", dir);
+        if (host_copy_file(config.otp_path, otp) != 0) {
+            fprintf(stderr, "Failed to copy %s for instance %d: %s\n", config.otp_path, index,
+                    strerror(errno));
+            return -1;
+        }
+        config.otp_path = otp;
+    }
+
+    void* memory = aligned_alloc(emulator_get_alignment(), emulator_get_size());
+    if (!memory) {
+        fprintf(stderr, "Failed to allocate memory for instance %d: %s\n", index, strerror(errno));
+        return -1;
+    }
+    enum EmulatorError result = emulator_init((struct CEmulator*)memory, &config);
+    if (result != Success) {
+        fprintf(stderr, "Failed to initialize instance %d: %d\n", index, result);
+        free(memory);
+        return -1;
+    }
+    emulator_detach_globals((struct CEmulator*)memory);
+
+    instance->emulator = (struct CEmulator*)memory;
+    instance->started = 1;
+    instance->running = 1;
+    return 0;
+}
+
+// Write an instance's pending UART output to stderr, prefixing each line with its index
+static void host_drain_uart(struct host* host, int index) {
+    struct host_instance* instance = &host->instances[index];
+    struct CUartRing* ring = emulator_get_uart_ring(instance->emulator);
+    if (!ring || ring->head == ring->tail) {
+        return;
+    }
+
+    pthread_mutex_lock(&host->output_lock);
+    unsigned int head = ring->head;
+    for (unsigned int tail = ring->tail; tail != head; tail++) {
+        unsigned char ch = ring->data[tail & (ring->capacity - 1)];
+        if (instance->at_line_start) {
+            fprintf(stderr, "[emu %d] ", index);
+        }
+        fputc(ch, stderr);
+        instance->at_line_start = (ch == '\n');
+    }
+    ring->tail = head;
+    fflush(stderr);
+    pthread_mutex_unlock(&host->output_lock);
+}
+
+static void* host_worker_main(void* arg) {
+    struct host_worker* worker = (struct host_worker*)arg;
+    struct host* host = worker->host;
+    struct CRunConditions conditions = {0};
+
+    int i;
+    while ((i = atomic_fetch_add(&host->next_instance, 1)) < host->instance_count) {
+        struct host_instance* instance = &host->instances[i];
+        if (host_instance_create(host, i) != 0) {
+            continue;
+        }
+
+        while (instance->running) {
+            unsigned long long budget = HOST_QUANTUM_CYCLES;
+            if (host->max_cycles && host->max_cycles - instance->cycles < budget) {
+                budget = host->max_cycles - instance->cycles;
+            }
+
+            unsigned long long cycles = 0;
+            enum CStepAction action =
+                emulator_run_until(instance->emulator, budget, &conditions, &cycles);
+            instance->cycles += cycles;
+            host_drain_uart(host, i);
+
+            if (action == Break || action == ExitSuccess || action == ExitFailure ||
+                (host->max_cycles && instance->cycles >= host->max_cycles)) {
+                instance->result = action;
+                instance->running = 0;
+            }
+        }
+
+        emulator_destroy(instance->emulator);
+        free(instance->emulator);
+        instance->emulator = NULL;
+    }
+    return NULL;
+}
+
+// Run `instance_count` emulators created from `config` on `worker_count` threads until all
+// of them exit, break, or have run `max_cycles` cycles (0 means no limit).
+// Returns the process exit status: 0 if every instance exited successfully.
+int run_host(const struct CEmulatorConfig* config, int instance_count, int worker_count,
+             unsigned long long max_cycles) {
+    if (worker_count <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        worker_count = cpus > 0 ? (int)cpus : 1;
+    }
+    if (worker_count > instance_count) {
+        worker_count = instance_count;
+    }
+
+    // Instances share nothing that is bound to a port or the console
+    struct CEmulatorConfig instance_config = *config;
+    instance_config.gdb_port = 0;
+    instance_config.i3c_port = 0;
+    instance_config.stdin_uart = 0;
+    instance_config.capture_uart_output = 1;
+
+    const char* dir = config->log_dir_path ? config->log_dir_path : "/tmp";
+    if (host_make_dirs(dir) != 0) {
+        fprintf(stderr, "Failed to create %s: %s\n", dir, strerror(errno));
+        return 1;
+    }
+
+    struct host host = {
+        .config = &instance_config,
+        .dir = dir,
+        .instances = calloc(instance_count, sizeof(struct host_instance)),
+        .instance_count = instance_count,
+        .worker_count = worker_count,
+        .max_cycles = max_cycles,
+    };
+    struct host_worker* workers = calloc(worker_count, sizeof(struct host_worker));
+    if (!host.instances || !workers) {
+        fprintf(stderr, "Failed to allocate host state\n");
+        return 1;
+    }
+    pthread_mutex_init(&host.output_lock, NULL);
+    atomic_init(&host.next_instance, 0);
+    for (int i = 0; i < instance_count; i++) {
+        host.instances[i].result = Continue;
+        host.instances[i].at_line_start = 1;
+    }
+
+    printf("Running %d emulator instances on %d worker threads\n", instance_count, worker_count);
+    for (int i = 0; i < worker_count; i++) {
+        workers[i].host = &host;
+        workers[i].index = i;
+        pthread_create(&workers[i].thread, NULL, host_worker_main, &workers[i]);
+    }
+    for (int i = 0; i < worker_count; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+
+    int status = 0;
+    for (int i = 0; i < instance_count; i++) {
+        const char* outcome = "timed out";
+        if (!host.instances[i].started) {
+            outcome = "failed to start";
+        } else {
+            switch (host.instances[i].result) {
+                case ExitSuccess: outcome = "finished successfully"; break;
+                case ExitFailure: outcome = "exited with failure"; break;
+                case Break: outcome = "stopped"; break;
+                default: break;
+            }
+        }
+        printf("Instance %d %s after %llu steps\n", i, outcome, host.instances[i].cycles);
+        if (!host.instances[i].started || host.instances[i].result != ExitSuccess) {
+            status = 1;
+        }
+    }
+
+    pthread_mutex_destroy(&host.output_lock);
+    free(workers);
+    free(host.instances);
+    return status;
+}
+#else
+int run_host(const struct CEmulatorConfig* config, int instance_count, int worker_count,
+             unsigned long long max_cycles) {
+    (void)config;
+    (void)instance_count;
+    (void)worker_count;
+    (void)max_cycles;
+    fprintf(stderr, "Multi-instance host mode is not supported on Windows\n");
+    return 1;
+}
+#endif
+
+// Benchmark mode.
+//
+// Boots a single emulator until the MCU runtime reports that it has started and then
+// times the paths a host drives in a tight loop: single steps through the C API, batched
+// steps inside Rust, bus reads, PC reads and draining the UART ring. The results are
+// written as JSON so runs can be compared across changes.
+
+#define BENCH_BOOT_BATCH_CYCLES 10000ULL
+#define BENCH_DEFAULT_ITERATIONS 1000000ULL
+#define BENCH_DEFAULT_BOOT_CYCLES 2000000000ULL
+
+static double bench_now(void) {
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+struct bench_uart {
+    unsigned long long bytes;
+    double seconds;
+    unsigned int checksum; // Keeps the copy loop from being optimized away
+};
+
+// Consume the pending UART output without printing it, timing only the ring access
+static void bench_drain_uart(struct CEmulator* emulator, struct bench_uart* uart) {
+    struct CUartRing* ring = emulator_get_uart_ring(emulator);
+    if (!ring || ring->head == ring->tail) {
+        return;
+    }
+    double start = bench_now();
+    unsigned int head = ring->head;
+    for (unsigned int tail = ring->tail; tail != head; tail++) {
+        uart->checksum = uart->checksum * 31 + ring->data[tail & (ring->capacity - 1)];
+    }
+    uart->bytes += head - ring->tail;
+    ring->tail = head;
+    uart->seconds += bench_now() - start;
+}
+
+static double bench_rate(double count, double seconds) {
+    return seconds > 0 ? count / seconds : 0;
+}
+
+static void bench_write_calls(FILE* out, const char* name, unsigned long long calls, double seconds) {
+    fprintf(out, "  \"%s\": {\"calls\": %llu, \"seconds\": %.6f, \"calls_per_second\": %.0f, \"ns_per_call\": %.2f},\n",
+            name, calls, seconds, bench_rate((double)calls, seconds),
+            calls ? seconds * 1e9 / (double)calls : 0);
+}
+
+// Run the benchmark and write the results to `output_path` ("-" for stdout).
+// `iterations` is the number of calls per timed loop and `max_boot_cycles` bounds the
+// boot phase. Returns the process exit status.
+int run_bench(const struct CEmulatorConfig* config, const char* output_path,
+              unsigned long long iterations, unsigned long long max_boot_cycles) {
+    if (iterations == 0) {
+        iterations = BENCH_DEFAULT_ITERATIONS;
+    }
+    if (max_boot_cycles == 0) {
+        max_boot_cycles = BENCH_DEFAULT_BOOT_CYCLES;
+    }
+
+    // Nothing in the timed loops may wait on a debugger, a socket or the console
+    struct CEmulatorConfig bench_config = *config;
+    bench_config.gdb_port = 0;
+    bench_config.i3c_port = 0;
+    bench_config.stdin_uart = 0;
+    bench_config.capture_uart_output = 1;
+
+    void* memory = aligned_alloc(emulator_get_alignment(), emulator_get_size());
+    if (!memory) {
+        fprintf(stderr, "Failed to allocate memory: %s\n", strerror(errno));
+        return 1;
+    }
+    struct CEmulator* emulator = (struct CEmulator*)memory;
+
+    double init_start = bench_now();
+    enum EmulatorError result = emulator_init(emulator, &bench_config);
+    double init_seconds = bench_now() - init_start;
+    if (result != Success) {
+        fprintf(stderr, "Failed to initialize emulator: %d\n", result);
+#ifdef _WIN32
+        _aligned_free(memory);
+#else
+        free(memory);
+#endif
+        return 1;
+    }
+
+    struct bench_uart uart = {0};
+    struct CRunConditions conditions = {0};
+    enum CStepAction action = Continue;
+
+    // Boot to MCU runtime. The cycle count is only as precise as the batch size.
+    unsigned long long boot_cycles = 0;
+    double boot_start = bench_now();
+    while (!emulator_runtime_started(emulator) && boot_cycles < max_boot_cycles &&
+           action != Break && action != ExitSuccess && action != ExitFailure) {
+        unsigned long long cycles = 0;
+        action = emulator_run_until(emulator, BENCH_BOOT_BATCH_CYCLES, &conditions, &cycles);
+        boot_cycles += cycles;
+        bench_drain_uart(emulator, &uart);
+    }
+    double boot_seconds = bench_now() - boot_start;
+    int runtime_started = emulator_runtime_started(emulator);
+    if (!runtime_started) {
+        fprintf(stderr, "MCU runtime did not start within %llu cycles, timing the loops anyway\n", boot_cycles);
+    }
+
+    // One FFI call per instruction
+    unsigned long long step_calls = 0;
+    double step_start = bench_now();
+    for (; step_calls < iterations; step_calls++) {
+        action = emulator_step(emulator);
+        if (action == Break || action == ExitSuccess || action == ExitFailure) {
+            break;
+        }
+    }
+    double step_seconds = bench_now() - step_start;
+    bench_drain_uart(emulator, &uart);
+
+    // The same work as one batch inside Rust
+    unsigned long long batch_cycles = 0;
+    double batch_start = bench_now();
+    emulator_step_n(emulator, iterations, &batch_cycles);
+    double batch_seconds = bench_now() - batch_start;
+    bench_drain_uart(emulator, &uart);
+
+    unsigned int mci_offset = config->mci_offset >= 0 ? (unsigned int)config->mci_offset : 0x21000000;
+    unsigned long long bus_errors = 0;
+    unsigned int value = 0;
+    double bus_start = bench_now();
+    for (unsigned long long i = 0; i < iterations; i++) {
+        if (emulator_read_auto_root_bus(emulator, 4, mci_offset, &value) != Success) {
+            bus_errors++;
+        }
+    }
+    double bus_seconds = bench_now() - bus_start;
+
+    unsigned int pc_sum = 0;
+    double pc_start = bench_now();
+    for (unsigned long long i = 0; i < iterations; i++) {
+        pc_sum += emulator_get_pc(emulator);
+    }
+    double pc_seconds = bench_now() - pc_start;
+
+    emulator_destroy(emulator);
+#ifdef _WIN32
+    _aligned_free(memory);
+#else
+    free(memory);
+#endif
+
+    FILE* out = strcmp(output_path, "-") == 0 ? stdout : fopen(output_path, "w");
+    if (!out) {
+        fprintf(stderr, "Failed to open %s: %s\n", output_path, strerror(errno));
+        return 1;
+    }
+    double step_ns = step_calls ? step_seconds * 1e9 / (double)step_calls : 0;
+    double batch_ns = batch_cycles ? batch_seconds * 1e9 / (double)batch_cycles : 0;
+    fprintf(out, "{\n");
+    fprintf(out, "  \"init_seconds\": %.6f,\n", init_seconds);
+    fprintf(out, "  \"boot\": {\"runtime_started\": %s, \"cycles\": %llu, \"seconds\": %.6f, \"cycles_per_second\": %.0f},\n",
+            runtime_started ? "true" : "false", boot_cycles, boot_seconds,
+            bench_rate((double)boot_cycles, boot_seconds));
+    bench_write_calls(out, "emulator_step", step_calls, step_seconds);
+    fprintf(out, "  \"emulator_step_n\": {\"cycles\": %llu, \"seconds\": %.6f, \"cycles_per_second\": %.0f, \"ns_per_cycle\": %.2f},\n",
+            batch_cycles, batch_seconds, bench_rate((double)batch_cycles, batch_seconds), batch_ns);
+    fprintf(out, "  \"ffi_overhead_ns_per_step\": %.2f,\n", step_ns > batch_ns ? step_ns - batch_ns : 0);
+    bench_write_calls(out, "emulator_read_auto_root_bus", iterations, bus_seconds);
+    bench_write_calls(out, "emulator_get_pc", iterations, pc_seconds);
+    fprintf(out, "  \"bus_read_errors\": %llu,\n", bus_errors);
+    fprintf(out, "  \"uart\": {\"bytes\": %llu, \"drain_seconds\": %.6f, \"bytes_per_second\": %.0f}\n",
+            uart.bytes, uart.seconds, bench_rate((double)uart.bytes, uart.seconds));
+    fprintf(out, "}\n");
+    if (out != stdout) {
+        fclose(out);
+        printf("Benchmark results written to %s\n", output_path);
+    }
+    (void)pc_sum;
+    (void)uart.checksum;
+    return runtime_started ? 0 : 1;
 }
 
 unsigned int parse_hex_or_decimal(const char* str) {
@@ -530,6 +1101,9 @@ int main(int argc, char *argv[]) {
         .gdb_port = 0,
         .i3c_port = 0,
         .trace_instr = 0,
+        .trace_format = 0,
+        .trace_stdout = 0,
+        .trace_queue_policy = 0,
         .stdin_uart = 1,  // Default to true
         .manufacturing_mode = 0,
         .capture_uart_output = 1,  // Default to capturing UART output
@@ -538,6 +1112,7 @@ int main(int argc, char *argv[]) {
         .streaming_boot_path = NULL,
         .primary_flash_image_path = NULL,
         .secondary_flash_image_path = NULL,
+        .map_flash_images = 0,
         .hw_revision_major = 2,
         .hw_revision_minor = 0,
         .hw_revision_patch = 0,
@@ -576,6 +1151,9 @@ int main(int argc, char *argv[]) {
         .external_read_callback = NULL,
         .external_write_callback = NULL,
         .callback_context = NULL,
+        .primary_flash_file_path = NULL,
+        .secondary_flash_file_path = NULL,
+        .memory_map = NULL,
     };
 
     // Define long options
@@ -623,6 +1201,19 @@ int main(int argc, char *argv[]) {
         {"lc-size", required_argument, 0, 162},
         {"mbox-offset", required_argument, 0, 163},
         {"mbox-size", required_argument, 0, 164},
+        {"instances", required_argument, 0, 165},
+        {"threads", required_argument, 0, 166},
+        {"max-cycles", required_argument, 0, 167},
+        {"trace-format", required_argument, 0, 168},
+        {"trace-stdout", no_argument, 0, 169},
+        {"trace-queue-policy", required_argument, 0, 170},
+        {"bench", required_argument, 0, 171},
+        {"bench-iterations", required_argument, 0, 172},
+        {"map-flash-images", no_argument, 0, 173},
+        {"memory-map", required_argument, 0, 174},
+        {"primary-flash-file", required_argument, 0, 175},
+        {"secondary-flash-file", required_argument, 0, 176},
+        {"time-warp", required_argument, 0, 177},
         {"help", no_argument, 0, 'h'},
         {"version", no_argument, 0, 'V'},
         {0, 0, 0, 0}
@@ -631,6 +1222,21 @@ int main(int argc, char *argv[]) {
     int c;
     int option_index = 0;
 
+    // Multi-instance host mode settings (0 instances means run a single emulator)
+    int host_instances = 0;
+    int host_threads = 0;
+    unsigned long long host_max_cycles = 0;
+
+    // Benchmark mode settings (NULL output means no benchmark)
+    const char* bench_output = NULL;
+    unsigned long long bench_iterations = 0;
+
+    // Largest single warp of the clocks through idle periods (0 means no time warp)
+    unsigned long long time_warp_cycles = 0;
+
+    // Memory map profile or file (NULL means use the per-field overrides)
+    const char* memory_map_spec = NULL;
+
     while ((c = getopt_long(argc, argv, "r:f:o:g:l:thV", long_options, &option_index)) != -1) {
         switch (c) {
             case 'r':
@@ -767,6 +1373,61 @@ int main(int argc, char *argv[]) {
             case 164: // --mbox-size
                 config.mbox_size = parse_hex_or_decimal(optarg);
                 break;
+            case 165: // --instances
+                host_instances = atoi(optarg);
+                break;
+            case 166: // --threads
+                host_threads = atoi(optarg);
+                break;
+            case 167: // --max-cycles
+                host_max_cycles = strtoull(optarg, NULL, 0);
+                break;
+            case 168: // --trace-format
+                if (strcmp(optarg, "text") == 0) {
+                    config.trace_format = 0;
+                } else if (strcmp(optarg, "binary") == 0) {
+                    config.trace_format = 1;
+                } else {
+                    fprintf(stderr, "Invalid trace format: %s. Supported formats are 'text' and 'binary'.\n", optarg);
+                    return 1;
+                }
+                break;
+            case 169: // --trace-stdout
+                config.trace_stdout = 1;
+                break;
+            case 170: // --trace-queue-policy
+                if (strcmp(optarg, "block") == 0) {
+                    config.trace_queue_policy = 0;
+                } else if (strcmp(optarg, "drop") == 0) {
+                    config.trace_queue_policy = 1;
+                } else if (strcmp(optarg, "sample") == 0) {
+                    config.trace_queue_policy = 2;
+                } else {
+                    fprintf(stderr, "Invalid trace queue policy: %s. Supported policies are 'block', 'drop' and 'sample'.\n", optarg);
+                    return 1;
+                }
+                break;
+            case 171: // --bench
+                bench_output = optarg;
+                break;
+            case 172: // --bench-iterations
+                bench_iterations = strtoull(optarg, NULL, 0);
+                break;
+            case 173: // --map-flash-images
+                config.map_flash_images = 1;
+                break;
+            case 174: // --memory-map
+                memory_map_spec = optarg;
+                break;
+            case 175: // --primary-flash-file
+                config.primary_flash_file_path = optarg;
+                break;
+            case 176: // --secondary-flash-file
+                config.secondary_flash_file_path = optarg;
+                break;
+            case 177: // --time-warp
+                time_warp_cycles = strtoull(optarg, NULL, 0);
+                break;
             case 'h':
                 print_usage(argv[0]);
                 return 0;
@@ -808,6 +1469,15 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
+    // Resolve and validate the memory map once, every instance shares it
+    if (memory_map_spec) {
+        if (emulator_memory_map_create(memory_map_spec, &config, &global_memory_map) != Success) {
+            fprintf(stderr, "Error: invalid memory map: %s\n", memory_map_spec);
+            return 1;
+        }
+        config.memory_map = global_memory_map;
+    }
+
     // Set up signal handlers for various termination signals
     signal(SIGINT, signal_handler);   // Ctrl+C
 #ifndef _WIN32
@@ -819,6 +1489,13 @@ int main(int argc, char *argv[]) {
     // Register cleanup function to run on normal exit
     atexit(cleanup_on_exit);
 
+    if (host_instances > 0) {
+        return run_host(&config, host_instances, host_threads, host_max_cycles);
+    }
+    if (bench_output) {
+        return run_bench(&config, bench_output, bench_iterations, host_max_cycles);
+    }
+
     // Get memory requirements and allocate
     size_t emulator_size = emulator_get_size();
     size_t emulator_alignment = emulator_get_alignment();
@@ -863,6 +1540,12 @@ int main(int argc, char *argv[]) {
     global_emulator = (struct CEmulator*)memory;
     printf("Emulator initialized successfully\n");
 
+    if (time_warp_cycles) {
+        emulator_set_time_warp(global_emulator, time_warp_cycles);
+    }
+
+    int exit_status = 0;
+
     // Check if we're in GDB mode
     if (emulator_is_gdb_mode(global_emulator)) {
         unsigned int port = emulator_get_gdb_port(global_emulator);
@@ -881,15 +1564,17 @@ int main(int argc, char *argv[]) {
         }
     } else {
         // Normal mode - free run like main.rs
-        free_run(global_emulator);
+        exit_status = free_run(global_emulator);
     }
 
     // Final UART output check (get any remaining output)
-    char final_output[4096];
-    int final_len = emulator_get_uart_output_streaming(global_emulator, final_output, sizeof(final_output) - 1);
-    if (final_len > 0) {
-        final_output[final_len] = '\0';
-        fprintf(stderr, "Final UART output:\n%s", final_output);
+    struct CUartRing* uart_ring = emulator_get_uart_ring(global_emulator);
+    if (uart_ring && uart_ring->head != uart_ring->tail) {
+        fprintf(stderr, "Final UART output:\n");
+        drain_uart_ring(uart_ring);
+    }
+    if (uart_ring && uart_ring->dropped > 0) {
+        fprintf(stderr, "Dropped %u bytes of UART output\n", uart_ring->dropped);
     }
 
     // Clean up
@@ -902,5 +1587,5 @@ int main(int argc, char *argv[]) {
 #endif
 
     printf("Emulator cleaned up\n");
-    return 0;
+    return exit_status;
 }
@@ -15,12 +15,25 @@ use caliptra_emu_bus::Bus;
 use caliptra_emu_cpu::xreg_file::XReg;
 use caliptra_emu_cpu::StepAction;
 use caliptra_emu_types::{RvAddr, RvSize};
-use emulator::{gdb, Emulator, EmulatorArgs, ExternalReadCallback, ExternalWriteCallback};
+use emulator::emulator::MCU_BUS_DELEGATES;
+use emulator::lockstep::DEFAULT_CHECKPOINT_INTERVAL;
+use emulator::time_warp::TimeWarpStats;
+use emulator::trace::{TraceCore, TraceFormat};
+use emulator::trace_thread::{TraceQueuePolicy, DEFAULT_TRACE_QUEUE_RECORDS};
+use emulator::{
+    gdb, Emulator, EmulatorArgs, EmulatorSnapshot, ExternalReadCallback, ExternalWriteCallback,
+    MemoryMap, MemoryMapOverrides,
+};
+use emulator_periph::{ExternalWrite, UartOutputRing};
+use emulator_registers_generated::root_bus::AutoRootBusAccessStats;
+use mcu_testing_common::i3c_socket_server::I3cSocketStatsSnapshot;
 use mcu_testing_common::MCU_RUNNING;
 use std::ffi::CStr;
-use std::os::raw::{c_char, c_int, c_longlong, c_uchar, c_uint};
+use std::os::raw::{c_char, c_int, c_longlong, c_uchar, c_uint, c_ulonglong};
+use std::path::Path;
 use std::ptr;
 use std::sync::atomic::Ordering;
+use std::sync::Arc;
 
 #[cfg(test)]
 mod simple_test;
@@ -34,7 +47,8 @@ enum EmulatorWrapper {
 /// Internal state for the C emulator instance
 struct CEmulatorState {
     wrapper: EmulatorWrapper,
-    gdb_port: Option<u16>, // Store GDB port for later use
+    gdb_port: Option<u16>,                     // Store GDB port for later use
+    callback_context: *const std::ffi::c_void, // Passed to callbacks registered later
 }
 
 /// Error codes for C API
@@ -60,6 +74,12 @@ pub enum CStepAction {
     Break = 1,
     ExitSuccess = 2,
     ExitFailure = 3,
+    /// Returned by `emulator_run_until()` when UART output is waiting to be drained
+    UartOutput = 4,
+    /// Returned by `emulator_run_until()` when the MCU PC reached `stop_pc`
+    PcMatch = 5,
+    /// Returned by `emulator_run_until()` when both cores are parked on `wfi`
+    Idle = 6,
 }
 
 impl From<StepAction> for CStepAction {
@@ -72,6 +92,43 @@ impl From<StepAction> for CStepAction {
     }
 }
 
+/// Stop conditions for `emulator_run_until()`
+///
+/// Each condition is checked after every cycle; a zeroed structure only stops
+/// on the cycle budget or on a break/exit from the emulator itself.
+#[repr(C)]
+pub struct CRunConditions {
+    pub stop_on_uart_output: c_uchar, // 0 = false, 1 = true
+    pub stop_on_pc: c_uchar,          // 0 = false, 1 = true
+    pub stop_pc: c_uint,              // Only used when stop_on_pc is set
+    pub stop_on_idle: c_uchar,        // 0 = false, 1 = true
+}
+
+/// Captured UART output ring, shared directly with C
+///
+/// This mirrors the layout of the emulator's internal ring buffer. The emulator only
+/// ever advances `head` (after writing the byte) and C only ever advances `tail` (after
+/// reading it). Both indices are free-running; the byte for index `i` lives at
+/// `data[i & (capacity - 1)]` and `head - tail` (with unsigned wraparound) is the number of
+/// pending bytes. When the ring is full the emulator drops new bytes and counts them in
+/// `dropped`; it never writes `tail`.
+///
+/// If C drains the ring from a different thread than the one stepping the emulator, `head`
+/// must be loaded with acquire semantics and `tail` stored with release semantics.
+#[repr(C)]
+pub struct CUartRing {
+    pub head: c_uint,
+    pub tail: c_uint,
+    pub capacity: c_uint,
+    pub dropped: c_uint,
+    pub data: *const c_uchar,
+}
+
+const _: () = assert!(
+    std::mem::size_of::<CUartRing>() == std::mem::size_of::<UartOutputRing>()
+        && std::mem::align_of::<CUartRing>() == std::mem::align_of::<UartOutputRing>()
+);
+
 /// C function pointer type for external read callbacks
 ///
 /// # Arguments
@@ -106,6 +163,145 @@ pub type CExternalWriteCallback = unsafe extern "C" fn(
     data: c_uint,                     // RvData as u32
 ) -> c_int;
 
+/// Access counters of one MCU peripheral, see `emulator_get_stats`
+#[repr(C)]
+#[derive(Clone, Copy, Debug, Default)]
+pub struct CPeripheralStats {
+    pub reads: c_ulonglong,
+    pub writes: c_ulonglong,
+    pub bytes_read: c_ulonglong,
+    pub bytes_written: c_ulonglong,
+    /// Reads returning the same value from the same address as the previous read
+    pub poll_reads: c_ulonglong,
+    /// Cycles spent between those repeated reads, i.e. in polling loops
+    pub poll_cycles: c_ulonglong,
+}
+
+/// MCU peripheral access counters returned by `emulator_get_stats`
+///
+/// `mcu_root_bus` covers the UART, emulator control and PIC registers, `soc_to_caliptra`
+/// the Caliptra mailbox and SoC interface and `external` the external bus callbacks.
+/// The MCU mailboxes are counted apart from `mci`. The memories served by the fast path of
+/// the bus count reads, writes and bytes only; their misaligned accesses count under
+/// `mcu_root_bus`.
+#[repr(C)]
+#[derive(Clone, Copy, Debug, Default)]
+pub struct CEmulatorStats {
+    /// MCU cycle at which the counters were read
+    pub cycle: c_ulonglong,
+    pub i3c: CPeripheralStats,
+    pub primary_flash: CPeripheralStats,
+    pub secondary_flash: CPeripheralStats,
+    pub mci: CPeripheralStats,
+    pub doe_mbox: CPeripheralStats,
+    pub otp: CPeripheralStats,
+    pub lc: CPeripheralStats,
+    pub axicdma: CPeripheralStats,
+    pub mcu_root_bus: CPeripheralStats,
+    pub soc_to_caliptra: CPeripheralStats,
+    pub external: CPeripheralStats,
+    pub mcu_mbox0: CPeripheralStats,
+    pub mcu_mbox1: CPeripheralStats,
+    pub sram: CPeripheralStats,
+    pub dccm: CPeripheralStats,
+    pub rom: CPeripheralStats,
+    pub external_test_sram: CPeripheralStats,
+    pub direct_read_flash: CPeripheralStats,
+}
+
+impl From<AutoRootBusAccessStats> for CPeripheralStats {
+    fn from(stats: AutoRootBusAccessStats) -> Self {
+        Self {
+            reads: stats.reads,
+            writes: stats.writes,
+            bytes_read: stats.bytes_read,
+            bytes_written: stats.bytes_written,
+            poll_reads: stats.poll_reads,
+            poll_cycles: stats.poll_cycles,
+        }
+    }
+}
+
+/// Counters of the I3C socket opened with `--i3c-port`, see `emulator_get_i3c_socket_stats`
+#[repr(C)]
+#[derive(Clone, Copy, Debug, Default)]
+pub struct CI3cSocketStats {
+    /// Commands received from the socket client
+    pub commands: c_ulonglong,
+    /// Responses written to the client, not counting IBIs
+    pub responses: c_ulonglong,
+    pub ibis: c_ulonglong,
+    pub bytes_received: c_ulonglong,
+    pub bytes_sent: c_ulonglong,
+    /// Times the socket thread woke up with work to do
+    pub wakeups: c_ulonglong,
+    /// Most commands and responses handled in a single wakeup
+    pub max_batch: c_ulonglong,
+    /// Time from the I3C controller handing a response or IBI to the socket thread until
+    /// it is written to the socket
+    pub mean_latency_ns: c_ulonglong,
+    pub max_latency_ns: c_ulonglong,
+}
+
+impl From<I3cSocketStatsSnapshot> for CI3cSocketStats {
+    fn from(stats: I3cSocketStatsSnapshot) -> Self {
+        Self {
+            commands: stats.commands,
+            responses: stats.responses,
+            ibis: stats.ibis,
+            bytes_received: stats.bytes_received,
+            bytes_sent: stats.bytes_sent,
+            wakeups: stats.wakeups,
+            max_batch: stats.max_batch,
+            mean_latency_ns: stats.mean_latency_ns(),
+            max_latency_ns: stats.latency_max_ns,
+        }
+    }
+}
+
+/// Cycles skipped by the time warp, see `emulator_get_time_warp_stats`
+#[repr(C)]
+#[derive(Clone, Copy, Debug, Default)]
+pub struct CTimeWarpStats {
+    /// Number of times the clocks were moved forward
+    pub warps: c_ulonglong,
+    /// Total number of cycles skipped
+    pub cycles: c_ulonglong,
+}
+
+impl From<TimeWarpStats> for CTimeWarpStats {
+    fn from(stats: TimeWarpStats) -> Self {
+        Self {
+            warps: stats.warps,
+            cycles: stats.cycles,
+        }
+    }
+}
+
+/// A posted write delivered by `CExternalBatchWriteCallback`
+#[repr(C)]
+#[derive(Clone, Copy, Debug)]
+pub struct CExternalWrite {
+    pub size: c_uint, // Size of the write operation (1, 2, or 4 bytes)
+    pub addr: c_uint,
+    pub data: c_uint,
+}
+
+/// C function pointer type for batched external write callbacks
+///
+/// # Arguments
+/// * `context` - Context pointer passed to the callback
+/// * `writes` - Queued writes, in the order the MCU issued them
+/// * `count` - Number of writes
+///
+/// # Returns
+/// * 1 for success, 0 for failure; a failure makes the next external read fault
+pub type CExternalBatchWriteCallback = unsafe extern "C" fn(
+    context: *const std::ffi::c_void,
+    writes: *const CExternalWrite,
+    count: usize,
+) -> c_int;
+
 /// Opaque structure representing the emulator
 /// C code should allocate memory for this structure
 #[repr(C)]
@@ -113,6 +309,14 @@ pub struct CEmulator {
     _private: [u8; 0],
 }
 
+/// Opaque structure representing a validated memory map shared by emulators
+///
+/// Created with `emulator_memory_map_create()` and released with `emulator_memory_map_free()`.
+#[repr(C)]
+pub struct CMemoryMap {
+    _private: [u8; 0],
+}
+
 /// Configuration structure for emulator initialization
 ///
 /// Memory layout override parameters use int64_t values where:
@@ -145,6 +349,9 @@ pub struct CEmulatorConfig {
     pub gdb_port: c_uint,                        // 0 means no GDB
     pub i3c_port: c_uint,                        // 0 means no I3C socket
     pub trace_instr: c_uchar,                    // 0 = false, 1 = true
+    pub trace_format: c_uchar,                   // 0 = text, 1 = binary
+    pub trace_stdout: c_uchar,                   // 0 = false, 1 = true
+    pub trace_queue_policy: c_uchar,             // 0 = block, 1 = drop, 2 = sample
     pub stdin_uart: c_uchar,                     // 0 = false, 1 = true
     pub manufacturing_mode: c_uchar,             // 0 = false, 1 = true
     pub capture_uart_output: c_uchar,            // 0 = false, 1 = true
@@ -154,6 +361,7 @@ pub struct CEmulatorConfig {
     pub streaming_boot_path: *const c_char,      // Optional, can be null
     pub primary_flash_image_path: *const c_char, // Optional, can be null
     pub secondary_flash_image_path: *const c_char, // Optional, can be null
+    pub map_flash_images: c_uchar,               // 0 = false, 1 = true
     pub hw_revision_major: c_uint,
     pub hw_revision_minor: c_uint,
     pub hw_revision_patch: c_uint,
@@ -200,6 +408,18 @@ pub struct CEmulatorConfig {
     pub external_read_callback: *const std::ffi::c_void,
     pub external_write_callback: *const std::ffi::c_void,
     pub callback_context: *const std::ffi::c_void, // Context pointer for callbacks
+
+    // Input log, see `--record-inputs` and `--replay-inputs` (can be null)
+    pub record_inputs_path: *const c_char,
+    pub replay_inputs_path: *const c_char,
+
+    // Flash backing files, `primary_flash`/`secondary_flash` in the working directory if null
+    pub primary_flash_file_path: *const c_char,
+    pub secondary_flash_file_path: *const c_char,
+
+    // Shared memory map from `emulator_memory_map_create()` (can be null); replaces the
+    // memory layout overrides above
+    pub memory_map: *const CMemoryMap,
 }
 
 /// Get the size required to allocate memory for the emulator
@@ -267,6 +487,16 @@ pub unsafe extern "C" fn emulator_init(
         Err(_) => return EmulatorError::InvalidArgs,
     };
 
+    // A shared memory map already carries its overrides
+    let (shared_memory_map, memory_map_overrides) = if config.memory_map.is_null() {
+        (None, convert_memory_map_overrides(config))
+    } else {
+        let map = config.memory_map as *const MemoryMap;
+        // the config keeps its reference, the emulator takes a new one
+        Arc::increment_strong_count(map);
+        (Some(Arc::from_raw(map)), MemoryMapOverrides::default())
+    };
+
     // Build EmulatorArgs
     let args = EmulatorArgs {
         rom: rom_path.into(),
@@ -282,6 +512,28 @@ pub unsafe extern "C" fn emulator_init(
         },
         log_dir: convert_optional_c_string(config.log_dir_path).map(|s| s.into()),
         trace_instr: config.trace_instr != 0,
+        trace_format: if config.trace_format == 1 {
+            TraceFormat::Binary
+        } else {
+            TraceFormat::Text
+        },
+        trace_stdout: config.trace_stdout != 0,
+        trace_queue_policy: match config.trace_queue_policy {
+            1 => TraceQueuePolicy::Drop,
+            2 => TraceQueuePolicy::Sample,
+            _ => TraceQueuePolicy::Block,
+        },
+        trace_queue_size: DEFAULT_TRACE_QUEUE_RECORDS,
+        profile: false,
+        profile_interval: 1,
+        profile_mcu_elf: vec![],
+        profile_caliptra_elf: vec![],
+        bus_stats_interval: None,
+        lockstep_log: None,
+        lockstep_checkpoint_interval: DEFAULT_CHECKPOINT_INTERVAL,
+        time_warp: None,
+        record_inputs: convert_optional_c_string(config.record_inputs_path).map(|s| s.into()),
+        replay_inputs: convert_optional_c_string(config.replay_inputs_path).map(|s| s.into()),
         stdin_uart: config.stdin_uart != 0,
         _no_stdin_uart: false,
         i3c_port: if config.i3c_port == 0 {
@@ -301,44 +553,20 @@ pub unsafe extern "C" fn emulator_init(
             .map(|s| s.into()),
         secondary_flash_image: convert_optional_c_string(config.secondary_flash_image_path)
             .map(|s| s.into()),
+        primary_flash_file: convert_optional_c_string(config.primary_flash_file_path)
+            .map(|s| s.into()),
+        secondary_flash_file: convert_optional_c_string(config.secondary_flash_file_path)
+            .map(|s| s.into()),
+        map_flash_images: config.map_flash_images != 0,
         hw_revision: semver::Version::new(
             config.hw_revision_major as u64,
             config.hw_revision_minor as u64,
             config.hw_revision_patch as u64,
         ),
         flash_based_boot: config.flash_based_boot != 0,
-        // Use provided offset and size override parameters (-1 means use default)
-        rom_offset: convert_optional_offset_size(config.rom_offset),
-        rom_size: convert_optional_offset_size(config.rom_size),
-        uart_offset: convert_optional_offset_size(config.uart_offset),
-        uart_size: convert_optional_offset_size(config.uart_size),
-        ctrl_offset: convert_optional_offset_size(config.ctrl_offset),
-        ctrl_size: convert_optional_offset_size(config.ctrl_size),
-        sram_offset: convert_optional_offset_size(config.sram_offset),
-        sram_size: convert_optional_offset_size(config.sram_size),
-        pic_offset: convert_optional_offset_size(config.pic_offset),
-        external_test_sram_offset: convert_optional_offset_size(config.external_test_sram_offset),
-        external_test_sram_size: convert_optional_offset_size(config.external_test_sram_size),
-        dccm_offset: convert_optional_offset_size(config.dccm_offset),
-        dccm_size: convert_optional_offset_size(config.dccm_size),
-        i3c_offset: convert_optional_offset_size(config.i3c_offset),
-        i3c_size: convert_optional_offset_size(config.i3c_size),
-        primary_flash_offset: convert_optional_offset_size(config.primary_flash_offset),
-        primary_flash_size: convert_optional_offset_size(config.primary_flash_size),
-        secondary_flash_offset: convert_optional_offset_size(config.secondary_flash_offset),
-        secondary_flash_size: convert_optional_offset_size(config.secondary_flash_size),
-        mci_offset: convert_optional_offset_size(config.mci_offset),
-        mci_size: convert_optional_offset_size(config.mci_size),
-        dma_offset: convert_optional_offset_size(config.dma_offset),
-        dma_size: convert_optional_offset_size(config.dma_size),
-        mbox_offset: convert_optional_offset_size(config.mbox_offset),
-        mbox_size: convert_optional_offset_size(config.mbox_size),
-        soc_offset: convert_optional_offset_size(config.soc_offset),
-        soc_size: convert_optional_offset_size(config.soc_size),
-        otp_offset: convert_optional_offset_size(config.otp_offset),
-        otp_size: convert_optional_offset_size(config.otp_size),
-        lc_offset: convert_optional_offset_size(config.lc_offset),
-        lc_size: convert_optional_offset_size(config.lc_size),
+        memory_map: None,
+        shared_memory_map,
+        memory_map_overrides,
         fuse_soc_manifest_svn: convert_optional_offset_size(config.fuse_soc_manifest_svn),
         fuse_soc_manifest_max_svn: convert_optional_offset_size(config.fuse_soc_manifest_max_svn),
         fuse_vendor_hashes_prod_partition: convert_optional_c_string(
@@ -388,11 +616,13 @@ pub unsafe extern "C" fn emulator_init(
         CEmulatorState {
             wrapper: EmulatorWrapper::Gdb(gdb::gdb_target::GdbTarget::new(emulator)),
             gdb_port: Some(port),
+            callback_context: config.callback_context,
         }
     } else {
         CEmulatorState {
             wrapper: EmulatorWrapper::Normal(emulator),
             gdb_port: None,
+            callback_context: config.callback_context,
         }
     };
 
@@ -430,14 +660,170 @@ pub unsafe extern "C" fn emulator_step(emulator_memory: *mut CEmulator) -> CStep
     match &mut emulator_state.wrapper {
         EmulatorWrapper::Normal(emulator) => {
             let action = emulator.step();
-            action.into()
+            convert_step_action(emulator, action)
         }
         EmulatorWrapper::Gdb(gdb_target) => {
             // In GDB mode, step the underlying emulator directly
             let action = gdb_target.emulator_mut().step();
-            action.into()
+            convert_step_action(gdb_target.emulator(), action)
+        }
+    }
+}
+
+/// Map a step result to the C action, reporting firmware exit requests as
+/// `ExitSuccess`/`ExitFailure` based on the exit code.
+fn convert_step_action(emulator: &Emulator, action: StepAction) -> CStepAction {
+    match emulator.exit_code() {
+        Some(0) => CStepAction::ExitSuccess,
+        Some(_) => CStepAction::ExitFailure,
+        None => action.into(),
+    }
+}
+
+/// Step the emulator up to `max_cycles` times without returning to C in between
+///
+/// Stops early if the emulator returns anything other than `Continue`.
+///
+/// # Arguments
+/// * `emulator_memory` - Pointer to the initialized emulator
+/// * `max_cycles` - Maximum number of cycles to execute
+/// * `cycles_executed` - Optional pointer to store the number of cycles executed (can be null)
+///
+/// # Returns
+/// * `Continue` if the cycle budget was exhausted, otherwise the action that stopped execution
+///
+/// # Safety
+/// * `emulator_memory` must point to a valid, initialized emulator
+/// * `cycles_executed` must be null or a valid pointer to a u64
+#[no_mangle]
+pub unsafe extern "C" fn emulator_step_n(
+    emulator_memory: *mut CEmulator,
+    max_cycles: c_ulonglong,
+    cycles_executed: *mut c_ulonglong,
+) -> CStepAction {
+    emulator_run_until(emulator_memory, max_cycles, ptr::null(), cycles_executed)
+}
+
+/// Run the emulator until a stop condition is met or `max_cycles` have been executed
+///
+/// This keeps the whole loop inside Rust, so callers pay the FFI and dispatch cost
+/// once per batch instead of once per instruction.
+///
+/// # Arguments
+/// * `emulator_memory` - Pointer to the initialized emulator
+/// * `max_cycles` - Maximum number of cycles to execute
+/// * `conditions` - Optional stop conditions (can be null)
+/// * `cycles_executed` - Optional pointer to store the number of cycles executed (can be null)
+///
+/// # Returns
+/// * `Continue` if the cycle budget was exhausted
+/// * `UartOutput`, `PcMatch` or `Idle` if one of the requested stop conditions was met
+/// * Otherwise the action returned by the emulator that stopped execution
+///
+/// # Safety
+/// * `emulator_memory` must point to a valid, initialized emulator
+/// * `conditions` must be null or a valid pointer to a CRunConditions structure
+/// * `cycles_executed` must be null or a valid pointer to a u64
+#[no_mangle]
+pub unsafe extern "C" fn emulator_run_until(
+    emulator_memory: *mut CEmulator,
+    max_cycles: c_ulonglong,
+    conditions: *const CRunConditions,
+    cycles_executed: *mut c_ulonglong,
+) -> CStepAction {
+    if !cycles_executed.is_null() {
+        *cycles_executed = 0;
+    }
+
+    if emulator_memory.is_null() {
+        return CStepAction::ExitFailure;
+    }
+
+    let emulator_state = &mut *(emulator_memory as *mut CEmulatorState);
+    let emulator = match &mut emulator_state.wrapper {
+        EmulatorWrapper::Normal(emulator) => emulator,
+        EmulatorWrapper::Gdb(gdb_target) => gdb_target.emulator_mut(),
+    };
+
+    let (stop_on_uart_output, stop_pc, stop_on_idle) = if conditions.is_null() {
+        (false, None, false)
+    } else {
+        let conditions = &*conditions;
+        (
+            conditions.stop_on_uart_output != 0 && emulator.uart_output.is_some(),
+            (conditions.stop_on_pc != 0).then_some(conditions.stop_pc),
+            conditions.stop_on_idle != 0,
+        )
+    };
+    emulator.set_idle_tracking(stop_on_idle);
+
+    let mut cycles = 0;
+    let mut action = CStepAction::Continue;
+    while cycles < max_cycles {
+        let step_action = emulator.step();
+        cycles += 1;
+        if step_action != StepAction::Continue {
+            action = convert_step_action(emulator, step_action);
+            break;
+        }
+        if stop_on_uart_output
+            && emulator
+                .uart_output
+                .as_ref()
+                .is_some_and(|output| !output.is_empty())
+        {
+            action = CStepAction::UartOutput;
+            break;
         }
+        if stop_pc.is_some_and(|pc| emulator.get_pc() == pc) {
+            action = CStepAction::PcMatch;
+            break;
+        }
+        if stop_on_idle && emulator.is_idle() {
+            // Report each idle window once; the caller is expected to wait for input
+            // and then resume stepping so that timers keep advancing. Not reported while
+            // an interrupt is pending or the time warp still finds timer actions.
+            emulator.reset_idle();
+            action = CStepAction::Idle;
+            break;
+        }
+    }
+
+    // the caller may talk to the external device before stepping again
+    emulator.external_bus.flush();
+
+    if !cycles_executed.is_null() {
+        *cycles_executed = cycles;
+    }
+    action
+}
+
+/// Get a descriptor to poll along with the host's own input while the emulator is idle
+///
+/// It becomes readable when the I3C socket (`--i3c-port`) passes on commands from its
+/// client, which the emulator handles on its next steps. It is non-blocking and must be
+/// read empty before it is polled again. It stays owned by the emulator.
+///
+/// # Arguments
+/// * `emulator_memory` - Pointer to the initialized emulator
+///
+/// # Returns
+/// * The descriptor, or -1 if the emulator has no I3C socket
+///
+/// # Safety
+/// * `emulator_memory` must point to a valid, initialized emulator
+#[no_mangle]
+pub unsafe extern "C" fn emulator_get_input_fd(emulator_memory: *mut CEmulator) -> c_int {
+    if emulator_memory.is_null() {
+        return -1;
     }
+
+    let state = &*(emulator_memory as *mut CEmulatorState);
+    let emulator = match &state.wrapper {
+        EmulatorWrapper::Normal(emulator) => emulator,
+        EmulatorWrapper::Gdb(gdb_target) => gdb_target.emulator(),
+    };
+    emulator.input_wait_fd().unwrap_or(-1)
 }
 
 /// Destroy the emulator and clean up resources
@@ -458,10 +844,15 @@ pub unsafe extern "C" fn emulator_destroy(emulator_memory: *mut CEmulator) {
 
 /// Get UART output if it was captured
 ///
+/// Returns the output that has not been consumed yet. The capture ring holds up to
+/// `UartOutputRing::DEFAULT_CAPACITY` bytes and drops new output once it is full;
+/// `dropped` receives the total number of bytes lost so far.
+///
 /// # Arguments
 /// * `emulator_memory` - Pointer to the initialized emulator
 /// * `output_buffer` - Buffer to write the output to
 /// * `buffer_size` - Size of the output buffer
+/// * `dropped` - Optional pointer to store the number of dropped bytes (can be null)
 ///
 /// # Returns
 /// * Number of bytes written to the buffer, or -1 if no output available
@@ -469,11 +860,13 @@ pub unsafe extern "C" fn emulator_destroy(emulator_memory: *mut CEmulator) {
 /// # Safety
 /// * `emulator_memory` must point to a valid, initialized emulator
 /// * `output_buffer` must be a valid buffer of at least `buffer_size` bytes
+/// * `dropped` must be null or a valid pointer to a u32
 #[no_mangle]
 pub unsafe extern "C" fn emulator_get_uart_output(
     emulator_memory: *mut CEmulator,
     output_buffer: *mut c_char,
     buffer_size: usize,
+    dropped: *mut c_uint,
 ) -> c_int {
     if emulator_memory.is_null() || output_buffer.is_null() || buffer_size == 0 {
         return -1;
@@ -488,11 +881,10 @@ pub unsafe extern "C" fn emulator_get_uart_output(
     };
 
     if let Some(ref uart_output_rc) = uart_output {
-        let uart_data = uart_output_rc.borrow();
-        let copy_len = std::cmp::min(uart_data.len(), buffer_size - 1);
-
-        if copy_len > 0 {
-            ptr::copy_nonoverlapping(uart_data.as_ptr() as *const c_char, output_buffer, copy_len);
+        let buffer = std::slice::from_raw_parts_mut(output_buffer as *mut u8, buffer_size - 1);
+        let copy_len = uart_output_rc.peek_into(buffer);
+        if !dropped.is_null() {
+            *dropped = uart_output_rc.dropped();
         }
 
         // Null terminate
@@ -526,21 +918,15 @@ pub unsafe extern "C" fn emulator_send_uart_char(
     let emulator_ptr = emulator_memory as *mut CEmulatorState;
     let emulator_state = &mut *emulator_ptr;
 
-    let stdin_uart = match &emulator_state.wrapper {
-        EmulatorWrapper::Normal(emulator) => &emulator.stdin_uart,
-        EmulatorWrapper::Gdb(gdb_target) => &gdb_target.emulator().stdin_uart,
+    let emulator = match &mut emulator_state.wrapper {
+        EmulatorWrapper::Normal(emulator) => emulator,
+        EmulatorWrapper::Gdb(gdb_target) => gdb_target.emulator_mut(),
     };
 
-    if let Some(ref stdin_uart_arc) = stdin_uart {
-        let mut uart_rx = stdin_uart_arc.lock().unwrap();
-        if uart_rx.is_none() {
-            *uart_rx = Some(character as u8);
-            1
-        } else {
-            0 // Buffer full
-        }
-    } else {
-        -1 // UART RX not enabled
+    match emulator.send_uart_rx(character as u8) {
+        Some(true) => 1,
+        Some(false) => 0, // Buffer full
+        None => -1,       // UART RX not enabled
     }
 }
 
@@ -580,6 +966,38 @@ pub unsafe extern "C" fn emulator_uart_rx_ready(emulator_memory: *mut CEmulator)
     }
 }
 
+/// Get a pointer to the captured UART output ring
+///
+/// C code can drain output straight from this ring without calling back into Rust.
+/// The pointer stays valid until `emulator_destroy()` is called.
+///
+/// # Arguments
+/// * `emulator_memory` - Pointer to the initialized emulator
+///
+/// # Returns
+/// * Pointer to the ring, or null if UART output capture is disabled
+///
+/// # Safety
+/// * `emulator_memory` must point to a valid, initialized emulator
+#[no_mangle]
+pub unsafe extern "C" fn emulator_get_uart_ring(emulator_memory: *mut CEmulator) -> *mut CUartRing {
+    if emulator_memory.is_null() {
+        return ptr::null_mut();
+    }
+
+    let emulator_state = &*(emulator_memory as *const CEmulatorState);
+
+    let uart_output = match &emulator_state.wrapper {
+        EmulatorWrapper::Normal(emulator) => &emulator.uart_output,
+        EmulatorWrapper::Gdb(gdb_target) => &gdb_target.emulator().uart_output,
+    };
+
+    match uart_output {
+        Some(ring) => std::rc::Rc::as_ptr(ring) as *mut CUartRing,
+        None => ptr::null_mut(),
+    }
+}
+
 /// Get the most recent UART output (streaming mode)
 /// This function returns only the new output since the last call and clears the buffer.
 ///
@@ -613,14 +1031,8 @@ pub unsafe extern "C" fn emulator_get_uart_output_streaming(
     };
 
     if let Some(ref uart_output_rc) = uart_output {
-        let mut uart_data = uart_output_rc.borrow_mut();
-        let copy_len = std::cmp::min(uart_data.len(), buffer_size - 1);
-
-        if copy_len > 0 {
-            ptr::copy_nonoverlapping(uart_data.as_ptr() as *const c_char, output_buffer, copy_len);
-            // Clear the buffer after reading
-            uart_data.clear();
-        }
+        let buffer = std::slice::from_raw_parts_mut(output_buffer as *mut u8, buffer_size - 1);
+        let copy_len = uart_output_rc.pop_into(buffer);
 
         // Null terminate
         *output_buffer.add(copy_len) = 0;
@@ -782,67 +1194,405 @@ pub unsafe extern "C" fn emulator_start_i3c_controller(
     }
 }
 
-/// Trigger an exit request by setting EMULATOR_RUNNING to false
-/// This will cause any loops waiting on EMULATOR_RUNNING to exit
+/// Read the throughput and latency counters of the emulator's I3C socket
+///
+/// Every instance opened with an `i3c_port` has a socket and counters of its own.
+///
+/// # Arguments
+/// * `emulator_memory` - Pointer to the initialized emulator
+/// * `stats` - Receives the counters accumulated since the socket was opened or the last
+///   `emulator_reset_i3c_socket_stats`
 ///
 /// # Returns
 /// * `EmulatorError::Success` on success
+///
+/// # Safety
+/// * `emulator_memory` must point to a valid, initialized emulator
+/// * `stats` must be a valid pointer
 #[no_mangle]
-pub extern "C" fn emulator_trigger_exit() -> EmulatorError {
-    MCU_RUNNING.store(false, Ordering::Relaxed);
+pub unsafe extern "C" fn emulator_get_i3c_socket_stats(
+    emulator_memory: *mut CEmulator,
+    stats: *mut CI3cSocketStats,
+) -> EmulatorError {
+    if emulator_memory.is_null() || stats.is_null() {
+        return EmulatorError::NullPointer;
+    }
+
+    let state = &*(emulator_memory as *mut CEmulatorState);
+    let emulator = match &state.wrapper {
+        EmulatorWrapper::Normal(emulator) => emulator,
+        EmulatorWrapper::Gdb(gdb_target) => gdb_target.emulator(),
+    };
+    *stats = emulator.i3c_socket_stats().snapshot().into();
     EmulatorError::Success
 }
 
-/// Example external read callback that returns the address as data
-/// This is a simple test callback that C code can use for testing
+/// Reset the counters of the emulator's I3C socket
 ///
 /// # Arguments
-/// * `context` - Context pointer (unused in this example)
-/// * `size` - Size of the read operation (1, 2, or 4 bytes)
-/// * `addr` - Address being read from
-/// * `buffer` - Pointer to write the read data to
+/// * `emulator_memory` - Pointer to the initialized emulator
 ///
 /// # Returns
-/// * 1 for success
+/// * `EmulatorError::Success` on success
 ///
 /// # Safety
-/// * `buffer` must be a valid pointer to a u32 that can be written to
+/// * `emulator_memory` must point to a valid, initialized emulator
 #[no_mangle]
-pub unsafe extern "C" fn example_external_read_callback(
-    _context: *const std::ffi::c_void,
-    _size: c_uint,
-    addr: c_uint,
-    buffer: *mut c_uint,
-) -> c_int {
-    if buffer.is_null() {
-        return 0;
+pub unsafe extern "C" fn emulator_reset_i3c_socket_stats(
+    emulator_memory: *mut CEmulator,
+) -> EmulatorError {
+    if emulator_memory.is_null() {
+        return EmulatorError::NullPointer;
     }
 
-    // Simple example: return the address as the read data
-    *buffer = addr;
-    1 // Success
+    let state = &*(emulator_memory as *mut CEmulatorState);
+    let emulator = match &state.wrapper {
+        EmulatorWrapper::Normal(emulator) => emulator,
+        EmulatorWrapper::Gdb(gdb_target) => gdb_target.emulator(),
+    };
+    emulator.i3c_socket_stats().reset();
+    EmulatorError::Success
 }
 
-/// Example external write callback that logs the operation
-/// This is a simple test callback that C code can use for testing
+/// Stop one emulator instance
+///
+/// Every later step returns `Break` and the instance's I3C socket closes. Other
+/// instances in the process keep running.
 ///
 /// # Arguments
-/// * `context` - Context pointer (unused in this example)
-/// * `size` - Size of the write operation (1, 2, or 4 bytes)
-/// * `addr` - Address being written to
-/// * `data` - Data being written
+/// * `emulator_memory` - Pointer to the initialized emulator
 ///
 /// # Returns
-/// * 1 for success
+/// * `EmulatorError::Success` on success
 ///
 /// # Safety
-/// * This function only reads the provided parameters and performs no unsafe operations
-/// * All parameters are passed by value, so no pointer safety concerns
+/// * `emulator_memory` must point to a valid, initialized emulator
 #[no_mangle]
-pub unsafe extern "C" fn example_external_write_callback(
-    _context: *const std::ffi::c_void,
-    size: c_uint,
-    addr: c_uint,
+pub unsafe extern "C" fn emulator_stop(emulator_memory: *mut CEmulator) -> EmulatorError {
+    if emulator_memory.is_null() {
+        return EmulatorError::NullPointer;
+    }
+
+    let state = &*(emulator_memory as *mut CEmulatorState);
+    match &state.wrapper {
+        EmulatorWrapper::Normal(emulator) => emulator.stop(),
+        EmulatorWrapper::Gdb(gdb_target) => gdb_target.emulator().stop(),
+    }
+    EmulatorError::Success
+}
+
+/// Trigger an exit request by setting EMULATOR_RUNNING to false
+/// This will cause any loops waiting on EMULATOR_RUNNING to exit
+///
+/// The flag is process-wide, so this stops every emulator instance in the process; use
+/// `emulator_stop` to stop a single one.
+///
+/// # Returns
+/// * `EmulatorError::Success` on success
+#[no_mangle]
+pub extern "C" fn emulator_trigger_exit() -> EmulatorError {
+    MCU_RUNNING.store(false, Ordering::Relaxed);
+    EmulatorError::Success
+}
+
+/// Save a snapshot of the emulator state into a caller-provided buffer
+///
+/// The snapshot holds the cycle count, PC, general purpose registers and machine CSRs of
+/// the MCU and Caliptra cores, the contents of the MCU RAM regions (SRAM, DCCM, external
+/// test SRAM and the direct-read flash window) and the Caliptra ICCM and DCCM, with
+/// all-zero pages omitted, and the state of the MCI, I3C, OTP and flash controllers. See
+/// `Emulator::snapshot` for what is left out. Take it at a quiescent point (Caliptra booted
+/// and parked on `wfi`) and restore it into the emulator it was taken from or a fresh one
+/// with the same configuration, e.g. to rewind to the point where runtime started before
+/// each test case.
+///
+/// Pass a NULL `buffer` to query the required size.
+///
+/// # Arguments
+/// * `emulator_memory` - Pointer to the initialized emulator
+/// * `buffer` - Buffer to store the snapshot, or NULL
+/// * `buffer_size` - Size of `buffer` in bytes
+/// * `snapshot_size` - Set to the size of the snapshot in bytes
+///
+/// # Returns
+/// * `EmulatorError::Success` if the snapshot was written (or `buffer` is NULL)
+/// * `EmulatorError::InvalidArgs` if `buffer` is too small
+///
+/// # Safety
+/// * `emulator_memory` must point to a valid, initialized emulator
+/// * `buffer` must be NULL or point to at least `buffer_size` bytes
+/// * `snapshot_size` must be a valid pointer
+#[no_mangle]
+pub unsafe extern "C" fn emulator_snapshot(
+    emulator_memory: *mut CEmulator,
+    buffer: *mut c_uchar,
+    buffer_size: usize,
+    snapshot_size: *mut usize,
+) -> EmulatorError {
+    if emulator_memory.is_null() || snapshot_size.is_null() {
+        return EmulatorError::NullPointer;
+    }
+
+    let emulator_ptr = emulator_memory as *mut CEmulatorState;
+    let emulator_state = &*emulator_ptr;
+
+    let snapshot = match &emulator_state.wrapper {
+        EmulatorWrapper::Normal(emulator) => emulator.snapshot(),
+        EmulatorWrapper::Gdb(gdb_target) => gdb_target.emulator().snapshot(),
+    };
+    let bytes = snapshot.to_bytes();
+    *snapshot_size = bytes.len();
+
+    if buffer.is_null() {
+        return EmulatorError::Success;
+    }
+    if buffer_size < bytes.len() {
+        return EmulatorError::InvalidArgs;
+    }
+    ptr::copy_nonoverlapping(bytes.as_ptr(), buffer, bytes.len());
+    EmulatorError::Success
+}
+
+/// Restore the emulator state from a snapshot created by `emulator_snapshot`
+///
+/// # Arguments
+/// * `emulator_memory` - Pointer to the initialized emulator
+/// * `snapshot` - Snapshot data
+/// * `snapshot_size` - Size of the snapshot data in bytes
+///
+/// # Returns
+/// * `EmulatorError::Success` on success
+/// * `EmulatorError::InvalidArgs` if the snapshot is corrupt or its memory layout, CSRs or
+///   peripherals do not match the emulator
+///
+/// # Safety
+/// * `emulator_memory` must point to a valid, initialized emulator
+/// * `snapshot` must point to at least `snapshot_size` bytes
+#[no_mangle]
+pub unsafe extern "C" fn emulator_restore(
+    emulator_memory: *mut CEmulator,
+    snapshot: *const c_uchar,
+    snapshot_size: usize,
+) -> EmulatorError {
+    if emulator_memory.is_null() || snapshot.is_null() {
+        return EmulatorError::NullPointer;
+    }
+
+    let bytes = std::slice::from_raw_parts(snapshot, snapshot_size);
+    let snapshot = match EmulatorSnapshot::from_bytes(bytes) {
+        Ok(snapshot) => snapshot,
+        Err(_) => return EmulatorError::InvalidArgs,
+    };
+
+    restore_snapshot(emulator_memory, &snapshot)
+}
+
+/// Save a snapshot of the emulator state to a file
+///
+/// See `emulator_snapshot` for what the snapshot contains.
+///
+/// # Arguments
+/// * `emulator_memory` - Pointer to the initialized emulator
+/// * `path` - Path of the file to write
+///
+/// # Returns
+/// * `EmulatorError::Success` on success
+/// * `EmulatorError::InvalidArgs` if the file cannot be written
+///
+/// # Safety
+/// * `emulator_memory` must point to a valid, initialized emulator
+/// * `path` must be a valid null-terminated C string
+#[no_mangle]
+pub unsafe extern "C" fn emulator_snapshot_to_file(
+    emulator_memory: *mut CEmulator,
+    path: *const c_char,
+) -> EmulatorError {
+    if emulator_memory.is_null() || path.is_null() {
+        return EmulatorError::NullPointer;
+    }
+
+    let path = match convert_c_string(path) {
+        Ok(path) => path,
+        Err(_) => return EmulatorError::InvalidArgs,
+    };
+
+    let emulator_ptr = emulator_memory as *mut CEmulatorState;
+    let emulator_state = &*emulator_ptr;
+
+    let snapshot = match &emulator_state.wrapper {
+        EmulatorWrapper::Normal(emulator) => emulator.snapshot(),
+        EmulatorWrapper::Gdb(gdb_target) => gdb_target.emulator().snapshot(),
+    };
+
+    match std::fs::write(path, snapshot.to_bytes()) {
+        Ok(_) => EmulatorError::Success,
+        Err(_) => EmulatorError::InvalidArgs,
+    }
+}
+
+/// Restore the emulator state from a file written by `emulator_snapshot_to_file`
+///
+/// # Arguments
+/// * `emulator_memory` - Pointer to the initialized emulator
+/// * `path` - Path of the snapshot file
+///
+/// # Returns
+/// * `EmulatorError::Success` on success
+/// * `EmulatorError::InvalidArgs` if the file cannot be read, is corrupt or does not match
+///   the emulator's memory layout
+///
+/// # Safety
+/// * `emulator_memory` must point to a valid, initialized emulator
+/// * `path` must be a valid null-terminated C string
+#[no_mangle]
+pub unsafe extern "C" fn emulator_restore_from_file(
+    emulator_memory: *mut CEmulator,
+    path: *const c_char,
+) -> EmulatorError {
+    if emulator_memory.is_null() || path.is_null() {
+        return EmulatorError::NullPointer;
+    }
+
+    let path = match convert_c_string(path) {
+        Ok(path) => path,
+        Err(_) => return EmulatorError::InvalidArgs,
+    };
+
+    let snapshot = match std::fs::read(path).and_then(|bytes| EmulatorSnapshot::from_bytes(&bytes))
+    {
+        Ok(snapshot) => snapshot,
+        Err(_) => return EmulatorError::InvalidArgs,
+    };
+
+    restore_snapshot(emulator_memory, &snapshot)
+}
+
+unsafe fn restore_snapshot(
+    emulator_memory: *mut CEmulator,
+    snapshot: &EmulatorSnapshot,
+) -> EmulatorError {
+    let emulator_ptr = emulator_memory as *mut CEmulatorState;
+    let emulator_state = &mut *emulator_ptr;
+
+    let result = match &mut emulator_state.wrapper {
+        EmulatorWrapper::Normal(emulator) => emulator.restore(snapshot),
+        EmulatorWrapper::Gdb(gdb_target) => gdb_target.emulator_mut().restore(snapshot),
+    };
+
+    match result {
+        Ok(_) => EmulatorError::Success,
+        Err(_) => EmulatorError::InvalidArgs,
+    }
+}
+
+/// Returns 1 once the MCU of this emulator has started executing runtime firmware from SRAM
+///
+/// Unlike the process-wide `MCU_RUNTIME_STARTED` flag this is tracked per instance.
+///
+/// # Arguments
+/// * `emulator_memory` - Pointer to the initialized emulator
+///
+/// # Returns
+/// * 1 if runtime has started, 0 otherwise
+///
+/// # Safety
+/// * `emulator_memory` must point to a valid, initialized emulator
+#[no_mangle]
+pub unsafe extern "C" fn emulator_runtime_started(emulator_memory: *mut CEmulator) -> c_int {
+    if emulator_memory.is_null() {
+        return 0;
+    }
+
+    let emulator_ptr = emulator_memory as *mut CEmulatorState;
+    let emulator_state = &*emulator_ptr;
+
+    let started = match &emulator_state.wrapper {
+        EmulatorWrapper::Normal(emulator) => emulator.runtime_started(),
+        EmulatorWrapper::Gdb(gdb_target) => gdb_target.emulator().runtime_started(),
+    };
+    started as c_int
+}
+
+/// Stop an emulator from publishing its tick count and runtime-started state to the
+/// process-wide flags used by the test threads
+///
+/// Call this on every instance when running several emulators in one process so that
+/// they do not overwrite each other's progress.
+///
+/// # Arguments
+/// * `emulator_memory` - Pointer to the initialized emulator
+///
+/// # Returns
+/// * `EmulatorError::Success` on success
+///
+/// # Safety
+/// * `emulator_memory` must point to a valid, initialized emulator
+#[no_mangle]
+pub unsafe extern "C" fn emulator_detach_globals(emulator_memory: *mut CEmulator) -> EmulatorError {
+    if emulator_memory.is_null() {
+        return EmulatorError::NullPointer;
+    }
+
+    let emulator_ptr = emulator_memory as *mut CEmulatorState;
+    let emulator_state = &mut *emulator_ptr;
+
+    match &mut emulator_state.wrapper {
+        EmulatorWrapper::Normal(emulator) => emulator.set_publish_globals(false),
+        EmulatorWrapper::Gdb(gdb_target) => gdb_target.emulator_mut().set_publish_globals(false),
+    }
+    EmulatorError::Success
+}
+
+/// Example external read callback that returns the address as data
+/// This is a simple test callback that C code can use for testing
+///
+/// # Arguments
+/// * `context` - Context pointer (unused in this example)
+/// * `size` - Size of the read operation (1, 2, or 4 bytes)
+/// * `addr` - Address being read from
+/// * `buffer` - Pointer to write the read data to
+///
+/// # Returns
+/// * 1 for success
+///
+/// # Safety
+/// * `buffer` must be a valid pointer to a u32 that can be written to
+#[no_mangle]
+pub unsafe extern "C" fn example_external_read_callback(
+    _context: *const std::ffi::c_void,
+    _size: c_uint,
+    addr: c_uint,
+    buffer: *mut c_uint,
+) -> c_int {
+    if buffer.is_null() {
+        return 0;
+    }
+
+    // Simple example: return the address as the read data
+    *buffer = addr;
+    1 // Success
+}
+
+/// Example external write callback that logs the operation
+/// This is a simple test callback that C code can use for testing
+///
+/// # Arguments
+/// * `context` - Context pointer (unused in this example)
+/// * `size` - Size of the write operation (1, 2, or 4 bytes)
+/// * `addr` - Address being written to
+/// * `data` - Data being written
+///
+/// # Returns
+/// * 1 for success
+///
+/// # Safety
+/// * This function only reads the provided parameters and performs no unsafe operations
+/// * All parameters are passed by value, so no pointer safety concerns
+#[no_mangle]
+pub unsafe extern "C" fn example_external_write_callback(
+    _context: *const std::ffi::c_void,
+    size: c_uint,
+    addr: c_uint,
     data: c_uint,
 ) -> c_int {
     println!(
@@ -1195,6 +1945,30 @@ fn convert_c_write_callback(
     })
 }
 
+/// Convert C batched external write callback to Rust callback
+fn convert_c_batch_write_callback(
+    c_callback: CExternalBatchWriteCallback,
+    context: *const std::ffi::c_void,
+) -> impl Fn(&[ExternalWrite]) -> bool + 'static {
+    move |writes| {
+        // ExternalWrite and CExternalWrite are both repr(C) with the same fields, see the
+        // layout assertion below
+        let result = unsafe {
+            c_callback(
+                context,
+                writes.as_ptr() as *const CExternalWrite,
+                writes.len(),
+            )
+        };
+        result != 0
+    }
+}
+
+const _: () = assert!(
+    std::mem::size_of::<CExternalWrite>() == std::mem::size_of::<ExternalWrite>()
+        && std::mem::align_of::<CExternalWrite>() == std::mem::align_of::<ExternalWrite>()
+);
+
 pub(crate) fn convert_optional_offset_size(value: c_longlong) -> Option<u32> {
     if value == -1 {
         None
@@ -1208,26 +1982,131 @@ pub(crate) fn convert_optional_offset_size(value: c_longlong) -> Option<u32> {
     }
 }
 
-/// Read from the auto_root_bus at the specified address
-///
-/// # Arguments
-/// * `emulator_memory` - Pointer to the initialized emulator
-/// * `size` - Size of the read operation (1, 2, or 4 bytes)
-/// * `addr` - Address to read from
-/// * `value` - Pointer to store the read value
-///
-/// # Returns
-/// * `EmulatorError::Success` on success
-/// * Appropriate error code on failure
-///
-/// # Safety
-/// * `emulator_memory` must point to a valid, initialized emulator
-/// * `value` must be a valid pointer to a u32
-#[no_mangle]
-pub unsafe extern "C" fn emulator_read_auto_root_bus(
-    emulator_memory: *mut CEmulator,
-    size: c_uint,
-    addr: c_uint,
+/// Memory layout overrides of `config` (-1 means use default)
+fn convert_memory_map_overrides(config: &CEmulatorConfig) -> MemoryMapOverrides {
+    MemoryMapOverrides {
+        rom_offset: convert_optional_offset_size(config.rom_offset),
+        rom_size: convert_optional_offset_size(config.rom_size),
+        uart_offset: convert_optional_offset_size(config.uart_offset),
+        uart_size: convert_optional_offset_size(config.uart_size),
+        ctrl_offset: convert_optional_offset_size(config.ctrl_offset),
+        ctrl_size: convert_optional_offset_size(config.ctrl_size),
+        sram_offset: convert_optional_offset_size(config.sram_offset),
+        sram_size: convert_optional_offset_size(config.sram_size),
+        pic_offset: convert_optional_offset_size(config.pic_offset),
+        external_test_sram_offset: convert_optional_offset_size(config.external_test_sram_offset),
+        external_test_sram_size: convert_optional_offset_size(config.external_test_sram_size),
+        dccm_offset: convert_optional_offset_size(config.dccm_offset),
+        dccm_size: convert_optional_offset_size(config.dccm_size),
+        i3c_offset: convert_optional_offset_size(config.i3c_offset),
+        i3c_size: convert_optional_offset_size(config.i3c_size),
+        primary_flash_offset: convert_optional_offset_size(config.primary_flash_offset),
+        primary_flash_size: convert_optional_offset_size(config.primary_flash_size),
+        secondary_flash_offset: convert_optional_offset_size(config.secondary_flash_offset),
+        secondary_flash_size: convert_optional_offset_size(config.secondary_flash_size),
+        mci_offset: convert_optional_offset_size(config.mci_offset),
+        mci_size: convert_optional_offset_size(config.mci_size),
+        dma_offset: convert_optional_offset_size(config.dma_offset),
+        dma_size: convert_optional_offset_size(config.dma_size),
+        mbox_offset: convert_optional_offset_size(config.mbox_offset),
+        mbox_size: convert_optional_offset_size(config.mbox_size),
+        soc_offset: convert_optional_offset_size(config.soc_offset),
+        soc_size: convert_optional_offset_size(config.soc_size),
+        otp_offset: convert_optional_offset_size(config.otp_offset),
+        otp_size: convert_optional_offset_size(config.otp_size),
+        lc_offset: convert_optional_offset_size(config.lc_offset),
+        lc_size: convert_optional_offset_size(config.lc_size),
+    }
+}
+
+/// Build and validate a memory map that any number of emulators can share
+///
+/// The map starts from `spec` and has the memory layout overrides of `overrides` applied.
+/// Pass it in `CEmulatorConfig::memory_map` so that `emulator_init()` skips the per-field
+/// overrides and the validation.
+///
+/// # Arguments
+/// * `spec` - Profile name ("default", "emulator" or "fpga") or path of a TOML memory map
+///   file; null means "default"
+/// * `overrides` - Configuration whose memory layout override fields are applied; can be null
+/// * `out_map` - Receives the memory map, to be released with `emulator_memory_map_free()`
+///
+/// # Returns
+/// * `EmulatorError::Success` on success
+/// * `EmulatorError::InvalidArgs` if `spec` can't be loaded or the resulting map is invalid
+///
+/// # Safety
+/// * `spec` must be null or a valid null-terminated C string
+/// * `overrides` must be null or a valid pointer to a CEmulatorConfig structure
+/// * `out_map` must be a valid pointer
+#[no_mangle]
+pub unsafe extern "C" fn emulator_memory_map_create(
+    spec: *const c_char,
+    overrides: *const CEmulatorConfig,
+    out_map: *mut *const CMemoryMap,
+) -> EmulatorError {
+    if out_map.is_null() {
+        return EmulatorError::NullPointer;
+    }
+
+    let map = match convert_optional_c_string(spec) {
+        Some(spec) => match MemoryMap::from_spec(&spec) {
+            Ok(map) => map,
+            Err(err) => {
+                eprintln!("Failed to load memory map {}: {}", spec, err);
+                return EmulatorError::InvalidArgs;
+            }
+        },
+        None => MemoryMap::default(),
+    };
+    let map = match overrides.as_ref() {
+        Some(config) => map.with_overrides(&convert_memory_map_overrides(config)),
+        None => map,
+    };
+    if let Err(err) = map.validate() {
+        eprintln!("Invalid memory map: {}", err);
+        return EmulatorError::InvalidArgs;
+    }
+
+    *out_map = Arc::into_raw(Arc::new(map)) as *const CMemoryMap;
+    EmulatorError::Success
+}
+
+/// Release a memory map created by `emulator_memory_map_create()`
+///
+/// Emulators that were initialized with the map keep their own reference to it, so it can
+/// be released as soon as the last `emulator_init()` using it has returned.
+///
+/// # Safety
+/// * `map` must be null or a pointer returned by `emulator_memory_map_create()` that has
+///   not been released yet
+#[no_mangle]
+pub unsafe extern "C" fn emulator_memory_map_free(map: *const CMemoryMap) {
+    if !map.is_null() {
+        drop(Arc::from_raw(map as *const MemoryMap));
+    }
+}
+
+/// Read from the auto_root_bus at the specified address
+///
+/// # Arguments
+/// * `emulator_memory` - Pointer to the initialized emulator
+/// * `size` - Size of the read operation (1, 2, or 4 bytes)
+/// * `addr` - Address to read from
+/// * `value` - Pointer to store the read value
+///
+/// # Returns
+/// * `EmulatorError::Success` on success
+/// * Appropriate error code on failure
+///
+/// # Safety
+/// * `emulator_memory` must point to a valid, initialized emulator
+/// * `value` must be a valid pointer to a u32
+#[no_mangle]
+pub unsafe extern "C" fn emulator_read_auto_root_bus(
+    emulator_memory: *mut CEmulator,
+    size: c_uint,
+    addr: c_uint,
     value: *mut c_uint,
 ) -> EmulatorError {
     if emulator_memory.is_null() || value.is_null() {
@@ -1320,9 +2199,676 @@ pub unsafe extern "C" fn emulator_write_auto_root_bus(
     }
 }
 
+/// Read a block of MCU memory
+///
+/// RAM-backed ranges (SRAM, DCCM, ROM, external test SRAM and direct-read flash) are
+/// copied directly; MMIO ranges are read through the bus a word at a time.
+///
+/// # Arguments
+/// * `emulator_memory` - Pointer to the initialized emulator
+/// * `addr` - Address to start reading from
+/// * `buffer` - Buffer to receive the data
+/// * `len` - Number of bytes to read
+///
+/// # Returns
+/// * `EmulatorError::Success` on success
+/// * `EmulatorError::BusLoadAccessFault` or `EmulatorError::BusLoadAddrMisaligned` if part of
+///   the range cannot be read; the contents of `buffer` are then unspecified
+///
+/// # Safety
+/// * `emulator_memory` must point to a valid, initialized emulator
+/// * `buffer` must be valid for writes of `len` bytes
+#[no_mangle]
+pub unsafe extern "C" fn emulator_read_memory(
+    emulator_memory: *mut CEmulator,
+    addr: c_uint,
+    buffer: *mut u8,
+    len: usize,
+) -> EmulatorError {
+    if emulator_memory.is_null() || buffer.is_null() {
+        return EmulatorError::NullPointer;
+    }
+
+    let state = &mut *(emulator_memory as *mut CEmulatorState);
+    let data = std::slice::from_raw_parts_mut(buffer, len);
+
+    let result = match &mut state.wrapper {
+        EmulatorWrapper::Normal(emulator) => emulator.read_memory(addr, data),
+        EmulatorWrapper::Gdb(gdb_target) => gdb_target.emulator_mut().read_memory(addr, data),
+    };
+
+    match result {
+        Ok(()) => EmulatorError::Success,
+        Err(caliptra_emu_bus::BusError::LoadAddrMisaligned) => EmulatorError::BusLoadAddrMisaligned,
+        Err(_) => EmulatorError::BusLoadAccessFault,
+    }
+}
+
+/// Write a block of MCU memory
+///
+/// Writable RAM-backed ranges are copied directly; MMIO ranges are written through the
+/// bus a word at a time. ROM and direct-read flash are read-only and fault.
+///
+/// # Arguments
+/// * `emulator_memory` - Pointer to the initialized emulator
+/// * `addr` - Address to start writing to
+/// * `buffer` - Data to write
+/// * `len` - Number of bytes to write
+///
+/// # Returns
+/// * `EmulatorError::Success` on success
+/// * `EmulatorError::BusStoreAccessFault` or `EmulatorError::BusStoreAddrMisaligned` at the
+///   first access that fails; the bytes before it have been written
+///
+/// # Safety
+/// * `emulator_memory` must point to a valid, initialized emulator
+/// * `buffer` must be valid for reads of `len` bytes
+#[no_mangle]
+pub unsafe extern "C" fn emulator_write_memory(
+    emulator_memory: *mut CEmulator,
+    addr: c_uint,
+    buffer: *const u8,
+    len: usize,
+) -> EmulatorError {
+    if emulator_memory.is_null() || buffer.is_null() {
+        return EmulatorError::NullPointer;
+    }
+
+    let state = &mut *(emulator_memory as *mut CEmulatorState);
+    let data = std::slice::from_raw_parts(buffer, len);
+
+    let result = match &mut state.wrapper {
+        EmulatorWrapper::Normal(emulator) => emulator.write_memory(addr, data),
+        EmulatorWrapper::Gdb(gdb_target) => gdb_target.emulator_mut().write_memory(addr, data),
+    };
+
+    match result {
+        Ok(()) => EmulatorError::Success,
+        Err(caliptra_emu_bus::BusError::StoreAddrMisaligned) => {
+            EmulatorError::BusStoreAddrMisaligned
+        }
+        Err(_) => EmulatorError::BusStoreAccessFault,
+    }
+}
+
+/// Switch external writes to batched delivery
+///
+/// Writes to the regions declared with `emulator_add_postable_external_region` are posted:
+/// they are queued instead of calling the write callback and are handed to `callback`
+/// together when the MCU executes a fence, before any external read, every
+/// `flush_interval` cycles (0 disables this), when the queue fills up, when
+/// `emulator_run_until` returns, when batching is disabled, when the emulator is destroyed
+/// or when `emulator_flush_external_writes` is called. A batch the callback rejects makes
+/// the next external read fault. Writes outside those regions flush the queue and are then
+/// passed to `callback` on their own, and fault if it rejects them.
+///
+/// # Arguments
+/// * `emulator_memory` - Pointer to the initialized emulator
+/// * `callback` - Batched write callback, called with the init `callback_context`, or NULL
+///   to deliver the queued writes and go back to the per-access write callback
+/// * `flush_interval` - Cycles between periodic flushes, 0 to disable
+///
+/// # Returns
+/// * `EmulatorError::Success` on success
+/// * `EmulatorError::BusStoreAccessFault` if batching was disabled and the callback
+///   rejected the last batch
+///
+/// # Safety
+/// * `emulator_memory` must point to a valid, initialized emulator
+#[no_mangle]
+pub unsafe extern "C" fn emulator_set_batched_write_callback(
+    emulator_memory: *mut CEmulator,
+    callback: Option<CExternalBatchWriteCallback>,
+    flush_interval: c_ulonglong,
+) -> EmulatorError {
+    if emulator_memory.is_null() {
+        return EmulatorError::NullPointer;
+    }
+
+    let state = &mut *(emulator_memory as *mut CEmulatorState);
+    let context = state.callback_context;
+    let emulator = match &mut state.wrapper {
+        EmulatorWrapper::Normal(emulator) => emulator,
+        EmulatorWrapper::Gdb(gdb_target) => gdb_target.emulator_mut(),
+    };
+    let Some(callback) = callback else {
+        return if emulator.disable_external_write_batching() {
+            EmulatorError::Success
+        } else {
+            EmulatorError::BusStoreAccessFault
+        };
+    };
+    emulator.enable_external_write_batching(
+        convert_c_batch_write_callback(callback, context),
+        flush_interval,
+    );
+    EmulatorError::Success
+}
+
+/// Declare a range of the external address space whose writes may be posted
+///
+/// Only writes that lie entirely in such a range are queued while batching is enabled,
+/// see `emulator_set_batched_write_callback`. Declare the ranges of device memory and
+/// registers whose writes have no side effects the MCU waits for.
+///
+/// # Arguments
+/// * `emulator_memory` - Pointer to the initialized emulator
+/// * `addr` - First external address of the range
+/// * `len` - Length of the range in bytes
+///
+/// # Returns
+/// * `EmulatorError::Success` on success
+/// * `EmulatorError::InvalidArgs` if the range wraps around the address space
+///
+/// # Safety
+/// * `emulator_memory` must point to a valid, initialized emulator
+#[no_mangle]
+pub unsafe extern "C" fn emulator_add_postable_external_region(
+    emulator_memory: *mut CEmulator,
+    addr: c_uint,
+    len: c_uint,
+) -> EmulatorError {
+    if emulator_memory.is_null() {
+        return EmulatorError::NullPointer;
+    }
+
+    let state = &*(emulator_memory as *mut CEmulatorState);
+    let external_bus = match &state.wrapper {
+        EmulatorWrapper::Normal(emulator) => &emulator.external_bus,
+        EmulatorWrapper::Gdb(gdb_target) => &gdb_target.emulator().external_bus,
+    };
+    if external_bus.add_postable_region(addr, len) {
+        EmulatorError::Success
+    } else {
+        EmulatorError::InvalidArgs
+    }
+}
+
+/// Deliver all queued external writes to the batched write callback now
+///
+/// # Arguments
+/// * `emulator_memory` - Pointer to the initialized emulator
+///
+/// # Returns
+/// * `EmulatorError::Success` on success or if nothing was queued
+/// * `EmulatorError::BusStoreAccessFault` if the callback rejected the batch
+///
+/// # Safety
+/// * `emulator_memory` must point to a valid, initialized emulator
+#[no_mangle]
+pub unsafe extern "C" fn emulator_flush_external_writes(
+    emulator_memory: *mut CEmulator,
+) -> EmulatorError {
+    if emulator_memory.is_null() {
+        return EmulatorError::NullPointer;
+    }
+
+    let state = &*(emulator_memory as *mut CEmulatorState);
+    let flushed = match &state.wrapper {
+        EmulatorWrapper::Normal(emulator) => emulator.external_bus.flush(),
+        EmulatorWrapper::Gdb(gdb_target) => gdb_target.emulator().external_bus.flush(),
+    };
+    if flushed {
+        EmulatorError::Success
+    } else {
+        EmulatorError::BusStoreAccessFault
+    }
+}
+
+/// Serve a range of the external address space directly from host memory
+///
+/// MCU accesses to `[addr, addr + len)` that would otherwise reach the external read and
+/// write callbacks read and write `buffer` instead (little-endian), e.g. for the plain
+/// memory of a co-simulated device.
+///
+/// # Arguments
+/// * `emulator_memory` - Pointer to the initialized emulator
+/// * `addr` - First external address of the region
+/// * `len` - Length of the region in bytes
+/// * `buffer` - Backing memory of at least `len` bytes
+///
+/// # Returns
+/// * `EmulatorError::Success` on success
+/// * `EmulatorError::InvalidArgs` if the range wraps or overlaps a mapped region
+///
+/// # Safety
+/// * `emulator_memory` must point to a valid, initialized emulator
+/// * `buffer` must stay valid until the emulator is destroyed and must not be accessed by
+///   other threads while the emulator is running
+#[no_mangle]
+pub unsafe extern "C" fn emulator_map_external_region(
+    emulator_memory: *mut CEmulator,
+    addr: c_uint,
+    len: c_uint,
+    buffer: *mut std::ffi::c_void,
+) -> EmulatorError {
+    if emulator_memory.is_null() || buffer.is_null() {
+        return EmulatorError::NullPointer;
+    }
+
+    let state = &*(emulator_memory as *mut CEmulatorState);
+    let external_bus = match &state.wrapper {
+        EmulatorWrapper::Normal(emulator) => &emulator.external_bus,
+        EmulatorWrapper::Gdb(gdb_target) => &gdb_target.emulator().external_bus,
+    };
+    if external_bus.map_direct_region(addr, len, buffer as *mut u8) {
+        EmulatorError::Success
+    } else {
+        EmulatorError::InvalidArgs
+    }
+}
+
+/// Start profiling the cycles spent per PC on both cores
+///
+/// Restarts the profile if one is already running. Name the profiled code with
+/// `emulator_profile_add_symbols` and write the result with `emulator_write_profile`.
+///
+/// # Arguments
+/// * `emulator_memory` - Pointer to the initialized emulator
+/// * `interval` - Sample every `interval` steps; 0 or 1 counts every step
+///
+/// # Returns
+/// * `EmulatorError::Success` on success
+///
+/// # Safety
+/// * `emulator_memory` must point to a valid, initialized emulator
+#[no_mangle]
+pub unsafe extern "C" fn emulator_start_profiling(
+    emulator_memory: *mut CEmulator,
+    interval: c_ulonglong,
+) -> EmulatorError {
+    if emulator_memory.is_null() {
+        return EmulatorError::NullPointer;
+    }
+
+    let state = &mut *(emulator_memory as *mut CEmulatorState);
+    match &mut state.wrapper {
+        EmulatorWrapper::Normal(emulator) => emulator.enable_profiling(interval),
+        EmulatorWrapper::Gdb(gdb_target) => gdb_target.emulator_mut().enable_profiling(interval),
+    }
+    EmulatorError::Success
+}
+
+/// Load the function symbols of an ELF executable to name the profiled code of one core
+///
+/// # Arguments
+/// * `emulator_memory` - Pointer to the initialized emulator
+/// * `core` - 0 for the MCU, 1 for Caliptra
+/// * `elf_path` - Path of the ELF executable
+///
+/// # Returns
+/// * `EmulatorError::Success` on success
+/// * `EmulatorError::InvalidArgs` if profiling is not started, `core` is invalid or the file
+///   cannot be read as an ELF executable
+///
+/// # Safety
+/// * `emulator_memory` must point to a valid, initialized emulator
+/// * `elf_path` must be a valid null-terminated string
+#[no_mangle]
+pub unsafe extern "C" fn emulator_profile_add_symbols(
+    emulator_memory: *mut CEmulator,
+    core: c_uint,
+    elf_path: *const c_char,
+) -> EmulatorError {
+    if emulator_memory.is_null() || elf_path.is_null() {
+        return EmulatorError::NullPointer;
+    }
+    let core = match core {
+        0 => TraceCore::Mcu,
+        1 => TraceCore::Caliptra,
+        _ => return EmulatorError::InvalidArgs,
+    };
+    let Ok(path) = convert_c_string(elf_path) else {
+        return EmulatorError::InvalidArgs;
+    };
+
+    let state = &mut *(emulator_memory as *mut CEmulatorState);
+    let emulator = match &mut state.wrapper {
+        EmulatorWrapper::Normal(emulator) => emulator,
+        EmulatorWrapper::Gdb(gdb_target) => gdb_target.emulator_mut(),
+    };
+    match emulator.profiler.as_mut() {
+        Some(profiler) if profiler.add_elf_symbols(core, Path::new(&path)).is_ok() => {
+            EmulatorError::Success
+        }
+        _ => EmulatorError::InvalidArgs,
+    }
+}
+
+/// Write the profile collected so far in the folded stack format
+///
+/// Each line is `<core>;<caller>;...;<function> <cycles>` per call stack, with PCs outside
+/// the loaded symbols named `0x<pc>`, ready for flame graph tools.
+///
+/// # Arguments
+/// * `emulator_memory` - Pointer to the initialized emulator
+/// * `path` - Path of the file to write
+///
+/// # Returns
+/// * `EmulatorError::Success` on success
+/// * `EmulatorError::InvalidArgs` if profiling is not started or the file cannot be written
+///
+/// # Safety
+/// * `emulator_memory` must point to a valid, initialized emulator
+/// * `path` must be a valid null-terminated string
+#[no_mangle]
+pub unsafe extern "C" fn emulator_write_profile(
+    emulator_memory: *mut CEmulator,
+    path: *const c_char,
+) -> EmulatorError {
+    if emulator_memory.is_null() || path.is_null() {
+        return EmulatorError::NullPointer;
+    }
+    let Ok(path) = convert_c_string(path) else {
+        return EmulatorError::InvalidArgs;
+    };
+
+    let state = &*(emulator_memory as *mut CEmulatorState);
+    let emulator = match &state.wrapper {
+        EmulatorWrapper::Normal(emulator) => emulator,
+        EmulatorWrapper::Gdb(gdb_target) => gdb_target.emulator(),
+    };
+    match emulator.profiler.as_ref() {
+        Some(profiler) if profiler.save_folded(Path::new(&path)).is_ok() => EmulatorError::Success,
+        _ => EmulatorError::InvalidArgs,
+    }
+}
+
+/// Start counting the accesses to each MCU peripheral
+///
+/// Counts reads, writes and bytes per peripheral, and detects polling loops as repeated
+/// reads of the same register returning the same value. SRAM, DCCM and ROM accesses are
+/// counted per memory, without polling detection. Restarts the counters if they are
+/// already enabled.
+///
+/// # Arguments
+/// * `emulator_memory` - Pointer to the initialized emulator
+///
+/// # Returns
+/// * `EmulatorError::Success` on success
+///
+/// # Safety
+/// * `emulator_memory` must point to a valid, initialized emulator
+#[no_mangle]
+pub unsafe extern "C" fn emulator_enable_stats(emulator_memory: *mut CEmulator) -> EmulatorError {
+    if emulator_memory.is_null() {
+        return EmulatorError::NullPointer;
+    }
+
+    let state = &mut *(emulator_memory as *mut CEmulatorState);
+    match &mut state.wrapper {
+        EmulatorWrapper::Normal(emulator) => emulator.enable_bus_stats(),
+        EmulatorWrapper::Gdb(gdb_target) => gdb_target.emulator_mut().enable_bus_stats(),
+    }
+    EmulatorError::Success
+}
+
+/// Read the MCU peripheral access counters
+///
+/// # Arguments
+/// * `emulator_memory` - Pointer to the initialized emulator
+/// * `stats` - Receives the counters accumulated since `emulator_enable_stats`
+///
+/// # Returns
+/// * `EmulatorError::Success` on success
+/// * `EmulatorError::InvalidArgs` if the counters are not enabled
+///
+/// # Safety
+/// * `emulator_memory` must point to a valid, initialized emulator
+/// * `stats` must be a valid pointer
+#[no_mangle]
+pub unsafe extern "C" fn emulator_get_stats(
+    emulator_memory: *mut CEmulator,
+    stats: *mut CEmulatorStats,
+) -> EmulatorError {
+    if emulator_memory.is_null() || stats.is_null() {
+        return EmulatorError::NullPointer;
+    }
+
+    let state = &*(emulator_memory as *mut CEmulatorState);
+    let emulator = match &state.wrapper {
+        EmulatorWrapper::Normal(emulator) => emulator,
+        EmulatorWrapper::Gdb(gdb_target) => gdb_target.emulator(),
+    };
+    let Some(bus_stats) = emulator.bus_stats() else {
+        return EmulatorError::InvalidArgs;
+    };
+
+    let mut result = CEmulatorStats {
+        cycle: emulator.mcu_cpu.clock.now(),
+        ..Default::default()
+    };
+    for (name, periph) in bus_stats {
+        let field = match name {
+            "i3c" => &mut result.i3c,
+            "primary_flash" => &mut result.primary_flash,
+            "secondary_flash" => &mut result.secondary_flash,
+            "mci" => &mut result.mci,
+            "doe_mbox" => &mut result.doe_mbox,
+            "otp" => &mut result.otp,
+            "lc" => &mut result.lc,
+            "axicdma" => &mut result.axicdma,
+            "mcu_root_bus" => &mut result.mcu_root_bus,
+            "soc_to_caliptra" => &mut result.soc_to_caliptra,
+            "caliptra_to_ext" => &mut result.external,
+            "mcu_mbox0" => &mut result.mcu_mbox0,
+            "mcu_mbox1" => &mut result.mcu_mbox1,
+            "sram" => &mut result.sram,
+            "dccm" => &mut result.dccm,
+            "rom" => &mut result.rom,
+            "external_test_sram" => &mut result.external_test_sram,
+            "direct_read_flash" => &mut result.direct_read_flash,
+            _ => continue,
+        };
+        *field = periph.into();
+    }
+    *stats = result;
+    EmulatorError::Success
+}
+
+/// Start recording the lockstep log of the MCU
+///
+/// Records every access to the MCU peripherals and to the Caliptra and external buses,
+/// and a checkpoint of the MCU PC and registers every `checkpoint_interval` cycles, so the
+/// run can be compared with another one, e.g. replayed on the FPGA. The log is flushed
+/// when the emulator is destroyed. Replaces the log being recorded, if any.
+///
+/// # Arguments
+/// * `emulator_memory` - Pointer to the initialized emulator
+/// * `path` - Path of the log file to create
+/// * `checkpoint_interval` - Cycles between two checkpoints; 0 records accesses only
+///
+/// # Returns
+/// * `EmulatorError::Success` on success
+/// * `EmulatorError::InvalidArgs` if the file cannot be created
+///
+/// # Safety
+/// * `emulator_memory` must point to a valid, initialized emulator
+/// * `path` must be a valid null-terminated string
+#[no_mangle]
+pub unsafe extern "C" fn emulator_enable_lockstep_log(
+    emulator_memory: *mut CEmulator,
+    path: *const c_char,
+    checkpoint_interval: c_ulonglong,
+) -> EmulatorError {
+    if emulator_memory.is_null() || path.is_null() {
+        return EmulatorError::NullPointer;
+    }
+    let Ok(path) = convert_c_string(path) else {
+        return EmulatorError::InvalidArgs;
+    };
+
+    let state = &mut *(emulator_memory as *mut CEmulatorState);
+    let emulator = match &mut state.wrapper {
+        EmulatorWrapper::Normal(emulator) => emulator,
+        EmulatorWrapper::Gdb(gdb_target) => gdb_target.emulator_mut(),
+    };
+    match emulator.enable_lockstep_log(Path::new(&path), checkpoint_interval) {
+        Ok(()) => EmulatorError::Success,
+        Err(_) => EmulatorError::InvalidArgs,
+    }
+}
+
+/// Fast-forward the clocks through idle periods
+///
+/// While Caliptra is parked on `wfi` and the MCU is parked on `wfi` too or spins in a
+/// polling loop that reads the same values, the clocks of both cores are moved forward
+/// instead of stepping through every cycle. Warps start at one cycle and double while no
+/// timer event comes due, so an event is delivered at most `max_cycles` late.
+///
+/// # Arguments
+/// * `emulator_memory` - Pointer to the initialized emulator
+/// * `max_cycles` - Largest single warp; 0 disables the time warp
+///
+/// # Returns
+/// * `EmulatorError::Success` on success
+///
+/// # Safety
+/// * `emulator_memory` must point to a valid, initialized emulator
+#[no_mangle]
+pub unsafe extern "C" fn emulator_set_time_warp(
+    emulator_memory: *mut CEmulator,
+    max_cycles: c_ulonglong,
+) -> EmulatorError {
+    if emulator_memory.is_null() {
+        return EmulatorError::NullPointer;
+    }
+
+    let state = &mut *(emulator_memory as *mut CEmulatorState);
+    match &mut state.wrapper {
+        EmulatorWrapper::Normal(emulator) => emulator.set_time_warp(max_cycles),
+        EmulatorWrapper::Gdb(gdb_target) => gdb_target.emulator_mut().set_time_warp(max_cycles),
+    }
+    EmulatorError::Success
+}
+
+/// Read the number of cycles skipped by the time warp
+///
+/// # Arguments
+/// * `emulator_memory` - Pointer to the initialized emulator
+/// * `stats` - Receives the warps taken since `emulator_set_time_warp`
+///
+/// # Returns
+/// * `EmulatorError::Success` on success
+/// * `EmulatorError::InvalidArgs` if the time warp is not enabled
+///
+/// # Safety
+/// * `emulator_memory` must point to a valid, initialized emulator
+/// * `stats` must be a valid pointer
+#[no_mangle]
+pub unsafe extern "C" fn emulator_get_time_warp_stats(
+    emulator_memory: *mut CEmulator,
+    stats: *mut CTimeWarpStats,
+) -> EmulatorError {
+    if emulator_memory.is_null() || stats.is_null() {
+        return EmulatorError::NullPointer;
+    }
+
+    let state = &*(emulator_memory as *mut CEmulatorState);
+    let emulator = match &state.wrapper {
+        EmulatorWrapper::Normal(emulator) => emulator,
+        EmulatorWrapper::Gdb(gdb_target) => gdb_target.emulator(),
+    };
+    match emulator.time_warp_stats() {
+        Some(warp_stats) => {
+            *stats = warp_stats.into();
+            EmulatorError::Success
+        }
+        None => EmulatorError::InvalidArgs,
+    }
+}
+
 #[cfg(test)]
 mod tests {
     use super::*;
+    use std::path::PathBuf;
+
+    /// Reset vector of the MCU with the default memory map
+    const TEST_ROM_ORG: u32 = 0x8000_0000;
+
+    /// MCU SRAM with the default memory map
+    const TEST_SRAM_ORG: u32 = 0x4000_0000;
+
+    /// FW_FLOW_STATUS register of the MCI with the default memory map
+    const TEST_MCI_FLOW_STATUS: u32 = 0x2100_0030;
+
+    /// MCU ROM of the tests: count a0 up to 3, storing each count at the start of SRAM,
+    /// then park on wfi
+    const TEST_MCU_ROM: [u32; 7] = [
+        0x4000_05b7, // lui a1, 0x40000
+        0x0015_0513, // addi a0, a0, 1
+        0x00a5_a023, // sw a0, 0(a1)
+        0xffd5_0293, // addi t0, a0, -3
+        0xfe02_9ae3, // bnez t0, -12
+        0x1050_0073, // wfi
+        0xffdf_f06f, // j -4
+    ];
+    /// MCU ROM counting like [`TEST_MCU_ROM`], then exiting with the code 0
+    const TEST_MCU_EXIT_ROM: [u32; 9] = [
+        0x4000_05b7, // lui a1, 0x40000
+        0x0015_0513, // addi a0, a0, 1
+        0x00a5_a023, // sw a0, 0(a1)
+        0xffd5_0293, // addi t0, a0, -3
+        0xfe02_9ae3, // bnez t0, -12
+        0x1000_2637, // lui a2, 0x10002
+        0x0056_2023, // sw t0, 0(a2)
+        0x1050_0073, // wfi
+        0xffdf_f06f, // j -4
+    ];
+    /// Caliptra ROM of the tests: `wfi; j -4`
+    const TEST_CALIPTRA_ROM: [u32; 2] = [0x1050_0073, 0xffdf_f06f];
+
+    /// An emulator running the test ROMs, with its input files and logs in a
+    /// directory of its own.
+    struct TestEmulator {
+        state: Box<CEmulatorState>,
+        dir: PathBuf,
+    }
+
+    impl TestEmulator {
+        fn new(name: &str) -> Self {
+            Self::with_rom(name, &TEST_MCU_ROM)
+        }
+
+        fn with_rom(name: &str, rom: &[u32]) -> Self {
+            let dir = std::env::temp_dir()
+                .join(format!("emulator-cbinding-{}-{name}", std::process::id()));
+            std::fs::create_dir_all(&dir).unwrap();
+            let mut args = simple_test::test_args(&dir);
+            args.log_dir = Some(dir.clone());
+
+            let words = |words: &[u32]| -> Vec<u8> {
+                words.iter().flat_map(|word| word.to_le_bytes()).collect()
+            };
+            std::fs::write(&args.rom, words(rom)).unwrap();
+            std::fs::write(&args.caliptra_rom, words(&TEST_CALIPTRA_ROM)).unwrap();
+            for path in [&args.firmware, &args.caliptra_firmware, &args.soc_manifest] {
+                std::fs::write(path, [0u8; 4]).unwrap();
+            }
+
+            let mut emulator = Emulator::from_args_with_callbacks(args, true, None, None).unwrap();
+            // tests run in parallel; keep them off the process-wide globals
+            emulator.set_publish_globals(false);
+            Self {
+                state: Box::new(CEmulatorState {
+                    wrapper: EmulatorWrapper::Normal(emulator),
+                    gdb_port: None,
+                    callback_context: ptr::null(),
+                }),
+                dir,
+            }
+        }
+
+        fn as_ptr(&mut self) -> *mut CEmulator {
+            &mut *self.state as *mut CEmulatorState as *mut CEmulator
+        }
+    }
+
+    impl Drop for TestEmulator {
+        fn drop(&mut self) {
+            let _ = std::fs::remove_dir_all(&self.dir);
+        }
+    }
 
     #[test]
     fn test_size_and_alignment() {
@@ -1334,4 +2880,387 @@ mod tests {
         assert!(align > 0);
         assert!(align.is_power_of_two());
     }
+
+    #[test]
+    fn test_run_until_null_emulator() {
+        let mut cycles: c_ulonglong = 123;
+        let action = unsafe { emulator_run_until(ptr::null_mut(), 10, ptr::null(), &mut cycles) };
+        assert_eq!(action, CStepAction::ExitFailure);
+        assert_eq!(cycles, 0);
+
+        let action = unsafe { emulator_step_n(ptr::null_mut(), 10, ptr::null_mut()) };
+        assert_eq!(action, CStepAction::ExitFailure);
+        assert_eq!(unsafe { emulator_get_input_fd(ptr::null_mut()) }, -1);
+    }
+
+    #[test]
+    fn test_stop_one_instance() {
+        let mut stopped = TestEmulator::new("stop-stopped");
+        let mut other = TestEmulator::new("stop-other");
+        let mut cycles: c_ulonglong = 0;
+
+        assert_eq!(
+            unsafe { emulator_stop(stopped.as_ptr()) },
+            EmulatorError::Success
+        );
+        let action = unsafe { emulator_step_n(stopped.as_ptr(), 10, &mut cycles) };
+        assert_eq!(action, CStepAction::Break);
+        assert_eq!(cycles, 1);
+
+        let action = unsafe { emulator_step_n(other.as_ptr(), 10, &mut cycles) };
+        assert_eq!(action, CStepAction::Continue);
+        assert_eq!(cycles, 10);
+        assert_eq!(
+            unsafe { emulator_stop(ptr::null_mut()) },
+            EmulatorError::NullPointer
+        );
+    }
+
+    #[test]
+    fn test_run_until_stop_conditions() {
+        let mut emulator = TestEmulator::new("run-until");
+        let memory = emulator.as_ptr();
+        let mut cycles: c_ulonglong = 0;
+
+        // lui and addi retire, then the PC reaches the sw
+        let conditions = CRunConditions {
+            stop_on_uart_output: 1,
+            stop_on_pc: 1,
+            stop_pc: TEST_ROM_ORG + 8,
+            stop_on_idle: 0,
+        };
+        let action = unsafe { emulator_run_until(memory, 100, &conditions, &mut cycles) };
+        assert_eq!(action, CStepAction::PcMatch);
+        assert_eq!(cycles, 2);
+
+        let action = unsafe { emulator_step_n(memory, 1, &mut cycles) };
+        assert_eq!(action, CStepAction::Continue);
+        assert_eq!(cycles, 1);
+        assert_eq!(unsafe { emulator_get_pc(memory) }, TEST_ROM_ORG + 12);
+
+        // both cores park on wfi without printing anything
+        let conditions = CRunConditions {
+            stop_on_uart_output: 1,
+            stop_on_pc: 0,
+            stop_pc: 0,
+            stop_on_idle: 1,
+        };
+        let action = unsafe { emulator_run_until(memory, 100_000, &conditions, &mut cycles) };
+        assert_eq!(action, CStepAction::Idle);
+        assert!(cycles < 100_000);
+        // no I3C socket to wait on
+        assert_eq!(unsafe { emulator_get_input_fd(memory) }, -1);
+
+        // without stop conditions the whole budget is spent
+        let action = unsafe { emulator_run_until(memory, 50, ptr::null(), &mut cycles) };
+        assert_eq!(action, CStepAction::Continue);
+        assert_eq!(cycles, 50);
+    }
+
+    #[test]
+    fn test_restore_continues_execution() {
+        let mut emulator = TestEmulator::new("restore");
+        let memory = emulator.as_ptr();
+        let mut cycles: c_ulonglong = 0;
+        let run_to = |pc: u32, cycles: &mut c_ulonglong| {
+            let conditions = CRunConditions {
+                stop_on_uart_output: 0,
+                stop_on_pc: 1,
+                stop_pc: pc,
+                stop_on_idle: 0,
+            };
+            unsafe { emulator_run_until(memory, 100, &conditions, cycles) }
+        };
+        let count = || {
+            let mut a0 = 0;
+            let mut sram = [0u8; 4];
+            unsafe {
+                assert_eq!(
+                    emulator_read_xreg(memory, 10 /* a0 */, &mut a0),
+                    EmulatorError::Success
+                );
+                assert_eq!(
+                    emulator_read_memory(memory, TEST_SRAM_ORG, sram.as_mut_ptr(), sram.len()),
+                    EmulatorError::Success
+                );
+            }
+            assert_eq!(u32::from_le_bytes(sram), a0);
+            a0
+        };
+
+        // snapshot after the first count
+        assert_eq!(run_to(TEST_ROM_ORG + 12, &mut cycles), CStepAction::PcMatch);
+        assert_eq!(count(), 1);
+        let mut size = 0;
+        assert_eq!(
+            unsafe { emulator_snapshot(memory, ptr::null_mut(), 0, &mut size) },
+            EmulatorError::Success
+        );
+        let mut snapshot = vec![0u8; size];
+        assert_eq!(
+            unsafe { emulator_snapshot(memory, snapshot.as_mut_ptr(), size, &mut size) },
+            EmulatorError::Success
+        );
+
+        assert_eq!(run_to(TEST_ROM_ORG + 20, &mut cycles), CStepAction::PcMatch);
+        assert_eq!(count(), 3);
+
+        // rewind and count up again from the restored registers and memory
+        assert_eq!(
+            unsafe { emulator_restore(memory, snapshot.as_ptr(), size) },
+            EmulatorError::Success
+        );
+        assert_eq!(unsafe { emulator_get_pc(memory) }, TEST_ROM_ORG + 12);
+        assert_eq!(count(), 1);
+        assert_eq!(run_to(TEST_ROM_ORG + 20, &mut cycles), CStepAction::PcMatch);
+        assert_eq!(cycles, 10);
+        assert_eq!(count(), 3);
+
+        // corrupt snapshots are rejected
+        assert_eq!(
+            unsafe { emulator_restore(memory, snapshot.as_ptr(), size - 1) },
+            EmulatorError::InvalidArgs
+        );
+    }
+
+    #[test]
+    fn test_restore_into_fresh_emulator() {
+        let mut emulator = TestEmulator::with_rom("restore-source", &TEST_MCU_EXIT_ROM);
+        let memory = emulator.as_ptr();
+        let mut cycles: c_ulonglong = 0;
+        let conditions = CRunConditions {
+            stop_on_uart_output: 0,
+            stop_on_pc: 1,
+            stop_pc: TEST_ROM_ORG + 12,
+            stop_on_idle: 0,
+        };
+        let action = unsafe { emulator_run_until(memory, 100, &conditions, &mut cycles) };
+        assert_eq!(action, CStepAction::PcMatch);
+        // peripheral state travels with the snapshot
+        let flow_status = 0x1234_5678u32.to_le_bytes();
+        let result =
+            unsafe { emulator_write_memory(memory, TEST_MCI_FLOW_STATUS, flow_status.as_ptr(), 4) };
+        assert_eq!(result, EmulatorError::Success);
+        let mut size = 0;
+        assert_eq!(
+            unsafe { emulator_snapshot(memory, ptr::null_mut(), 0, &mut size) },
+            EmulatorError::Success
+        );
+        let mut snapshot = vec![0u8; size];
+        assert_eq!(
+            unsafe { emulator_snapshot(memory, snapshot.as_mut_ptr(), size, &mut size) },
+            EmulatorError::Success
+        );
+        drop(emulator);
+
+        let mut fresh = TestEmulator::with_rom("restore-fresh", &TEST_MCU_EXIT_ROM);
+        let memory = fresh.as_ptr();
+        assert_eq!(
+            unsafe { emulator_restore(memory, snapshot.as_ptr(), size) },
+            EmulatorError::Success
+        );
+        assert_eq!(unsafe { emulator_get_pc(memory) }, TEST_ROM_ORG + 12);
+        let mut readback = [0u8; 4];
+        let result =
+            unsafe { emulator_read_memory(memory, TEST_MCI_FLOW_STATUS, readback.as_mut_ptr(), 4) };
+        assert_eq!(result, EmulatorError::Success);
+        assert_eq!(readback, flow_status);
+
+        // the restored MCU finishes counting from 1 and exits
+        let action = unsafe { emulator_run_until(memory, 1000, ptr::null(), &mut cycles) };
+        assert_eq!(action, CStepAction::ExitSuccess);
+        let mut sram = [0u8; 4];
+        let result =
+            unsafe { emulator_read_memory(memory, TEST_SRAM_ORG, sram.as_mut_ptr(), sram.len()) };
+        assert_eq!(result, EmulatorError::Success);
+        assert_eq!(u32::from_le_bytes(sram), 3);
+    }
+
+    #[test]
+    fn test_uart_ring_layout() {
+        let ring = UartOutputRing::new(16);
+        for &b in b"hi" {
+            ring.push(b);
+        }
+
+        // C sees the same ring through the mirrored struct
+        let c_ring = unsafe { &mut *(&ring as *const UartOutputRing as *mut CUartRing) };
+        assert_eq!(c_ring.capacity, 16);
+        assert_eq!(c_ring.head.wrapping_sub(c_ring.tail), 2);
+        let data = unsafe { std::slice::from_raw_parts(c_ring.data, 2) };
+        assert_eq!(data, b"hi");
+
+        // ...and draining from C is visible to Rust
+        c_ring.tail = c_ring.head;
+        assert!(ring.is_empty());
+    }
+
+    #[test]
+    fn test_snapshot_null_pointers() {
+        let mut size = 0usize;
+        let result = unsafe { emulator_snapshot(ptr::null_mut(), ptr::null_mut(), 0, &mut size) };
+        assert_eq!(result, EmulatorError::NullPointer);
+
+        let data = [0u8; 4];
+        let result = unsafe { emulator_restore(ptr::null_mut(), data.as_ptr(), data.len()) };
+        assert_eq!(result, EmulatorError::NullPointer);
+    }
+
+    #[test]
+    fn test_memory_block_access() {
+        let mut emulator = TestEmulator::new("memory");
+        let memory = emulator.as_ptr();
+
+        // the ROM comes back as it was loaded
+        let mut rom = [0u8; TEST_MCU_ROM.len() * 4];
+        let result =
+            unsafe { emulator_read_memory(memory, TEST_ROM_ORG, rom.as_mut_ptr(), rom.len()) };
+        assert_eq!(result, EmulatorError::Success);
+        let words: Vec<u32> = rom
+            .chunks(4)
+            .map(|word| u32::from_le_bytes(word.try_into().unwrap()))
+            .collect();
+        assert_eq!(words, TEST_MCU_ROM);
+
+        // an unaligned SRAM block reads back as written, both as a block and over the bus
+        let addr = TEST_SRAM_ORG + 0x101;
+        let data: Vec<u8> = (0..37u8).map(|i| i.wrapping_mul(7) ^ 0x5a).collect();
+        let result = unsafe { emulator_write_memory(memory, addr, data.as_ptr(), data.len()) };
+        assert_eq!(result, EmulatorError::Success);
+        let mut readback = vec![0u8; data.len()];
+        let result =
+            unsafe { emulator_read_memory(memory, addr, readback.as_mut_ptr(), readback.len()) };
+        assert_eq!(result, EmulatorError::Success);
+        assert_eq!(readback, data);
+        for (offset, byte) in data.iter().enumerate() {
+            let mut value = 0;
+            let result =
+                unsafe { emulator_read_auto_root_bus(memory, 1, addr + offset as u32, &mut value) };
+            assert_eq!(result, EmulatorError::Success);
+            assert_eq!(value, *byte as u32);
+        }
+
+        // stores by the firmware are visible, and leave the block alone
+        let conditions = CRunConditions {
+            stop_on_uart_output: 0,
+            stop_on_pc: 1,
+            stop_pc: TEST_ROM_ORG + 12,
+            stop_on_idle: 0,
+        };
+        let action = unsafe { emulator_run_until(memory, 100, &conditions, ptr::null_mut()) };
+        assert_eq!(action, CStepAction::PcMatch);
+        let mut count = [0u8; 4];
+        let result =
+            unsafe { emulator_read_memory(memory, TEST_SRAM_ORG, count.as_mut_ptr(), count.len()) };
+        assert_eq!(result, EmulatorError::Success);
+        assert_eq!(u32::from_le_bytes(count), 1);
+        let result =
+            unsafe { emulator_read_memory(memory, addr, readback.as_mut_ptr(), readback.len()) };
+        assert_eq!(result, EmulatorError::Success);
+        assert_eq!(readback, data);
+    }
+
+    #[test]
+    fn test_memory_null_pointers() {
+        let mut data = [0u8; 16];
+        let result =
+            unsafe { emulator_read_memory(ptr::null_mut(), 0, data.as_mut_ptr(), data.len()) };
+        assert_eq!(result, EmulatorError::NullPointer);
+
+        let result =
+            unsafe { emulator_write_memory(ptr::null_mut(), 0, data.as_ptr(), data.len()) };
+        assert_eq!(result, EmulatorError::NullPointer);
+    }
+
+    #[test]
+    fn test_external_bus_null_pointers() {
+        let result = unsafe { emulator_set_batched_write_callback(ptr::null_mut(), None, 0) };
+        assert_eq!(result, EmulatorError::NullPointer);
+
+        let result = unsafe { emulator_add_postable_external_region(ptr::null_mut(), 0, 16) };
+        assert_eq!(result, EmulatorError::NullPointer);
+
+        let result = unsafe { emulator_flush_external_writes(ptr::null_mut()) };
+        assert_eq!(result, EmulatorError::NullPointer);
+
+        let mut buffer = [0u8; 16];
+        let result = unsafe {
+            emulator_map_external_region(ptr::null_mut(), 0, 16, buffer.as_mut_ptr().cast())
+        };
+        assert_eq!(result, EmulatorError::NullPointer);
+    }
+
+    #[test]
+    fn test_profile_null_pointers() {
+        let result = unsafe { emulator_start_profiling(ptr::null_mut(), 1) };
+        assert_eq!(result, EmulatorError::NullPointer);
+
+        let path = c"profile.folded";
+        let result = unsafe { emulator_profile_add_symbols(ptr::null_mut(), 0, path.as_ptr()) };
+        assert_eq!(result, EmulatorError::NullPointer);
+
+        let result = unsafe { emulator_write_profile(ptr::null_mut(), path.as_ptr()) };
+        assert_eq!(result, EmulatorError::NullPointer);
+    }
+
+    #[test]
+    fn test_time_warp_null_pointers() {
+        let result = unsafe { emulator_set_time_warp(ptr::null_mut(), 1000) };
+        assert_eq!(result, EmulatorError::NullPointer);
+
+        let mut stats = CTimeWarpStats::default();
+        let result = unsafe { emulator_get_time_warp_stats(ptr::null_mut(), &mut stats) };
+        assert_eq!(result, EmulatorError::NullPointer);
+    }
+
+    #[test]
+    fn test_i3c_socket_stats_null_pointer() {
+        let mut stats = CI3cSocketStats::default();
+        let result = unsafe { emulator_get_i3c_socket_stats(ptr::null_mut(), &mut stats) };
+        assert_eq!(result, EmulatorError::NullPointer);
+        let result = unsafe { emulator_reset_i3c_socket_stats(ptr::null_mut()) };
+        assert_eq!(result, EmulatorError::NullPointer);
+    }
+
+    #[test]
+    fn test_stats_null_pointers() {
+        let result = unsafe { emulator_enable_stats(ptr::null_mut()) };
+        assert_eq!(result, EmulatorError::NullPointer);
+
+        let mut stats = CEmulatorStats::default();
+        let result = unsafe { emulator_get_stats(ptr::null_mut(), &mut stats) };
+        assert_eq!(result, EmulatorError::NullPointer);
+    }
+
+    #[test]
+    fn test_stats_cover_all_targets() {
+        // every counter emulator_get_stats() reports must still exist on the bus
+        let targets: Vec<_> = emulator_registers_generated::root_bus::AutoRootBus::PERIPHERALS
+            .iter()
+            .chain(MCU_BUS_DELEGATES.iter())
+            .chain(emulator_periph::McuRootBus::FAST_REGIONS.iter())
+            .collect();
+        for name in [
+            "i3c",
+            "primary_flash",
+            "secondary_flash",
+            "mci",
+            "doe_mbox",
+            "otp",
+            "lc",
+            "axicdma",
+            "mcu_root_bus",
+            "soc_to_caliptra",
+            "caliptra_to_ext",
+            "mcu_mbox0",
+            "mcu_mbox1",
+            "sram",
+            "dccm",
+            "rom",
+            "external_test_sram",
+            "direct_read_flash",
+        ] {
+            assert!(targets.contains(&&name), "{name}");
+        }
+    }
 }
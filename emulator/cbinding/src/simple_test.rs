@@ -13,7 +13,11 @@ Abstract:
 --*/
 
 use caliptra_image_types::FwVerificationPqcKeyType;
-use emulator::{Emulator, EmulatorArgs};
+use emulator::lockstep::DEFAULT_CHECKPOINT_INTERVAL;
+use emulator::trace::TraceFormat;
+use emulator::trace_thread::{TraceQueuePolicy, DEFAULT_TRACE_QUEUE_RECORDS};
+use emulator::{Emulator, EmulatorArgs, MemoryMapOverrides};
+use std::path::Path;
 
 #[test]
 fn test_can_import_emulator() {
@@ -27,21 +31,33 @@ fn test_can_import_emulator() {
     assert!(align > 0);
 }
 
-#[test]
-fn test_emulator_args_creation() {
-    // Test that we can create EmulatorArgs
-    use std::path::PathBuf;
-
-    let _args = EmulatorArgs {
-        rom: PathBuf::from("test_rom.bin"),
-        firmware: PathBuf::from("test_firmware.bin"),
-        caliptra_rom: PathBuf::from("test_caliptra_rom.bin"),
-        caliptra_firmware: PathBuf::from("test_caliptra_firmware.bin"),
-        soc_manifest: PathBuf::from("test_soc_manifest.bin"),
+/// Arguments of an emulator whose input files are in `dir`, with every option at its
+/// default.
+pub(crate) fn test_args(dir: &Path) -> EmulatorArgs {
+    EmulatorArgs {
+        rom: dir.join("test_rom.bin"),
+        firmware: dir.join("test_firmware.bin"),
+        caliptra_rom: dir.join("test_caliptra_rom.bin"),
+        caliptra_firmware: dir.join("test_caliptra_firmware.bin"),
+        soc_manifest: dir.join("test_soc_manifest.bin"),
         otp: None,
         gdb_port: None,
         log_dir: None,
         trace_instr: false,
+        trace_format: TraceFormat::Text,
+        trace_stdout: false,
+        trace_queue_policy: TraceQueuePolicy::Block,
+        trace_queue_size: DEFAULT_TRACE_QUEUE_RECORDS,
+        profile: false,
+        profile_interval: 1,
+        profile_mcu_elf: vec![],
+        profile_caliptra_elf: vec![],
+        bus_stats_interval: None,
+        lockstep_log: None,
+        lockstep_checkpoint_interval: DEFAULT_CHECKPOINT_INTERVAL,
+        time_warp: None,
+        record_inputs: None,
+        replay_inputs: None,
         stdin_uart: false,
         _no_stdin_uart: false,
         flash_based_boot: false,
@@ -53,42 +69,23 @@ fn test_emulator_args_creation() {
         streaming_boot: None,
         primary_flash_image: None,
         secondary_flash_image: None,
+        primary_flash_file: None,
+        secondary_flash_file: None,
+        map_flash_images: false,
         hw_revision: semver::Version::new(2, 0, 0),
-        rom_offset: None,
-        rom_size: None,
-        uart_offset: None,
-        uart_size: None,
-        ctrl_offset: None,
-        ctrl_size: None,
-        sram_offset: None,
-        sram_size: None,
-        pic_offset: None,
-        external_test_sram_offset: None,
-        external_test_sram_size: None,
-        dccm_offset: None,
-        dccm_size: None,
-        i3c_offset: None,
-        i3c_size: None,
-        primary_flash_offset: None,
-        primary_flash_size: None,
-        secondary_flash_offset: None,
-        secondary_flash_size: None,
-        mci_offset: None,
-        mci_size: None,
-        dma_offset: None,
-        dma_size: None,
-        mbox_offset: None,
-        mbox_size: None,
-        soc_offset: None,
-        soc_size: None,
-        otp_offset: None,
-        otp_size: None,
-        lc_offset: None,
-        lc_size: None,
+        memory_map: None,
+        shared_memory_map: None,
+        memory_map_overrides: MemoryMapOverrides::default(),
         fuse_soc_manifest_max_svn: None,
         fuse_soc_manifest_svn: None,
         fuse_vendor_hashes_prod_partition: None,
-    };
+    }
+}
+
+#[test]
+fn test_emulator_args_creation() {
+    // Test that we can create EmulatorArgs
+    let _args = test_args(Path::new(""));
 
     println!("EmulatorArgs created successfully");
 }
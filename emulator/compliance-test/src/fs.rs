@@ -23,7 +23,6 @@ pub fn create_dir<P: AsRef<Path> + Debug>(path: P) -> std::io::Result<()> {
 }
 
 /// Same as [`std::fs::write`] but with more informative errors.
-#[allow(dead_code)]
 pub fn write<P: AsRef<Path> + Debug, C: AsRef<[u8]>>(path: P, contents: C) -> std::io::Result<()> {
     std::fs::write(&path, contents)
         .map_err(|err| annotate_error(err, &format!("while writing to file {:?}", path)))
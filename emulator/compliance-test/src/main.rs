@@ -12,20 +12,21 @@ Abstract:
 
 --*/
 
-use caliptra_emu_bus::{Bus, Clock, Ram};
-use caliptra_emu_cpu::{Cpu, Pic, StepAction};
-use caliptra_emu_types::RvSize;
 use clap::{arg, value_parser};
-use emulator_consts::DEFAULT_CPU_ARGS;
 use fs::TempDir;
+use runner::{run_parallel, TestCase};
+use std::env::set_var;
 use std::error::Error;
 use std::io::ErrorKind;
 use std::path::PathBuf;
-use std::{env::set_var, rc::Rc};
-use test_data::{get_binary_data, get_signature_data, run_riscof};
+use test_data::{
+    get_binary_data, get_dut_signature_path, get_elf_data, get_signature_data, run_riscof,
+    TestLayout,
+};
 
 mod exec;
 mod fs;
+mod runner;
 mod test_data;
 
 pub struct TestInfo {
@@ -164,19 +165,20 @@ fn into_io_error(err: impl Into<Box<dyn Error + Send + Sync>>) -> std::io::Error
     std::io::Error::new(ErrorKind::Other, err)
 }
 
-fn check_reference_data(expected_txt: &str, bus: &mut impl Bus) -> std::io::Result<()> {
-    let mut addr = 0x1000;
+/// Compare the signature the emulator produced against the reference signature, both
+/// in the RISCOF format of one hex word per line. `base` is the address of the first word.
+fn check_signature(expected_txt: &str, actual_txt: &str, base: u32) -> std::io::Result<()> {
+    let mut actual_lines = actual_txt.lines();
+    let mut addr = base;
     for line in expected_txt.lines() {
         let expected_word = u32::from_str_radix(line, 16).map_err(into_io_error)?;
-        let actual_word = match bus.read(RvSize::Word, addr) {
-            Ok(val) => val,
-            Err(err) => {
-                return Err(into_io_error(format!(
-                    "Error accessing memory for comparison with reference data: {:?}",
-                    err
-                )))
-            }
+        let Some(actual_line) = actual_lines.next() else {
+            return Err(into_io_error(format!(
+                "At addr {:#x}, expected {:#010x} but the signature ended",
+                addr, expected_word
+            )));
         };
+        let actual_word = u32::from_str_radix(actual_line, 16).map_err(into_io_error)?;
         if expected_word != actual_word {
             return Err(std::io::Error::new(
                 ErrorKind::Other,
@@ -188,13 +190,15 @@ fn check_reference_data(expected_txt: &str, bus: &mut impl Bus) -> std::io::Resu
         }
         addr += 4;
     }
+    if actual_lines.next().is_some() {
+        return Err(into_io_error(format!(
+            "Signature is longer than the {} reference words",
+            (addr - base) / 4
+        )));
+    }
     Ok(())
 }
 
-fn is_test_complete(bus: &mut impl Bus) -> bool {
-    bus.read(RvSize::Word, 0x0).unwrap() != 0
-}
-
 fn main() -> Result<(), Box<dyn Error>> {
     let args = clap::Command::new("compliance-test")
         .about("RISC-V compliance suite runner")
@@ -205,6 +209,7 @@ fn main() -> Result<(), Box<dyn Error>> {
         .arg(arg!(--riscof <FILE> "Path to riscof").required(false).default_value("riscof").value_parser(value_parser!(PathBuf)))
         .arg(arg!(--riscv_sim_rv32 <FILE> "Path to riscv_sim_RV32").required(false).default_value("riscv_sim_RV32").value_parser(value_parser!(PathBuf)))
         .arg(arg!(--spike <FILE> "Path to spike").required(false).default_value("spike").value_parser(value_parser!(PathBuf)))
+        .arg(arg!(--jobs <N> "Number of tests to run in parallel (default: number of CPUs)").required(false).value_parser(value_parser!(usize)))
         .get_matches();
 
     set_var("RISCV_CC", args.get_one::<PathBuf>("compiler").unwrap());
@@ -224,66 +229,80 @@ fn main() -> Result<(), Box<dyn Error>> {
         temp_dir.path().to_owned(),
     )?;
 
-    for test in TESTS_TO_RUN.iter() {
-        println!("Running test {}/{}", test.extension, test.name);
+    let tests = TESTS_TO_RUN
+        .iter()
+        .map(|test| {
+            Ok(TestCase {
+                name: format!("{}/{}", test.extension, test.name),
+                binary: get_binary_data(test, temp_dir.path().to_owned())?,
+                layout: TestLayout::from_elf(&get_elf_data(test, temp_dir.path().to_owned())?)?,
+                reference: get_signature_data(test, temp_dir.path().to_owned())?,
+                signature_path: Some(get_dut_signature_path(test, temp_dir.path().to_owned())),
+            })
+        })
+        .collect::<std::io::Result<Vec<_>>>()?;
 
-        let binary = get_binary_data(test, temp_dir.path().to_owned())?;
-        let reference_txt = get_signature_data(test, temp_dir.path().to_owned())?;
-
-        let clock = Rc::new(Clock::new());
-        let pic = Rc::new(Pic::new());
-        let args = DEFAULT_CPU_ARGS;
-        let mut cpu = Cpu::new(Ram::new(binary), clock, pic, args);
-        cpu.write_pc(0x3000);
-        while !is_test_complete(&mut cpu.bus) {
-            match cpu.step(None) {
-                StepAction::Continue => continue,
-                _ => break,
-            }
-        }
-        if !is_test_complete(&mut cpu.bus) {
-            Err(std::io::Error::new(
-                ErrorKind::Other,
-                "test did not complete",
-            ))?;
-        }
+    let jobs = match args.get_one::<usize>("jobs") {
+        Some(jobs) => *jobs,
+        None => std::thread::available_parallelism().map_or(1, |n| n.get()),
+    };
+    println!("Running {} tests on {} threads", tests.len(), jobs);
+    let results = run_parallel(&tests, jobs);
 
-        check_reference_data(&reference_txt, &mut cpu.bus)?;
-        println!("PASSED");
-        drop(cpu);
+    let failed: Vec<&str> = tests
+        .iter()
+        .zip(results.iter())
+        .filter(|(_, result)| result.is_err())
+        .map(|(test, _)| test.name.as_str())
+        .collect();
+    println!(
+        "{} passed, {} failed",
+        tests.len() - failed.len(),
+        failed.len()
+    );
+    if !failed.is_empty() {
+        Err(into_io_error(format!(
+            "failed tests: {}",
+            failed.join(", ")
+        )))?;
     }
     Ok(())
 }
 
 #[cfg(test)]
 mod tests {
-    use std::rc::Rc;
-
     use super::*;
 
     #[test]
-    fn test_check_reference_data() {
-        let mut ram_bytes = vec![0u8; 4096];
-        ram_bytes.extend(vec![0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07]);
-        let clock = Rc::new(Clock::new());
-        let pic = Rc::new(Pic::new());
-        let args = DEFAULT_CPU_ARGS;
-        let mut cpu = Cpu::new(Ram::new(ram_bytes), clock, pic, args);
-
-        check_reference_data("03020100\n07060504\n", &mut cpu.bus).unwrap();
+    fn test_check_signature() {
+        check_signature("03020100\n07060504\n", "03020100\n07060504\n", 0x1000).unwrap();
         assert_eq!(
-            check_reference_data("03050100\n07060503\n", &mut cpu.bus)
+            check_signature("03050100\n07060503\n", "03020100\n07060504\n", 0x1000)
                 .err()
                 .unwrap()
                 .to_string(),
             "At addr 0x1000, expected 0x03050100 but was 0x03020100"
         );
         assert_eq!(
-            check_reference_data("03020100\n07060502", &mut cpu.bus)
+            check_signature("03020100\n07060502", "03020100\n07060504\n", 0x1000)
                 .err()
                 .unwrap()
                 .to_string(),
             "At addr 0x1004, expected 0x07060502 but was 0x07060504"
         );
+        assert_eq!(
+            check_signature("03020100\n07060504\n", "03020100\n", 0x1000)
+                .err()
+                .unwrap()
+                .to_string(),
+            "At addr 0x1004, expected 0x07060504 but the signature ended"
+        );
+        assert_eq!(
+            check_signature("03020100\n", "03020100\n07060504\n", 0x1000)
+                .err()
+                .unwrap()
+                .to_string(),
+            "Signature is longer than the 1 reference words"
+        );
     }
 }
@@ -0,0 +1,272 @@
+/*++
+
+Licensed under the Apache-2.0 license.
+
+File Name:
+
+    runner.rs
+
+Abstract:
+
+    Runs the compliance tests in parallel, one emulator per worker thread.
+
+--*/
+
+use crate::test_data::TestLayout;
+use crate::{check_signature, fs, into_io_error};
+use caliptra_emu_bus::{Bus, BusError, Clock, Ram};
+use caliptra_emu_cpu::{Cpu, Pic, StepAction};
+use caliptra_emu_types::{RvAddr, RvData, RvSize};
+use emulator_consts::DEFAULT_CPU_ARGS;
+use std::cell::RefCell;
+use std::fmt::Write;
+use std::io::ErrorKind;
+use std::path::PathBuf;
+use std::rc::Rc;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::Mutex;
+use std::thread;
+
+/// Tests that have not halted after this many steps are failed.
+const TEST_STEP_LIMIT: u64 = 100_000_000;
+
+/// A test image and the signature it is expected to produce.
+pub struct TestCase {
+    pub name: String,
+    pub binary: Vec<u8>,
+    pub layout: TestLayout,
+    pub reference: String,
+    /// Where to write the signature the emulator produced, if anywhere
+    pub signature_path: Option<PathBuf>,
+}
+
+/// RAM shared between a worker and the core it is currently running.
+///
+/// Watches for the `RVMODEL_HALT` store to `tohost` so the test can be stopped on the
+/// instruction that ends it instead of spinning in the `self_loop` that follows.
+struct SharedRam {
+    ram: Rc<RefCell<Ram>>,
+    tohost: RvAddr,
+    halted: bool,
+}
+
+impl Bus for SharedRam {
+    fn read(&mut self, size: RvSize, addr: RvAddr) -> Result<RvData, BusError> {
+        self.ram.borrow_mut().read(size, addr)
+    }
+
+    fn write(&mut self, size: RvSize, addr: RvAddr, val: RvData) -> Result<(), BusError> {
+        if addr == self.tohost && val != 0 {
+            self.halted = true;
+        }
+        self.ram.borrow_mut().write(size, addr, val)
+    }
+}
+
+/// Emulator state owned by one worker thread and reused for every test it runs.
+///
+/// The memory is allocated once, sized for the largest image, and reset between tests
+/// by clearing it and loading the next image. Each test gets a freshly constructed core
+/// so no register or CSR state leaks from the previous one.
+pub struct Worker {
+    ram: Rc<RefCell<Ram>>,
+    step_limit: u64,
+}
+
+impl Worker {
+    pub fn new(ram_size: usize) -> Self {
+        Self {
+            ram: Rc::new(RefCell::new(Ram::new(vec![0; ram_size]))),
+            step_limit: TEST_STEP_LIMIT,
+        }
+    }
+
+    /// Run `binary` until it writes `tohost` and return its signature in the RISCOF
+    /// format, one hex word per line.
+    pub fn run(&mut self, binary: &[u8], layout: &TestLayout) -> std::io::Result<String> {
+        {
+            let mut ram = self.ram.borrow_mut();
+            let data = ram.data_mut();
+            if binary.len() > data.len() {
+                return Err(into_io_error(format!(
+                    "test image of {} bytes does not fit in {} bytes of RAM",
+                    binary.len(),
+                    data.len()
+                )));
+            }
+            data[..binary.len()].copy_from_slice(binary);
+            data[binary.len()..].fill(0);
+        }
+
+        let clock = Rc::new(Clock::new());
+        let pic = Rc::new(Pic::new());
+        let bus = SharedRam {
+            ram: self.ram.clone(),
+            tohost: layout.tohost,
+            halted: false,
+        };
+        let mut cpu = Cpu::new(bus, clock, pic, DEFAULT_CPU_ARGS);
+        cpu.write_pc(layout.entry);
+        let mut steps = 0;
+        while !cpu.bus.halted && steps < self.step_limit {
+            match cpu.step(None) {
+                StepAction::Continue => steps += 1,
+                _ => break,
+            }
+        }
+        if !cpu.bus.halted {
+            Err(std::io::Error::new(
+                ErrorKind::Other,
+                "test did not complete",
+            ))?;
+        }
+        self.signature(layout)
+    }
+
+    /// Format the `begin_signature`..`end_signature` region straight from memory.
+    fn signature(&self, layout: &TestLayout) -> std::io::Result<String> {
+        let ram = self.ram.borrow();
+        let region = ram
+            .data()
+            .get(layout.begin_signature as usize..layout.end_signature as usize)
+            .ok_or_else(|| {
+                into_io_error(format!(
+                    "signature {:#x}..{:#x} is outside of RAM",
+                    layout.begin_signature, layout.end_signature
+                ))
+            })?;
+        let mut signature = String::with_capacity(region.len() / 4 * 9);
+        for word in region.chunks_exact(4) {
+            let word = u32::from_le_bytes(word.try_into().unwrap());
+            writeln!(signature, "{:08x}", word).unwrap();
+        }
+        Ok(signature)
+    }
+
+    /// Run `test`, write its signature if requested and compare it to the reference.
+    pub fn run_test(&mut self, test: &TestCase) -> std::io::Result<()> {
+        let signature = self.run(&test.binary, &test.layout)?;
+        if let Some(path) = &test.signature_path {
+            fs::write(path, &signature)?;
+        }
+        check_signature(&test.reference, &signature, test.layout.begin_signature)
+    }
+}
+
+/// Run `tests` on `jobs` worker threads and return the outcome of each, in order.
+///
+/// Workers take the next unclaimed test as they finish the previous one, so long
+/// running tests don't hold up a whole shard.
+pub fn run_parallel(tests: &[TestCase], jobs: usize) -> Vec<std::io::Result<()>> {
+    let ram_size = tests.iter().map(|t| t.binary.len()).max().unwrap_or(0);
+    let next = AtomicUsize::new(0);
+    let results: Mutex<Vec<Option<std::io::Result<()>>>> =
+        Mutex::new((0..tests.len()).map(|_| None).collect());
+
+    thread::scope(|scope| {
+        for _ in 0..jobs.clamp(1, tests.len().max(1)) {
+            scope.spawn(|| {
+                let mut worker = Worker::new(ram_size);
+                loop {
+                    let index = next.fetch_add(1, Ordering::Relaxed);
+                    let Some(test) = tests.get(index) else {
+                        break;
+                    };
+                    let result = worker.run_test(test);
+                    match &result {
+                        Ok(()) => println!("{}: PASSED", test.name),
+                        Err(err) => println!("{}: FAILED: {}", test.name, err),
+                    }
+                    results.lock().unwrap()[index] = Some(result);
+                }
+            });
+        }
+    });
+
+    results
+        .into_inner()
+        .unwrap()
+        .into_iter()
+        .map(|result| result.unwrap())
+        .collect()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// Layout of `link-caliptra.ld`, for `signature_words` words of signature.
+    fn layout(signature_words: u32) -> TestLayout {
+        TestLayout {
+            entry: 0x3000,
+            tohost: 0,
+            begin_signature: 0x1000,
+            end_signature: 0x1000 + signature_words * 4,
+        }
+    }
+
+    /// Image that stores 1 to `tohost` and spins. `signature` is placed at 0x1000.
+    fn test_image(signature: &[u32]) -> Vec<u8> {
+        let mut image = vec![0u8; 0x3000];
+        for (i, word) in signature.iter().enumerate() {
+            image[0x1000 + i * 4..0x1000 + i * 4 + 4].copy_from_slice(&word.to_le_bytes());
+        }
+        // li t0, 1; sw t0, 0(zero); j .
+        for instr in [0x0010_0293u32, 0x0050_2023, 0x0000_006f] {
+            image.extend_from_slice(&instr.to_le_bytes());
+        }
+        image
+    }
+
+    #[test]
+    fn test_worker_reset_between_tests() {
+        let mut long_image = test_image(&[0x11111111, 0x22222222]);
+        long_image.extend_from_slice(&[0xff; 64]);
+        let mut worker = Worker::new(long_image.len());
+        assert_eq!(
+            worker.run(&long_image, &layout(2)).unwrap(),
+            "11111111\n22222222\n"
+        );
+
+        // the previous tohost write and the tail of the longer image must be gone
+        let short_image = test_image(&[0x33333333]);
+        assert_eq!(
+            worker.run(&short_image, &layout(2)).unwrap(),
+            "33333333\n00000000\n"
+        );
+        assert!(worker.ram.borrow().data()[short_image.len()..]
+            .iter()
+            .all(|&b| b == 0));
+    }
+
+    #[test]
+    fn test_stops_at_tohost_write() {
+        let image = test_image(&[]);
+        let mut worker = Worker::new(image.len());
+        let mut layout = layout(0);
+        worker.run(&image, &layout).unwrap();
+
+        // a test that never writes tohost runs into the step limit
+        worker.step_limit = 1000;
+        layout.tohost = 0x4;
+        assert!(worker.run(&image, &layout).is_err());
+    }
+
+    #[test]
+    fn test_run_parallel_keeps_order() {
+        let tests: Vec<TestCase> = (0..8u32)
+            .map(|i| TestCase {
+                name: format!("test-{}", i),
+                binary: test_image(&[i]),
+                layout: layout(1),
+                reference: format!("{:08x}\n", if i == 5 { 0 } else { i }),
+                signature_path: None,
+            })
+            .collect();
+        let results = run_parallel(&tests, 3);
+        assert_eq!(results.len(), 8);
+        for (i, result) in results.iter().enumerate() {
+            assert_eq!(result.is_ok(), i != 5, "test {}", i);
+        }
+    }
+}
@@ -16,10 +16,50 @@ Abstract:
 use crate::{
     exec::exec,
     fs::{read, read_to_string},
-    TestInfo,
+    into_io_error, TestInfo,
 };
+use elf::endian::AnyEndian;
+use elf::ElfBytes;
 use std::{error::Error, path::PathBuf, process::Command};
 
+/// Name of the signature file the emulator writes next to the reference signature.
+const DUT_SIGNATURE_FILE: &str = "DUT-emulator.signature";
+
+/// Addresses of a test's entry point and of the symbols `model_test.h` defines.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct TestLayout {
+    pub entry: u32,
+    /// Written by `RVMODEL_HALT` when the test is done
+    pub tohost: u32,
+    pub begin_signature: u32,
+    pub end_signature: u32,
+}
+
+impl TestLayout {
+    /// Read the layout from the symbol table of the test ELF.
+    pub fn from_elf(elf_bytes: &[u8]) -> std::io::Result<Self> {
+        let elf_file = ElfBytes::<AnyEndian>::minimal_parse(elf_bytes)
+            .map_err(|e| into_io_error(format!("Failed to parse ELF file: {:?}", e)))?;
+        let (symbols, strings) = elf_file
+            .symbol_table()
+            .map_err(|e| into_io_error(e.to_string()))?
+            .ok_or_else(|| into_io_error("ELF file has no symbol table"))?;
+        let symbol = |name: &str| {
+            symbols
+                .iter()
+                .find(|sym| strings.get(sym.st_name as usize).is_ok_and(|s| s == name))
+                .map(|sym| sym.st_value as u32)
+                .ok_or_else(|| into_io_error(format!("ELF file has no {} symbol", name)))
+        };
+        Ok(Self {
+            entry: elf_file.ehdr.e_entry as u32,
+            tohost: symbol("tohost")?,
+            begin_signature: symbol("begin_signature")?,
+            end_signature: symbol("end_signature")?,
+        })
+    }
+}
+
 /// Run riscof to setup the environment
 pub fn run_riscof(
     riscof_path: PathBuf,
@@ -68,6 +108,20 @@ pub fn get_signature_data(test: &TestInfo, work_dir: PathBuf) -> std::io::Result
     Ok(data)
 }
 
+/// Get the path of the signature file the emulator writes for the given test
+pub fn get_dut_signature_path(test: &TestInfo, work_dir: PathBuf) -> PathBuf {
+    let mut path = get_test_dut_path(test, work_dir);
+    path.push(DUT_SIGNATURE_FILE);
+    path
+}
+
+/// Read the ELF file the binary of the given test was made from
+pub fn get_elf_data(test: &TestInfo, work_dir: PathBuf) -> std::io::Result<Vec<u8>> {
+    let mut path = get_test_dut_path(test, work_dir);
+    path.push("my_caliptra.elf");
+    read(path)
+}
+
 /// Get the binary file of the given test
 fn get_binary_path(test: &TestInfo, work_dir: PathBuf) -> PathBuf {
     let mut path = get_test_dut_path(test, work_dir);
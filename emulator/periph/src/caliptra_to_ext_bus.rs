@@ -15,15 +15,228 @@ Abstract:
 
 use caliptra_emu_bus::{Bus, BusError};
 use caliptra_emu_types::{RvAddr, RvData, RvSize};
-use std::{rc::Rc, sync::mpsc};
+use std::{cell::RefCell, ops::Range, rc::Rc, sync::mpsc};
 
 type ReadCallback = Box<dyn Fn(RvSize, RvAddr, &mut u32) -> bool>;
 type WriteCallback = Box<dyn Fn(RvSize, RvAddr, RvData) -> bool>;
+type BatchWriteCallback = Box<dyn Fn(&[ExternalWrite]) -> bool>;
+
+/// Number of queued writes after which a batch is flushed regardless of the interval.
+const MAX_QUEUED_WRITES: usize = 4096;
+
+/// A write queued for the batched write callback.
+#[repr(C)]
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct ExternalWrite {
+    /// Access size in bytes (1, 2 or 4)
+    pub size: u32,
+    pub addr: u32,
+    pub data: u32,
+}
+
+struct WriteBatch {
+    writes: Vec<ExternalWrite>,
+    callback: BatchWriteCallback,
+    flush_interval: u64,
+    last_flush: u64,
+    failed: bool,
+}
+
+/// Range of the external address space backed directly by memory owned by the host.
+struct DirectRegion {
+    start: u32,
+    len: u32,
+    data: *mut u8,
+}
+
+/// Handle for configuring how a [`CaliptraToExtBus`] reaches the external device after
+/// the bus has been mounted.
+///
+/// In batched mode, writes to the regions declared with
+/// [`ExternalBusControl::add_postable_region`] are posted: they are queued and handed to the
+/// batch callback together when the MCU executes a fence, before any read from the
+/// external bus, every `flush_interval` cycles, when the queue fills up, when batching is
+/// disabled or when [`ExternalBusControl::flush`] is called. A batch the callback rejects
+/// makes the next external read fail. Any other write flushes the queue and is then
+/// delivered on its own, and faults if the callback rejects it.
+#[derive(Default)]
+pub struct ExternalBusControl {
+    batch: RefCell<Option<WriteBatch>>,
+    direct_regions: RefCell<Vec<DirectRegion>>,
+    postable_regions: RefCell<Vec<Range<u32>>>,
+}
+
+impl ExternalBusControl {
+    /// Queue writes and deliver them through `callback` instead of the per-access write
+    /// callback. A `flush_interval` of 0 disables the periodic flush.
+    pub fn enable_write_batching<F>(&self, callback: F, flush_interval: u64)
+    where
+        F: Fn(&[ExternalWrite]) -> bool + 'static,
+    {
+        self.flush();
+        *self.batch.borrow_mut() = Some(WriteBatch {
+            writes: Vec::new(),
+            callback: Box::new(callback),
+            flush_interval,
+            last_flush: 0,
+            failed: false,
+        });
+    }
+
+    /// Deliver the queued writes and go back to the per-access write callback. Returns
+    /// false if the callback rejected the last batch.
+    pub fn disable_write_batching(&self) -> bool {
+        let ok = self.flush();
+        *self.batch.borrow_mut() = None;
+        ok
+    }
+
+    pub fn write_batching(&self) -> bool {
+        self.batch.borrow().is_some()
+    }
+
+    /// Allow writes to `len` bytes of the external address space starting at `start` to be
+    /// posted while batching is enabled. Returns false if the range wraps around the
+    /// address space.
+    pub fn add_postable_region(&self, start: u32, len: u32) -> bool {
+        let Some(end) = start.checked_add(len) else {
+            return false;
+        };
+        self.postable_regions.borrow_mut().push(start..end);
+        true
+    }
+
+    /// Hand all queued writes to the batch callback. Returns false if the callback
+    /// rejected them.
+    pub fn flush(&self) -> bool {
+        let mut batch = self.batch.borrow_mut();
+        let Some(batch) = batch.as_mut() else {
+            return true;
+        };
+        if batch.writes.is_empty() {
+            return true;
+        }
+        let ok = (batch.callback)(&batch.writes);
+        batch.writes.clear();
+        batch.failed |= !ok;
+        ok
+    }
+
+    /// Flush if at least `flush_interval` cycles have passed since the last periodic flush.
+    pub fn flush_if_due(&self, now: u64) {
+        let due = match self.batch.borrow_mut().as_mut() {
+            Some(batch) if batch.flush_interval != 0 => {
+                let due = now.wrapping_sub(batch.last_flush) >= batch.flush_interval;
+                if due {
+                    batch.last_flush = now;
+                }
+                due
+            }
+            _ => false,
+        };
+        if due {
+            self.flush();
+        }
+    }
+
+    /// Serve `len` bytes of the external address space starting at `start` directly from
+    /// `data` without calling the read and write callbacks. Returns false if the range
+    /// wraps around the address space or overlaps a region that is already mapped.
+    ///
+    /// # Safety
+    ///
+    /// `data` must be valid for reads and writes of `len` bytes for as long as the bus is
+    /// in use, and must not be accessed concurrently while the emulator is stepping.
+    pub unsafe fn map_direct_region(&self, start: u32, len: u32, data: *mut u8) -> bool {
+        let Some(end) = start.checked_add(len) else {
+            return false;
+        };
+        let mut regions = self.direct_regions.borrow_mut();
+        if regions
+            .iter()
+            .any(|region| start < region.start + region.len && region.start < end)
+        {
+            return false;
+        }
+        regions.push(DirectRegion { start, len, data });
+        true
+    }
+
+    /// Returns a pointer to the target of an access if a direct region can serve it.
+    fn direct(&self, size: RvSize, addr: RvAddr) -> Option<*mut u8> {
+        let width = match size {
+            RvSize::Invalid => return None,
+            size => size_in_bytes(size) as u64,
+        };
+        self.direct_regions
+            .borrow()
+            .iter()
+            .find(|region| addr.wrapping_sub(region.start) as u64 + width <= region.len as u64)
+            // SAFETY: the access lies within the region, see `map_direct_region`
+            .map(|region| unsafe { region.data.add((addr - region.start) as usize) })
+    }
+
+    /// Hand a write to the batch callback if batching is enabled: queue it if it lies in
+    /// a postable region, otherwise deliver it right after the writes queued before it.
+    /// Returns whether the write was accepted, or None if batching is disabled and the
+    /// write must go through the per-access callback instead.
+    fn post(&self, size: RvSize, addr: RvAddr, val: RvData) -> Option<bool> {
+        let write = ExternalWrite {
+            size: size_in_bytes(size),
+            addr,
+            data: val,
+        };
+        let end = addr as u64 + write.size as u64;
+        let postable = self
+            .postable_regions
+            .borrow()
+            .iter()
+            .any(|region| region.start <= addr && end <= region.end as u64);
+
+        let full = match self.batch.borrow_mut().as_mut() {
+            Some(batch) if postable => {
+                batch.writes.push(write);
+                batch.writes.len() >= MAX_QUEUED_WRITES
+            }
+            Some(_) => false,
+            None => return None,
+        };
+        if !postable {
+            self.flush();
+            let batch = self.batch.borrow();
+            return batch.as_ref().map(|batch| (batch.callback)(&[write]));
+        }
+        if full {
+            self.flush();
+        }
+        Some(true)
+    }
+
+    /// Flush before a read so it observes all earlier writes. Returns false if this or a
+    /// previous flush was rejected.
+    fn flush_for_read(&self) -> bool {
+        self.flush();
+        match self.batch.borrow_mut().as_mut() {
+            Some(batch) => !std::mem::take(&mut batch.failed),
+            None => true,
+        }
+    }
+}
+
+fn size_in_bytes(size: RvSize) -> u32 {
+    match size {
+        RvSize::Byte => 1,
+        RvSize::HalfWord => 2,
+        RvSize::Word => 4,
+        RvSize::Invalid => 0,
+    }
+}
 
 /// Bus for handling external communication via callbacks
 pub struct CaliptraToExtBus {
     read_callback: Option<ReadCallback>,
     write_callback: Option<WriteCallback>,
+    control: Rc<ExternalBusControl>,
 }
 
 impl CaliptraToExtBus {
@@ -31,6 +244,7 @@ impl CaliptraToExtBus {
         Self {
             read_callback: None,
             write_callback: None,
+            control: Rc::default(),
         }
     }
 
@@ -50,6 +264,11 @@ impl CaliptraToExtBus {
         self.write_callback = Some(Box::new(callback));
     }
 
+    /// Handle for enabling write batching and direct regions once the bus is mounted.
+    pub fn control(&self) -> Rc<ExternalBusControl> {
+        self.control.clone()
+    }
+
     // Keep this method for backward compatibility but delegate to set_read_callback
     pub fn external_shim_mut(&mut self) -> &mut Self {
         self
@@ -74,6 +293,16 @@ impl Bus for CaliptraToExtBus {
     ///
     /// * `BusError::LoadAccessFault` - If no callback is registered or callback returns false
     fn read(&mut self, size: RvSize, addr: RvAddr) -> Result<RvData, BusError> {
+        if let Some(ptr) = self.control.direct(size, addr) {
+            let mut val = [0u8; 4];
+            let width = size_in_bytes(size) as usize;
+            // SAFETY: `direct` checked that `width` bytes at `ptr` are within the region
+            unsafe { std::ptr::copy_nonoverlapping(ptr, val.as_mut_ptr(), width) };
+            return Ok(u32::from_le_bytes(val));
+        }
+        if !self.control.flush_for_read() {
+            return Err(BusError::LoadAccessFault);
+        }
         if let Some(callback) = &self.read_callback {
             let mut buffer: u32 = 0;
             if callback(size, addr, &mut buffer) {
@@ -97,6 +326,17 @@ impl Bus for CaliptraToExtBus {
     ///
     /// * `BusError::StoreAccessFault` - If no callback is registered or callback returns false
     fn write(&mut self, size: RvSize, addr: RvAddr, val: RvData) -> Result<(), BusError> {
+        if let Some(ptr) = self.control.direct(size, addr) {
+            let width = size_in_bytes(size) as usize;
+            // SAFETY: `direct` checked that `width` bytes at `ptr` are within the region
+            unsafe { std::ptr::copy_nonoverlapping(val.to_le_bytes().as_ptr(), ptr, width) };
+            return Ok(());
+        }
+        match self.control.post(size, addr, val) {
+            Some(true) => return Ok(()),
+            Some(false) => return Err(BusError::StoreAccessFault),
+            None => {}
+        }
         if let Some(callback) = &self.write_callback {
             if callback(size, addr, val) {
                 return Ok(());
@@ -112,7 +352,7 @@ impl Bus for CaliptraToExtBus {
     }
 
     fn warm_reset(&mut self) {
-        // External communication doesn't need reset handling
+        self.control.flush();
     }
 
     fn update_reset(&mut self) {
@@ -127,3 +367,116 @@ impl Bus for CaliptraToExtBus {
         // External communication doesn't need event handling
     }
 }
+
+#[cfg(test)]
+mod test {
+    use super::*;
+    use std::cell::Cell;
+
+    #[test]
+    fn test_batched_writes_flush_before_read() {
+        let mut bus = CaliptraToExtBus::new();
+        assert!(bus.control().add_postable_region(0x100, 0x10));
+        let delivered = Rc::new(RefCell::new(vec![]));
+        let reads = Rc::new(Cell::new(0));
+        let reads_clone = reads.clone();
+        bus.set_read_callback(move |_, _, buffer| {
+            reads_clone.set(reads_clone.get() + 1);
+            *buffer = 0x55;
+            true
+        });
+        let delivered_clone = delivered.clone();
+        bus.control().enable_write_batching(
+            move |writes| {
+                delivered_clone.borrow_mut().push(writes.to_vec());
+                true
+            },
+            0,
+        );
+
+        bus.write(RvSize::Word, 0x100, 1).unwrap();
+        bus.write(RvSize::Byte, 0x104, 2).unwrap();
+        assert!(delivered.borrow().is_empty());
+
+        assert_eq!(bus.read(RvSize::Word, 0x200).unwrap(), 0x55);
+        assert_eq!(reads.get(), 1);
+        assert_eq!(
+            *delivered.borrow(),
+            vec![vec![
+                ExternalWrite {
+                    size: 4,
+                    addr: 0x100,
+                    data: 1
+                },
+                ExternalWrite {
+                    size: 1,
+                    addr: 0x104,
+                    data: 2
+                },
+            ]]
+        );
+    }
+
+    #[test]
+    fn test_rejected_batch_faults_next_read() {
+        let mut bus = CaliptraToExtBus::new();
+        bus.set_read_callback(|_, _, _| true);
+        bus.control().add_postable_region(0x100, 4);
+        bus.control().enable_write_batching(|_| false, 0);
+        bus.write(RvSize::Word, 0x100, 1).unwrap();
+        assert!(bus.read(RvSize::Word, 0x100).is_err());
+        assert!(bus.read(RvSize::Word, 0x100).is_ok());
+    }
+
+    #[test]
+    fn test_unpostable_writes_are_not_posted() {
+        let mut bus = CaliptraToExtBus::new();
+        let delivered = Rc::new(RefCell::new(vec![]));
+        let delivered_clone = delivered.clone();
+        let control = bus.control();
+        assert!(control.add_postable_region(0x100, 0x10));
+        control.enable_write_batching(
+            move |writes| {
+                delivered_clone.borrow_mut().push(writes.to_vec());
+                // nothing is mapped at 0x300
+                writes.iter().all(|write| write.addr != 0x300)
+            },
+            0,
+        );
+
+        // the halfword at 0x10f straddles the end of the postable region
+        bus.write(RvSize::Word, 0x104, 1).unwrap();
+        bus.write(RvSize::HalfWord, 0x10f, 2).unwrap();
+        assert_eq!(delivered.borrow().len(), 2);
+        assert_eq!(delivered.borrow()[0][0].addr, 0x104);
+        assert_eq!(delivered.borrow()[1][0].addr, 0x10f);
+
+        // unmapped stores still fault
+        assert!(bus.write(RvSize::Word, 0x300, 3).is_err());
+
+        // disabling batching delivers the trailing writes
+        bus.write(RvSize::Word, 0x108, 4).unwrap();
+        assert_eq!(delivered.borrow().len(), 3);
+        assert!(control.disable_write_batching());
+        assert_eq!(delivered.borrow().len(), 4);
+        assert_eq!(delivered.borrow()[3][0].addr, 0x108);
+        assert!(!control.write_batching());
+    }
+
+    #[test]
+    fn test_direct_region() {
+        let mut bus = CaliptraToExtBus::new();
+        let mut backing = vec![0u8; 16];
+        let control = bus.control();
+        assert!(unsafe { control.map_direct_region(0x1000, 16, backing.as_mut_ptr()) });
+        assert!(!unsafe { control.map_direct_region(0x1008, 16, backing.as_mut_ptr()) });
+
+        bus.write(RvSize::Word, 0x1004, 0xaabb_ccdd).unwrap();
+        assert_eq!(bus.read(RvSize::HalfWord, 0x1006).unwrap(), 0xaabb);
+        // no callbacks are registered, so anything outside the region faults
+        assert!(bus.read(RvSize::Word, 0x100e).is_err());
+        assert!(bus.read(RvSize::Word, 0x1010).is_err());
+        drop(bus);
+        assert_eq!(&backing[4..8], &[0xdd, 0xcc, 0xbb, 0xaa]);
+    }
+}
@@ -14,10 +14,15 @@ Abstract:
 
 use caliptra_emu_bus::{Bus, BusError};
 use caliptra_emu_types::{RvAddr, RvData, RvSize};
+use std::cell::Cell;
 use std::process::exit;
+use std::rc::Rc;
 
 /// Emulation Control
-pub struct EmuCtrl {}
+pub struct EmuCtrl {
+    /// Records the exit code written by the firmware. If unset the process exits instead.
+    exit_request: Option<Rc<Cell<Option<u32>>>>,
+}
 
 impl EmuCtrl {
     // Exit emulator address
@@ -29,7 +34,15 @@ impl EmuCtrl {
     ///
     /// * `name` - Name of the device
     pub fn new() -> Self {
-        Self {}
+        Self { exit_request: None }
+    }
+
+    /// Create an instance that records exit requests in `exit_request` instead of
+    /// terminating the process, so that several emulators can share one process.
+    pub fn new_with_exit_request(exit_request: Rc<Cell<Option<u32>>>) -> Self {
+        Self {
+            exit_request: Some(exit_request),
+        }
     }
     /// Memory map size.
     pub fn mmap_size(&self) -> RvAddr {
@@ -75,9 +88,10 @@ impl Bus for EmuCtrl {
     ///   or `RvExceptionCause::StoreAddrMisaligned`
     fn write(&mut self, _size: RvSize, addr: RvAddr, val: RvData) -> Result<(), BusError> {
         match addr {
-            EmuCtrl::ADDR_EXIT => {
-                exit(val as i32);
-            }
+            EmuCtrl::ADDR_EXIT => match &self.exit_request {
+                Some(exit_request) => exit_request.set(Some(val)),
+                None => exit(val as i32),
+            },
             _ => Err(BusError::StoreAccessFault)?,
         }
         Ok(())
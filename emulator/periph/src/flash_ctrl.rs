@@ -12,7 +12,11 @@ Abstract:
 
 --*/
 
-use caliptra_emu_bus::{ActionHandle, Bus, Clock, Ram, ReadOnlyRegister, ReadWriteRegister, Timer};
+use crate::state::{invalid, StateReader, StateWriter};
+use crate::MappedImage;
+use caliptra_emu_bus::{
+    ActionHandle, Bus, BusError, Clock, Ram, ReadOnlyRegister, ReadWriteRegister, Timer,
+};
 use caliptra_emu_cpu::Irq;
 use caliptra_emu_types::{RvData, RvSize};
 use core::convert::TryInto;
@@ -24,6 +28,7 @@ use registers_generated::primary_flash_ctrl::bits::{
     CtrlRegwen, FlControl, FlInterruptEnable, FlInterruptState, OpStatus,
 };
 use std::cell::RefCell;
+use std::collections::HashMap;
 use std::fs::File;
 use std::io::{Read, Seek, Write};
 use std::path::PathBuf;
@@ -71,6 +76,83 @@ pub enum FlashOpError {
     DmaRamAccessError = 4,
 }
 
+/// Flash contents backed by a read-only image.
+///
+/// Pages the firmware writes or erases are copied into memory on their first write, so
+/// the image file is never modified and untouched pages are never loaded. Everything
+/// past the end of the image reads as erased.
+///
+/// The same contents can also serve the direct-read flash window through
+/// [`crate::McuRootBus::map_direct_read_flash`], so that no copy of the image is needed
+/// there either.
+pub struct CopyOnWriteFlash {
+    image: MappedImage,
+    pages: HashMap<u32, Box<[u8]>>,
+}
+
+impl CopyOnWriteFlash {
+    pub fn new(image: MappedImage) -> Self {
+        Self {
+            image,
+            pages: HashMap::new(),
+        }
+    }
+
+    fn read_page(&self, page_num: u32, buffer: &mut [u8]) {
+        if let Some(page) = self.pages.get(&page_num) {
+            buffer.copy_from_slice(page);
+            return;
+        }
+        buffer.fill(0xff);
+        let offset = page_num as usize * buffer.len();
+        if offset < self.image.len() {
+            let len = buffer.len().min(self.image.len() - offset);
+            buffer[..len].copy_from_slice(&self.image[offset..offset + len]);
+        }
+    }
+
+    fn write_page(&mut self, page_num: u32, data: &[u8]) {
+        self.pages
+            .entry(page_num)
+            .or_insert_with(|| vec![0; data.len()].into_boxed_slice())
+            .copy_from_slice(data);
+    }
+
+    /// Load `size` bytes at `offset` of the flash, as the direct-read window does.
+    pub fn read(&self, size: RvSize, offset: u32) -> Result<RvData, BusError> {
+        let width = match size {
+            RvSize::Byte => 1,
+            RvSize::HalfWord => 2,
+            RvSize::Word => 4,
+            _ => return Err(BusError::LoadAccessFault),
+        };
+        let offset = offset as usize;
+        if offset % width != 0 {
+            return Err(BusError::LoadAddrMisaligned);
+        }
+        let page_size = DummyFlashCtrl::PAGE_SIZE;
+        if offset + width > page_size * DummyFlashCtrl::MAX_PAGES as usize {
+            return Err(BusError::LoadAccessFault);
+        }
+
+        // an aligned access never crosses a page
+        let mut bytes = [0xff; 4];
+        if let Some(page) = self.pages.get(&((offset / page_size) as u32)) {
+            let start = offset % page_size;
+            bytes[..width].copy_from_slice(&page[start..start + width]);
+        } else if offset < self.image.len() {
+            let len = width.min(self.image.len() - offset);
+            bytes[..len].copy_from_slice(&self.image[offset..offset + len]);
+        }
+        Ok(u32::from_le_bytes(bytes) & (u32::MAX >> (32 - 8 * width)))
+    }
+}
+
+enum FlashStorage {
+    File(File),
+    CopyOnWrite(Rc<RefCell<CopyOnWriteFlash>>),
+}
+
 /// A dummy flash controller peripheral for emulation purposes.
 pub struct DummyFlashCtrl {
     interrupt_state: ReadWriteRegister<u32, FlInterruptState::Register>,
@@ -85,7 +167,7 @@ pub struct DummyFlashCtrl {
     dma_rom_sram: Option<Rc<RefCell<Ram>>>,
     direct_read_region: Option<Rc<RefCell<Ram>>>,
     timer: Timer,
-    file: Option<File>,
+    storage: Option<FlashStorage>,
     buffer: Vec<u8>,
     operation_start: Option<ActionHandle>,
     error_irq: Irq,
@@ -132,8 +214,7 @@ impl DummyFlashCtrl {
         event_irq: Irq,
         initial_content: Option<&[u8]>,
     ) -> Result<Self, std::io::Error> {
-        let timer = Timer::new(clock);
-        let file = if let Some(path) = file_name {
+        let storage = if let Some(path) = file_name {
             let mut file = std::fs::File::options()
                 .read(true)
                 .write(true)
@@ -157,12 +238,49 @@ impl DummyFlashCtrl {
                 file.seek(std::io::SeekFrom::Start(0))?;
                 file.read_exact(&mut region.borrow_mut().data_mut()[..capacity])?;
             }
-            Some(file)
+            Some(FlashStorage::File(file))
         } else {
             None
         };
 
-        Ok(Self {
+        Ok(Self::with_storage(
+            clock,
+            direct_read_region,
+            storage,
+            error_irq,
+            event_irq,
+        ))
+    }
+
+    /// Create a controller whose flash starts out with the contents of `flash`.
+    ///
+    /// Unlike [`DummyFlashCtrl::new`] with initial content, nothing is copied into a flash
+    /// file: writes and erases stay in memory and are lost when the controller is dropped.
+    /// Page reads come from `flash` as well, so the direct-read window of the primary flash
+    /// is mapped onto it instead of being handed to the controller.
+    pub fn new_copy_on_write(
+        clock: &Clock,
+        flash: Rc<RefCell<CopyOnWriteFlash>>,
+        error_irq: Irq,
+        event_irq: Irq,
+    ) -> Self {
+        Self::with_storage(
+            clock,
+            None,
+            Some(FlashStorage::CopyOnWrite(flash)),
+            error_irq,
+            event_irq,
+        )
+    }
+
+    fn with_storage(
+        clock: &Clock,
+        direct_read_region: Option<Rc<RefCell<Ram>>>,
+        storage: Option<FlashStorage>,
+        error_irq: Irq,
+        event_irq: Irq,
+    ) -> Self {
+        Self {
             dma_ram: None,
             dma_rom_sram: None,
             direct_read_region,
@@ -174,13 +292,85 @@ impl DummyFlashCtrl {
             control: ReadWriteRegister::new(0x0000_0000),
             op_status: ReadWriteRegister::new(0x0000_0000),
             ctrl_regwen: ReadOnlyRegister::new(CtrlRegwen::En::SET.value),
-            timer,
-            file,
+            timer: Timer::new(clock),
+            storage,
             buffer: vec![0; Self::PAGE_SIZE],
             operation_start: None,
             error_irq,
             event_irq,
-        })
+        }
+    }
+
+    /// Registers, page buffer and pending operation, plus the written pages of copy-on-write
+    /// flash. A flash file already holds its own contents, so they are not saved again.
+    fn save_ctrl_state(&self) -> Vec<u8> {
+        let mut out = StateWriter::default();
+        for reg in [
+            self.interrupt_state.reg.get(),
+            self.interrupt_enable.reg.get(),
+            self.page_size.reg.get(),
+            self.page_num.reg.get(),
+            self.page_addr.reg.get(),
+            self.control.reg.get(),
+            self.op_status.reg.get(),
+            self.ctrl_regwen.reg.get(),
+        ] {
+            out.u32(reg);
+        }
+        out.bytes(&self.buffer).bool(self.operation_start.is_some());
+        if let Some(FlashStorage::CopyOnWrite(flash)) = &self.storage {
+            let flash = flash.borrow();
+            let mut pages: Vec<_> = flash.pages.iter().collect();
+            pages.sort_by_key(|(page_num, _)| **page_num);
+            out.u32(pages.len() as u32);
+            for (page_num, page) in pages {
+                out.u32(*page_num).bytes(page);
+            }
+        }
+        out.finish()
+    }
+
+    fn restore_ctrl_state(&mut self, state: &[u8]) -> std::io::Result<()> {
+        let mut state = StateReader::new(state);
+        self.interrupt_state.reg.set(state.u32()?);
+        self.interrupt_enable.reg.set(state.u32()?);
+        self.page_size.reg.set(state.u32()?);
+        self.page_num.reg.set(state.u32()?);
+        self.page_addr.reg.set(state.u32()?);
+        self.control.reg.set(state.u32()?);
+        self.op_status.reg.set(state.u32()?);
+        self.ctrl_regwen.reg.set(state.u32()?);
+        let buffer = state.bytes()?;
+        if buffer.len() != Self::PAGE_SIZE {
+            Err(invalid("flash page size does not match"))?;
+        }
+        self.buffer.copy_from_slice(buffer);
+        if let Some(old) = self.operation_start.take() {
+            self.timer.cancel(old);
+        }
+        // the operation restarts from the beginning of its delay
+        if state.bool()? {
+            self.operation_start = Some(self.timer.schedule_poll_in(Self::IO_START_DELAY));
+        }
+        if let Some(FlashStorage::CopyOnWrite(flash)) = &self.storage {
+            let mut pages = HashMap::new();
+            for _ in 0..state.u32()? {
+                let page_num = state.u32()?;
+                pages.insert(page_num, state.bytes()?.into());
+            }
+            flash.borrow_mut().pages = pages;
+        }
+        state.finish()?;
+
+        self.error_irq.set_level(
+            self.interrupt_state.reg.is_set(FlInterruptState::Error)
+                && self.interrupt_enable.reg.is_set(FlInterruptEnable::Error),
+        );
+        self.event_irq.set_level(
+            self.interrupt_state.reg.is_set(FlInterruptState::Event)
+                && self.interrupt_enable.reg.is_set(FlInterruptEnable::Event),
+        );
+        Ok(())
     }
 
     fn raise_interrupt(&mut self, interrupt_type: FlashCtrlIntType) {
@@ -263,7 +453,7 @@ impl DummyFlashCtrl {
         // Sanity check for the page number, page size and file
         if page_num >= Self::MAX_PAGES
             || self.page_size.reg.get() < Self::PAGE_SIZE as u32
-            || self.file.is_none()
+            || self.storage.is_none()
         {
             return Err(FlashOpError::ReadError);
         }
@@ -277,10 +467,15 @@ impl DummyFlashCtrl {
             self.buffer
                 .copy_from_slice(&region.data()[offset..offset + Self::PAGE_SIZE]);
         } else {
-            let file = self.file.as_mut().unwrap();
-            file.seek(std::io::SeekFrom::Start(offset as u64))
-                .and_then(|_| file.read_exact(&mut self.buffer))
-                .map_err(|_| FlashOpError::ReadError)?;
+            match self.storage.as_mut().unwrap() {
+                FlashStorage::File(file) => file
+                    .seek(std::io::SeekFrom::Start(offset as u64))
+                    .and_then(|_| file.read_exact(&mut self.buffer))
+                    .map_err(|_| FlashOpError::ReadError)?,
+                FlashStorage::CopyOnWrite(flash) => {
+                    flash.borrow().read_page(page_num, &mut self.buffer)
+                }
+            }
         }
 
         let access_type = self.dma_ram_access_check(page_addr);
@@ -321,7 +516,7 @@ impl DummyFlashCtrl {
         // Sanity check for the page number, page size and file
         if page_num >= Self::MAX_PAGES
             || self.page_size.reg.get() < Self::PAGE_SIZE as u32
-            || self.file.is_none()
+            || self.storage.is_none()
         {
             return Err(FlashOpError::WriteError);
         }
@@ -356,11 +551,16 @@ impl DummyFlashCtrl {
         }
 
         let offset = (page_num * Self::PAGE_SIZE as u32) as usize;
-        // Write to file first
-        let file = self.file.as_mut().unwrap();
-        file.seek(std::io::SeekFrom::Start(offset as u64))
-            .and_then(|_| file.write_all(&self.buffer))
-            .map_err(|_| FlashOpError::WriteError)?;
+        // Write to the storage first
+        match self.storage.as_mut().unwrap() {
+            FlashStorage::File(file) => file
+                .seek(std::io::SeekFrom::Start(offset as u64))
+                .and_then(|_| file.write_all(&self.buffer))
+                .map_err(|_| FlashOpError::WriteError)?,
+            FlashStorage::CopyOnWrite(flash) => {
+                flash.borrow_mut().write_page(page_num, &self.buffer)
+            }
+        }
 
         // If direct_read_region is present, update it only if file write succeeded.
         if let Some(region) = self.direct_read_region.as_ref() {
@@ -381,16 +581,20 @@ impl DummyFlashCtrl {
         // Sanity check for the page number and file
         if page_num >= Self::MAX_PAGES
             || self.page_size.reg.get() < Self::PAGE_SIZE as u32
-            || self.file.is_none()
+            || self.storage.is_none()
         {
             return Err(FlashOpError::EraseError);
         }
 
         let offset = (page_num * Self::PAGE_SIZE as u32) as usize;
-        let file = self.file.as_mut().unwrap();
-        file.seek(std::io::SeekFrom::Start(offset as u64))
-            .and_then(|_| file.write_all(&vec![0xFF; Self::PAGE_SIZE]))
-            .map_err(|_| FlashOpError::EraseError)?;
+        let erased = [0xFF; Self::PAGE_SIZE];
+        match self.storage.as_mut().unwrap() {
+            FlashStorage::File(file) => file
+                .seek(std::io::SeekFrom::Start(offset as u64))
+                .and_then(|_| file.write_all(&erased))
+                .map_err(|_| FlashOpError::EraseError)?,
+            FlashStorage::CopyOnWrite(flash) => flash.borrow_mut().write_page(page_num, &erased),
+        }
 
         // If direct_read_region is present, update it only if file erase succeeded
         if let Some(region) = self.direct_read_region.as_ref() {
@@ -442,6 +646,14 @@ impl PrimaryFlashPeripheral for DummyFlashCtrl {
         }
     }
 
+    fn save_state(&self) -> Vec<u8> {
+        self.save_ctrl_state()
+    }
+
+    fn restore_state(&mut self, state: &[u8]) -> std::io::Result<()> {
+        self.restore_ctrl_state(state)
+    }
+
     fn read_fl_interrupt_state(
         &mut self,
     ) -> caliptra_emu_bus::ReadWriteRegister<
@@ -610,6 +822,14 @@ impl SecondaryFlashPeripheral for DummyFlashCtrl {
         }
     }
 
+    fn save_state(&self) -> Vec<u8> {
+        self.save_ctrl_state()
+    }
+
+    fn restore_state(&mut self, state: &[u8]) -> std::io::Result<()> {
+        self.restore_ctrl_state(state)
+    }
+
     fn warm_reset(&mut self) {}
     fn update_reset(&mut self) {}
 
@@ -921,6 +1141,84 @@ mod test {
         file.write_all(data).unwrap();
     }
 
+    #[test]
+    fn test_copy_on_write_flash() {
+        const PAGE_SIZE: usize = DummyFlashCtrl::PAGE_SIZE;
+        let mut flash = CopyOnWriteFlash::new(MappedImage::from_vec(vec![0x5a; PAGE_SIZE + 16]));
+        let mut buffer = [0u8; PAGE_SIZE];
+
+        flash.read_page(0, &mut buffer);
+        assert_eq!(buffer, [0x5a; PAGE_SIZE]);
+        // the image ends partway through page 1
+        flash.read_page(1, &mut buffer);
+        assert_eq!(buffer[..16], [0x5a; 16]);
+        assert_eq!(buffer[16..], [0xff; PAGE_SIZE - 16]);
+        flash.read_page(2, &mut buffer);
+        assert_eq!(buffer, [0xff; PAGE_SIZE]);
+
+        flash.write_page(1, &[0x11; PAGE_SIZE]);
+        flash.read_page(1, &mut buffer);
+        assert_eq!(buffer, [0x11; PAGE_SIZE]);
+        assert_eq!(flash.image[PAGE_SIZE..], [0x5a; 16]);
+
+        // direct reads see the image, the written page and the erased tail
+        assert_eq!(flash.read(RvSize::Word, 0).unwrap(), 0x5a5a_5a5a);
+        assert_eq!(
+            flash.read(RvSize::Byte, PAGE_SIZE as u32 + 3).unwrap(),
+            0x11
+        );
+        assert_eq!(
+            flash.read(RvSize::HalfWord, 2 * PAGE_SIZE as u32).unwrap(),
+            0xffff
+        );
+        assert!(matches!(
+            flash.read(RvSize::Word, 2),
+            Err(BusError::LoadAddrMisaligned)
+        ));
+        let end = (PAGE_SIZE * DummyFlashCtrl::MAX_PAGES as usize) as u32;
+        assert!(matches!(
+            flash.read(RvSize::Word, end),
+            Err(BusError::LoadAccessFault)
+        ));
+    }
+
+    #[test]
+    fn test_save_restore_state() {
+        const PAGE_SIZE: usize = DummyFlashCtrl::PAGE_SIZE;
+        let new_ctrl = |clock: &Clock| {
+            let pic = Pic::new();
+            let flash = Rc::new(RefCell::new(CopyOnWriteFlash::new(MappedImage::from_vec(
+                vec![0x5a; PAGE_SIZE],
+            ))));
+            let ctrl = DummyFlashCtrl::new_copy_on_write(
+                clock,
+                flash.clone(),
+                pic.register_irq(1),
+                pic.register_irq(2),
+            );
+            (ctrl, flash)
+        };
+        let clock = Clock::new();
+        let (mut ctrl, flash) = new_ctrl(&clock);
+        flash.borrow_mut().write_page(3, &[0x11; PAGE_SIZE]);
+        PrimaryFlashPeripheral::write_page_num(&mut ctrl, 3);
+        PrimaryFlashPeripheral::write_page_size(&mut ctrl, 1);
+        ctrl.operation_start = Some(ctrl.timer.schedule_poll_in(DummyFlashCtrl::IO_START_DELAY));
+        let state = PrimaryFlashPeripheral::save_state(&ctrl);
+
+        let (mut restored, restored_flash) = new_ctrl(&clock);
+        PrimaryFlashPeripheral::restore_state(&mut restored, &state).unwrap();
+        assert_eq!(PrimaryFlashPeripheral::read_page_num(&mut restored), 3);
+        assert_eq!(PrimaryFlashPeripheral::read_page_size(&mut restored), 1);
+        assert!(restored.operation_start.is_some());
+        let mut buffer = [0u8; PAGE_SIZE];
+        restored_flash.borrow().read_page(3, &mut buffer);
+        assert_eq!(buffer, [0x11; PAGE_SIZE]);
+        assert_eq!(PrimaryFlashPeripheral::save_state(&restored), state);
+
+        assert!(PrimaryFlashPeripheral::restore_state(&mut restored, &state[..12]).is_err());
+    }
+
     fn test_flash_ctrl_regs_access(fl_type: FlashType) {
         let dummy_clock = Clock::new();
         // Create a auto root bus
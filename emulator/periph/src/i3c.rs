@@ -7,6 +7,7 @@ Abstract:
 --*/
 
 use crate::i3c_protocol::I3cController;
+use crate::state::{StateReader, StateWriter};
 use crate::{I3cIncomingCommandClient, I3cTarget};
 use caliptra_emu_bus::{Clock, ReadWriteRegister, Timer};
 use caliptra_emu_bus::{Device, Event, EventData};
@@ -14,7 +15,8 @@ use caliptra_emu_cpu::Irq;
 use caliptra_emu_types::RvData;
 use emulator_registers_generated::i3c::I3cPeripheral;
 use mcu_testing_common::i3c::{
-    DynamicI3cAddress, I3cTcriCommand, I3cTcriResponseXfer, IbiDescriptor, ResponseDescriptor,
+    DynamicI3cAddress, I3cTcriCommand, I3cTcriCommandXfer, I3cTcriResponseXfer, IbiDescriptor,
+    ResponseDescriptor,
 };
 use registers_generated::i3c::bits::{
     DeviceStatus0, ExtcapHeader, IndirectFifoCtrl0, IndirectFifoStatus0, InterruptEnable,
@@ -86,6 +88,9 @@ pub struct I3c {
     events_from_caliptra: Option<mpsc::Receiver<Event>>,
     events_to_mcu: Option<mpsc::Sender<Event>>,
     events_from_mcu: Option<mpsc::Receiver<Event>>,
+
+    /// Called with each command taken from the controller
+    command_observer: Option<Box<dyn FnMut(&I3cTcriCommandXfer)>>,
 }
 
 impl I3c {
@@ -137,6 +142,7 @@ impl I3c {
             events_from_caliptra: None,
             events_to_mcu: None,
             events_from_mcu: None,
+            command_observer: None,
         }
     }
 
@@ -164,8 +170,20 @@ impl I3c {
         }
     }
 
+    /// Call `observer` with each command the target takes from the controller, e.g. to
+    /// record the I3C input of a run.
+    pub fn set_command_observer<F>(&mut self, observer: F)
+    where
+        F: FnMut(&I3cTcriCommandXfer) + 'static,
+    {
+        self.command_observer = Some(Box::new(observer));
+    }
+
     fn read_rx_data_into_buffer(&mut self) {
         if let Some(xfer) = self.i3c_target.read_command() {
+            if let Some(observer) = self.command_observer.as_mut() {
+                observer(&xfer);
+            }
             // TODO: we don't request data using rnw
             let rnw = (u64::from(xfer.cmd.clone()) & (1 << 29)) as u32;
             self.tti_rx_desc_queue_raw
@@ -914,6 +932,113 @@ impl I3cPeripheral for I3c {
         self.i3c_ec_soc_mgmt_if_rec_intf_cfg.reg.set(val.reg.get());
     }
 
+    fn save_state(&self) -> Vec<u8> {
+        let mut out = StateWriter::default();
+        for queue in [&self.tti_rx_desc_queue_raw, &self.tti_tx_desc_queue_raw] {
+            out.u32(queue.len() as u32);
+            for desc in queue {
+                out.u32(*desc);
+            }
+        }
+        for queue in [&self.tti_rx_data_raw, &self.tti_tx_data_raw] {
+            out.u32(queue.len() as u32);
+            for data in queue {
+                out.bytes(data);
+            }
+        }
+        let rx_current: Vec<u8> = self.tti_rx_current.iter().copied().collect();
+        out.bytes(&rx_current)
+            .bytes(&self.tti_ibi_buffer)
+            .bytes(&self.indirect_fifo_data);
+        for reg in [
+            self.i3c_ec_sec_fw_recovery_if_prot_cap_2.reg.get(),
+            self.i3c_ec_sec_fw_recovery_if_device_status_0.reg.get(),
+            self.i3c_ec_sec_fw_recovery_if_recovery_status.reg.get(),
+            self.i3c_ec_sec_fw_recovery_if_indirect_fifo_ctrl_0
+                .reg
+                .get(),
+            self.i3c_ec_sec_fw_recovery_if_indirect_fifo_ctrl_1
+                .reg
+                .get(),
+            self.i3c_ec_sec_fw_recovery_if_indirect_fifo_status_0
+                .reg
+                .get(),
+            self.i3c_ec_sec_fw_recovery_if_indirect_fifo_status_1
+                .reg
+                .get(),
+            self.i3c_ec_sec_fw_recovery_if_indirect_fifo_status_2
+                .reg
+                .get(),
+            self.i3c_ec_sec_fw_recovery_if_recovery_ctrl.reg.get(),
+            self.i3c_ec_soc_mgmt_if_rec_intf_cfg.reg.get(),
+            self.interrupt_status.reg.get(),
+            self.interrupt_enable.reg.get(),
+        ] {
+            out.u32(reg);
+        }
+        out.bool(self.ibi_status.is_some())
+            .u32(self.ibi_status.unwrap_or_default());
+        out.finish()
+    }
+
+    fn restore_state(&mut self, state: &[u8]) -> std::io::Result<()> {
+        let mut state = StateReader::new(state);
+        for queue in [
+            &mut self.tti_rx_desc_queue_raw,
+            &mut self.tti_tx_desc_queue_raw,
+        ] {
+            queue.clear();
+            for _ in 0..state.u32()? {
+                queue.push_back(state.u32()?);
+            }
+        }
+        for queue in [&mut self.tti_rx_data_raw, &mut self.tti_tx_data_raw] {
+            queue.clear();
+            for _ in 0..state.u32()? {
+                queue.push_back(state.bytes()?.to_vec());
+            }
+        }
+        self.tti_rx_current = state.bytes()?.iter().copied().collect();
+        self.tti_ibi_buffer = state.bytes()?.to_vec();
+        self.indirect_fifo_data = state.bytes()?.to_vec();
+        self.i3c_ec_sec_fw_recovery_if_prot_cap_2
+            .reg
+            .set(state.u32()?);
+        self.i3c_ec_sec_fw_recovery_if_device_status_0
+            .reg
+            .set(state.u32()?);
+        self.i3c_ec_sec_fw_recovery_if_recovery_status
+            .reg
+            .set(state.u32()?);
+        self.i3c_ec_sec_fw_recovery_if_indirect_fifo_ctrl_0
+            .reg
+            .set(state.u32()?);
+        self.i3c_ec_sec_fw_recovery_if_indirect_fifo_ctrl_1
+            .reg
+            .set(state.u32()?);
+        self.i3c_ec_sec_fw_recovery_if_indirect_fifo_status_0
+            .reg
+            .set(state.u32()?);
+        self.i3c_ec_sec_fw_recovery_if_indirect_fifo_status_1
+            .reg
+            .set(state.u32()?);
+        self.i3c_ec_sec_fw_recovery_if_indirect_fifo_status_2
+            .reg
+            .set(state.u32()?);
+        self.i3c_ec_sec_fw_recovery_if_recovery_ctrl
+            .reg
+            .set(state.u32()?);
+        self.i3c_ec_soc_mgmt_if_rec_intf_cfg.reg.set(state.u32()?);
+        self.interrupt_status.reg.set(state.u32()?);
+        self.interrupt_enable.reg.set(state.u32()?);
+        let has_ibi_status = state.bool()?;
+        let ibi_status = state.u32()?;
+        self.ibi_status = has_ibi_status.then_some(ibi_status);
+        state.finish()?;
+        self.check_interrupts();
+        Ok(())
+    }
+
     fn poll(&mut self) {
         self.check_interrupts();
         self.read_rx_data_into_buffer();
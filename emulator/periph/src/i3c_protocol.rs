@@ -73,6 +73,10 @@ impl I3cController {
                     });
                 if let Ok(cmd) = rx.recv_timeout(Duration::from_millis(5)) {
                     I3cController::incoming(targets.clone(), counter.clone(), cmd);
+                    // relay the rest of a burst without waiting for the next round
+                    rx.try_iter().for_each(|cmd| {
+                        I3cController::incoming(targets.clone(), counter.clone(), cmd);
+                    });
                 }
             }
         })
@@ -82,9 +86,9 @@ impl I3cController {
     /// This is useful for testing or running in a polling loop, rather than spawning a thread.
     pub fn run_once(&mut self) {
         if let Some(rx) = self.rx.as_ref() {
-            if let Ok(cmd) = rx.try_recv() {
+            rx.try_iter().for_each(|cmd| {
                 I3cController::incoming(self.targets.clone(), self.incoming_counter.clone(), cmd);
-            }
+            });
         }
         I3cController::tcri_receive_all(self.targets.clone())
             .iter()
@@ -22,22 +22,27 @@ mod flash_ctrl;
 mod i3c;
 pub(crate) mod i3c_protocol;
 mod lc_ctrl;
+mod mapped_image;
 mod mci;
 mod mcu_mbox0;
 mod otp;
 mod otp_digest;
+mod otp_file;
 mod reset_reason;
 mod root_bus;
+mod state;
 mod uart;
+mod uart_ring;
 
 pub use axicdma::AxiCDMA;
-pub use caliptra_to_ext_bus::CaliptraToExtBus;
+pub use caliptra_to_ext_bus::{CaliptraToExtBus, ExternalBusControl, ExternalWrite};
 pub use doe_mbox::{DoeMboxPeriph, DummyDoeMbox};
 pub use emu_ctrl::EmuCtrl;
-pub use flash_ctrl::DummyFlashCtrl;
+pub use flash_ctrl::{CopyOnWriteFlash, DummyFlashCtrl};
 pub use i3c::I3c;
 pub use i3c_protocol::*;
 pub use lc_ctrl::LcCtrl;
+pub use mapped_image::MappedImage;
 pub use mci::Mci;
 pub use mcu_mbox0::{MciMailboxRequester, McuMailbox0External, McuMailbox0Internal};
 pub use otp::{Otp, OtpArgs};
@@ -45,3 +50,4 @@ pub use otp_digest::{otp_digest, otp_scramble, otp_unscramble};
 pub use reset_reason::ResetReasonEmulator;
 pub use root_bus::{McuRootBus, McuRootBusArgs, McuRootBusOffsets};
 pub use uart::Uart;
+pub use uart_ring::UartOutputRing;
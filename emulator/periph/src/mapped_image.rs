@@ -0,0 +1,134 @@
+/*++
+
+Licensed under the Apache-2.0 license.
+
+File Name:
+
+    mapped_image.rs
+
+Abstract:
+
+    File contains the read-only mapping of firmware and flash image files.
+
+--*/
+
+use std::fs::File;
+use std::io::{self, Read};
+use std::ops::Deref;
+use std::path::Path;
+
+/// Read-only contents of an image file.
+///
+/// On Unix the file is mapped privately instead of being read, so its pages are only
+/// loaded when they are first accessed, and every emulator mapping the same image shares
+/// them through the page cache. Elsewhere the file is read into memory.
+///
+/// The file must not be truncated while it is mapped.
+pub struct MappedImage {
+    inner: Inner,
+}
+
+enum Inner {
+    #[cfg(unix)]
+    Mapped {
+        ptr: std::ptr::NonNull<u8>,
+        len: usize,
+    },
+    Owned(Vec<u8>),
+}
+
+impl MappedImage {
+    pub fn open(path: &Path) -> io::Result<Self> {
+        let file = File::open(path)?;
+        let len = usize::try_from(file.metadata()?.len())
+            .map_err(|_| io::Error::new(io::ErrorKind::InvalidInput, "image file too large"))?;
+
+        // an empty file can't be mapped
+        #[cfg(unix)]
+        if len != 0 {
+            use std::os::fd::AsRawFd;
+            // SAFETY: a fresh private read-only mapping of an open file does not alias any
+            // Rust object; the mapping stays valid after the file is closed.
+            let ptr = unsafe {
+                libc::mmap(
+                    std::ptr::null_mut(),
+                    len,
+                    libc::PROT_READ,
+                    libc::MAP_PRIVATE,
+                    file.as_raw_fd(),
+                    0,
+                )
+            };
+            if ptr == libc::MAP_FAILED {
+                return Err(io::Error::last_os_error());
+            }
+            return Ok(Self {
+                inner: Inner::Mapped {
+                    ptr: std::ptr::NonNull::new(ptr as *mut u8).unwrap(),
+                    len,
+                },
+            });
+        }
+
+        let mut data = Vec::with_capacity(len);
+        (&file).read_to_end(&mut data)?;
+        Ok(Self::from_vec(data))
+    }
+
+    /// An image whose contents are already in memory.
+    pub fn from_vec(data: Vec<u8>) -> Self {
+        Self {
+            inner: Inner::Owned(data),
+        }
+    }
+}
+
+impl Deref for MappedImage {
+    type Target = [u8];
+
+    fn deref(&self) -> &[u8] {
+        match &self.inner {
+            #[cfg(unix)]
+            // SAFETY: the mapping is `len` bytes long, readable and lives as long as `self`
+            Inner::Mapped { ptr, len } => unsafe { std::slice::from_raw_parts(ptr.as_ptr(), *len) },
+            Inner::Owned(data) => data,
+        }
+    }
+}
+
+impl Drop for MappedImage {
+    fn drop(&mut self) {
+        #[cfg(unix)]
+        if let Inner::Mapped { ptr, len } = self.inner {
+            // SAFETY: the mapping was created by `open` and no slice of it outlives `self`
+            unsafe {
+                libc::munmap(ptr.as_ptr() as *mut libc::c_void, len);
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+    use std::io::Write;
+    use tempfile::NamedTempFile;
+
+    #[test]
+    fn test_open_reads_file_contents() {
+        let mut file = NamedTempFile::new().unwrap();
+        let contents: Vec<u8> = (0..10000u32).map(|i| i as u8).collect();
+        file.write_all(&contents).unwrap();
+        file.flush().unwrap();
+
+        let image = MappedImage::open(file.path()).unwrap();
+        assert_eq!(&*image, &contents[..]);
+    }
+
+    #[test]
+    fn test_open_empty_file() {
+        let file = NamedTempFile::new().unwrap();
+        let image = MappedImage::open(file.path()).unwrap();
+        assert!(image.is_empty());
+    }
+}
@@ -2,6 +2,7 @@
 
 use crate::mcu_mbox0::McuMailbox0Internal;
 use crate::reset_reason::ResetReasonEmulator;
+use crate::state::{invalid, StateReader, StateWriter};
 use caliptra_emu_bus::{ActionHandle, Clock, ReadWriteRegister, Timer, TimerAction};
 use caliptra_emu_cpu::Irq;
 use caliptra_emu_types::RvData;
@@ -919,6 +920,118 @@ impl MciPeripheral for Mci {
         caliptra_emu_bus::ReadWriteRegister::new(0x1000)
     }
 
+    fn save_state(&self) -> Vec<u8> {
+        let regs = self.ext_mci_regs.regs.borrow();
+        let mut out = StateWriter::default();
+        for reg in [
+            regs.flow_status,
+            regs.reset_request,
+            regs.reset_status,
+            regs.reset_reason,
+            regs.wdt_timer1_en,
+            regs.wdt_timer1_ctrl,
+            regs.wdt_timer1_timeout_period[0],
+            regs.wdt_timer1_timeout_period[1],
+            regs.wdt_timer2_en,
+            regs.wdt_timer2_ctrl,
+            regs.wdt_timer2_timeout_period[0],
+            regs.wdt_timer2_timeout_period[1],
+            regs.wdt_status,
+            regs.intr_block_rf_notif0_intr_trig_r,
+            regs.intr_block_rf_notif0_internal_intr_r,
+            regs.intr_block_rf_notif0_intr_en_r,
+            self.error0_internal_intr_r.reg.get(),
+        ] {
+            out.u32(reg);
+        }
+        out.u64(self.mtimecmp);
+        // Pending timers can't be read back, so only record which ones are
+        // armed; restore re-arms them from the current cycle.
+        for action in [
+            &self.op_wdt_timer1_expired_action,
+            &self.op_wdt_timer2_expired_action,
+            &self.op_mcu_reset_request_action,
+            &self.op_mcu_assert_mcu_reset_status_action,
+            &self.op_mcu_deassert_mcu_reset_status_action,
+        ] {
+            out.bool(action.is_some());
+        }
+        for mailbox in [&self.mcu_mailbox0, &self.mcu_mailbox1] {
+            out.bool(mailbox.is_some());
+            if let Some(mailbox) = mailbox {
+                mailbox.regs.lock().unwrap().save_state(&mut out);
+            }
+        }
+        out.finish()
+    }
+
+    fn restore_state(&mut self, state: &[u8]) -> std::io::Result<()> {
+        let mut state = StateReader::new(state);
+        {
+            let mut regs = self.ext_mci_regs.regs.borrow_mut();
+            regs.flow_status = state.u32()?;
+            regs.reset_request = state.u32()?;
+            regs.reset_status = state.u32()?;
+            regs.reset_reason = state.u32()?;
+            regs.wdt_timer1_en = state.u32()?;
+            regs.wdt_timer1_ctrl = state.u32()?;
+            regs.wdt_timer1_timeout_period[0] = state.u32()?;
+            regs.wdt_timer1_timeout_period[1] = state.u32()?;
+            regs.wdt_timer2_en = state.u32()?;
+            regs.wdt_timer2_ctrl = state.u32()?;
+            regs.wdt_timer2_timeout_period[0] = state.u32()?;
+            regs.wdt_timer2_timeout_period[1] = state.u32()?;
+            regs.wdt_status = state.u32()?;
+            regs.intr_block_rf_notif0_intr_trig_r = state.u32()?;
+            regs.intr_block_rf_notif0_internal_intr_r = state.u32()?;
+            regs.intr_block_rf_notif0_intr_en_r = state.u32()?;
+        }
+        self.error0_internal_intr_r.reg.set(state.u32()?);
+        self.mtimecmp = state.u64()?;
+        self.arm_mtime_interrupt();
+
+        let (wdt1_period, wdt2_period) = {
+            let regs = self.ext_mci_regs.regs.borrow();
+            let period = |period: &[u32]| (period[1] as u64) << 32 | period[0] as u64;
+            (
+                period(&regs.wdt_timer1_timeout_period),
+                period(&regs.wdt_timer2_timeout_period),
+            )
+        };
+        for (action, delay) in [
+            (&mut self.op_wdt_timer1_expired_action, wdt1_period),
+            (&mut self.op_wdt_timer2_expired_action, wdt2_period),
+            (&mut self.op_mcu_reset_request_action, 100),
+            (&mut self.op_mcu_assert_mcu_reset_status_action, 100),
+            (&mut self.op_mcu_deassert_mcu_reset_status_action, 1000),
+        ] {
+            if let Some(old) = action.take() {
+                self.timer.cancel(old);
+            }
+            if state.bool()? {
+                *action = Some(self.timer.schedule_poll_in(delay));
+            }
+        }
+
+        for mailbox in [&self.mcu_mailbox0, &self.mcu_mailbox1] {
+            if state.bool()? != mailbox.is_some() {
+                Err(invalid("MCU mailbox configuration does not match"))?;
+            }
+            if let Some(mailbox) = mailbox {
+                mailbox.regs.lock().unwrap().restore_state(&mut state)?;
+            }
+        }
+        state.finish()?;
+
+        let notif = self
+            .ext_mci_regs
+            .regs
+            .borrow()
+            .intr_block_rf_notif0_internal_intr_r;
+        self.irq.borrow_mut().set_level(notif != 0);
+        Ok(())
+    }
+
     fn poll(&mut self) {
         if self.timer.fired(&mut self.op_wdt_timer1_expired_action) {
             // Set T1Timeout in WDT status register
@@ -1399,4 +1512,51 @@ mod tests {
         assert_eq!(mci.read_mci_reg_mcu_rv_mtime_l(), now as u32);
         assert_eq!(mci.read_mci_reg_mcu_rv_mtime_h(), (now >> 32) as u32);
     }
+
+    #[test]
+    fn test_save_restore_state() {
+        let new_mci = |clock: &Clock| {
+            let pic = caliptra_emu_cpu::Pic::new();
+            Mci::new(
+                clock,
+                caliptra_emu_periph::mci::Mci::new(vec![]),
+                Rc::new(RefCell::new(pic.register_irq(1))),
+                Some(McuMailbox0Internal::new(clock)),
+                None,
+            )
+        };
+        let clock = Clock::new();
+        let mut mci = new_mci(&clock);
+        mci.write_mci_reg_fw_flow_status(0x1234);
+        mci.write_mci_reg_mcu_rv_mtimecmp_h(1);
+        mci.write_mci_reg_mcu_rv_mtimecmp_l(2);
+        mci.read_mcu_mbox0_csr_mbox_lock();
+        mci.write_mcu_mbox0_csr_mbox_sram(0xdead_beef, 3);
+        mci.write_mcu_mbox0_csr_mbox_cmd(0x55);
+        mci.write_mci_reg_wdt_timer1_timeout_period(10, 0);
+        mci.write_mci_reg_wdt_timer1_en(ReadWriteRegister::new(1));
+        let state = mci.save_state();
+
+        let clock = Clock::new();
+        let mut restored = new_mci(&clock);
+        restored.restore_state(&state).unwrap();
+        assert_eq!(restored.read_mci_reg_fw_flow_status(), 0x1234);
+        assert_eq!(restored.read_mci_reg_mcu_rv_mtimecmp_h(), 1);
+        assert_eq!(restored.read_mci_reg_mcu_rv_mtimecmp_l(), 2);
+        assert_eq!(restored.read_mcu_mbox0_csr_mbox_sram(3), 0xdead_beef);
+        assert_eq!(restored.read_mcu_mbox0_csr_mbox_cmd(), 0x55);
+        assert_eq!(restored.save_state(), state);
+
+        // The armed watchdog carries over to the restored peripheral.
+        let mut mci_bus = MciBus {
+            periph: Box::new(restored),
+        };
+        clock.increment_and_process_timer_actions(20, &mut mci_bus);
+        let status = InMemoryRegister::<u32, WdtStatus::Register>::new(
+            mci_bus.read(RvSize::Word, CPTRA_WDT_STATUS_START).unwrap(),
+        );
+        assert!(status.is_set(WdtStatus::T1Timeout));
+
+        assert!(new_mci(&clock).restore_state(&state[..8]).is_err());
+    }
 }
@@ -1,5 +1,6 @@
 // Licensed under the Apache-2.0 license
 
+use crate::state::{invalid, StateReader, StateWriter};
 use caliptra_emu_bus::BusError;
 use caliptra_emu_bus::{Bus, Clock, Ram, ReadOnlyRegister, ReadWriteRegister, Timer};
 use caliptra_emu_types::{RvAddr, RvSize};
@@ -203,6 +204,64 @@ impl MciMailboxImpl {
         ));
     }
 
+    /// Append the SRAM and registers of the mailbox to a snapshot state.
+    pub(crate) fn save_state(&self, out: &mut StateWriter) {
+        out.bytes(self.sram.ram.lock().unwrap().data());
+        for reg in [
+            self.lock.reg.get(),
+            self.user.reg.get(),
+            self.target_user.reg.get(),
+            self.target_user_valid.reg.get(),
+            self.cmd.reg.get(),
+            self.dlen.reg.get(),
+            self.execute.reg.get(),
+            self.target_status.reg.get(),
+            self.cmd_status.reg.get(),
+            self.hw_status.reg.get(),
+        ] {
+            out.u32(reg);
+        }
+        out.u32(self.requester.into())
+            .u64(self.max_dlen_in_lock_session as u64)
+            .bool(self.irq)
+            .u32(match self.last_irq_event {
+                None => 0,
+                Some(IrqEventToMcu::Mbox0CmdAvailable) => 1,
+                Some(IrqEventToMcu::Mbox0TargetDone) => 2,
+            });
+    }
+
+    /// Load the state written by [`MciMailboxImpl::save_state`].
+    pub(crate) fn restore_state(&mut self, state: &mut StateReader) -> std::io::Result<()> {
+        let sram = state.bytes()?;
+        let mut ram = self.sram.ram.lock().unwrap();
+        if sram.len() != ram.data().len() {
+            Err(invalid("MCU mailbox SRAM size does not match"))?;
+        }
+        ram.data_mut().copy_from_slice(sram);
+        drop(ram);
+        self.lock.reg.set(state.u32()?);
+        self.user.reg.set(state.u32()?);
+        self.target_user.reg.set(state.u32()?);
+        self.target_user_valid.reg.set(state.u32()?);
+        self.cmd.reg.set(state.u32()?);
+        self.dlen.reg.set(state.u32()?);
+        self.execute.reg.set(state.u32()?);
+        self.target_status.reg.set(state.u32()?);
+        self.cmd_status.reg.set(state.u32()?);
+        self.hw_status.reg.set(state.u32()?);
+        self.requester = state.u32()?.into();
+        self.max_dlen_in_lock_session = state.u64()? as usize;
+        self.irq = state.bool()?;
+        self.last_irq_event = match state.u32()? {
+            0 => None,
+            1 => Some(IrqEventToMcu::Mbox0CmdAvailable),
+            2 => Some(IrqEventToMcu::Mbox0TargetDone),
+            _ => Err(invalid("unknown MCU mailbox interrupt event"))?,
+        };
+        Ok(())
+    }
+
     pub fn set_requester(&mut self, requester: MciMailboxRequester) {
         self.requester = requester;
     }
@@ -13,6 +13,8 @@ Abstract:
 
 --*/
 use crate::otp_digest;
+use crate::otp_file::OtpFile;
+use crate::state::{invalid, StateReader, StateWriter};
 use caliptra_emu_bus::{Clock, ReadWriteRegister, Timer};
 use caliptra_emu_types::{RvAddr, RvData};
 use caliptra_image_types::FwVerificationPqcKeyType;
@@ -20,8 +22,6 @@ use registers_generated::fuses::{self};
 use registers_generated::otp_ctrl::bits::{DirectAccessCmd, OtpStatus};
 use serde::{Deserialize, Serialize};
 use std::collections::HashSet;
-use std::fs::File;
-use std::io::Seek;
 use std::path::PathBuf;
 #[allow(unused_imports)] // Rust compiler doesn't like these
 use tock_registers::interfaces::{Readable, Writeable};
@@ -97,11 +97,14 @@ const PARTITIONS: [(usize, usize); 15] = [
 ];
 
 /// Used to hold the state that is saved between emulator runs.
+///
+/// OTP files used to be this state serialized as JSON; those are still accepted and
+/// converted to the [`OtpFile`] layout.
 #[derive(Deserialize, Serialize)]
-struct OtpState {
-    partitions: Vec<u8>,
-    calculate_digests_on_reset: HashSet<usize>,
-    digests: Vec<u32>,
+pub(crate) struct OtpState {
+    pub(crate) partitions: Vec<u8>,
+    pub(crate) calculate_digests_on_reset: HashSet<usize>,
+    pub(crate) digests: Vec<u32>,
 }
 
 #[derive(Default, Clone)]
@@ -119,8 +122,8 @@ pub struct OtpArgs {
 //#[derive(Bus)]
 #[allow(dead_code)]
 pub struct Otp {
-    /// File to store the OTP partitions.
-    file: Option<File>,
+    /// File to store the OTP partitions, updated as they are written.
+    file: Option<OtpFile>,
     direct_access_address: u32,
     direct_access_buffer: u32,
     direct_access_cmd: ReadWriteRegister<u32, DirectAccessCmd::Register>,
@@ -132,12 +135,11 @@ pub struct Otp {
     calculate_digests_on_reset: HashSet<usize>,
 }
 
-// Ensure that we save the state before we drop the OTP instance.
+// Every update is already in the file; make sure it reaches the disk.
 impl Drop for Otp {
     fn drop(&mut self) {
-        self.save_to_file().unwrap();
         if let Some(file) = &mut self.file {
-            file.sync_all().unwrap();
+            file.sync().unwrap();
         }
     }
 }
@@ -146,14 +148,7 @@ impl Drop for Otp {
 impl Otp {
     pub fn new(clock: &Clock, args: OtpArgs) -> Result<Self, std::io::Error> {
         let file = if let Some(path) = args.file_name {
-            Some(
-                std::fs::File::options()
-                    .read(true)
-                    .write(true)
-                    .create(true)
-                    .truncate(false)
-                    .open(path)?,
-            )
+            Some(OtpFile::open(&path, TOTAL_SIZE, PARTITIONS.len() * 2)?)
         } else {
             None
         };
@@ -181,34 +176,39 @@ impl Otp {
             partitions: vec![0u8; TOTAL_SIZE],
             digests: [0; PARTITIONS.len() * 2],
         };
-        otp.read_from_file()?;
+        if let Some(state) = otp.file.as_ref().map(OtpFile::state) {
+            otp.load_state(&state);
+        }
         if let Some(mut vendor_pk_hash) = args.vendor_pk_hash {
             swap_endianness(&mut vendor_pk_hash);
-            otp.partitions[fuses::VENDOR_HASHES_MANUF_PARTITION_BYTE_OFFSET
-                ..fuses::VENDOR_HASHES_MANUF_PARTITION_BYTE_OFFSET + 48]
-                .copy_from_slice(&vendor_pk_hash);
+            otp.write_partitions(
+                fuses::VENDOR_HASHES_MANUF_PARTITION_BYTE_OFFSET,
+                &vendor_pk_hash,
+            )?;
         }
         // encode as a single bit, MLDSA as the default
         let val = match args.vendor_pqc_type {
             FwVerificationPqcKeyType::MLDSA => 0,
             FwVerificationPqcKeyType::LMS => 1,
         };
-        otp.partitions[fuses::VENDOR_HASHES_MANUF_PARTITION_BYTE_OFFSET + 48] = val;
-        otp.partitions[fuses::SVN_PARTITION_BYTE_OFFSET + 36] =
-            args.soc_manifest_max_svn.unwrap_or(0);
+        otp.write_partitions(
+            fuses::VENDOR_HASHES_MANUF_PARTITION_BYTE_OFFSET + 48,
+            &[val],
+        )?;
+        otp.write_partitions(
+            fuses::SVN_PARTITION_BYTE_OFFSET + 36,
+            &[args.soc_manifest_max_svn.unwrap_or(0)],
+        )?;
         if let Some(soc_manifest_svn) = args.soc_manifest_svn {
             let svn_bitmap = Self::svn_to_bitmap(soc_manifest_svn as u32);
-            otp.partitions
-                [fuses::SVN_PARTITION_BYTE_OFFSET + 20..fuses::SVN_PARTITION_BYTE_OFFSET + 36]
-                .copy_from_slice(&svn_bitmap);
+            otp.write_partitions(fuses::SVN_PARTITION_BYTE_OFFSET + 20, &svn_bitmap)?;
         }
 
         if let Some(vendor_hashes_prod_partition) = args.vendor_hashes_prod_partition {
             let dst_start = fuses::VENDOR_HASHES_PROD_PARTITION_BYTE_OFFSET;
             let max_len = fuses::VENDOR_HASHES_PROD_PARTITION_BYTE_SIZE;
             let copy_len = vendor_hashes_prod_partition.len().min(max_len);
-            otp.partitions[dst_start..dst_start + copy_len]
-                .copy_from_slice(&vendor_hashes_prod_partition[..copy_len]);
+            otp.write_partitions(dst_start, &vendor_hashes_prod_partition[..copy_len])?;
         }
 
         // if there were digests that were pending a reset, then calculate them now
@@ -224,29 +224,27 @@ impl Otp {
     fn calculate_digests(&mut self) -> Result<(), std::io::Error> {
         let partitions = self.calculate_digests_on_reset.clone();
         for partition in partitions {
-            self.calculate_digest(partition);
+            self.calculate_digest(partition)?;
         }
+        // the digests are stored first, so a partition still pending after a crash is
+        // simply digested again
         self.calculate_digests_on_reset.clear();
-        self.save_to_file()
+        self.save_pending()
     }
 
-    fn calculate_digest(&mut self, partition: usize) {
+    fn calculate_digest(&mut self, partition: usize) -> Result<(), std::io::Error> {
         if partition >= PARTITIONS.len() - 1 {
-            return;
+            return Ok(());
         }
         let (addr, size) = PARTITIONS[partition];
         let digest =
             otp_digest::otp_digest(&self.partitions[addr..addr + size], DIGEST_IV, DIGEST_CONST);
         self.digests[partition * 2] = (digest & 0xffff_ffff) as u32;
         self.digests[partition * 2 + 1] = (digest >> 32) as u32;
-    }
-
-    fn get_state(&self) -> OtpState {
-        OtpState {
-            partitions: self.partitions.clone(),
-            calculate_digests_on_reset: self.calculate_digests_on_reset.clone(),
-            digests: self.digests.to_vec(),
+        if let Some(file) = &mut self.file {
+            file.write_digests(partition * 2, &self.digests[partition * 2..][..2])?;
         }
+        Ok(())
     }
 
     fn load_state(&mut self, state: &OtpState) {
@@ -255,22 +253,22 @@ impl Otp {
         self.digests.copy_from_slice(&state.digests);
     }
 
-    fn read_from_file(&mut self) -> Result<(), std::io::Error> {
+    /// Write `data` to the partitions at `addr` and to the OTP file.
+    fn write_partitions(&mut self, addr: usize, data: &[u8]) -> Result<(), std::io::Error> {
+        self.partitions[addr..addr + data.len()].copy_from_slice(data);
         if let Some(file) = &mut self.file {
-            if file.metadata()?.len() > 0 {
-                file.rewind()?;
-                let state: OtpState = serde_json::from_reader(file)?;
-                self.load_state(&state);
-            }
+            file.write_partitions(addr, data)?;
         }
         Ok(())
     }
 
-    fn save_to_file(&mut self) -> Result<(), std::io::Error> {
-        let state = self.get_state();
+    fn save_pending(&mut self) -> Result<(), std::io::Error> {
         if let Some(file) = &mut self.file {
-            file.rewind()?;
-            serde_json::to_writer(file, &state)?;
+            let pending = self
+                .calculate_digests_on_reset
+                .iter()
+                .fold(0u32, |bits, partition| bits | 1 << partition);
+            file.write_pending(pending)?;
         }
         Ok(())
     }
@@ -357,8 +355,8 @@ impl emulator_registers_generated::otp::OtpPeripheral for Otp {
             if addr + 4 <= TOTAL_SIZE {
                 // refuse to write twice
                 if self.partitions[addr..addr + 4].iter().all(|x| *x == 0) {
-                    self.partitions[addr..addr + 4]
-                        .copy_from_slice(&self.direct_access_buffer.to_le_bytes());
+                    self.write_partitions(addr, &self.direct_access_buffer.to_le_bytes())
+                        .unwrap();
                 }
             }
             // reset direct access
@@ -390,6 +388,7 @@ impl emulator_registers_generated::otp::OtpPeripheral for Otp {
             // cowardly refuse to calculate digests for the lifecycle partition
             if partition != PARTITIONS.len() - 1 {
                 self.calculate_digests_on_reset.insert(partition);
+                self.save_pending().unwrap();
             }
         }
 
@@ -401,6 +400,54 @@ impl emulator_registers_generated::otp::OtpPeripheral for Otp {
     fn warm_reset(&mut self) {
         self.calculate_digests().unwrap();
     }
+
+    fn save_state(&self) -> Vec<u8> {
+        let mut out = StateWriter::default();
+        out.bytes(&self.partitions)
+            .bytes(&self.digest_bytes())
+            .u32(self.direct_access_address)
+            .u32(self.direct_access_buffer)
+            .u32(self.direct_access_cmd.reg.get())
+            .u32(self.status.reg.get())
+            .u32(
+                self.calculate_digests_on_reset
+                    .iter()
+                    .fold(0u32, |bits, partition| bits | 1 << partition),
+            );
+        out.finish()
+    }
+
+    /// Restores the partitions into the OTP file as well, so the file matches the snapshot.
+    fn restore_state(&mut self, state: &[u8]) -> std::io::Result<()> {
+        let mut state = StateReader::new(state);
+        let partitions = state.bytes()?;
+        let digests = state.bytes()?;
+        if partitions.len() != TOTAL_SIZE || digests.len() != self.digests.len() * 4 {
+            Err(invalid("OTP size does not match"))?;
+        }
+        self.write_partitions(0, partitions)?;
+        for (digest, bytes) in self.digests.iter_mut().zip(digests.chunks_exact(4)) {
+            *digest = u32::from_le_bytes(bytes.try_into().unwrap());
+        }
+        if let Some(file) = &mut self.file {
+            file.write_digests(0, &self.digests)?;
+        }
+        self.direct_access_address = state.u32()?;
+        self.direct_access_buffer = state.u32()?;
+        self.direct_access_cmd.reg.set(state.u32()?);
+        self.status.reg.set(state.u32()?);
+        let pending = state.u32()?;
+        state.finish()?;
+        self.calculate_digests_on_reset = (0..PARTITIONS.len())
+            .filter(|partition| pending & 1 << partition != 0)
+            .collect();
+        self.save_pending()?;
+        // finish a DAI command that was still in flight
+        if self.status.reg.read(OtpStatus::DaiIdle) == 0 {
+            self.timer.schedule_poll_in(2);
+        }
+        Ok(())
+    }
 }
 
 /// Convert the slice to hardware format
@@ -570,4 +617,68 @@ mod test {
         assert_eq!(otp.digests[18], 0xb01d0fde);
         assert_eq!(otp.digests[19], 0x3fc74486);
     }
+
+    #[test]
+    fn test_file_survives_exit_without_drop() {
+        let file = tempfile::NamedTempFile::new().unwrap();
+        let args = OtpArgs {
+            file_name: Some(file.path().to_path_buf()),
+            ..Default::default()
+        };
+        let clock = Clock::new();
+        let mut otp = Otp::new(&clock, args.clone()).unwrap();
+        let addr = fuses::VENDOR_TEST_PARTITION_BYTE_OFFSET as u32;
+        otp.write_dai_wdata_rf_direct_access_wdata_0(0x1234_5678);
+        otp.write_direct_access_address(addr.into());
+        otp.write_direct_access_cmd(2u32.into());
+        otp.poll();
+        otp.write_direct_access_address(addr.into());
+        otp.write_direct_access_cmd(4u32.into());
+        otp.poll();
+        // like exit() from a signal handler, nothing runs on the way out; only the file
+        // is closed, releasing its lock as the process dying would
+        let file = otp.file.take();
+        std::mem::forget(otp);
+        drop(file);
+
+        let mut otp = Otp::new(&clock, args).unwrap();
+        otp.write_direct_access_address(addr.into());
+        otp.write_direct_access_cmd(1u32.into());
+        otp.poll();
+        assert_eq!(otp.read_dai_rdata_rf_direct_access_rdata_0(), 0x1234_5678);
+        // the pending digest was calculated on startup
+        assert!(otp.calculate_digests_on_reset.is_empty());
+        assert_ne!(otp.digests[18], 0);
+    }
+
+    #[test]
+    fn test_save_restore_state() {
+        let clock = Clock::new();
+        let mut otp = Otp::new(&clock, OtpArgs::default()).unwrap();
+        let addr = fuses::VENDOR_TEST_PARTITION_BYTE_OFFSET as u32;
+        otp.write_dai_wdata_rf_direct_access_wdata_0(0x1234_5678);
+        otp.write_direct_access_address(addr.into());
+        otp.write_direct_access_cmd(2u32.into());
+        otp.poll();
+        otp.write_direct_access_address(addr.into());
+        otp.write_direct_access_cmd(4u32.into());
+        otp.poll();
+        let state = otp.save_state();
+
+        let mut restored = Otp::new(&clock, OtpArgs::default()).unwrap();
+        restored.restore_state(&state).unwrap();
+        assert_eq!(restored.save_state(), state);
+        restored.write_direct_access_address(addr.into());
+        restored.write_direct_access_cmd(1u32.into());
+        restored.poll();
+        assert_eq!(
+            restored.read_dai_rdata_rf_direct_access_rdata_0(),
+            0x1234_5678
+        );
+        // the digest requested before the snapshot is still calculated on reset
+        restored.warm_reset();
+        assert_ne!(restored.digests[18], 0);
+
+        assert!(restored.restore_state(&state[..16]).is_err());
+    }
 }
@@ -0,0 +1,534 @@
+/*++
+
+Licensed under the Apache-2.0 license.
+
+File Name:
+
+    otp_file.rs
+
+Abstract:
+
+    File contains the persistent, incrementally updated backing store of the OTP
+    controller.
+
+--*/
+
+use crate::otp::OtpState;
+use std::fs::File;
+use std::io::{self, Read, Write};
+#[cfg(not(unix))]
+use std::io::{Seek, SeekFrom};
+use std::path::Path;
+use std::sync::atomic::{fence, Ordering};
+
+const MAGIC: &[u8; 8] = b"MCUOTP\0\x01";
+const HEADER_SIZE: usize = 16;
+
+/// Journaled updates are applied in chunks of at most this many bytes.
+const JOURNAL_DATA_SIZE: usize = 256;
+const JOURNAL_COMMITTED: u32 = 0x4f54_5031;
+
+/// Fixed layout of an OTP file on disk. All fields are little endian and word aligned.
+///
+/// ```text
+/// header      magic[8] partitions_size:u32 digest_words:u32
+/// partitions  [u8; partitions_size]
+/// digests     [u32; digest_words]
+/// pending     u32, bit N set if partition N's digest is calculated on the next reset
+/// journal     commit:u32 offset:u32 len:u32 checksum:u32 data[JOURNAL_DATA_SIZE]
+/// ```
+#[derive(Clone, Copy)]
+struct Layout {
+    partitions_size: usize,
+    digest_words: usize,
+}
+
+impl Layout {
+    fn partitions(&self) -> usize {
+        HEADER_SIZE
+    }
+
+    fn digests(&self) -> usize {
+        self.partitions() + self.partitions_size.next_multiple_of(4)
+    }
+
+    fn pending(&self) -> usize {
+        self.digests() + self.digest_words * 4
+    }
+
+    fn journal(&self) -> usize {
+        self.pending() + 4
+    }
+
+    fn journal_data(&self) -> usize {
+        self.journal() + 16
+    }
+
+    fn file_size(&self) -> usize {
+        self.journal_data() + JOURNAL_DATA_SIZE
+    }
+}
+
+enum Backing {
+    /// Shared writable mapping of the whole file: stores land in the page cache, so
+    /// they survive the process being killed at any point.
+    #[cfg(unix)]
+    Mapped(std::ptr::NonNull<u8>),
+    /// Copy of the file that every store is written through to.
+    #[cfg(not(unix))]
+    Buffered(Vec<u8>),
+}
+
+/// OTP state kept in a file that is updated in place as fuses are written, instead of
+/// being rewritten on exit.
+///
+/// An aligned word store, which is all a DAI write is, can't be torn by the process
+/// dying, so those go directly to their place in the file. Larger updates are first
+/// copied to a one-entry journal that is replayed when the file is next opened, so an
+/// update that was interrupted half way is either completed or never happened.
+pub(crate) struct OtpFile {
+    file: File,
+    layout: Layout,
+    backing: Backing,
+}
+
+impl OtpFile {
+    /// Open the OTP file at `path`, creating it if it doesn't exist.
+    ///
+    /// The file is locked for as long as it is open, so a second emulator opening it fails
+    /// instead of overwriting the fuses the first one writes. Files written in the old
+    /// JSON format are converted, replacing them atomically.
+    pub(crate) fn open(
+        path: &Path,
+        partitions_size: usize,
+        digest_words: usize,
+    ) -> io::Result<Self> {
+        let mut file = File::options()
+            .read(true)
+            .write(true)
+            .create(true)
+            .truncate(false)
+            .open(path)?;
+        lock(&file)?;
+        let layout = Layout {
+            partitions_size,
+            digest_words,
+        };
+
+        let mut contents = vec![];
+        file.read_to_end(&mut contents)?;
+        let legacy = if contents.first() == Some(&b'{') {
+            let state: OtpState = serde_json::from_slice(&contents)?;
+            if state.partitions.len() != partitions_size || state.digests.len() != digest_words {
+                Err(invalid_data("OTP file does not match the OTP layout"))?;
+            }
+            Some(state)
+        } else {
+            None
+        };
+
+        let new = contents.is_empty() || legacy.is_some();
+        if new {
+            contents = initial_contents(layout, legacy.as_ref());
+            file = replace_file(path, &contents)?;
+        } else if contents.len() != layout.file_size()
+            || &contents[..8] != MAGIC
+            || read_u32(&contents, 8) as usize != partitions_size
+            || read_u32(&contents, 12) as usize != digest_words
+        {
+            Err(invalid_data("OTP file does not match the OTP layout"))?;
+        }
+
+        let mut otp_file = Self {
+            backing: Self::map(&file, layout, contents)?,
+            file,
+            layout,
+        };
+        if !new {
+            otp_file.replay_journal()?;
+        }
+        Ok(otp_file)
+    }
+
+    #[cfg(unix)]
+    fn map(file: &File, layout: Layout, _contents: Vec<u8>) -> io::Result<Backing> {
+        use std::os::fd::AsRawFd;
+        // SAFETY: a fresh mapping of an open file does not alias any Rust object; it
+        // stays valid after the file is closed and is unmapped in `drop`.
+        let ptr = unsafe {
+            libc::mmap(
+                std::ptr::null_mut(),
+                layout.file_size(),
+                libc::PROT_READ | libc::PROT_WRITE,
+                libc::MAP_SHARED,
+                file.as_raw_fd(),
+                0,
+            )
+        };
+        if ptr == libc::MAP_FAILED {
+            return Err(io::Error::last_os_error());
+        }
+        Ok(Backing::Mapped(
+            std::ptr::NonNull::new(ptr as *mut u8).unwrap(),
+        ))
+    }
+
+    #[cfg(not(unix))]
+    fn map(_file: &File, layout: Layout, mut contents: Vec<u8>) -> io::Result<Backing> {
+        contents.resize(layout.file_size(), 0);
+        Ok(Backing::Buffered(contents))
+    }
+
+    fn bytes(&self) -> &[u8] {
+        match &self.backing {
+            #[cfg(unix)]
+            // SAFETY: the mapping covers the whole file and lives as long as `self`
+            Backing::Mapped(ptr) => unsafe {
+                std::slice::from_raw_parts(ptr.as_ptr(), self.layout.file_size())
+            },
+            #[cfg(not(unix))]
+            Backing::Buffered(data) => data,
+        }
+    }
+
+    /// The persisted partitions, digests and pending digest calculations.
+    pub(crate) fn state(&self) -> OtpState {
+        let bytes = self.bytes();
+        let layout = self.layout;
+        let pending = read_u32(bytes, layout.pending());
+        OtpState {
+            partitions: bytes[layout.partitions()..][..layout.partitions_size].to_vec(),
+            calculate_digests_on_reset: (0..32).filter(|i| pending & 1 << i != 0).collect(),
+            digests: (0..layout.digest_words)
+                .map(|i| read_u32(bytes, layout.digests() + i * 4))
+                .collect(),
+        }
+    }
+
+    /// Store `data` at `offset` of the partitions.
+    pub(crate) fn write_partitions(&mut self, offset: usize, data: &[u8]) -> io::Result<()> {
+        assert!(offset + data.len() <= self.layout.partitions_size);
+        self.update(self.layout.partitions() + offset, data)
+    }
+
+    /// Store `digests` starting at digest word `index`.
+    pub(crate) fn write_digests(&mut self, index: usize, digests: &[u32]) -> io::Result<()> {
+        assert!(index + digests.len() <= self.layout.digest_words);
+        let data: Vec<u8> = digests.iter().flat_map(|d| d.to_le_bytes()).collect();
+        self.update(self.layout.digests() + index * 4, &data)
+    }
+
+    /// Store the bitmap of partitions whose digests are calculated on the next reset.
+    pub(crate) fn write_pending(&mut self, pending: u32) -> io::Result<()> {
+        self.update(self.layout.pending(), &pending.to_le_bytes())
+    }
+
+    /// Flush all updates to the disk.
+    pub(crate) fn sync(&mut self) -> io::Result<()> {
+        #[cfg(unix)]
+        {
+            let Backing::Mapped(ptr) = self.backing;
+            // SAFETY: the range is exactly the mapping created in `map`
+            if unsafe {
+                libc::msync(
+                    ptr.as_ptr() as *mut libc::c_void,
+                    self.layout.file_size(),
+                    libc::MS_SYNC,
+                )
+            } != 0
+            {
+                return Err(io::Error::last_os_error());
+            }
+        }
+        self.file.sync_data()
+    }
+
+    fn update(&mut self, offset: usize, data: &[u8]) -> io::Result<()> {
+        if self.bytes()[offset..offset + data.len()] == *data {
+            return Ok(());
+        }
+        if data.len() == 4 && offset % 4 == 0 {
+            return self.put(offset, data);
+        }
+        let journal = self.layout.journal();
+        for (i, chunk) in data.chunks(JOURNAL_DATA_SIZE).enumerate() {
+            let target = offset + i * JOURNAL_DATA_SIZE;
+            let mut entry = [0u8; 12];
+            entry[..4].copy_from_slice(&(target as u32).to_le_bytes());
+            entry[4..8].copy_from_slice(&(chunk.len() as u32).to_le_bytes());
+            entry[8..].copy_from_slice(&checksum(target, chunk).to_le_bytes());
+            self.put(self.layout.journal_data(), chunk)?;
+            self.put(journal + 4, &entry)?;
+            self.put(journal, &JOURNAL_COMMITTED.to_le_bytes())?;
+            self.put(target, chunk)?;
+            self.put(journal, &0u32.to_le_bytes())?;
+        }
+        Ok(())
+    }
+
+    /// Complete an update that was interrupted after being committed to the journal.
+    fn replay_journal(&mut self) -> io::Result<()> {
+        let bytes = self.bytes();
+        let journal = self.layout.journal();
+        if read_u32(bytes, journal) != JOURNAL_COMMITTED {
+            return Ok(());
+        }
+        let target = read_u32(bytes, journal + 4) as usize;
+        let len = read_u32(bytes, journal + 8) as usize;
+        if len <= JOURNAL_DATA_SIZE && target >= HEADER_SIZE && target + len <= journal {
+            let chunk = bytes[self.layout.journal_data()..][..len].to_vec();
+            if read_u32(bytes, journal + 12) == checksum(target, &chunk) {
+                self.put(target, &chunk)?;
+            }
+        }
+        self.put(journal, &0u32.to_le_bytes())?;
+        self.sync()
+    }
+
+    /// Copy `data` to `offset` of the file, after all previous stores.
+    fn put(&mut self, offset: usize, data: &[u8]) -> io::Result<()> {
+        fence(Ordering::SeqCst);
+        match &mut self.backing {
+            #[cfg(unix)]
+            Backing::Mapped(ptr) => {
+                assert!(offset + data.len() <= self.layout.file_size());
+                // SAFETY: the mapping covers the whole file, which was checked above, and
+                // `&mut self` makes this the only reference to it
+                unsafe {
+                    let dst = ptr.as_ptr().add(offset);
+                    if data.len() == 4 && offset % 4 == 0 {
+                        // a single aligned store, so the word is never seen half written
+                        std::ptr::write_volatile(
+                            dst as *mut u32,
+                            u32::from_le_bytes(data.try_into().unwrap()),
+                        );
+                    } else {
+                        std::ptr::copy_nonoverlapping(data.as_ptr(), dst, data.len());
+                    }
+                }
+            }
+            #[cfg(not(unix))]
+            Backing::Buffered(contents) => {
+                contents[offset..offset + data.len()].copy_from_slice(data);
+                self.file.seek(SeekFrom::Start(offset as u64))?;
+                self.file.write_all(data)?;
+            }
+        }
+        Ok(())
+    }
+}
+
+impl Drop for OtpFile {
+    fn drop(&mut self) {
+        #[cfg(unix)]
+        {
+            let Backing::Mapped(ptr) = self.backing;
+            // SAFETY: the mapping was created by `map` and no slice of it outlives `self`
+            unsafe {
+                libc::munmap(ptr.as_ptr() as *mut libc::c_void, self.layout.file_size());
+            }
+        }
+    }
+}
+
+/// Contents of a new OTP file, holding `state` if it is converted from an old one.
+fn initial_contents(layout: Layout, state: Option<&OtpState>) -> Vec<u8> {
+    let mut contents = vec![0; layout.file_size()];
+    contents[..8].copy_from_slice(MAGIC);
+    contents[8..12].copy_from_slice(&(layout.partitions_size as u32).to_le_bytes());
+    contents[12..HEADER_SIZE].copy_from_slice(&(layout.digest_words as u32).to_le_bytes());
+    if let Some(state) = state {
+        contents[layout.partitions()..][..layout.partitions_size]
+            .copy_from_slice(&state.partitions);
+        for (i, digest) in state.digests.iter().enumerate() {
+            contents[layout.digests() + i * 4..][..4].copy_from_slice(&digest.to_le_bytes());
+        }
+        let pending = state
+            .calculate_digests_on_reset
+            .iter()
+            .fold(0u32, |bits, partition| bits | 1 << partition);
+        contents[layout.pending()..][..4].copy_from_slice(&pending.to_le_bytes());
+    }
+    contents
+}
+
+/// Replace the file at `path` with `contents` so that a crash leaves either the old or
+/// the new file: they are written to a locked temporary file in the same directory,
+/// flushed and renamed over `path`. Returns the new file, still locked.
+fn replace_file(path: &Path, contents: &[u8]) -> io::Result<File> {
+    let mut tmp_name = path
+        .file_name()
+        .ok_or_else(|| io::Error::new(io::ErrorKind::InvalidInput, "OTP path has no file name"))?
+        .to_os_string();
+    tmp_name.push(".tmp");
+    let tmp_path = path.with_file_name(tmp_name);
+
+    let mut file = File::options()
+        .read(true)
+        .write(true)
+        .create(true)
+        .truncate(true)
+        .open(&tmp_path)?;
+    let result = lock(&file)
+        .and_then(|_| file.write_all(contents))
+        .and_then(|_| file.sync_all())
+        .and_then(|_| std::fs::rename(&tmp_path, path));
+    if let Err(err) = result {
+        let _ = std::fs::remove_file(&tmp_path);
+        return Err(err);
+    }
+
+    // make the rename itself durable
+    #[cfg(unix)]
+    {
+        let dir = match path.parent() {
+            Some(dir) if !dir.as_os_str().is_empty() => dir,
+            _ => Path::new("."),
+        };
+        File::open(dir)?.sync_all()?;
+    }
+    Ok(file)
+}
+
+/// Take an exclusive lock on `file` that is held until it is closed, failing if another
+/// open file holds it. Every emulator maps the whole file shared, so two of them would
+/// silently overwrite each other's fuses.
+#[cfg(unix)]
+fn lock(file: &File) -> io::Result<()> {
+    use std::os::fd::AsRawFd;
+    // SAFETY: flock only operates on the descriptor, which `file` keeps open
+    if unsafe { libc::flock(file.as_raw_fd(), libc::LOCK_EX | libc::LOCK_NB) } != 0 {
+        let err = io::Error::last_os_error();
+        if err.raw_os_error() == Some(libc::EWOULDBLOCK) {
+            return Err(io::Error::new(
+                io::ErrorKind::WouldBlock,
+                "OTP file is already open in another emulator",
+            ));
+        }
+        return Err(err);
+    }
+    Ok(())
+}
+
+/// Locking is only implemented on Unix.
+#[cfg(not(unix))]
+fn lock(_file: &File) -> io::Result<()> {
+    Ok(())
+}
+
+fn read_u32(bytes: &[u8], offset: usize) -> u32 {
+    u32::from_le_bytes(bytes[offset..offset + 4].try_into().unwrap())
+}
+
+/// FNV-1a of a journal entry, so a commit word left over from a torn entry is ignored.
+fn checksum(target: usize, data: &[u8]) -> u32 {
+    (target as u32)
+        .to_le_bytes()
+        .iter()
+        .chain(data)
+        .fold(0x811c_9dc5, |hash, &b| {
+            (hash ^ b as u32).wrapping_mul(0x0100_0193)
+        })
+}
+
+fn invalid_data(msg: &str) -> io::Error {
+    io::Error::new(io::ErrorKind::InvalidData, msg)
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+    use tempfile::NamedTempFile;
+
+    const PARTITIONS_SIZE: usize = 64;
+    const DIGEST_WORDS: usize = 4;
+
+    fn open(file: &NamedTempFile) -> OtpFile {
+        OtpFile::open(file.path(), PARTITIONS_SIZE, DIGEST_WORDS).unwrap()
+    }
+
+    #[test]
+    fn test_updates_persist_without_save() {
+        let file = NamedTempFile::new().unwrap();
+        {
+            let mut otp = open(&file);
+            otp.write_partitions(8, &0x1234_5678u32.to_le_bytes())
+                .unwrap();
+            otp.write_partitions(16, &[0xaa; 12]).unwrap();
+            otp.write_digests(2, &[1, 2]).unwrap();
+            otp.write_pending(0b101).unwrap();
+            // dropped without syncing, like a killed process would leave it
+        }
+        let state = open(&file).state();
+        assert_eq!(&state.partitions[8..12], &[0x78, 0x56, 0x34, 0x12]);
+        assert_eq!(&state.partitions[16..28], &[0xaa; 12]);
+        assert_eq!(state.digests, vec![0, 0, 1, 2]);
+        assert_eq!(state.calculate_digests_on_reset, [0, 2].into());
+        assert_eq!(
+            std::fs::metadata(file.path()).unwrap().len() as usize,
+            open(&file).layout.file_size()
+        );
+    }
+
+    #[test]
+    fn test_replays_committed_journal() {
+        let file = NamedTempFile::new().unwrap();
+        {
+            let mut otp = open(&file);
+            // an update that was committed to the journal but not applied
+            let journal = otp.layout.journal();
+            let target = otp.layout.partitions() + 4;
+            let mut entry = [0u8; 12];
+            entry[..4].copy_from_slice(&(target as u32).to_le_bytes());
+            entry[4..8].copy_from_slice(&8u32.to_le_bytes());
+            entry[8..].copy_from_slice(&checksum(target, &[0x55; 8]).to_le_bytes());
+            otp.put(otp.layout.journal_data(), &[0x55; 8]).unwrap();
+            otp.put(journal + 4, &entry).unwrap();
+            otp.put(journal, &JOURNAL_COMMITTED.to_le_bytes()).unwrap();
+        }
+        let otp = open(&file);
+        assert_eq!(&otp.state().partitions[4..12], &[0x55; 8]);
+        assert_eq!(read_u32(otp.bytes(), otp.layout.journal()), 0);
+    }
+
+    #[test]
+    fn test_converts_json_file() {
+        let file = NamedTempFile::new().unwrap();
+        let mut state = OtpState {
+            partitions: vec![0; PARTITIONS_SIZE],
+            calculate_digests_on_reset: [1].into(),
+            digests: vec![5, 6, 7, 8],
+        };
+        state.partitions[0] = 0x42;
+        std::fs::write(file.path(), serde_json::to_vec(&state).unwrap()).unwrap();
+
+        let loaded = open(&file).state();
+        assert_eq!(loaded.partitions, state.partitions);
+        assert_eq!(loaded.digests, state.digests);
+        assert_eq!(loaded.calculate_digests_on_reset, [1].into());
+        assert_eq!(&std::fs::read(file.path()).unwrap()[..8], MAGIC);
+        let mut tmp_path = file.path().as_os_str().to_os_string();
+        tmp_path.push(".tmp");
+        assert!(!Path::new(&tmp_path).exists());
+    }
+
+    #[cfg(unix)]
+    #[test]
+    fn test_rejects_second_open() {
+        let file = NamedTempFile::new().unwrap();
+        let otp = open(&file);
+        let err = OtpFile::open(file.path(), PARTITIONS_SIZE, DIGEST_WORDS)
+            .err()
+            .unwrap();
+        assert_eq!(err.kind(), io::ErrorKind::WouldBlock);
+        drop(otp);
+        drop(open(&file));
+    }
+
+    #[test]
+    fn test_rejects_mismatched_layout() {
+        let file = NamedTempFile::new().unwrap();
+        drop(open(&file));
+        assert!(OtpFile::open(file.path(), PARTITIONS_SIZE * 2, DIGEST_WORDS).is_err());
+    }
+}
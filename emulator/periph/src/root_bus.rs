@@ -12,9 +12,10 @@ Abstract:
 
 --*/
 
+use crate::CopyOnWriteFlash;
 use crate::McuMailbox0Internal;
-use crate::{EmuCtrl, Uart};
-use caliptra_emu_bus::{Bus, BusError, Clock, Ram, Rom};
+use crate::{EmuCtrl, Uart, UartOutputRing};
+use caliptra_emu_bus::{Bus, BusError, Clock, Ram};
 use caliptra_emu_bus::{Device, Event, EventData};
 use caliptra_emu_cpu::{Irq, Pic, PicMmioRegisters};
 use caliptra_emu_types::{RvAddr, RvData, RvSize};
@@ -22,8 +23,9 @@ use emulator_consts::{
     DIRECT_READ_FLASH_ORG, DIRECT_READ_FLASH_SIZE, EXTERNAL_TEST_SRAM_SIZE, MCU_MAILBOX0_SRAM_SIZE,
     MCU_MAILBOX1_SRAM_SIZE, RAM_SIZE, ROM_DEDICATED_RAM_ORG, ROM_DEDICATED_RAM_SIZE,
 };
+use emulator_registers_generated::root_bus::AutoRootBusFastRegion;
 use std::{
-    cell::RefCell,
+    cell::{Cell, RefCell},
     path::PathBuf,
     rc::Rc,
     sync::{mpsc, Arc, Mutex},
@@ -79,13 +81,17 @@ pub struct McuRootBusArgs {
     pub clock: Rc<Clock>,
     pub rom: Vec<u8>,
     pub log_dir: PathBuf,
-    pub uart_output: Option<Rc<RefCell<Vec<u8>>>>,
+    pub uart_output: Option<Rc<UartOutputRing>>,
     pub uart_rx: Option<Arc<Mutex<Option<u8>>>>,
     pub offsets: McuRootBusOffsets,
+    /// If set, firmware exit requests are recorded here instead of exiting the process.
+    pub exit_request: Option<Rc<Cell<Option<u32>>>>,
 }
 
 pub struct McuRootBus {
-    pub rom: Rom,
+    /// ROM image. Backed by a [`Ram`] so it can be mapped into the fast path of the
+    /// [`AutoRootBus`](emulator_registers_generated::root_bus::AutoRootBus); writes are rejected.
+    pub rom: Rc<RefCell<Ram>>,
     pub uart: Uart,
     pub ctrl: EmuCtrl,
     pub ram: Rc<RefCell<Ram>>,
@@ -95,6 +101,7 @@ pub struct McuRootBus {
     pub mcu_mailbox0: McuMailbox0Internal,
     pub mcu_mailbox1: McuMailbox0Internal,
     pub direct_read_flash: Rc<RefCell<Ram>>,
+    direct_read_window: Option<Rc<RefCell<CopyOnWriteFlash>>>,
     pub mci_irq: Rc<RefCell<Irq>>,
     event_sender: Option<mpsc::Sender<Event>>,
     offsets: McuRootBusOffsets,
@@ -115,7 +122,7 @@ impl McuRootBus {
     pub fn new(mut args: McuRootBusArgs) -> Result<Self, std::io::Error> {
         let clock = args.clock;
         let pic = args.pic;
-        let rom = Rom::new(std::mem::take(&mut args.rom));
+        let rom = Ram::new(std::mem::take(&mut args.rom));
         let uart_irq = pic.register_irq(Self::UART_NOTIF_IRQ);
         let ram = Ram::new(vec![0; args.offsets.ram_size as usize]);
         let rom_sram = Ram::new(vec![0; args.offsets.rom_dedicated_ram_size as usize]);
@@ -126,15 +133,19 @@ impl McuRootBus {
         let mcu_mailbox1 = McuMailbox0Internal::new(&clock.clone());
 
         Ok(Self {
-            rom,
+            rom: Rc::new(RefCell::new(rom)),
             ram: Rc::new(RefCell::new(ram)),
             rom_sram: Rc::new(RefCell::new(rom_sram)),
             uart: Uart::new(args.uart_output, args.uart_rx, uart_irq, &clock.clone()),
-            ctrl: EmuCtrl::new(),
+            ctrl: match args.exit_request {
+                Some(exit_request) => EmuCtrl::new_with_exit_request(exit_request),
+                None => EmuCtrl::new(),
+            },
             pic_regs: pic.mmio_regs(clock.clone()),
             event_sender: None,
             external_test_sram: Rc::new(RefCell::new(external_test_sram)),
             direct_read_flash: Rc::new(RefCell::new(direct_read_flash)),
+            direct_read_window: None,
             offsets: args.offsets,
             mci_irq: Rc::new(RefCell::new(mci_irq)),
             mcu_mailbox0,
@@ -142,6 +153,65 @@ impl McuRootBus {
         })
     }
 
+    /// Serve the direct-read flash window from `flash` instead of `direct_read_flash`,
+    /// which is replaced by an empty RAM so that no copy of the flash is kept. Call this
+    /// before cloning `direct_read_flash` or taking the fast regions.
+    pub fn map_direct_read_flash(&mut self, flash: Rc<RefCell<CopyOnWriteFlash>>) {
+        self.direct_read_flash = Rc::new(RefCell::new(Ram::new(vec![])));
+        self.direct_read_window = Some(flash);
+    }
+
+    /// Names of the regions returned by [`McuRootBus::fast_regions`], in order.
+    pub const FAST_REGIONS: [&'static str; 5] = [
+        "sram",
+        "dccm",
+        "rom",
+        "external_test_sram",
+        "direct_read_flash",
+    ];
+
+    /// RAM-backed regions of this bus, most frequently accessed first, for the fast path of
+    /// the root bus it is mounted on. The layout comes from the same offsets as the regular
+    /// dispatch, so `--sram-offset`, `--dccm-size` and friends apply to both.
+    pub fn fast_regions(&self) -> Vec<AutoRootBusFastRegion> {
+        let offsets = &self.offsets;
+        let regions = [
+            (offsets.ram_offset, offsets.ram_size, &self.ram, true),
+            (
+                offsets.rom_dedicated_ram_offset,
+                offsets.rom_dedicated_ram_size,
+                &self.rom_sram,
+                true,
+            ),
+            (offsets.rom_offset, offsets.rom_size, &self.rom, false),
+            (
+                offsets.external_test_sram_offset,
+                offsets.external_test_sram_size,
+                &self.external_test_sram,
+                true,
+            ),
+            (
+                offsets.direct_read_flash_offset,
+                offsets.direct_read_flash_size,
+                &self.direct_read_flash,
+                false,
+            ),
+        ];
+        Self::FAST_REGIONS
+            .into_iter()
+            .zip(regions)
+            .map(
+                |(name, (start, size, ram, writable))| AutoRootBusFastRegion {
+                    name,
+                    start,
+                    len: size.min(ram.borrow().len() as u32),
+                    ram: ram.clone(),
+                    writable,
+                },
+            )
+            .collect()
+    }
+
     pub fn load_ram(&mut self, offset: usize, data: &[u8]) {
         if offset + data.len() > self.ram.borrow().len() as usize {
             panic!("Data exceeds RAM size");
@@ -161,7 +231,10 @@ impl Bus for McuRootBus {
     fn read(&mut self, size: RvSize, addr: RvAddr) -> Result<RvData, BusError> {
         if addr >= self.offsets.rom_offset && addr < self.offsets.rom_offset + self.offsets.rom_size
         {
-            return self.rom.read(size, addr - self.offsets.rom_offset);
+            return self
+                .rom
+                .borrow_mut()
+                .read(size, addr - self.offsets.rom_offset);
         }
         if addr >= self.offsets.uart_offset
             && addr < self.offsets.uart_offset + self.offsets.uart_size
@@ -202,10 +275,11 @@ impl Bus for McuRootBus {
         if addr >= self.offsets.direct_read_flash_offset
             && addr < self.offsets.direct_read_flash_offset + self.offsets.direct_read_flash_size
         {
-            return self
-                .direct_read_flash
-                .borrow_mut()
-                .read(size, addr - self.offsets.direct_read_flash_offset);
+            let offset = addr - self.offsets.direct_read_flash_offset;
+            if let Some(window) = self.direct_read_window.as_ref() {
+                return window.borrow().read(size, offset);
+            }
+            return self.direct_read_flash.borrow_mut().read(size, offset);
         }
         Err(BusError::LoadAccessFault)
     }
@@ -213,7 +287,7 @@ impl Bus for McuRootBus {
     fn write(&mut self, size: RvSize, addr: RvAddr, val: RvData) -> Result<(), BusError> {
         if addr >= self.offsets.rom_offset && addr < self.offsets.rom_offset + self.offsets.rom_size
         {
-            return self.rom.write(size, addr - self.offsets.rom_offset, val);
+            return Err(BusError::StoreAccessFault);
         }
         if addr >= self.offsets.uart_offset
             && addr < self.offsets.uart_offset + self.offsets.uart_size
@@ -259,7 +333,7 @@ impl Bus for McuRootBus {
     }
 
     fn poll(&mut self) {
-        self.rom.poll();
+        self.rom.borrow_mut().poll();
         self.uart.poll();
         self.ctrl.poll();
         self.ram.borrow_mut().poll();
@@ -270,7 +344,7 @@ impl Bus for McuRootBus {
     }
 
     fn warm_reset(&mut self) {
-        self.rom.warm_reset();
+        self.rom.borrow_mut().warm_reset();
         self.uart.warm_reset();
         self.ctrl.warm_reset();
         self.ram.borrow_mut().warm_reset();
@@ -281,7 +355,7 @@ impl Bus for McuRootBus {
     }
 
     fn update_reset(&mut self) {
-        self.rom.update_reset();
+        self.rom.borrow_mut().update_reset();
         self.uart.update_reset();
         self.ctrl.update_reset();
         self.ram.borrow_mut().update_reset();
@@ -292,7 +366,9 @@ impl Bus for McuRootBus {
     }
 
     fn register_outgoing_events(&mut self, sender: mpsc::Sender<Event>) {
-        self.rom.register_outgoing_events(sender.clone());
+        self.rom
+            .borrow_mut()
+            .register_outgoing_events(sender.clone());
         self.uart.register_outgoing_events(sender.clone());
         self.ctrl.register_outgoing_events(sender.clone());
         self.ram
@@ -303,7 +379,7 @@ impl Bus for McuRootBus {
     }
 
     fn incoming_event(&mut self, event: Rc<Event>) {
-        self.rom.incoming_event(event.clone());
+        self.rom.borrow_mut().incoming_event(event.clone());
         self.uart.incoming_event(event.clone());
         self.ctrl.incoming_event(event.clone());
         self.ram.borrow_mut().incoming_event(event.clone());
@@ -488,3 +564,126 @@ impl Bus for McuRootBus {
         }
     }
 }
+
+#[cfg(test)]
+mod test {
+    use super::*;
+    use emulator_registers_generated::root_bus::AutoRootBus;
+
+    fn test_helper_setup_autobus(fast: bool) -> AutoRootBus {
+        let root_bus = McuRootBus::new(McuRootBusArgs {
+            rom: vec![0x11, 0x22, 0x33, 0x44],
+            ..Default::default()
+        })
+        .unwrap();
+        let fast_regions = root_bus.fast_regions();
+        let mut bus = AutoRootBus::new(
+            vec![Box::new(root_bus)],
+            None,
+            None,
+            None,
+            None,
+            None,
+            None,
+            None,
+            None,
+            None,
+            None,
+            None,
+            None,
+            None,
+        );
+        if fast {
+            bus.set_fast_regions(fast_regions);
+        }
+        bus
+    }
+
+    #[test]
+    fn test_fast_regions_match_dispatch() {
+        let offsets = McuRootBusOffsets::default();
+        let ram = offsets.ram_offset;
+        let dccm = offsets.rom_dedicated_ram_offset;
+        let ram_end = offsets.ram_offset + offsets.ram_size;
+
+        let mut slow = test_helper_setup_autobus(false);
+        let mut fast = test_helper_setup_autobus(true);
+        for bus in [&mut slow, &mut fast] {
+            bus.write(RvSize::Word, ram, 0xdead_beef).unwrap();
+            bus.write(RvSize::HalfWord, ram + 6, 0x1234).unwrap();
+            bus.write(RvSize::Byte, dccm + 1, 0x5a).unwrap();
+            assert!(bus.write(RvSize::Word, offsets.rom_offset, 0).is_err());
+            assert!(bus.write(RvSize::Word, ram + 2, 0).is_err());
+        }
+
+        let accesses = [
+            (RvSize::Word, ram),
+            (RvSize::Byte, ram + 1),
+            (RvSize::HalfWord, ram + 6),
+            (RvSize::Word, ram + 4),
+            (RvSize::Word, dccm),
+            (RvSize::Word, offsets.rom_offset),
+            (RvSize::HalfWord, offsets.rom_offset + 2),
+            (RvSize::Word, ram + 2),
+            (RvSize::Word, ram_end - 4),
+            (RvSize::Word, ram_end),
+        ];
+        for (size, addr) in accesses {
+            assert_eq!(
+                slow.read(size, addr).ok(),
+                fast.read(size, addr).ok(),
+                "read of {:#x}",
+                addr
+            );
+        }
+        assert_eq!(fast.read(RvSize::Word, ram).ok(), Some(0xdead_beef));
+        assert_eq!(
+            fast.read(RvSize::Word, offsets.rom_offset).ok(),
+            Some(0x4433_2211)
+        );
+    }
+
+    #[test]
+    fn test_fast_region_stats() {
+        let offsets = McuRootBusOffsets::default();
+        let ram = offsets.ram_offset;
+        let mut bus = test_helper_setup_autobus(true);
+        bus.enable_stats(Rc::new(Clock::new()));
+        bus.write(RvSize::Word, ram, 0xdead_beef).unwrap();
+        bus.read(RvSize::HalfWord, ram + 2).unwrap();
+        bus.read(RvSize::Word, offsets.rom_offset).unwrap();
+
+        let stats = bus.fast_region_stats().unwrap();
+        assert_eq!(stats.len(), McuRootBus::FAST_REGIONS.len());
+        assert_eq!(bus.fast_regions()[0].name, "sram");
+        assert_eq!((stats[0].reads, stats[0].bytes_read), (1, 2));
+        assert_eq!((stats[0].writes, stats[0].bytes_written), (1, 4));
+        assert_eq!((stats[2].reads, stats[2].writes), (1, 0));
+        // the fast path bypasses the counters of the MCU root bus delegate
+        assert_eq!(
+            bus.stats().unwrap()[AutoRootBus::PERIPHERALS.len()].reads,
+            0
+        );
+    }
+
+    #[test]
+    fn test_mapped_direct_read_flash() {
+        let mut root_bus = McuRootBus::new(McuRootBusArgs::default()).unwrap();
+        let image = crate::MappedImage::from_vec(vec![0x11, 0x22, 0x33, 0x44, 0x55]);
+        root_bus.map_direct_read_flash(Rc::new(RefCell::new(CopyOnWriteFlash::new(image))));
+        let flash = root_bus.offsets.direct_read_flash_offset;
+        // the window is no longer served from RAM
+        assert_eq!(root_bus.direct_read_flash.borrow().len(), 0);
+        assert!(root_bus
+            .fast_regions()
+            .iter()
+            .any(|region| region.start == flash && region.len == 0));
+
+        assert_eq!(root_bus.read(RvSize::Word, flash).ok(), Some(0x4433_2211));
+        assert_eq!(
+            root_bus.read(RvSize::Word, flash + 4).ok(),
+            Some(0xffff_ff55)
+        );
+        assert!(root_bus.write(RvSize::Word, flash, 0).is_err());
+    }
+}
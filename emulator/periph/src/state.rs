@@ -0,0 +1,133 @@
+/*++
+
+Licensed under the Apache-2.0 license.
+
+File Name:
+
+    state.rs
+
+Abstract:
+
+    File contains the encoding of the peripheral state saved in emulator snapshots.
+
+--*/
+
+use std::io::{Error, ErrorKind};
+
+/// Little-endian encoder of the state returned by a peripheral's `save_state`.
+#[derive(Default)]
+pub(crate) struct StateWriter {
+    out: Vec<u8>,
+}
+
+impl StateWriter {
+    pub fn u32(&mut self, val: u32) -> &mut Self {
+        self.out.extend_from_slice(&val.to_le_bytes());
+        self
+    }
+
+    pub fn u64(&mut self, val: u64) -> &mut Self {
+        self.out.extend_from_slice(&val.to_le_bytes());
+        self
+    }
+
+    pub fn bool(&mut self, val: bool) -> &mut Self {
+        self.u32(val as u32)
+    }
+
+    /// Append `data` prefixed with its length.
+    pub fn bytes(&mut self, data: &[u8]) -> &mut Self {
+        self.u32(data.len() as u32);
+        self.out.extend_from_slice(data);
+        self
+    }
+
+    pub fn finish(self) -> Vec<u8> {
+        self.out
+    }
+}
+
+/// Decoder of the state written by [`StateWriter`], failing on truncated input.
+pub(crate) struct StateReader<'a> {
+    bytes: &'a [u8],
+    pos: usize,
+}
+
+impl<'a> StateReader<'a> {
+    pub fn new(bytes: &'a [u8]) -> Self {
+        Self { bytes, pos: 0 }
+    }
+
+    fn take(&mut self, len: usize) -> Result<&'a [u8], Error> {
+        if self.bytes.len() - self.pos < len {
+            Err(invalid("truncated peripheral state"))?;
+        }
+        let slice = &self.bytes[self.pos..self.pos + len];
+        self.pos += len;
+        Ok(slice)
+    }
+
+    pub fn u32(&mut self) -> Result<u32, Error> {
+        Ok(u32::from_le_bytes(self.take(4)?.try_into().unwrap()))
+    }
+
+    pub fn u64(&mut self) -> Result<u64, Error> {
+        Ok(u64::from_le_bytes(self.take(8)?.try_into().unwrap()))
+    }
+
+    pub fn bool(&mut self) -> Result<bool, Error> {
+        Ok(self.u32()? != 0)
+    }
+
+    pub fn bytes(&mut self) -> Result<&'a [u8], Error> {
+        let len = self.u32()? as usize;
+        self.take(len)
+    }
+
+    /// Fail if anything is left after the state.
+    pub fn finish(self) -> Result<(), Error> {
+        if self.pos != self.bytes.len() {
+            Err(invalid("trailing data after peripheral state"))?;
+        }
+        Ok(())
+    }
+}
+
+pub(crate) fn invalid(msg: &str) -> Error {
+    Error::new(ErrorKind::InvalidData, msg)
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    #[test]
+    fn test_round_trip() {
+        let mut writer = StateWriter::default();
+        writer
+            .u32(0x1234_5678)
+            .u64(1 << 40)
+            .bool(true)
+            .bytes(&[1, 2, 3]);
+        let state = writer.finish();
+
+        let mut reader = StateReader::new(&state);
+        assert_eq!(reader.u32().unwrap(), 0x1234_5678);
+        assert_eq!(reader.u64().unwrap(), 1 << 40);
+        assert!(reader.bool().unwrap());
+        assert_eq!(reader.bytes().unwrap(), &[1, 2, 3]);
+        reader.finish().unwrap();
+    }
+
+    #[test]
+    fn test_rejects_truncated_and_trailing() {
+        let mut writer = StateWriter::default();
+        writer.bytes(&[1, 2, 3]).u32(7);
+        let state = writer.finish();
+
+        assert!(StateReader::new(&state[..5]).bytes().is_err());
+        let mut reader = StateReader::new(&state);
+        reader.bytes().unwrap();
+        assert!(reader.finish().is_err());
+    }
+}
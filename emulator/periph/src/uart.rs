@@ -12,10 +12,11 @@ Abstract:
 
 --*/
 
+use crate::UartOutputRing;
 use caliptra_emu_bus::{Bus, BusError, Clock, Timer};
 use caliptra_emu_cpu::Irq;
 use caliptra_emu_types::{RvAddr, RvData, RvSize};
-use std::cell::{Cell, RefCell};
+use std::cell::Cell;
 use std::rc::Rc;
 use std::sync::{Arc, Mutex};
 
@@ -23,7 +24,7 @@ pub struct Uart {
     bit_rate: u8,
     data_bits: u8,
     stop_bits: u8,
-    output: Option<Rc<RefCell<Vec<u8>>>>,
+    output: Option<Rc<UartOutputRing>>,
     input: Option<Arc<Mutex<Option<u8>>>>,
     bytes_read: Cell<u64>,
     byte_last_irq_triggered: Cell<u64>,
@@ -49,7 +50,7 @@ impl Uart {
     const ADDR_TX_DATA: RvAddr = 0x00000041;
 
     pub fn new(
-        output: Option<Rc<RefCell<Vec<u8>>>>,
+        output: Option<Rc<UartOutputRing>>,
         input: Option<Arc<Mutex<Option<u8>>>>,
         irq: Irq,
         clock: &Clock,
@@ -139,8 +140,7 @@ impl Bus for Uart {
             (RvSize::Byte, Uart::ADDR_STOP_BITS) => self.stop_bits = value as u8,
             (RvSize::Byte, Uart::ADDR_TX_DATA) => match &self.output {
                 Some(output) => {
-                    let mut out = output.borrow_mut();
-                    out.push(value as u8);
+                    output.push(value as u8);
                 }
                 None => {
                     match value as u8 {
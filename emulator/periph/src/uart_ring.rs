@@ -0,0 +1,209 @@
+/*++
+
+Licensed under the Apache-2.0 license.
+
+File Name:
+
+    uart_ring.rs
+
+Abstract:
+
+    File contains the fixed-capacity ring buffer used to capture UART output.
+
+--*/
+
+use std::sync::atomic::{AtomicU32, Ordering};
+
+/// Fixed-capacity single-producer / single-consumer byte ring for captured UART output.
+///
+/// The UART is the only producer and only ever advances `head`; the consumer only
+/// advances `tail`. Both indices are free-running and wrap at `u32::MAX`, the slot for an
+/// index is `index & (capacity - 1)`. The struct is `repr(C)` so the C bindings can hand
+/// a pointer to it directly to C code, which then drains output without any copies or
+/// calls back into Rust. When the ring is full, new bytes are dropped and counted, so
+/// that the consumer's `tail` is never written by the producer and the consumer can run
+/// on any thread.
+#[repr(C)]
+pub struct UartOutputRing {
+    head: AtomicU32,
+    tail: AtomicU32,
+    capacity: u32,
+    dropped: AtomicU32,
+    data: *mut u8,
+}
+
+impl UartOutputRing {
+    /// Default capacity, large enough to hold a full boot log between drains.
+    pub const DEFAULT_CAPACITY: usize = 64 * 1024;
+
+    /// Create a new ring. `capacity` is rounded up to the next power of two.
+    pub fn new(capacity: usize) -> Self {
+        let capacity = capacity.max(1).next_power_of_two();
+        assert!(capacity <= 1 << 31, "UART ring capacity too large");
+        let data = Box::into_raw(vec![0u8; capacity].into_boxed_slice()) as *mut u8;
+        Self {
+            head: AtomicU32::new(0),
+            tail: AtomicU32::new(0),
+            capacity: capacity as u32,
+            dropped: AtomicU32::new(0),
+            data,
+        }
+    }
+
+    fn mask(&self) -> u32 {
+        self.capacity - 1
+    }
+
+    /// Capacity of the ring in bytes.
+    pub fn capacity(&self) -> usize {
+        self.capacity as usize
+    }
+
+    /// Number of bytes waiting to be consumed.
+    pub fn len(&self) -> usize {
+        let head = self.head.load(Ordering::Acquire);
+        let tail = self.tail.load(Ordering::Acquire);
+        head.wrapping_sub(tail) as usize
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    /// Number of bytes dropped because the ring was full.
+    pub fn dropped(&self) -> u32 {
+        self.dropped.load(Ordering::Relaxed)
+    }
+
+    /// Append a byte. If the ring is full, the byte is dropped and counted instead; returns
+    /// false in that case.
+    pub fn push(&self, byte: u8) -> bool {
+        let head = self.head.load(Ordering::Relaxed);
+        let tail = self.tail.load(Ordering::Acquire);
+        if head.wrapping_sub(tail) >= self.capacity {
+            self.dropped.fetch_add(1, Ordering::Relaxed);
+            return false;
+        }
+        // SAFETY: the index is masked to the allocation, and the slot is free: the acquire
+        // load of `tail` above orders this store after the consumer's reads of it.
+        unsafe { *self.data.add((head & self.mask()) as usize) = byte };
+        self.head.store(head.wrapping_add(1), Ordering::Release);
+        true
+    }
+
+    /// Copy up to `buf.len()` pending bytes into `buf` without consuming them.
+    pub fn peek_into(&self, buf: &mut [u8]) -> usize {
+        let tail = self.tail.load(Ordering::Relaxed);
+        self.copy_out(tail, buf)
+    }
+
+    /// Copy up to `buf.len()` pending bytes into `buf` and consume them.
+    pub fn pop_into(&self, buf: &mut [u8]) -> usize {
+        let tail = self.tail.load(Ordering::Relaxed);
+        let len = self.copy_out(tail, buf);
+        self.tail
+            .store(tail.wrapping_add(len as u32), Ordering::Release);
+        len
+    }
+
+    fn copy_out(&self, tail: u32, buf: &mut [u8]) -> usize {
+        let head = self.head.load(Ordering::Acquire);
+        let len = (head.wrapping_sub(tail) as usize).min(buf.len());
+        let start = (tail & self.mask()) as usize;
+        let first = len.min(self.capacity() - start);
+        // SAFETY: both ranges are within the allocation and were published by `push`.
+        unsafe {
+            std::ptr::copy_nonoverlapping(self.data.add(start), buf.as_mut_ptr(), first);
+            std::ptr::copy_nonoverlapping(self.data, buf.as_mut_ptr().add(first), len - first);
+        }
+        len
+    }
+}
+
+impl Drop for UartOutputRing {
+    fn drop(&mut self) {
+        // SAFETY: `data` was created from a boxed slice of exactly `capacity` bytes.
+        unsafe {
+            drop(Box::from_raw(std::ptr::slice_from_raw_parts_mut(
+                self.data,
+                self.capacity(),
+            )));
+        }
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    #[test]
+    fn test_push_pop_wraparound() {
+        let ring = UartOutputRing::new(6);
+        assert_eq!(ring.capacity(), 8);
+        let mut buf = [0u8; 8];
+
+        for round in 0..5u8 {
+            for i in 0..5 {
+                assert!(ring.push(round * 10 + i));
+            }
+            assert_eq!(ring.len(), 5);
+            assert_eq!(ring.peek_into(&mut buf[..2]), 2);
+            assert_eq!(ring.len(), 5);
+            assert_eq!(ring.pop_into(&mut buf), 5);
+            assert_eq!(&buf[..5], &[0, 1, 2, 3, 4].map(|i| round * 10 + i));
+            assert!(ring.is_empty());
+        }
+    }
+
+    #[test]
+    fn test_full_drops_new() {
+        let ring = UartOutputRing::new(4);
+        for i in 0..4 {
+            assert!(ring.push(i));
+        }
+        assert!(!ring.push(4));
+        assert!(!ring.push(5));
+        assert_eq!(ring.dropped(), 2);
+        assert_eq!(ring.len(), 4);
+
+        let mut buf = [0u8; 8];
+        assert_eq!(ring.pop_into(&mut buf), 4);
+        assert_eq!(&buf[..4], &[0, 1, 2, 3]);
+        assert!(ring.push(6));
+        assert_eq!(ring.pop_into(&mut buf), 1);
+        assert_eq!(buf[0], 6);
+        assert_eq!(ring.dropped(), 2);
+    }
+
+    #[test]
+    fn test_drain_from_another_thread() {
+        // stands in for the C driver, which drains the ring through a raw pointer
+        struct RingPtr(*const UartOutputRing);
+        // SAFETY: only the spawned thread pops and only this thread pushes
+        unsafe impl Send for RingPtr {}
+
+        let ring = UartOutputRing::new(16);
+        let ring_ptr = RingPtr(&ring);
+        std::thread::scope(|scope| {
+            let consumer = scope.spawn(move || {
+                let ring_ptr = ring_ptr;
+                // SAFETY: the ring outlives the scope
+                let ring = unsafe { &*ring_ptr.0 };
+                let mut out = vec![];
+                let mut buf = [0u8; 5];
+                while out.len() < 1000 {
+                    let len = ring.pop_into(&mut buf);
+                    out.extend_from_slice(&buf[..len]);
+                }
+                out
+            });
+            let expected: Vec<u8> = (0..1000u32).map(|i| i as u8).collect();
+            for &byte in &expected {
+                while !ring.push(byte) {
+                    std::thread::yield_now();
+                }
+            }
+            assert_eq!(consumer.join().unwrap(), expected);
+        });
+    }
+}
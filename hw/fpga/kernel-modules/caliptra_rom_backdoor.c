@@ -1,7 +1,5 @@
 // Licensed under the Apache-2.0 license
 
 #define DEVICE_NAME "caliptra-rom-backdoor"
-#define ROM_BACKDOOR_MINOR_ID 0
-#define ROM_ADDRESS 0xB0000000
-#define ROM_SIZE 0x18000
+#define ROM_REGION "rom"
 #include "rom_backdoor.h"
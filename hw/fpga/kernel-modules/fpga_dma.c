@@ -0,0 +1,249 @@
+// Licensed under the Apache-2.0 license
+
+// Bulk copies of firmware images into the FPGA memories with a memcpy capable DMA
+// channel, e.g. the Versal or ZynqMP ADMA, which is much faster than CPU stores
+// through the uio mappings.
+
+#include <linux/module.h>
+#include <linux/completion.h>
+#include <linux/dma-mapping.h>
+#include <linux/dmaengine.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+
+#include "fpga_dma_ioctl.h"
+#include "fpga_region_lookup.h"
+
+#define DEVICE_NAME "caliptra-fpga-dma"
+
+// Size of the coherent bounce buffer, transfers are split into chunks of this size
+#define FPGA_DMA_CHUNK_SIZE 0x10000
+
+// A DMA transfer that has not completed in this time is aborted
+#define FPGA_DMA_TIMEOUT_MS 1000
+
+struct fpga_dma_region
+{
+    // name of the region's map in io_module
+    const char *name;
+    // resolved through caliptra_fpga_region() when the module is loaded
+    phys_addr_t addr;
+    resource_size_t size;
+};
+
+// Indexed by FPGA_DMA_REGION_*
+static struct fpga_dma_region fpga_dma_regions[] = {
+    [FPGA_DMA_REGION_CALIPTRA_ROM] = {"rom"},
+    [FPGA_DMA_REGION_MCU_ROM] = {"mcu_rom"},
+    [FPGA_DMA_REGION_MCU_SRAM] = {"mcu_sram"},
+};
+
+struct fpga_dma_data
+{
+    struct dma_chan *chan;
+    // Bounce buffer in memory the DMA engine can read, serialized by lock
+    void *buf;
+    dma_addr_t buf_dma;
+    struct mutex lock;
+};
+
+static struct fpga_dma_data fpga_dma_data = {0};
+
+static void fpga_dma_callback(void *param)
+{
+    complete(param);
+}
+
+// Copy len bytes from the bounce buffer to the bus address dst
+static int fpga_dma_transfer(dma_addr_t dst, size_t len)
+{
+    struct dma_async_tx_descriptor *tx;
+    DECLARE_COMPLETION_ONSTACK(done);
+    dma_cookie_t cookie;
+
+    tx = dmaengine_prep_dma_memcpy(fpga_dma_data.chan, dst, fpga_dma_data.buf_dma, len,
+                                   DMA_PREP_INTERRUPT | DMA_CTRL_ACK);
+    if (!tx)
+    {
+        return -EIO;
+    }
+    tx->callback = fpga_dma_callback;
+    tx->callback_param = &done;
+
+    cookie = dmaengine_submit(tx);
+    if (dma_submit_error(cookie))
+    {
+        return -EIO;
+    }
+    dma_async_issue_pending(fpga_dma_data.chan);
+
+    if (!wait_for_completion_timeout(&done, msecs_to_jiffies(FPGA_DMA_TIMEOUT_MS)))
+    {
+        dmaengine_terminate_sync(fpga_dma_data.chan);
+        return -ETIMEDOUT;
+    }
+    if (dma_async_is_tx_complete(fpga_dma_data.chan, cookie, NULL, NULL) != DMA_COMPLETE)
+    {
+        return -EIO;
+    }
+    return 0;
+}
+
+static long fpga_dma_copy_to_region(const struct fpga_dma_copy *req)
+{
+    struct device *dma_dev = fpga_dma_data.chan->device->dev;
+    const struct fpga_dma_region *region;
+    const char __user *src = u64_to_user_ptr(req->data);
+    dma_addr_t dst;
+    size_t done = 0;
+    int rc = 0;
+
+    if (req->region >= ARRAY_SIZE(fpga_dma_regions) || req->reserved != 0)
+    {
+        return -EINVAL;
+    }
+    region = &fpga_dma_regions[req->region];
+    if (req->offset > region->size || req->size > region->size - req->offset)
+    {
+        return -EINVAL;
+    }
+    if (req->size == 0)
+    {
+        return 0;
+    }
+
+    // memcpy destinations are mapped DMA_BIDIRECTIONAL, as dmatest does
+    dst = dma_map_resource(dma_dev, region->addr + req->offset, req->size, DMA_BIDIRECTIONAL, 0);
+    if (dma_mapping_error(dma_dev, dst))
+    {
+        return -ENOMEM;
+    }
+
+    mutex_lock(&fpga_dma_data.lock);
+    while (done < req->size)
+    {
+        size_t len = min_t(size_t, req->size - done, FPGA_DMA_CHUNK_SIZE);
+
+        if (copy_from_user(fpga_dma_data.buf, src + done, len))
+        {
+            rc = -EFAULT;
+            break;
+        }
+        rc = fpga_dma_transfer(dst + done, len);
+        if (rc)
+        {
+            printk(KERN_ALERT "fpga_dma: error %d copying to %s at %#llx\n", rc, region->name, req->offset + done);
+            break;
+        }
+        done += len;
+    }
+    mutex_unlock(&fpga_dma_data.lock);
+
+    dma_unmap_resource(dma_dev, dst, req->size, DMA_BIDIRECTIONAL, 0);
+    return rc;
+}
+
+static long fpga_dma_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+    struct fpga_dma_copy req;
+
+    switch (cmd)
+    {
+    case FPGA_DMA_IOC_COPY_TO_REGION:
+        if (copy_from_user(&req, (void __user *)arg, sizeof(req)))
+        {
+            return -EFAULT;
+        }
+        return fpga_dma_copy_to_region(&req);
+    default:
+        return -ENOTTY;
+    }
+}
+
+static const struct file_operations fpga_dma_fops = {
+    .owner = THIS_MODULE,
+    .unlocked_ioctl = fpga_dma_ioctl,
+    .compat_ioctl = compat_ptr_ioctl,
+};
+
+static struct miscdevice fpga_dma_misc = {
+    .minor = MISC_DYNAMIC_MINOR,
+    .name = DEVICE_NAME,
+    .fops = &fpga_dma_fops,
+    // the DMA engine writes anywhere in the loadable regions, so only root may use it
+    .mode = 0600,
+};
+
+static int __init fpga_dma_init(void)
+{
+    dma_cap_mask_t mask;
+    size_t i;
+    int rc;
+
+    // use the same layout as the uio maps, including any overrides
+    for (i = 0; i < ARRAY_SIZE(fpga_dma_regions); i++)
+    {
+        struct fpga_dma_region *region = &fpga_dma_regions[i];
+
+        rc = caliptra_fpga_region(region->name, &region->addr, &region->size);
+        if (rc)
+        {
+            printk(KERN_ALERT "fpga_dma: no FPGA region %s: %d\n", region->name, rc);
+            return rc;
+        }
+    }
+
+    mutex_init(&fpga_dma_data.lock);
+
+    dma_cap_zero(mask);
+    dma_cap_set(DMA_MEMCPY, mask);
+    fpga_dma_data.chan = dma_request_chan_by_mask(&mask);
+    if (IS_ERR(fpga_dma_data.chan))
+    {
+        rc = PTR_ERR(fpga_dma_data.chan);
+        printk(KERN_ALERT "fpga_dma: no memcpy DMA channel available: %d\n", rc);
+        return rc;
+    }
+
+    fpga_dma_data.buf = dma_alloc_coherent(fpga_dma_data.chan->device->dev, FPGA_DMA_CHUNK_SIZE,
+                                           &fpga_dma_data.buf_dma, GFP_KERNEL);
+    if (!fpga_dma_data.buf)
+    {
+        rc = -ENOMEM;
+        goto err_release;
+    }
+
+    rc = misc_register(&fpga_dma_misc);
+    if (rc)
+    {
+        printk(KERN_ALERT "fpga_dma: error %d in misc_register\n", rc);
+        goto err_free;
+    }
+
+    printk(KERN_INFO "fpga_dma: using DMA channel %s\n", dma_chan_name(fpga_dma_data.chan));
+    return 0;
+
+err_free:
+    dma_free_coherent(fpga_dma_data.chan->device->dev, FPGA_DMA_CHUNK_SIZE, fpga_dma_data.buf,
+                      fpga_dma_data.buf_dma);
+err_release:
+    dma_release_channel(fpga_dma_data.chan);
+    return rc;
+}
+
+static void __exit fpga_dma_exit(void)
+{
+    misc_deregister(&fpga_dma_misc);
+    dma_free_coherent(fpga_dma_data.chan->device->dev, FPGA_DMA_CHUNK_SIZE, fpga_dma_data.buf,
+                      fpga_dma_data.buf_dma);
+    dma_release_channel(fpga_dma_data.chan);
+}
+
+module_init(fpga_dma_init);
+module_exit(fpga_dma_exit);
+
+MODULE_DESCRIPTION("Caliptra FPGA DMA image loader");
+MODULE_LICENSE("GPL v2");
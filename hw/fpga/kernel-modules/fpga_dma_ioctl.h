@@ -0,0 +1,35 @@
+// Licensed under the Apache-2.0 license
+
+// ioctls of the FPGA DMA device, shared with userspace
+
+#ifndef FPGA_DMA_IOCTL_H
+#define FPGA_DMA_IOCTL_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define FPGA_DMA_IOC_MAGIC 'D'
+
+// Regions that can be loaded through the DMA device
+#define FPGA_DMA_REGION_CALIPTRA_ROM 0
+#define FPGA_DMA_REGION_MCU_ROM 1
+#define FPGA_DMA_REGION_MCU_SRAM 2
+
+struct fpga_dma_copy
+{
+    // userspace address of the data to copy
+    __u64 data;
+    // number of bytes to copy
+    __u64 size;
+    // one of FPGA_DMA_REGION_*
+    __u32 region;
+    // must be 0
+    __u32 reserved;
+    // byte offset into the region
+    __u64 offset;
+};
+
+// Copy a buffer into a region with the DMA engine instead of CPU stores
+#define FPGA_DMA_IOC_COPY_TO_REGION _IOW(FPGA_DMA_IOC_MAGIC, 0, struct fpga_dma_copy)
+
+#endif
@@ -0,0 +1,14 @@
+// Licensed under the Apache-2.0 license
+
+// Lookup of the FPGA regions mapped by io_module, shared by the other kernel modules
+
+#ifndef FPGA_REGION_LOOKUP_H
+#define FPGA_REGION_LOOKUP_H
+
+#include <linux/types.h>
+
+// Address and size of the uio map called name, e.g. "mcu_rom", with the uio{0,1}_addr and
+// uio{0,1}_size overrides of io_module applied. Returns -ENOENT for an unknown name.
+int caliptra_fpga_region(const char *name, phys_addr_t *addr, resource_size_t *size);
+
+#endif
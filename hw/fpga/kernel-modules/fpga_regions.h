@@ -0,0 +1,48 @@
+// Licensed under the Apache-2.0 license
+
+// Generated by `cargo xtask fpga-regions-autogen` from
+// platforms/fpga/config/src/regions.rs, do not edit.
+
+#ifndef FPGA_REGIONS_H
+#define FPGA_REGIONS_H
+
+#define FPGA_REGION_FPGA_WRAPPER_ADDR 0xa4010000
+#define FPGA_REGION_FPGA_WRAPPER_SIZE 0x00010000
+#define FPGA_REGION_CALIPTRA_ADDR 0xa4100000
+#define FPGA_REGION_CALIPTRA_SIZE 0x00040000
+#define FPGA_REGION_ROM_ADDR 0xb0000000
+#define FPGA_REGION_ROM_SIZE 0x00018000
+#define FPGA_REGION_I3C_CONTROLLER_ADDR 0xa4080000
+#define FPGA_REGION_I3C_CONTROLLER_SIZE 0x00010000
+#define FPGA_REGION_MCU_SRAM_ADDR 0xb0080000
+#define FPGA_REGION_MCU_SRAM_SIZE 0x00080000
+#define FPGA_REGION_LC_ADDR 0xa4040000
+#define FPGA_REGION_LC_SIZE 0x00002000
+#define FPGA_REGION_MCU_ROM_ADDR 0xb0020000
+#define FPGA_REGION_MCU_ROM_SIZE 0x00020000
+#define FPGA_REGION_SS_I3C_ADDR 0xa4030000
+#define FPGA_REGION_SS_I3C_SIZE 0x00010000
+#define FPGA_REGION_MCI_ADDR 0xa8000000
+#define FPGA_REGION_MCI_SIZE 0x01000000
+#define FPGA_REGION_OTP_ADDR 0xa4060000
+#define FPGA_REGION_OTP_SIZE 0x00002000
+#define FPGA_REGION_MCU_ROM_AXI_ADDR 0xb0040000
+#define FPGA_REGION_MCU_ROM_AXI_SIZE 0x00020000
+
+// X(name, addr, size) for each map of caliptra-fpga-uio-dev0, in map order
+#define FPGA_UIO0_REGIONS(X) \
+    X("fpga_wrapper", FPGA_REGION_FPGA_WRAPPER_ADDR, FPGA_REGION_FPGA_WRAPPER_SIZE) \
+    X("caliptra", FPGA_REGION_CALIPTRA_ADDR, FPGA_REGION_CALIPTRA_SIZE) \
+    X("rom", FPGA_REGION_ROM_ADDR, FPGA_REGION_ROM_SIZE) \
+    X("i3c_controller", FPGA_REGION_I3C_CONTROLLER_ADDR, FPGA_REGION_I3C_CONTROLLER_SIZE) \
+    X("mcu_sram", FPGA_REGION_MCU_SRAM_ADDR, FPGA_REGION_MCU_SRAM_SIZE)
+
+// X(name, addr, size) for each map of caliptra-fpga-uio-dev1, in map order
+#define FPGA_UIO1_REGIONS(X) \
+    X("lc", FPGA_REGION_LC_ADDR, FPGA_REGION_LC_SIZE) \
+    X("mcu_rom", FPGA_REGION_MCU_ROM_ADDR, FPGA_REGION_MCU_ROM_SIZE) \
+    X("ss_i3c", FPGA_REGION_SS_I3C_ADDR, FPGA_REGION_SS_I3C_SIZE) \
+    X("mci", FPGA_REGION_MCI_ADDR, FPGA_REGION_MCI_SIZE) \
+    X("otp", FPGA_REGION_OTP_ADDR, FPGA_REGION_OTP_SIZE)
+
+#endif
@@ -1,8 +1,14 @@
 // Licensed under the Apache-2.0 license
 
 #include <linux/module.h>
+#include <linux/interrupt.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
 #include <linux/uio_driver.h>
 
+#include "fpga_region_lookup.h"
+#include "fpga_regions.h"
+
 const char caliptra_dev_name0[] = "caliptra-fpga-uio-dev0";
 const char caliptra_dev_name1[] = "caliptra-fpga-uio-dev1";
 static struct device uio_dev0;
@@ -10,6 +16,112 @@ static struct device uio_dev1;
 static struct uio_info uio_info0;
 static struct uio_info uio_info1;
 
+// Linux IRQ number of the FPGA wrapper interrupt line, as listed in /proc/interrupts.
+// 0 leaves uio device 0 without an interrupt and userspace has to poll the wrapper.
+static int wrapper_irq;
+module_param(wrapper_irq, int, 0444);
+MODULE_PARM_DESC(wrapper_irq, "Linux IRQ number of the FPGA wrapper interrupt (0 to poll)");
+
+// The wrapper interrupt is level triggered and can only be cleared by userspace through
+// the wrapper registers, so it is masked when it fires and userspace unmasks it again by
+// writing 1 to the uio fd once it has handled the event, as in uio_pdrv_genirq.
+static DEFINE_SPINLOCK(wrapper_irq_lock);
+static bool wrapper_irq_disabled;
+
+static irqreturn_t wrapper_irq_handler(int irq, struct uio_info *info)
+{
+    spin_lock(&wrapper_irq_lock);
+    if (!wrapper_irq_disabled)
+    {
+        wrapper_irq_disabled = true;
+        disable_irq_nosync(irq);
+    }
+    spin_unlock(&wrapper_irq_lock);
+    return IRQ_HANDLED;
+}
+
+static int wrapper_irq_control(struct uio_info *info, s32 irq_on)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&wrapper_irq_lock, flags);
+    if (irq_on && wrapper_irq_disabled)
+    {
+        wrapper_irq_disabled = false;
+        enable_irq(info->irq);
+    }
+    else if (!irq_on && !wrapper_irq_disabled)
+    {
+        wrapper_irq_disabled = true;
+        disable_irq_nosync(info->irq);
+    }
+    spin_unlock_irqrestore(&wrapper_irq_lock, flags);
+    return 0;
+}
+
+struct uio_region
+{
+    const char *name;
+    phys_addr_t addr;
+    resource_size_t size;
+};
+
+#define UIO_REGION(name, addr, size) {name, addr, size},
+static const struct uio_region uio0_regions[] = {FPGA_UIO0_REGIONS(UIO_REGION)};
+static const struct uio_region uio1_regions[] = {FPGA_UIO1_REGIONS(UIO_REGION)};
+
+// Overrides of the region map in fpga_regions.h for bitstreams with a different layout,
+// one entry per uio map with 0 keeping the default, e.g. uio1_addr=0,0xb0040000
+static ulong uio0_addr[MAX_UIO_MAPS];
+static ulong uio0_size[MAX_UIO_MAPS];
+static ulong uio1_addr[MAX_UIO_MAPS];
+static ulong uio1_size[MAX_UIO_MAPS];
+module_param_array(uio0_addr, ulong, NULL, 0444);
+MODULE_PARM_DESC(uio0_addr, "Physical addresses of the uio device 0 maps (0 for the default)");
+module_param_array(uio0_size, ulong, NULL, 0444);
+MODULE_PARM_DESC(uio0_size, "Sizes of the uio device 0 maps (0 for the default)");
+module_param_array(uio1_addr, ulong, NULL, 0444);
+MODULE_PARM_DESC(uio1_addr, "Physical addresses of the uio device 1 maps (0 for the default)");
+module_param_array(uio1_size, ulong, NULL, 0444);
+MODULE_PARM_DESC(uio1_size, "Sizes of the uio device 1 maps (0 for the default)");
+
+static void uio_setup_maps(struct uio_info *info, const struct uio_region *regions, size_t count,
+                           const ulong *addr, const ulong *size)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++)
+    {
+        info->mem[i].name = regions[i].name;
+        info->mem[i].addr = addr[i] ? addr[i] : regions[i].addr;
+        info->mem[i].size = size[i] ? size[i] : regions[i].size;
+        info->mem[i].memtype = UIO_MEM_PHYS;
+    }
+}
+
+// The uio maps are the only place the region overrides are applied, the ROM backdoors
+// and fpga_dma look their regions up here so that all the modules agree on the layout
+int caliptra_fpga_region(const char *name, phys_addr_t *addr, resource_size_t *size)
+{
+    const struct uio_info *infos[] = {&uio_info0, &uio_info1};
+    size_t i, j;
+
+    for (i = 0; i < ARRAY_SIZE(infos); i++)
+    {
+        for (j = 0; j < MAX_UIO_MAPS && infos[i]->mem[j].name; j++)
+        {
+            if (strcmp(infos[i]->mem[j].name, name) == 0)
+            {
+                *addr = infos[i]->mem[j].addr;
+                *size = infos[i]->mem[j].size;
+                return 0;
+            }
+        }
+    }
+    return -ENOENT;
+}
+EXPORT_SYMBOL(caliptra_fpga_region);
+
 static void uio_release(struct device *dev)
 {
     printk("releasing uio-device\n");
@@ -41,40 +153,25 @@ int init_module(void)
     uio_info0.name = caliptra_dev_name0;
     uio_info0.version = "1.0.0";
 
-    //  Caliptra FPGA wrapper
-    uio_info0.mem[0].name = "fpga_wrapper";
-    uio_info0.mem[0].addr = 0xA4010000;
-    uio_info0.mem[0].size = 0x00010000;
-    uio_info0.mem[0].memtype = UIO_MEM_PHYS;
-
-    // Caliptra MMIO interface
-    uio_info0.mem[1].name = "caliptra";
-    uio_info0.mem[1].addr = 0xA4100000;
-    uio_info0.mem[1].size = 0x00040000;
-    uio_info0.mem[1].memtype = UIO_MEM_PHYS;
-
-    // Caliptra ROM
-    uio_info0.mem[2].name = "rom";
-    uio_info0.mem[2].addr = 0xB0000000;
-    uio_info0.mem[2].size = 0x00018000;
-    uio_info0.mem[2].memtype = UIO_MEM_PHYS;
-
-    // I3C controller
-    uio_info0.mem[3].name = "i3c_controller";
-    uio_info0.mem[3].addr = 0xA4080000;
-    uio_info0.mem[3].size = 0x00010000;
-    uio_info0.mem[3].memtype = UIO_MEM_PHYS;
-
-    // MCU SRAM
-    uio_info0.mem[4].name = "mcu_sram";
-    uio_info0.mem[4].addr = 0xB0080000;
-    uio_info0.mem[4].size = 0x00080000;
-    uio_info0.mem[4].memtype = UIO_MEM_PHYS;
+    uio_setup_maps(&uio_info0, uio0_regions, ARRAY_SIZE(uio0_regions), uio0_addr, uio0_size);
 
+    // FPGA wrapper interrupt, blocking read() or poll() on the uio fd waits for it
+    if (wrapper_irq > 0)
+    {
+        uio_info0.irq = wrapper_irq;
+        uio_info0.handler = wrapper_irq_handler;
+        uio_info0.irqcontrol = wrapper_irq_control;
+    }
+    else
+    {
+        uio_info0.irq = UIO_IRQ_NONE;
+    }
 
     // Register device
     if (uio_register_device(&uio_dev0, &uio_info0) < 0)
     {
+        device_unregister(&uio_dev1);
+        device_unregister(&uio_dev0);
         printk("Failing to register uio device0 \n");
         return -EIO;
     }
@@ -84,40 +181,14 @@ int init_module(void)
     uio_info1.name = caliptra_dev_name1;
     uio_info1.version = "1.0.0";
 
-    // LC
-    uio_info1.mem[0].name = "lc";
-    uio_info1.mem[0].addr = 0xA4040000;
-    uio_info1.mem[0].size = 0x00002000;
-    uio_info1.mem[0].memtype = UIO_MEM_PHYS;
-
-    // MCU ROM Backdoor
-    uio_info1.mem[1].name = "mcu_rom";
-    uio_info1.mem[1].addr = 0xB0020000;
-    uio_info1.mem[1].size = 0x00020000;
-    uio_info1.mem[1].memtype = UIO_MEM_PHYS;
-
-    // I3C
-    uio_info1.mem[2].name = "ss_i3c";
-    uio_info1.mem[2].addr = 0xA4030000;
-    uio_info1.mem[2].size = 0x00010000;
-    uio_info1.mem[2].memtype = UIO_MEM_PHYS;
-
-    // MCI
-    uio_info1.mem[3].name = "mci";
-    uio_info1.mem[3].addr = 0xA8000000;
-    uio_info1.mem[3].size = 0x01000000;
-    uio_info1.mem[3].memtype = UIO_MEM_PHYS;
-
-    // OTP
-    uio_info1.mem[4].name = "otp";
-    uio_info1.mem[4].addr = 0xA4060000;
-    uio_info1.mem[4].size = 0x00002000;
-    uio_info1.mem[4].memtype = UIO_MEM_PHYS;
-
+    uio_setup_maps(&uio_info1, uio1_regions, ARRAY_SIZE(uio1_regions), uio1_addr, uio1_size);
 
     // Register device
     if (uio_register_device(&uio_dev1, &uio_info1) < 0)
     {
+        uio_unregister_device(&uio_info0);
+        device_unregister(&uio_dev1);
+        device_unregister(&uio_dev0);
         printk("Failing to register uio device1 \n");
         return -EIO;
     }
@@ -1,7 +1,5 @@
 // Licensed under the Apache-2.0 license
 
 #define DEVICE_NAME "mcu-rom-backdoor"
-#define ROM_BACKDOOR_MINOR_ID 1
-#define ROM_ADDRESS 0xB0040000
-#define ROM_SIZE 0xc000
+#define ROM_REGION "mcu_rom"
 #include "rom_backdoor.h"
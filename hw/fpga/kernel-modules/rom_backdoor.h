@@ -3,31 +3,51 @@
 #include <linux/module.h>
 #include <linux/slab.h>
 #include <linux/cdev.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/uaccess.h>
 #include <asm/io.h>
 
+#include "fpga_region_lookup.h"
+#include "rom_backdoor_ioctl.h"
+
 #ifndef DEVICE_NAME
 #define DEVICE_NAME "caliptra-rom-backdoor"
 #endif
 
-// Arbitrary number for device class
-#ifndef ROM_BACKDOOR_MAJOR_ID
-#define ROM_BACKDOOR_MAJOR_ID 47
+// Name of the ROM's map in io_module, which applies any overrides of its layout
+#ifndef ROM_REGION
+#define ROM_REGION "rom"
 #endif
 
-#ifndef ROM_BACKDOOR_MINOR_ID
-#define ROM_BACKDOOR_MINOR_ID 0
-#endif
+// Resolved through caliptra_fpga_region() when the module is loaded
+static phys_addr_t rom_address;
+static resource_size_t rom_size;
 
-#ifndef ROM_ADDRESS
-#define ROM_ADDRESS 0xB0000000
-#endif
-#ifndef ROM_SIZE
-#define ROM_SIZE 0x18000
-#endif
+// Writes and reads are copied through a bounce buffer of this size, in chunks that
+// never cross a page of the ROM
+#define ROM_BACKDOOR_CHUNK_SIZE PAGE_SIZE
 
 struct rom_backdoor_backend_data
 {
+    // Device number from alloc_chrdev_region()
+    dev_t dev;
     struct cdev rom_backdoor_dev;
+    // Mapping of the whole ROM, created once when the module is loaded
+    u8 __iomem *rom;
+    // Bounce buffer for read() and write(), serialized by lock
+    void *chunk;
+    // Current ROM contents of a chunk, for ROM_BACKDOOR_WRITE_CHANGED
+    void *current_chunk;
+    struct mutex lock;
+};
+
+// State of one open file descriptor
+struct rom_backdoor_file
+{
+    u32 write_mode;
+    u64 pages_written;
 };
 
 extern struct class *rom_backdoor_chardev_class;
@@ -35,108 +55,198 @@ static struct rom_backdoor_backend_data rom_backdoor_chardev_data = {0};
 
 static int rom_backdoor_dev_open(struct inode *inode, struct file *file)
 {
+    struct rom_backdoor_file *state = kzalloc(sizeof(*state), GFP_KERNEL);
+
+    if (!state)
+    {
+        return -ENOMEM;
+    }
+    file->private_data = state;
     return 0;
 }
 
 static int rom_backdoor_dev_release(struct inode *inode, struct file *file)
 {
+    kfree(file->private_data);
     return 0;
 }
 
-static ssize_t rom_backdoor_dev_write(struct file *file, const char __user *buf, size_t count, loff_t *offset)
+// Length of the next chunk at offset, so chunks line up with the pages of the ROM
+static size_t rom_backdoor_chunk_len(loff_t offset, size_t remaining)
 {
-    void *buffer = NULL;
-    u8 __iomem *rom = NULL;
+    return min_t(size_t, remaining, ROM_BACKDOOR_CHUNK_SIZE - offset % ROM_BACKDOOR_CHUNK_SIZE);
+}
+
+static loff_t rom_backdoor_dev_llseek(struct file *file, loff_t offset, int whence)
+{
+    return fixed_size_llseek(file, offset, whence, rom_size);
+}
 
-    printk(KERN_INFO "rom_backdoor: rom_backdoor_dev_write");
+static ssize_t rom_backdoor_dev_write(struct file *file, const char __user *buf, size_t count, loff_t *offset)
+{
+    struct rom_backdoor_file *state = file->private_data;
+    size_t done = 0;
 
-    if (*offset >= ROM_SIZE)
+    if (*offset >= rom_size)
     {
         return 0;
     }
 
-    if (*offset + count > ROM_SIZE)
+    if (*offset + count > rom_size)
     {
-        count = ROM_SIZE - *offset;
+        count = rom_size - *offset;
     }
 
-    printk(KERN_INFO "rom_backdoor:\t count %lu\n", count);
-    printk(KERN_INFO "rom_backdoor:\t offset %llu\n", *offset);
-
-    rom = ioremap(ROM_ADDRESS, ROM_SIZE);
-    if (rom == NULL)
+    mutex_lock(&rom_backdoor_chardev_data.lock);
+    while (done < count)
     {
-        printk("rom_backdoor: Failed ioremap\n");
-        return -1;
+        u8 __iomem *dest = rom_backdoor_chardev_data.rom + *offset + done;
+        size_t len = rom_backdoor_chunk_len(*offset + done, count - done);
+
+        if (copy_from_user(rom_backdoor_chardev_data.chunk, buf + done, len))
+        {
+            break;
+        }
+
+        // reading the ROM back is cheaper than writing it, so skip pages that are already loaded
+        if (state->write_mode == ROM_BACKDOOR_WRITE_CHANGED)
+        {
+            memcpy_fromio(rom_backdoor_chardev_data.current_chunk, dest, len);
+            if (memcmp(rom_backdoor_chardev_data.current_chunk, rom_backdoor_chardev_data.chunk, len) == 0)
+            {
+                done += len;
+                continue;
+            }
+        }
+
+        memcpy_toio(dest, rom_backdoor_chardev_data.chunk, len);
+        state->pages_written++;
+        done += len;
     }
+    mutex_unlock(&rom_backdoor_chardev_data.lock);
 
-    buffer = kmalloc(count, GFP_KERNEL);
-    if (!buffer)
+    if (done == 0 && count != 0)
     {
-        printk("rom_backdoor: Failed kmalloc allocation\n");
-        return -1;
+        return -EFAULT;
     }
+    *offset += done;
+    return done;
+}
 
-    if (copy_from_user(buffer, buf, count))
+static ssize_t rom_backdoor_dev_read(struct file *file, char __user *buf, size_t count, loff_t *offset)
+{
+    size_t done = 0;
+
+    if (*offset >= rom_size)
     {
-        printk(KERN_INFO "caliptra_rom: Failed copy_from_user\n");
-        kfree(buffer);
         return 0;
     }
 
-    memcpy_toio(rom + *offset, buffer, count);
-    *offset += count;
-    kfree(buffer);
+    if (*offset + count > rom_size)
+    {
+        count = rom_size - *offset;
+    }
+
+    mutex_lock(&rom_backdoor_chardev_data.lock);
+    while (done < count)
+    {
+        size_t len = rom_backdoor_chunk_len(*offset + done, count - done);
+
+        memcpy_fromio(rom_backdoor_chardev_data.chunk, rom_backdoor_chardev_data.rom + *offset + done, len);
+        if (copy_to_user(buf + done, rom_backdoor_chardev_data.chunk, len))
+        {
+            break;
+        }
+        done += len;
+    }
+    mutex_unlock(&rom_backdoor_chardev_data.lock);
 
-    return count;
+    if (done == 0 && count != 0)
+    {
+        return -EFAULT;
+    }
+    *offset += done;
+    return done;
 }
 
-static ssize_t rom_backdoor_dev_read(struct file *file, char __user *buf, size_t count, loff_t *offset)
+static long rom_backdoor_dev_hash(struct rom_backdoor_hash __user *arg)
 {
-    void *buffer = NULL;
-    u8 __iomem *rom = NULL;
-
-    printk(KERN_INFO "rom_backdoor: rom_backdoor_dev_read");
+    struct rom_backdoor_hash req;
+    u64 hash = ROM_BACKDOOR_HASH_OFFSET_BASIS;
+    size_t done = 0;
 
-    if (*offset >= ROM_SIZE)
+    if (copy_from_user(&req, arg, sizeof(req)))
     {
-        return 0;
+        return -EFAULT;
     }
-
-    if (*offset + count > ROM_SIZE)
+    if (req.size == 0)
     {
-        count = ROM_SIZE - *offset;
+        req.size = rom_size;
+    }
+    if (req.size > rom_size)
+    {
+        return -EINVAL;
     }
 
-    printk(KERN_INFO "rom_backdoor:\t count %lu\n", count);
-    printk(KERN_INFO "rom_backdoor:\t offset %llu\n", *offset);
-
-    rom = ioremap(ROM_ADDRESS, ROM_SIZE);
-    if (rom == NULL)
+    mutex_lock(&rom_backdoor_chardev_data.lock);
+    while (done < req.size)
     {
-        printk("rom_backdoor: Failed ioremap\n");
-        return -1;
+        const u8 *bytes = rom_backdoor_chardev_data.chunk;
+        size_t len = rom_backdoor_chunk_len(done, req.size - done);
+        size_t i;
+
+        memcpy_fromio(rom_backdoor_chardev_data.chunk, rom_backdoor_chardev_data.rom + done, len);
+        for (i = 0; i < len; i++)
+        {
+            hash = (hash ^ bytes[i]) * ROM_BACKDOOR_HASH_PRIME;
+        }
+        done += len;
     }
+    mutex_unlock(&rom_backdoor_chardev_data.lock);
 
-    buffer = kmalloc(count, GFP_KERNEL);
-    if (!buffer)
+    req.hash = hash;
+    if (copy_to_user(arg, &req, sizeof(req)))
     {
-        printk("rom_backdoor: Failed kmalloc allocation\n");
-        return -1;
+        return -EFAULT;
     }
+    return 0;
+}
+
+static long rom_backdoor_dev_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+    struct rom_backdoor_file *state = file->private_data;
 
-    memcpy_fromio(buffer, rom + *offset, count);
-    if (copy_to_user(buf, buffer, count))
+    switch (cmd)
+    {
+    case ROM_BACKDOOR_IOC_HASH:
+        return rom_backdoor_dev_hash((struct rom_backdoor_hash __user *)arg);
+    case ROM_BACKDOOR_IOC_SET_WRITE_MODE:
     {
-        printk(KERN_INFO "rom_backdoor: Failed copy_user\n");
-        kfree(buffer);
+        u32 mode;
+
+        if (get_user(mode, (u32 __user *)arg))
+        {
+            return -EFAULT;
+        }
+        if (mode != ROM_BACKDOOR_WRITE_ALL && mode != ROM_BACKDOOR_WRITE_CHANGED)
+        {
+            return -EINVAL;
+        }
+        state->write_mode = mode;
         return 0;
     }
+    case ROM_BACKDOOR_IOC_PAGES_WRITTEN:
+        return put_user(state->pages_written, (u64 __user *)arg);
+    default:
+        return -ENOTTY;
+    }
+}
 
-    *offset += count;
-    kfree(buffer);
-
-    return count;
+// Map the ROM straight into userspace, so an image can be written with a single memcpy
+static int rom_backdoor_dev_mmap(struct file *file, struct vm_area_struct *vma)
+{
+    vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+    return vm_iomap_memory(vma, rom_address, rom_size);
 }
 
 static int caliptra_fsync(struct file *, loff_t, loff_t, int datasync)
@@ -146,9 +256,14 @@ static int caliptra_fsync(struct file *, loff_t, loff_t, int datasync)
 
 static struct file_operations rom_backdoor_fops =
     {
+        .owner = THIS_MODULE,
         .open = rom_backdoor_dev_open,
+        .llseek = rom_backdoor_dev_llseek,
         .read = rom_backdoor_dev_read,
         .write = rom_backdoor_dev_write,
+        .unlocked_ioctl = rom_backdoor_dev_ioctl,
+        .compat_ioctl = compat_ptr_ioctl,
+        .mmap = rom_backdoor_dev_mmap,
         .release = rom_backdoor_dev_release,
         .fsync = caliptra_fsync,
 };
@@ -156,48 +271,86 @@ static struct file_operations rom_backdoor_fops =
 static int __init register_rom_backdoor_device(void)
 {
     int rc;
-    dev_t dev;
     struct device *dev_ret = NULL;
 
+    mutex_init(&rom_backdoor_chardev_data.lock);
+
+    rc = caliptra_fpga_region(ROM_REGION, &rom_address, &rom_size);
+    if (rc)
+    {
+        printk(KERN_ALERT "register_rom_backdoor_device: no FPGA region %s: %d\n", ROM_REGION, rc);
+        return rc;
+    }
+
+    rom_backdoor_chardev_data.rom = ioremap(rom_address, rom_size);
+    if (rom_backdoor_chardev_data.rom == NULL)
+    {
+        printk(KERN_ALERT "register_rom_backdoor_device: failed to ioremap ROM at %pa\n", &rom_address);
+        return -ENOMEM;
+    }
+
+    rom_backdoor_chardev_data.chunk = kmalloc(ROM_BACKDOOR_CHUNK_SIZE, GFP_KERNEL);
+    rom_backdoor_chardev_data.current_chunk = kmalloc(ROM_BACKDOOR_CHUNK_SIZE, GFP_KERNEL);
+    if (!rom_backdoor_chardev_data.chunk || !rom_backdoor_chardev_data.current_chunk)
+    {
+        rc = -ENOMEM;
+        goto err_free;
+    }
+
     // register char Device
-    rc = alloc_chrdev_region(&dev, 0, 1, DEVICE_NAME);
+    rc = alloc_chrdev_region(&rom_backdoor_chardev_data.dev, 0, 1, DEVICE_NAME);
     if (rc != 0)
     {
-        printk(KERN_ALERT "register_rom_backdoor_device: error %d in register_chrdev_region\n", rc);
-        return rc;
+        printk(KERN_ALERT "register_rom_backdoor_device: error %d in alloc_chrdev_region\n", rc);
+        goto err_free;
     }
 
     // initialize char device
     cdev_init(&rom_backdoor_chardev_data.rom_backdoor_dev, &rom_backdoor_fops);
 
     // add char device
-    rc = cdev_add(&rom_backdoor_chardev_data.rom_backdoor_dev, MKDEV(ROM_BACKDOOR_MAJOR_ID, ROM_BACKDOOR_MINOR_ID), 1);
+    rc = cdev_add(&rom_backdoor_chardev_data.rom_backdoor_dev, rom_backdoor_chardev_data.dev, 1);
     if (rc < 0)
     {
         printk(KERN_ALERT "register_rom_backdoor_device: error %d in cdev_add\n", rc);
-        return rc;
+        goto err_unregister;
     }
 
     // create device
-    dev_ret = device_create(rom_backdoor_chardev_class, NULL, MKDEV(ROM_BACKDOOR_MAJOR_ID, ROM_BACKDOOR_MINOR_ID), NULL, DEVICE_NAME);
+    dev_ret = device_create(rom_backdoor_chardev_class, NULL, rom_backdoor_chardev_data.dev, NULL, DEVICE_NAME);
     if (IS_ERR(dev_ret))
     {
-        printk(KERN_ALERT "register_rom_backdoor_device: error %lu in cdev_add\n", PTR_ERR(dev_ret));
-        return PTR_ERR(dev_ret);
+        printk(KERN_ALERT "register_rom_backdoor_device: error %ld in device_create\n", PTR_ERR(dev_ret));
+        rc = PTR_ERR(dev_ret);
+        goto err_cdev;
     }
 
     return 0;
+
+err_cdev:
+    cdev_del(&rom_backdoor_chardev_data.rom_backdoor_dev);
+err_unregister:
+    unregister_chrdev_region(rom_backdoor_chardev_data.dev, 1);
+err_free:
+    kfree(rom_backdoor_chardev_data.current_chunk);
+    kfree(rom_backdoor_chardev_data.chunk);
+    iounmap(rom_backdoor_chardev_data.rom);
+    return rc;
 }
 
 static void __exit rom_backdoor_backend_remove(void)
 {
-    device_destroy(rom_backdoor_chardev_class, MKDEV(ROM_BACKDOOR_MAJOR_ID, ROM_BACKDOOR_MINOR_ID));
+    device_destroy(rom_backdoor_chardev_class, rom_backdoor_chardev_data.dev);
 
     // delete char device
     cdev_del(&rom_backdoor_chardev_data.rom_backdoor_dev);
 
     // unregister char device region
-    unregister_chrdev_region(MKDEV(ROM_BACKDOOR_MAJOR_ID, ROM_BACKDOOR_MINOR_ID), 1);
+    unregister_chrdev_region(rom_backdoor_chardev_data.dev, 1);
+
+    kfree(rom_backdoor_chardev_data.current_chunk);
+    kfree(rom_backdoor_chardev_data.chunk);
+    iounmap(rom_backdoor_chardev_data.rom);
 }
 
 module_init(register_rom_backdoor_device);
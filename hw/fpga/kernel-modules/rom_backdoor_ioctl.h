@@ -0,0 +1,39 @@
+// Licensed under the Apache-2.0 license
+
+// ioctls of the ROM backdoor devices, shared with userspace
+
+#ifndef ROM_BACKDOOR_IOCTL_H
+#define ROM_BACKDOOR_IOCTL_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define ROM_BACKDOOR_IOC_MAGIC 'R'
+
+// FNV-1a, 64 bit, so userspace can hash an image without any library
+#define ROM_BACKDOOR_HASH_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define ROM_BACKDOOR_HASH_PRIME 0x100000001b3ULL
+
+struct rom_backdoor_hash
+{
+    // in: number of bytes to hash from the start of the ROM, 0 for the whole ROM
+    __u64 size;
+    // out: FNV-1a hash of the first size bytes
+    __u64 hash;
+};
+
+// Hash the current ROM contents, to check what is loaded without reading it back
+#define ROM_BACKDOOR_IOC_HASH _IOWR(ROM_BACKDOOR_IOC_MAGIC, 0, struct rom_backdoor_hash)
+
+// write() stores every byte
+#define ROM_BACKDOOR_WRITE_ALL 0
+// write() compares each page with the ROM and only stores the pages that differ
+#define ROM_BACKDOOR_WRITE_CHANGED 1
+
+// Select how write() on this file descriptor stores data, one of ROM_BACKDOOR_WRITE_*
+#define ROM_BACKDOOR_IOC_SET_WRITE_MODE _IOW(ROM_BACKDOOR_IOC_MAGIC, 1, __u32)
+
+// Number of pages stored by write() on this file descriptor since it was opened
+#define ROM_BACKDOOR_IOC_PAGES_WRITTEN _IOR(ROM_BACKDOOR_IOC_MAGIC, 2, __u64)
+
+#endif
@@ -34,12 +34,16 @@ mod fpga_regs;
 pub mod jtag;
 #[cfg(feature = "fpga_realtime")]
 pub mod lcc;
+#[cfg(feature = "fpga_realtime")]
+pub mod lockstep;
 mod mcu_mgr;
 mod model_emulated;
 #[cfg(feature = "fpga_realtime")]
 mod model_fpga_realtime;
 mod otp_provision;
 mod vmem;
+#[cfg(feature = "fpga_realtime")]
+mod wrapper_irq;
 
 pub enum ShaAccMode {
     Sha384Stream,
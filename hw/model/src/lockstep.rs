@@ -0,0 +1,207 @@
+// Licensed under the Apache-2.0 license
+
+//! Replay of an emulator lockstep log against the peripherals of the FPGA.
+//!
+//! The emulator records the MCU peripheral accesses with `--lockstep-log`; running it
+//! with the `fpga` memory map gives the accesses the addresses of the FPGA. Replaying
+//! them here through the uio maps of the FPGA and comparing the values read back finds
+//! the first register where the emulated peripherals and the hardware disagree.
+//!
+//! The replay issues the accesses back to back, so registers that change on their own,
+//! like timers, can't read back what the firmware saw. Reads of those volatile registers
+//! are replayed for their side effects but their values are not compared.
+
+use anyhow::{anyhow, bail, Context, Result};
+use mcu_config_fpga::regions::{FpgaRegion, FPGA_UIO0_REGIONS, FPGA_UIO1_REGIONS, MCI};
+use mcu_testing_common::lockstep::{first_divergence, Divergence, LockstepReader, LockstepRecord};
+use std::fs::{self, File, OpenOptions};
+use std::io::BufReader;
+use std::os::fd::AsRawFd;
+use std::path::{Path, PathBuf};
+use std::ptr::NonNull;
+
+const UIO_DEVICES: [(&str, &[FpgaRegion]); 2] = [
+    ("caliptra-fpga-uio-dev0", FPGA_UIO0_REGIONS),
+    ("caliptra-fpga-uio-dev1", FPGA_UIO1_REGIONS),
+];
+
+/// Registers whose value changes with time, by FPGA address.
+pub const VOLATILE_REGISTERS: [u32; 3] = [
+    MCI.addr + 0xd0, // WDT_STATUS
+    MCI.addr + 0xe4, // MCU_RV_MTIME_L
+    MCI.addr + 0xe8, // MCU_RV_MTIME_H
+];
+
+struct Mapping {
+    region: FpgaRegion,
+    ptr: NonNull<u8>,
+}
+
+/// The uio maps of the FPGA regions, mapped into this process.
+pub struct FpgaRegionMaps {
+    mappings: Vec<Mapping>,
+}
+
+/// Find the `/dev/uioN` device registered by `io_module` as `name`.
+pub(crate) fn find_uio_device(name: &str) -> Result<PathBuf> {
+    for entry in fs::read_dir("/sys/class/uio").context("no uio devices, is io_module loaded?")? {
+        let entry = entry?;
+        if fs::read_to_string(entry.path().join("name"))?.trim_end() == name {
+            return Ok(Path::new("/dev").join(entry.file_name()));
+        }
+    }
+    bail!("uio device {name} not found, is io_module loaded?")
+}
+
+impl FpgaRegionMaps {
+    pub fn open() -> Result<Self> {
+        // SAFETY: sysconf has no preconditions
+        let page_size = unsafe { libc::sysconf(libc::_SC_PAGESIZE) } as usize;
+        let mut maps = Self { mappings: vec![] };
+        for (name, regions) in UIO_DEVICES {
+            let path = find_uio_device(name)?;
+            let file = OpenOptions::new()
+                .read(true)
+                .write(true)
+                .open(&path)
+                .with_context(|| format!("failed to open {}", path.display()))?;
+            for (index, region) in regions.iter().enumerate() {
+                // uio selects map N with an offset of N pages
+                // SAFETY: a fresh shared mapping of device memory does not alias any Rust
+                // object; the mapping stays valid after the file is closed.
+                let ptr = unsafe {
+                    libc::mmap(
+                        std::ptr::null_mut(),
+                        region.size as usize,
+                        libc::PROT_READ | libc::PROT_WRITE,
+                        libc::MAP_SHARED,
+                        file.as_raw_fd(),
+                        (index * page_size) as libc::off_t,
+                    )
+                };
+                if ptr == libc::MAP_FAILED {
+                    return Err(std::io::Error::last_os_error())
+                        .with_context(|| format!("failed to map {} of {name}", region.name));
+                }
+                maps.mappings.push(Mapping {
+                    region: *region,
+                    ptr: NonNull::new(ptr as *mut u8).unwrap(),
+                });
+            }
+        }
+        Ok(maps)
+    }
+
+    /// Pointer to the naturally aligned `size` byte register at `addr`, if it is in a
+    /// mapped region.
+    fn register(&self, addr: u32, size: u8) -> Option<*mut u8> {
+        if !matches!(size, 1 | 2 | 4) || addr % u32::from(size) != 0 {
+            return None;
+        }
+        self.mappings.iter().find_map(|m| {
+            let offset = addr.checked_sub(m.region.addr)?;
+            (offset + u32::from(size) <= m.region.size)
+                // SAFETY: the offset is inside the mapping
+                .then(|| unsafe { m.ptr.as_ptr().add(offset as usize) })
+        })
+    }
+
+    /// Returns true if the access of `record` can be replayed on the FPGA.
+    pub fn contains(&self, record: &LockstepRecord) -> bool {
+        match *record {
+            LockstepRecord::Read { addr, size, .. } | LockstepRecord::Write { addr, size, .. } => {
+                self.register(addr, size).is_some()
+            }
+            LockstepRecord::Checkpoint { .. } => false,
+        }
+    }
+
+    /// Perform the access of `record` on the FPGA and return what happened there.
+    pub fn replay(&self, record: &LockstepRecord) -> Result<LockstepRecord> {
+        let (addr, size) = match *record {
+            LockstepRecord::Read { addr, size, .. } | LockstepRecord::Write { addr, size, .. } => {
+                (addr, size)
+            }
+            LockstepRecord::Checkpoint { .. } => bail!("checkpoints cannot be replayed"),
+        };
+        let ptr = self
+            .register(addr, size)
+            .ok_or_else(|| anyhow!("{addr:#010x} is not mapped"))?;
+        // SAFETY: `register` checked that the access is aligned and inside a mapping
+        unsafe {
+            match *record {
+                LockstepRecord::Write { val, .. } => {
+                    match size {
+                        1 => (ptr as *mut u8).write_volatile(val as u8),
+                        2 => (ptr as *mut u16).write_volatile(val as u16),
+                        _ => (ptr as *mut u32).write_volatile(val),
+                    }
+                    Ok(*record)
+                }
+                LockstepRecord::Read { cycle, .. } => {
+                    let val = match size {
+                        1 => u32::from((ptr as *const u8).read_volatile()),
+                        2 => u32::from((ptr as *const u16).read_volatile()),
+                        _ => (ptr as *const u32).read_volatile(),
+                    };
+                    Ok(LockstepRecord::Read {
+                        cycle,
+                        size,
+                        addr,
+                        val: Some(val),
+                    })
+                }
+                LockstepRecord::Checkpoint { .. } => unreachable!(),
+            }
+        }
+    }
+}
+
+impl Drop for FpgaRegionMaps {
+    fn drop(&mut self) {
+        for m in &self.mappings {
+            // SAFETY: the mapping was created by `open` and no pointer into it outlives `self`
+            unsafe {
+                libc::munmap(m.ptr.as_ptr() as *mut libc::c_void, m.region.size as usize);
+            }
+        }
+    }
+}
+
+/// Replay the accesses of the emulator lockstep log at `log` on the FPGA, in order, and
+/// return the first read whose value differs from the emulator's.
+///
+/// Reads of [`VOLATILE_REGISTERS`] and of the registers at the word addresses in
+/// `volatile` are not compared. Accesses to addresses the FPGA does not map, e.g. the MCU
+/// interrupt controller, are skipped. The subsystem must be out of reset with no MCU
+/// firmware running, so the replayed accesses are the only ones the peripherals see.
+pub fn replay_on_fpga(log: &Path, volatile: &[u32]) -> Result<Option<Divergence>> {
+    let reader = LockstepReader::new(BufReader::new(File::open(log)?))?;
+    let maps = FpgaRegionMaps::open()?;
+    let is_volatile = |addr: u32| {
+        let word = addr & !3;
+        VOLATILE_REGISTERS.contains(&word) || volatile.contains(&word)
+    };
+    let mut expected = vec![];
+    let mut actual = vec![];
+    for record in reader {
+        let record = record?;
+        if maps.contains(&record) {
+            let mut replayed = maps.replay(&record)?;
+            if let LockstepRecord::Read { addr, .. } = record {
+                if is_volatile(addr) {
+                    replayed = record;
+                }
+            }
+            let diverged = !replayed.same_event(&record);
+            expected.push(record);
+            actual.push(replayed);
+            if diverged {
+                break;
+            }
+        } else if let LockstepRecord::Checkpoint { .. } = record {
+            expected.push(record);
+        }
+    }
+    Ok(first_divergence(expected, actual))
+}
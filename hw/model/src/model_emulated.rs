@@ -331,6 +331,7 @@ impl McuHwModel for ModelEmulated {
 
         let mcu_mailbox0 = mcu_root_bus.mcu_mailbox0.clone();
         let mcu_mailbox1 = mcu_root_bus.mcu_mailbox1.clone();
+        let fast_regions = mcu_root_bus.fast_regions();
 
         let mci_irq = pic.register_irq(McuRootBus::MCI_IRQ);
         let mci = Mci::new(
@@ -344,7 +345,7 @@ impl McuHwModel for ModelEmulated {
         let delegates: Vec<Box<dyn caliptra_emu_bus::Bus>> =
             vec![Box::new(mcu_root_bus), Box::new(soc_to_caliptra)];
 
-        let auto_root_bus = AutoRootBus::new(
+        let mut auto_root_bus = AutoRootBus::new(
             delegates,
             None,
             Some(Box::new(i3c)),
@@ -360,6 +361,7 @@ impl McuHwModel for ModelEmulated {
             None,
             Some(Box::new(dma_ctrl)),
         );
+        auto_root_bus.set_fast_regions(fast_regions);
 
         let args = CpuArgs {
             org: CpuOrgArgs {
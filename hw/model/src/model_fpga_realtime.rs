@@ -2,6 +2,7 @@
 
 #![allow(clippy::mut_from_ref)]
 
+use crate::wrapper_irq::WrapperIrq;
 use crate::{InitParams, McuHwModel, McuManager};
 use anyhow::{bail, Result};
 use caliptra_api::SocManager;
@@ -32,6 +33,13 @@ use tock_registers::interfaces::{Readable, Writeable};
 
 const DEFAULT_AXI_PAUSER: u32 = 0x1;
 
+/// Longest a step waits for the wrapper interrupt when there is nothing to do, which
+/// bounds how late anything that does not raise it is noticed
+const WRAPPER_IRQ_TIMEOUT: Duration = Duration::from_millis(1);
+
+/// How often the I3C forwarding thread checks whether the model is shutting down
+const I3C_FORWARD_POLL_INTERVAL: Duration = Duration::from_millis(10);
+
 struct CaliptraMmio {
     ptr: *mut u32,
 }
@@ -57,6 +65,8 @@ pub struct ModelFpgaRealtime {
     i3c_handle: Option<JoinHandle<()>>,
     i3c_tx: Option<mpsc::Sender<I3cBusResponse>>,
     i3c_next_private_read_len: Option<u16>,
+    /// The FPGA wrapper interrupt, if io_module was loaded with one
+    wrapper_irq: Option<WrapperIrq>,
 }
 
 impl ModelFpgaRealtime {
@@ -144,42 +154,47 @@ impl ModelFpgaRealtime {
         i3c_rx: mpsc::Receiver<I3cBusCommand>,
         controller: XI3CWrapper,
     ) {
-        // check if we need to write any I3C packets to Caliptra
+        // block on the channel for the next packet to write to Caliptra instead of spinning
         while running.load(Ordering::Relaxed) {
-            for rx in i3c_rx.try_iter() {
-                match rx.cmd.cmd {
-                    I3cTcriCommand::Regular(_cmd) => {
-                        if rx.cmd.data.len() > 0 {
-                            // wait for space in the write FIFOs
-                            while controller.cmd_fifo_level() == 0
-                                || controller.write_fifo_level() < 16
-                            {
-                                std::thread::sleep(Duration::from_millis(1));
-                            }
-                            match controller.write(&rx.cmd.data) {
-                                Ok(_) => {}
-                                Err(e) => {
-                                    println!("[hw-model-fpga] Error writing I3C data: {:?}", e)
-                                }
+            let rx = match i3c_rx.recv_timeout(I3C_FORWARD_POLL_INTERVAL) {
+                Ok(rx) => rx,
+                Err(mpsc::RecvTimeoutError::Timeout) => continue,
+                Err(mpsc::RecvTimeoutError::Disconnected) => break,
+            };
+            match rx.cmd.cmd {
+                I3cTcriCommand::Regular(_cmd) => {
+                    if rx.cmd.data.len() > 0 {
+                        // wait for space in the write FIFOs
+                        while controller.cmd_fifo_level() == 0 || controller.write_fifo_level() < 16
+                        {
+                            std::thread::sleep(Duration::from_millis(1));
+                        }
+                        match controller.write(&rx.cmd.data) {
+                            Ok(_) => {}
+                            Err(e) => {
+                                println!("[hw-model-fpga] Error writing I3C data: {:?}", e)
                             }
-                            // add a delay after writing to not overwhelm the firmware buffers
-                            std::thread::sleep(Duration::from_millis(5));
                         }
+                        // add a delay after writing to not overwhelm the firmware buffers
+                        std::thread::sleep(Duration::from_millis(5));
                     }
-                    // these aren't used
-                    _ => todo!(),
                 }
+                // these aren't used
+                _ => todo!(),
             }
         }
     }
 
-    fn handle_i3c(&mut self) {
+    /// Forward IBIs and private reads from Caliptra, and return true if there was any.
+    fn handle_i3c(&mut self) -> bool {
         const MCTP_MDB: u8 = 0xae;
         let Some(tx) = self.i3c_tx.as_ref() else {
-            return;
+            return false;
         };
+        let mut busy = false;
         // check if we need to read any I3C packets from Caliptra
         if self.base.i3c_controller().ibi_ready() {
+            busy = true;
             match self.base.i3c_controller().ibi_recv(None) {
                 Ok(ibi) => {
                     // process each IBI in the buffer (each is 4 bytes)
@@ -209,6 +224,7 @@ impl ModelFpgaRealtime {
         }
         // check if we should do attempt a private read
         if let Some(private_read_len) = self.i3c_next_private_read_len.take() {
+            busy = true;
             match self.base.i3c_controller().read(private_read_len) {
                 Ok(data) => {
                     let data = data[0..private_read_len as usize].to_vec();
@@ -229,13 +245,21 @@ impl ModelFpgaRealtime {
                 }
             }
         }
+        busy
     }
 }
 
 impl McuHwModel for ModelFpgaRealtime {
     fn step(&mut self) {
+        let output_len = self.base.output().peek().len();
         self.base.step();
-        self.handle_i3c();
+        let i3c_busy = self.handle_i3c();
+        // sleep on the wrapper interrupt instead of spinning while nothing happens
+        if !i3c_busy && self.base.output().peek().len() == output_len {
+            if let Some(wrapper_irq) = self.wrapper_irq.as_mut() {
+                wrapper_irq.wait(WRAPPER_IRQ_TIMEOUT);
+            }
+        }
         update_ticks(self.cycle_count() / 100); // notify tests about current time, but reduce effective speed
     }
 
@@ -340,6 +364,7 @@ impl McuHwModel for ModelFpgaRealtime {
             i3c_handle,
             i3c_tx,
             i3c_next_private_read_len: None,
+            wrapper_irq: WrapperIrq::open(),
         };
 
         Ok(m)
@@ -0,0 +1,66 @@
+// Licensed under the Apache-2.0 license
+
+//! The FPGA wrapper interrupt, delivered through the uio fd of `caliptra-fpga-uio-dev0`.
+//!
+//! `io_module` only gives the uio device an interrupt when it is loaded with
+//! `wrapper_irq=<n>`. The line is level triggered, so its handler masks it when it fires,
+//! and writing 1 to the fd unmasks it again once userspace has handled the event.
+
+use crate::lockstep::find_uio_device;
+use std::fs::{File, OpenOptions};
+use std::io::{Read, Write};
+use std::os::fd::AsRawFd;
+use std::time::Duration;
+
+pub(crate) struct WrapperIrq {
+    file: File,
+    /// Set once the interrupt has fired and left the line masked
+    masked: bool,
+}
+
+impl WrapperIrq {
+    /// Open the wrapper interrupt, or return None if `io_module` was loaded without one.
+    pub(crate) fn open() -> Option<Self> {
+        let path = find_uio_device("caliptra-fpga-uio-dev0").ok()?;
+        let file = OpenOptions::new().read(true).write(true).open(path).ok()?;
+        let mut irq = Self { file, masked: true };
+        // uio refuses the write when the device has no interrupt
+        irq.unmask().ok()?;
+        Some(irq)
+    }
+
+    fn unmask(&mut self) -> std::io::Result<()> {
+        if self.masked {
+            self.file.write_all(&1u32.to_ne_bytes())?;
+            self.masked = false;
+        }
+        Ok(())
+    }
+
+    /// Block until the interrupt fires or `timeout` passes, and return true if it fired.
+    ///
+    /// The line is unmasked again first, so call this only after the events that made it
+    /// fire last time have been handled.
+    pub(crate) fn wait(&mut self, timeout: Duration) -> bool {
+        if self.unmask().is_err() {
+            return false;
+        }
+        let mut fd = libc::pollfd {
+            fd: self.file.as_raw_fd(),
+            events: libc::POLLIN,
+            revents: 0,
+        };
+        let timeout_ms = timeout.as_millis().min(i32::MAX as u128) as i32;
+        // SAFETY: fd is a valid pollfd for the duration of the call
+        if unsafe { libc::poll(&mut fd, 1, timeout_ms) } <= 0 {
+            return false;
+        }
+        // the read returns the number of interrupts so far and does not block after poll
+        let mut count = [0u8; 4];
+        if self.file.read_exact(&mut count).is_err() {
+            return false;
+        }
+        self.masked = true;
+        true
+    }
+}
@@ -2,11 +2,13 @@
 
 #![cfg_attr(target_arch = "riscv32", no_std)]
 
+pub mod regions;
+
 use mcu_config::{McuMemoryMap, McuStraps, MemoryRegionType};
 
 pub const FPGA_MEMORY_MAP: McuMemoryMap = McuMemoryMap {
-    rom_offset: 0xb004_0000,
-    rom_size: 128 * 1024,
+    rom_offset: regions::MCU_ROM_AXI.addr,
+    rom_size: regions::MCU_ROM_AXI.size,
     rom_stack_size: 0x3000,
     rom_properties: MemoryRegionType::MEMORY,
 
@@ -21,11 +23,11 @@ pub const FPGA_MEMORY_MAP: McuMemoryMap = McuMemoryMap {
     pic_offset: 0x6000_0000,
     pic_properties: MemoryRegionType::MMIO,
 
-    i3c_offset: 0xa403_0000,
+    i3c_offset: regions::SS_I3C.addr,
     i3c_size: 0x1000,
     i3c_properties: MemoryRegionType::MMIO,
 
-    mci_offset: 0xa800_0000,
+    mci_offset: regions::MCI.addr,
     mci_size: 0xa0_0028,
     mci_properties: MemoryRegionType::MMIO,
 
@@ -37,11 +39,11 @@ pub const FPGA_MEMORY_MAP: McuMemoryMap = McuMemoryMap {
     soc_size: 0x5e0,
     soc_properties: MemoryRegionType::MMIO,
 
-    otp_offset: 0xa406_0000,
+    otp_offset: regions::OTP.addr,
     otp_size: 0x140,
     otp_properties: MemoryRegionType::MMIO,
 
-    lc_offset: 0xa404_0000,
+    lc_offset: regions::LC.addr,
     lc_size: 0x8c,
     lc_properties: MemoryRegionType::MMIO,
 };
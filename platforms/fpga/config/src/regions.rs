@@ -0,0 +1,101 @@
+// Licensed under the Apache-2.0 license
+
+//! Physical regions of the FPGA, as seen by the SoC processor.
+//!
+//! This is the one description of the FPGA layout: `FPGA_MEMORY_MAP` takes the
+//! peripheral offsets from here, and `cargo xtask fpga-regions-autogen` generates
+//! `hw/fpga/kernel-modules/fpga_regions.h` from it for the kernel modules.
+
+/// A physical memory region of the FPGA.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct FpgaRegion {
+    /// Name of the region, also the name of its uio map
+    pub name: &'static str,
+    pub addr: u32,
+    pub size: u32,
+}
+
+impl FpgaRegion {
+    const fn new(name: &'static str, addr: u32, size: u32) -> Self {
+        Self { name, addr, size }
+    }
+}
+
+/// Caliptra FPGA wrapper
+pub const FPGA_WRAPPER: FpgaRegion = FpgaRegion::new("fpga_wrapper", 0xa401_0000, 0x1_0000);
+/// Caliptra MMIO interface
+pub const CALIPTRA: FpgaRegion = FpgaRegion::new("caliptra", 0xa410_0000, 0x4_0000);
+/// Caliptra ROM
+pub const CALIPTRA_ROM: FpgaRegion = FpgaRegion::new("rom", 0xb000_0000, 0x1_8000);
+/// I3C controller
+pub const I3C_CONTROLLER: FpgaRegion = FpgaRegion::new("i3c_controller", 0xa408_0000, 0x1_0000);
+/// MCU SRAM
+pub const MCU_SRAM: FpgaRegion = FpgaRegion::new("mcu_sram", 0xb008_0000, 0x8_0000);
+/// Lifecycle controller
+pub const LC: FpgaRegion = FpgaRegion::new("lc", 0xa404_0000, 0x2000);
+/// MCU ROM backdoor, always accessible
+pub const MCU_ROM: FpgaRegion = FpgaRegion::new("mcu_rom", 0xb002_0000, 0x2_0000);
+/// Subsystem I3C target
+pub const SS_I3C: FpgaRegion = FpgaRegion::new("ss_i3c", 0xa403_0000, 0x1_0000);
+/// MCI
+pub const MCI: FpgaRegion = FpgaRegion::new("mci", 0xa800_0000, 0x100_0000);
+/// OTP controller
+pub const OTP: FpgaRegion = FpgaRegion::new("otp", 0xa406_0000, 0x2000);
+/// MCU ROM through the subsystem AXI subordinate, where the MCU fetches it from.
+/// Only accessible while the subsystem is out of reset.
+pub const MCU_ROM_AXI: FpgaRegion = FpgaRegion::new("mcu_rom_axi", 0xb004_0000, 0x2_0000);
+
+/// Every region of the FPGA.
+pub const FPGA_REGIONS: &[FpgaRegion] = &[
+    FPGA_WRAPPER,
+    CALIPTRA,
+    CALIPTRA_ROM,
+    I3C_CONTROLLER,
+    MCU_SRAM,
+    LC,
+    MCU_ROM,
+    SS_I3C,
+    MCI,
+    OTP,
+    MCU_ROM_AXI,
+];
+
+/// Maps of `caliptra-fpga-uio-dev0`, in uio map order.
+pub const FPGA_UIO0_REGIONS: &[FpgaRegion] = &[
+    FPGA_WRAPPER,
+    CALIPTRA,
+    CALIPTRA_ROM,
+    I3C_CONTROLLER,
+    MCU_SRAM,
+];
+
+/// Maps of `caliptra-fpga-uio-dev1`, in uio map order.
+pub const FPGA_UIO1_REGIONS: &[FpgaRegion] = &[LC, MCU_ROM, SS_I3C, MCI, OTP];
+
+/// Maximum number of maps of a uio device (`MAX_UIO_MAPS` in the kernel).
+pub const MAX_UIO_MAPS: usize = 5;
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_regions_do_not_overlap() {
+        let regions = FPGA_REGIONS;
+        assert!(FPGA_UIO0_REGIONS.len() <= MAX_UIO_MAPS);
+        assert!(FPGA_UIO1_REGIONS.len() <= MAX_UIO_MAPS);
+        for (i, a) in regions.iter().enumerate() {
+            assert_eq!(a.addr % 0x1000, 0, "{} is not page aligned", a.name);
+            for b in &regions[i + 1..] {
+                let a_end = a.addr as u64 + a.size as u64;
+                let b_end = b.addr as u64 + b.size as u64;
+                assert!(
+                    a_end <= b.addr as u64 || b_end <= a.addr as u64,
+                    "{} overlaps {}",
+                    a.name,
+                    b.name
+                );
+            }
+        }
+    }
+}
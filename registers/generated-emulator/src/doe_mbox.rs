@@ -18,6 +18,13 @@ pub trait DoeMboxPeripheral {
     fn poll(&mut self) {}
     fn warm_reset(&mut self) {}
     fn update_reset(&mut self) {}
+    /// State to keep in an emulator snapshot, restored with `restore_state`.
+    fn save_state(&self) -> Vec<u8> {
+        vec![]
+    }
+    fn restore_state(&mut self, _state: &[u8]) -> std::io::Result<()> {
+        Ok(())
+    }
     fn read_doe_mbox_lock(
         &mut self,
     ) -> caliptra_emu_bus::ReadWriteRegister<
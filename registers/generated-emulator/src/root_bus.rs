@@ -60,9 +60,132 @@ impl Default for AutoRootBusOffsets {
         }
     }
 }
+/// RAM-backed region that is accessed directly instead of through the peripheral dispatch.
+#[derive(Clone)]
+pub struct AutoRootBusFastRegion {
+    /// Name of the region in the access statistics
+    pub name: &'static str,
+    pub start: u32,
+    pub len: u32,
+    pub ram: std::rc::Rc<std::cell::RefCell<caliptra_emu_bus::Ram>>,
+    /// Read-only regions only take the fast path for reads.
+    pub writable: bool,
+}
+/// Access counters of one peripheral or delegate of the root bus.
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub struct AutoRootBusAccessStats {
+    pub reads: u64,
+    pub writes: u64,
+    pub bytes_read: u64,
+    pub bytes_written: u64,
+    /// Reads that returned the same value from the same address as the previous read
+    /// of this target, i.e. iterations of a polling loop.
+    pub poll_reads: u64,
+    /// Cycles between the repeated reads counted in `poll_reads`.
+    pub poll_cycles: u64,
+}
+/// An access to a peripheral or delegate of the root bus, as passed to the access
+/// observer.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct AutoRootBusAccess {
+    /// Index of the target, in the order of `AutoRootBus::stats()`
+    pub target: usize,
+    pub write: bool,
+    pub size: caliptra_emu_types::RvSize,
+    pub addr: caliptra_emu_types::RvAddr,
+    /// The value written or read, `None` if the read faulted
+    pub val: Option<caliptra_emu_types::RvData>,
+}
+/// Callback of [`AutoRootBus::set_access_observer`].
+pub type AutoRootBusObserver = Box<dyn FnMut(&AutoRootBusAccess)>;
+struct AutoRootBusStats {
+    clock: std::rc::Rc<caliptra_emu_bus::Clock>,
+    targets: Vec<AutoRootBusAccessStats>,
+    /// Address, value and cycle of the last read of each target
+    last_reads: Vec<Option<(caliptra_emu_types::RvAddr, caliptra_emu_types::RvData, u64)>>,
+    /// Reads and writes served by each fast region, without polling or the observer
+    fast_regions: Vec<AutoRootBusAccessStats>,
+    observer: Option<AutoRootBusObserver>,
+}
+impl AutoRootBusStats {
+    fn access_bytes(size: caliptra_emu_types::RvSize) -> u64 {
+        match size {
+            caliptra_emu_types::RvSize::Byte => 1,
+            caliptra_emu_types::RvSize::HalfWord => 2,
+            caliptra_emu_types::RvSize::Word => 4,
+            _ => 0,
+        }
+    }
+    fn read(
+        &mut self,
+        target: usize,
+        size: caliptra_emu_types::RvSize,
+        addr: caliptra_emu_types::RvAddr,
+        result: &Result<caliptra_emu_types::RvData, caliptra_emu_bus::BusError>,
+    ) {
+        if let Some(observer) = self.observer.as_mut() {
+            observer(&AutoRootBusAccess {
+                target,
+                write: false,
+                size,
+                addr,
+                val: result.as_ref().ok().copied(),
+            });
+        }
+        let now = self.clock.now();
+        let stats = &mut self.targets[target];
+        stats.reads += 1;
+        stats.bytes_read += Self::access_bytes(size);
+        let Ok(val) = *result else {
+            return;
+        };
+        if let Some((last_addr, last_val, last_cycle)) = self.last_reads[target] {
+            if last_addr == addr && last_val == val {
+                stats.poll_reads += 1;
+                stats.poll_cycles += now - last_cycle;
+            }
+        }
+        self.last_reads[target] = Some((addr, val, now));
+    }
+    #[inline(always)]
+    fn fast_access(&mut self, region: usize, size: caliptra_emu_types::RvSize, write: bool) {
+        let stats = &mut self.fast_regions[region];
+        if write {
+            stats.writes += 1;
+            stats.bytes_written += Self::access_bytes(size);
+        } else {
+            stats.reads += 1;
+            stats.bytes_read += Self::access_bytes(size);
+        }
+    }
+    fn write(
+        &mut self,
+        target: usize,
+        size: caliptra_emu_types::RvSize,
+        addr: caliptra_emu_types::RvAddr,
+        val: caliptra_emu_types::RvData,
+    ) {
+        if let Some(observer) = self.observer.as_mut() {
+            observer(&AutoRootBusAccess {
+                target,
+                write: true,
+                size,
+                addr,
+                val: Some(val),
+            });
+        }
+        let stats = &mut self.targets[target];
+        stats.writes += 1;
+        stats.bytes_written += Self::access_bytes(size);
+        self.last_reads[target] = None;
+    }
+}
 pub struct AutoRootBus {
     delegates: Vec<Box<dyn caliptra_emu_bus::Bus>>,
     offsets: AutoRootBusOffsets,
+    fast_regions: Vec<AutoRootBusFastRegion>,
+    last_fast_region: usize,
+    stats: Option<Box<AutoRootBusStats>>,
     pub i3c_periph: Option<crate::i3c::I3cBus>,
     pub primary_flash_periph: Option<crate::primary_flash::PrimaryFlashBus>,
     pub secondary_flash_periph: Option<crate::secondary_flash::SecondaryFlashBus>,
@@ -97,6 +220,9 @@ impl AutoRootBus {
         Self {
             delegates,
             offsets: offsets.unwrap_or_default(),
+            fast_regions: vec![],
+            last_fast_region: 0,
+            stats: None,
             i3c_periph: i3c_periph.map(|p| crate::i3c::I3cBus { periph: p }),
             primary_flash_periph: primary_flash_periph
                 .map(|p| crate::primary_flash::PrimaryFlashBus { periph: p }),
@@ -114,6 +240,244 @@ impl AutoRootBus {
             axicdma_periph: axicdma_periph.map(|p| crate::axicdma::AxicdmaBus { periph: p }),
         }
     }
+    /// Set the RAM-backed regions that are resolved before the peripherals and delegates.
+    ///
+    /// Misaligned accesses and accesses past the end of the backing RAM fall through to
+    /// the regular dispatch, so the regions must be the ones the delegates would serve
+    /// for the same addresses.
+    pub fn set_fast_regions(&mut self, regions: Vec<AutoRootBusFastRegion>) {
+        if let Some(stats) = self.stats.as_mut() {
+            stats.fast_regions = vec![AutoRootBusAccessStats::default(); regions.len()];
+        }
+        self.fast_regions = regions;
+        self.last_fast_region = 0;
+    }
+    pub fn fast_regions(&self) -> &[AutoRootBusFastRegion] {
+        &self.fast_regions
+    }
+    /// Names of the peripherals, in the order of their counters in `stats()`.
+    pub const PERIPHERALS: &'static [&'static str] = &[
+        "i3c",
+        "primary_flash",
+        "secondary_flash",
+        "mci",
+        "mcu_mbox0",
+        "mcu_mbox1",
+        "doe_mbox",
+        "el2_pic",
+        "otp",
+        "lc",
+        "mbox",
+        "sha512_acc",
+        "soc",
+        "axicdma",
+    ];
+    /// Start counting the accesses to each peripheral, delegate and fast region, timing
+    /// polling loops of the peripherals and delegates with `clock`.
+    pub fn enable_stats(&mut self, clock: std::rc::Rc<caliptra_emu_bus::Clock>) {
+        let targets = Self::PERIPHERALS.len() + self.delegates.len();
+        let observer = self.stats.take().and_then(|stats| stats.observer);
+        self.stats = Some(Box::new(AutoRootBusStats {
+            clock,
+            targets: vec![AutoRootBusAccessStats::default(); targets],
+            last_reads: vec![None; targets],
+            fast_regions: vec![AutoRootBusAccessStats::default(); self.fast_regions.len()],
+            observer,
+        }));
+    }
+    /// Call `observer` on every access counted by the statistics, enabling them if
+    /// needed.
+    pub fn set_access_observer(
+        &mut self,
+        clock: std::rc::Rc<caliptra_emu_bus::Clock>,
+        observer: AutoRootBusObserver,
+    ) {
+        if self.stats.is_none() {
+            self.enable_stats(clock);
+        }
+        if let Some(stats) = self.stats.as_mut() {
+            stats.observer = Some(observer);
+        }
+    }
+    /// Access counters of the peripherals in `PERIPHERALS` order followed by those of
+    /// the delegates, if enabled.
+    pub fn stats(&self) -> Option<&[AutoRootBusAccessStats]> {
+        self.stats.as_ref().map(|stats| stats.targets.as_slice())
+    }
+    /// State of each peripheral with state to keep in an emulator snapshot, by name.
+    pub fn save_state(&self) -> Vec<(&'static str, Vec<u8>)> {
+        let mut states = vec![];
+        if let Some(periph) = self.i3c_periph.as_ref() {
+            let state = periph.periph.save_state();
+            if !state.is_empty() {
+                states.push(("i3c", state));
+            }
+        }
+        if let Some(periph) = self.primary_flash_periph.as_ref() {
+            let state = periph.periph.save_state();
+            if !state.is_empty() {
+                states.push(("primary_flash", state));
+            }
+        }
+        if let Some(periph) = self.secondary_flash_periph.as_ref() {
+            let state = periph.periph.save_state();
+            if !state.is_empty() {
+                states.push(("secondary_flash", state));
+            }
+        }
+        if let Some(periph) = self.mci_periph.as_ref() {
+            let state = periph.periph.save_state();
+            if !state.is_empty() {
+                states.push(("mci", state));
+            }
+        }
+        if let Some(periph) = self.doe_mbox_periph.as_ref() {
+            let state = periph.periph.save_state();
+            if !state.is_empty() {
+                states.push(("doe_mbox", state));
+            }
+        }
+        if let Some(periph) = self.el2_pic_periph.as_ref() {
+            let state = periph.periph.save_state();
+            if !state.is_empty() {
+                states.push(("el2_pic", state));
+            }
+        }
+        if let Some(periph) = self.otp_periph.as_ref() {
+            let state = periph.periph.save_state();
+            if !state.is_empty() {
+                states.push(("otp", state));
+            }
+        }
+        if let Some(periph) = self.lc_periph.as_ref() {
+            let state = periph.periph.save_state();
+            if !state.is_empty() {
+                states.push(("lc", state));
+            }
+        }
+        if let Some(periph) = self.mbox_periph.as_ref() {
+            let state = periph.periph.save_state();
+            if !state.is_empty() {
+                states.push(("mbox", state));
+            }
+        }
+        if let Some(periph) = self.sha512_acc_periph.as_ref() {
+            let state = periph.periph.save_state();
+            if !state.is_empty() {
+                states.push(("sha512_acc", state));
+            }
+        }
+        if let Some(periph) = self.soc_periph.as_ref() {
+            let state = periph.periph.save_state();
+            if !state.is_empty() {
+                states.push(("soc", state));
+            }
+        }
+        if let Some(periph) = self.axicdma_periph.as_ref() {
+            let state = periph.periph.save_state();
+            if !state.is_empty() {
+                states.push(("axicdma", state));
+            }
+        }
+        states
+    }
+    /// Restore the state `save_state` returned for peripheral `name`. Fails if this bus
+    /// does not have that peripheral.
+    pub fn restore_state(&mut self, name: &str, state: &[u8]) -> std::io::Result<()> {
+        let restored = match name {
+            "i3c" => self
+                .i3c_periph
+                .as_mut()
+                .map(|periph| periph.periph.restore_state(state)),
+            "primary_flash" => self
+                .primary_flash_periph
+                .as_mut()
+                .map(|periph| periph.periph.restore_state(state)),
+            "secondary_flash" => self
+                .secondary_flash_periph
+                .as_mut()
+                .map(|periph| periph.periph.restore_state(state)),
+            "mci" => self
+                .mci_periph
+                .as_mut()
+                .map(|periph| periph.periph.restore_state(state)),
+            "doe_mbox" => self
+                .doe_mbox_periph
+                .as_mut()
+                .map(|periph| periph.periph.restore_state(state)),
+            "el2_pic" => self
+                .el2_pic_periph
+                .as_mut()
+                .map(|periph| periph.periph.restore_state(state)),
+            "otp" => self
+                .otp_periph
+                .as_mut()
+                .map(|periph| periph.periph.restore_state(state)),
+            "lc" => self
+                .lc_periph
+                .as_mut()
+                .map(|periph| periph.periph.restore_state(state)),
+            "mbox" => self
+                .mbox_periph
+                .as_mut()
+                .map(|periph| periph.periph.restore_state(state)),
+            "sha512_acc" => self
+                .sha512_acc_periph
+                .as_mut()
+                .map(|periph| periph.periph.restore_state(state)),
+            "soc" => self
+                .soc_periph
+                .as_mut()
+                .map(|periph| periph.periph.restore_state(state)),
+            "axicdma" => self
+                .axicdma_periph
+                .as_mut()
+                .map(|periph| periph.periph.restore_state(state)),
+            _ => None,
+        };
+        restored.unwrap_or_else(|| {
+            Err(std::io::Error::new(
+                std::io::ErrorKind::InvalidData,
+                format!("no {} peripheral to restore", name),
+            ))
+        })
+    }
+    /// Access counters of the fast regions in `fast_regions()` order, if enabled.
+    /// Polling is not tracked and the observer is not called for these accesses.
+    pub fn fast_region_stats(&self) -> Option<&[AutoRootBusAccessStats]> {
+        self.stats
+            .as_ref()
+            .map(|stats| stats.fast_regions.as_slice())
+    }
+    /// Find the fast region serving an access, trying the last region hit first.
+    #[inline(always)]
+    fn fast_region(
+        &mut self,
+        size: caliptra_emu_types::RvSize,
+        addr: caliptra_emu_types::RvAddr,
+    ) -> Option<(&AutoRootBusFastRegion, std::ops::Range<usize>)> {
+        let width = match size {
+            caliptra_emu_types::RvSize::Byte => 1,
+            caliptra_emu_types::RvSize::HalfWord => 2,
+            caliptra_emu_types::RvSize::Word => 4,
+            _ => return None,
+        };
+        let contains =
+            |region: &AutoRootBusFastRegion| addr.wrapping_sub(region.start) < region.len;
+        if !self
+            .fast_regions
+            .get(self.last_fast_region)
+            .is_some_and(contains)
+        {
+            self.last_fast_region = self.fast_regions.iter().position(contains)?;
+        }
+        let region = &self.fast_regions[self.last_fast_region];
+        let offset = (addr - region.start) as usize;
+        if offset % width != 0 {
+            return None;
+        }
+        Some((region, offset..offset + width))
+    }
 }
 impl caliptra_emu_bus::Bus for AutoRootBus {
     fn read(
@@ -121,87 +485,160 @@ impl caliptra_emu_bus::Bus for AutoRootBus {
         size: caliptra_emu_types::RvSize,
         addr: caliptra_emu_types::RvAddr,
     ) -> Result<caliptra_emu_types::RvData, caliptra_emu_bus::BusError> {
+        if let Some((region, range)) = self.fast_region(size, addr) {
+            let val = region.ram.borrow().data().get(range).map(|bytes| {
+                let mut val = [0u8; 4];
+                val[..bytes.len()].copy_from_slice(bytes);
+                u32::from_le_bytes(val)
+            });
+            if let Some(val) = val {
+                if let Some(stats) = self.stats.as_mut() {
+                    stats.fast_access(self.last_fast_region, size, false);
+                }
+                return Ok(val);
+            }
+        }
         if addr >= self.offsets.i3c_offset && addr < self.offsets.i3c_offset + self.offsets.i3c_size
         {
             if let Some(periph) = self.i3c_periph.as_mut() {
-                return periph.read(size, addr - self.offsets.i3c_offset);
+                let result = periph.read(size, addr - self.offsets.i3c_offset);
+                if let Some(stats) = self.stats.as_mut() {
+                    stats.read(0, size, addr, &result);
+                }
+                return result;
             }
         }
         if addr >= self.offsets.primary_flash_offset
             && addr < self.offsets.primary_flash_offset + self.offsets.primary_flash_size
         {
             if let Some(periph) = self.primary_flash_periph.as_mut() {
-                return periph.read(size, addr - self.offsets.primary_flash_offset);
+                let result = periph.read(size, addr - self.offsets.primary_flash_offset);
+                if let Some(stats) = self.stats.as_mut() {
+                    stats.read(1, size, addr, &result);
+                }
+                return result;
             }
         }
         if addr >= self.offsets.secondary_flash_offset
             && addr < self.offsets.secondary_flash_offset + self.offsets.secondary_flash_size
         {
             if let Some(periph) = self.secondary_flash_periph.as_mut() {
-                return periph.read(size, addr - self.offsets.secondary_flash_offset);
+                let result = periph.read(size, addr - self.offsets.secondary_flash_offset);
+                if let Some(stats) = self.stats.as_mut() {
+                    stats.read(2, size, addr, &result);
+                }
+                return result;
             }
         }
         if addr >= self.offsets.mci_offset && addr < self.offsets.mci_offset + self.offsets.mci_size
         {
             if let Some(periph) = self.mci_periph.as_mut() {
-                return periph.read(size, addr - self.offsets.mci_offset);
+                let result = periph.read(size, addr - self.offsets.mci_offset);
+                if let Some(stats) = self.stats.as_mut() {
+                    stats.read(
+                        match addr - self.offsets.mci_offset {
+                            0x40_0000..0x60_0028 => 4,
+                            0x80_0000..0xa0_0028 => 5,
+                            _ => 3,
+                        },
+                        size,
+                        addr,
+                        &result,
+                    );
+                }
+                return result;
             }
         }
         if addr >= self.offsets.doe_mbox_offset
             && addr < self.offsets.doe_mbox_offset + self.offsets.doe_mbox_size
         {
             if let Some(periph) = self.doe_mbox_periph.as_mut() {
-                return periph.read(size, addr - self.offsets.doe_mbox_offset);
+                let result = periph.read(size, addr - self.offsets.doe_mbox_offset);
+                if let Some(stats) = self.stats.as_mut() {
+                    stats.read(6, size, addr, &result);
+                }
+                return result;
             }
         }
         if addr >= self.offsets.el2_pic_offset
             && addr < self.offsets.el2_pic_offset + self.offsets.el2_pic_size
         {
             if let Some(periph) = self.el2_pic_periph.as_mut() {
-                return periph.read(size, addr - self.offsets.el2_pic_offset);
+                let result = periph.read(size, addr - self.offsets.el2_pic_offset);
+                if let Some(stats) = self.stats.as_mut() {
+                    stats.read(7, size, addr, &result);
+                }
+                return result;
             }
         }
         if addr >= self.offsets.otp_offset && addr < self.offsets.otp_offset + self.offsets.otp_size
         {
             if let Some(periph) = self.otp_periph.as_mut() {
-                return periph.read(size, addr - self.offsets.otp_offset);
+                let result = periph.read(size, addr - self.offsets.otp_offset);
+                if let Some(stats) = self.stats.as_mut() {
+                    stats.read(8, size, addr, &result);
+                }
+                return result;
             }
         }
         if addr >= self.offsets.lc_offset && addr < self.offsets.lc_offset + self.offsets.lc_size {
             if let Some(periph) = self.lc_periph.as_mut() {
-                return periph.read(size, addr - self.offsets.lc_offset);
+                let result = periph.read(size, addr - self.offsets.lc_offset);
+                if let Some(stats) = self.stats.as_mut() {
+                    stats.read(9, size, addr, &result);
+                }
+                return result;
             }
         }
         if addr >= self.offsets.mbox_offset
             && addr < self.offsets.mbox_offset + self.offsets.mbox_size
         {
             if let Some(periph) = self.mbox_periph.as_mut() {
-                return periph.read(size, addr - self.offsets.mbox_offset);
+                let result = periph.read(size, addr - self.offsets.mbox_offset);
+                if let Some(stats) = self.stats.as_mut() {
+                    stats.read(10, size, addr, &result);
+                }
+                return result;
             }
         }
         if addr >= self.offsets.sha512_acc_offset
             && addr < self.offsets.sha512_acc_offset + self.offsets.sha512_acc_size
         {
             if let Some(periph) = self.sha512_acc_periph.as_mut() {
-                return periph.read(size, addr - self.offsets.sha512_acc_offset);
+                let result = periph.read(size, addr - self.offsets.sha512_acc_offset);
+                if let Some(stats) = self.stats.as_mut() {
+                    stats.read(11, size, addr, &result);
+                }
+                return result;
             }
         }
         if addr >= self.offsets.soc_offset && addr < self.offsets.soc_offset + self.offsets.soc_size
         {
             if let Some(periph) = self.soc_periph.as_mut() {
-                return periph.read(size, addr - self.offsets.soc_offset);
+                let result = periph.read(size, addr - self.offsets.soc_offset);
+                if let Some(stats) = self.stats.as_mut() {
+                    stats.read(12, size, addr, &result);
+                }
+                return result;
             }
         }
         if addr >= self.offsets.axicdma_offset
             && addr < self.offsets.axicdma_offset + self.offsets.axicdma_size
         {
             if let Some(periph) = self.axicdma_periph.as_mut() {
-                return periph.read(size, addr - self.offsets.axicdma_offset);
+                let result = periph.read(size, addr - self.offsets.axicdma_offset);
+                if let Some(stats) = self.stats.as_mut() {
+                    stats.read(13, size, addr, &result);
+                }
+                return result;
             }
         }
-        for delegate in self.delegates.iter_mut() {
+        for (index, delegate) in self.delegates.iter_mut().enumerate() {
             let result = delegate.read(size, addr);
             if !matches!(result, Err(caliptra_emu_bus::BusError::LoadAccessFault)) {
+                if let Some(stats) = self.stats.as_mut() {
+                    stats.read(Self::PERIPHERALS.len() + index, size, addr, &result);
+                }
                 return result;
             }
         }
@@ -213,9 +650,31 @@ impl caliptra_emu_bus::Bus for AutoRootBus {
         addr: caliptra_emu_types::RvAddr,
         val: caliptra_emu_types::RvData,
     ) -> Result<(), caliptra_emu_bus::BusError> {
+        if let Some((region, range)) = self.fast_region(size, addr) {
+            let written = region.writable
+                && region
+                    .ram
+                    .borrow_mut()
+                    .data_mut()
+                    .get_mut(range)
+                    .map(|bytes| {
+                        let width = bytes.len();
+                        bytes.copy_from_slice(&val.to_le_bytes()[..width]);
+                    })
+                    .is_some();
+            if written {
+                if let Some(stats) = self.stats.as_mut() {
+                    stats.fast_access(self.last_fast_region, size, true);
+                }
+                return Ok(());
+            }
+        }
         if addr >= self.offsets.i3c_offset && addr < self.offsets.i3c_offset + self.offsets.i3c_size
         {
             if let Some(periph) = self.i3c_periph.as_mut() {
+                if let Some(stats) = self.stats.as_mut() {
+                    stats.write(0, size, addr, val);
+                }
                 return periph.write(size, addr - self.offsets.i3c_offset, val);
             }
         }
@@ -223,6 +682,9 @@ impl caliptra_emu_bus::Bus for AutoRootBus {
             && addr < self.offsets.primary_flash_offset + self.offsets.primary_flash_size
         {
             if let Some(periph) = self.primary_flash_periph.as_mut() {
+                if let Some(stats) = self.stats.as_mut() {
+                    stats.write(1, size, addr, val);
+                }
                 return periph.write(size, addr - self.offsets.primary_flash_offset, val);
             }
         }
@@ -230,12 +692,27 @@ impl caliptra_emu_bus::Bus for AutoRootBus {
             && addr < self.offsets.secondary_flash_offset + self.offsets.secondary_flash_size
         {
             if let Some(periph) = self.secondary_flash_periph.as_mut() {
+                if let Some(stats) = self.stats.as_mut() {
+                    stats.write(2, size, addr, val);
+                }
                 return periph.write(size, addr - self.offsets.secondary_flash_offset, val);
             }
         }
         if addr >= self.offsets.mci_offset && addr < self.offsets.mci_offset + self.offsets.mci_size
         {
             if let Some(periph) = self.mci_periph.as_mut() {
+                if let Some(stats) = self.stats.as_mut() {
+                    stats.write(
+                        match addr - self.offsets.mci_offset {
+                            0x40_0000..0x60_0028 => 4,
+                            0x80_0000..0xa0_0028 => 5,
+                            _ => 3,
+                        },
+                        size,
+                        addr,
+                        val,
+                    );
+                }
                 return periph.write(size, addr - self.offsets.mci_offset, val);
             }
         }
@@ -243,6 +720,9 @@ impl caliptra_emu_bus::Bus for AutoRootBus {
             && addr < self.offsets.doe_mbox_offset + self.offsets.doe_mbox_size
         {
             if let Some(periph) = self.doe_mbox_periph.as_mut() {
+                if let Some(stats) = self.stats.as_mut() {
+                    stats.write(6, size, addr, val);
+                }
                 return periph.write(size, addr - self.offsets.doe_mbox_offset, val);
             }
         }
@@ -250,17 +730,26 @@ impl caliptra_emu_bus::Bus for AutoRootBus {
             && addr < self.offsets.el2_pic_offset + self.offsets.el2_pic_size
         {
             if let Some(periph) = self.el2_pic_periph.as_mut() {
+                if let Some(stats) = self.stats.as_mut() {
+                    stats.write(7, size, addr, val);
+                }
                 return periph.write(size, addr - self.offsets.el2_pic_offset, val);
             }
         }
         if addr >= self.offsets.otp_offset && addr < self.offsets.otp_offset + self.offsets.otp_size
         {
             if let Some(periph) = self.otp_periph.as_mut() {
+                if let Some(stats) = self.stats.as_mut() {
+                    stats.write(8, size, addr, val);
+                }
                 return periph.write(size, addr - self.offsets.otp_offset, val);
             }
         }
         if addr >= self.offsets.lc_offset && addr < self.offsets.lc_offset + self.offsets.lc_size {
             if let Some(periph) = self.lc_periph.as_mut() {
+                if let Some(stats) = self.stats.as_mut() {
+                    stats.write(9, size, addr, val);
+                }
                 return periph.write(size, addr - self.offsets.lc_offset, val);
             }
         }
@@ -268,6 +757,9 @@ impl caliptra_emu_bus::Bus for AutoRootBus {
             && addr < self.offsets.mbox_offset + self.offsets.mbox_size
         {
             if let Some(periph) = self.mbox_periph.as_mut() {
+                if let Some(stats) = self.stats.as_mut() {
+                    stats.write(10, size, addr, val);
+                }
                 return periph.write(size, addr - self.offsets.mbox_offset, val);
             }
         }
@@ -275,12 +767,18 @@ impl caliptra_emu_bus::Bus for AutoRootBus {
             && addr < self.offsets.sha512_acc_offset + self.offsets.sha512_acc_size
         {
             if let Some(periph) = self.sha512_acc_periph.as_mut() {
+                if let Some(stats) = self.stats.as_mut() {
+                    stats.write(11, size, addr, val);
+                }
                 return periph.write(size, addr - self.offsets.sha512_acc_offset, val);
             }
         }
         if addr >= self.offsets.soc_offset && addr < self.offsets.soc_offset + self.offsets.soc_size
         {
             if let Some(periph) = self.soc_periph.as_mut() {
+                if let Some(stats) = self.stats.as_mut() {
+                    stats.write(12, size, addr, val);
+                }
                 return periph.write(size, addr - self.offsets.soc_offset, val);
             }
         }
@@ -288,12 +786,18 @@ impl caliptra_emu_bus::Bus for AutoRootBus {
             && addr < self.offsets.axicdma_offset + self.offsets.axicdma_size
         {
             if let Some(periph) = self.axicdma_periph.as_mut() {
+                if let Some(stats) = self.stats.as_mut() {
+                    stats.write(13, size, addr, val);
+                }
                 return periph.write(size, addr - self.offsets.axicdma_offset, val);
             }
         }
-        for delegate in self.delegates.iter_mut() {
+        for (index, delegate) in self.delegates.iter_mut().enumerate() {
             let result = delegate.write(size, addr, val);
             if !matches!(result, Err(caliptra_emu_bus::BusError::StoreAccessFault)) {
+                if let Some(stats) = self.stats.as_mut() {
+                    stats.write(Self::PERIPHERALS.len() + index, size, addr, val);
+                }
                 return result;
             }
         }
@@ -1,7 +1,10 @@
 // Licensed under the Apache-2.0 license
 
-use anyhow::Result;
-use mcu_builder::{target_dir, PROJECT_ROOT};
+use anyhow::{bail, Result};
+use mcu_builder::{
+    rom_build, runtime_build_with_apps_cached, target_dir, CaliptraBuilder, PROJECT_ROOT,
+};
+use std::path::Path;
 use std::process::Command;
 
 const CBINDING_DIR: &str = "emulator/cbinding";
@@ -362,3 +365,81 @@ pub(crate) fn build_all(release: bool) -> Result<()> {
     println!("All emulator C binding components built successfully");
     Ok(())
 }
+
+/// Build the release emulator and firmware, then run the emulator's `--bench` mode
+///
+/// The emulator boots to MCU runtime and times the C API hot paths; the JSON results are
+/// written to `output`.
+pub(crate) fn bench(output: &Path, iterations: Option<u64>) -> Result<()> {
+    build_emulator(true)?;
+
+    let rom_binary = rom_build(None, "")?;
+    let tock_binary = runtime_build_with_apps_cached(
+        &[],
+        None,
+        false,
+        None,
+        None,
+        false,
+        None,
+        None,
+        None,
+        None,
+    )?;
+    let mut caliptra_builder = CaliptraBuilder::new(
+        false,
+        None,
+        None,
+        None,
+        None,
+        Some(tock_binary.clone().into()),
+        None,
+        None,
+        None,
+        None,
+        None,
+    );
+    let caliptra_rom = caliptra_builder.get_caliptra_rom()?;
+    let caliptra_firmware = caliptra_builder.get_caliptra_fw()?;
+    let soc_manifest = caliptra_builder.get_soc_manifest(None)?;
+    let vendor_pk_hash = caliptra_builder.get_vendor_pk_hash()?.to_string();
+
+    let emulator_exe = if cfg!(windows) {
+        "emulator.exe"
+    } else {
+        "emulator"
+    };
+    let mut cmd = Command::new(
+        target_dir()
+            .join("release")
+            .join("emulator_cbinding")
+            .join(emulator_exe),
+    );
+    cmd.current_dir(&*PROJECT_ROOT)
+        .arg("--rom")
+        .arg(&rom_binary)
+        .arg("--firmware")
+        .arg(&tock_binary)
+        .arg("--caliptra-rom")
+        .arg(&caliptra_rom)
+        .arg("--caliptra-firmware")
+        .arg(&caliptra_firmware)
+        .arg("--soc-manifest")
+        .arg(&soc_manifest)
+        .arg("--vendor-pk-hash")
+        .arg(&vendor_pk_hash)
+        .arg("--bench")
+        .arg(output);
+
+    // the firmware is built for the emulator memory map, which may differ from the defaults
+    cmd.arg("--memory-map").arg("emulator");
+    if let Some(iterations) = iterations {
+        cmd.arg("--bench-iterations").arg(iterations.to_string());
+    }
+
+    println!("Running emulator C binding benchmark...");
+    if !cmd.status()?.success() {
+        bail!("Benchmark failed");
+    }
+    Ok(())
+}
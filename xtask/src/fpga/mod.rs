@@ -5,6 +5,7 @@ use caliptra_hw_model::BootParams;
 use caliptra_image_gen::to_hw_format;
 use caliptra_image_types::FwVerificationPqcKeyType;
 use clap::Subcommand;
+use clap_num::maybe_hex;
 use configurations::Configuration;
 use mcu_builder::FirmwareBinaries;
 use mcu_hw_model::{InitParams, McuHwModel, ModelFpgaRealtime};
@@ -115,6 +116,16 @@ pub(crate) enum Fpga {
         #[arg(long, default_value_t = false)]
         test_output: bool,
     },
+    /// Replay an emulator lockstep log against the FPGA peripherals
+    LockstepReplay {
+        /// Lockstep log written by the emulator with `--lockstep-log`
+        #[arg(long)]
+        log: PathBuf,
+        /// Address of a register whose reads are not compared because its value changes
+        /// on its own, on top of the MCI timers; can be repeated
+        #[arg(long, value_parser=maybe_hex::<u32>)]
+        volatile: Vec<u32>,
+    },
 }
 
 pub fn fpga_install_kernel_modules(target_host: Option<&str>) -> Result<()> {
@@ -248,6 +259,13 @@ pub(crate) fn fpga_entry(args: &Fpga) -> Result<()> {
                     test_output,
                 })?;
         }
+        Fpga::LockstepReplay { log, volatile } => {
+            println!("Replaying {} on the FPGA", log.display());
+            match mcu_hw_model::lockstep::replay_on_fpga(log, volatile)? {
+                Some(divergence) => bail!("{divergence}"),
+                None => println!("No divergence"),
+            }
+        }
         _ => todo!("implement this command"),
     }
 
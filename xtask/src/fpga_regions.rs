@@ -0,0 +1,82 @@
+// Licensed under the Apache-2.0 license
+
+use anyhow::{bail, Result};
+use mcu_builder::PROJECT_ROOT;
+use mcu_config_fpga::regions::{FpgaRegion, FPGA_REGIONS, FPGA_UIO0_REGIONS, FPGA_UIO1_REGIONS};
+use std::fmt::Write;
+use std::path::PathBuf;
+
+fn header_path() -> PathBuf {
+    PROJECT_ROOT
+        .join("hw")
+        .join("fpga")
+        .join("kernel-modules")
+        .join("fpga_regions.h")
+}
+
+fn macro_prefix(region: &FpgaRegion) -> String {
+    format!("FPGA_REGION_{}", region.name.to_uppercase())
+}
+
+fn write_uio_list(out: &mut String, dev: usize, regions: &[FpgaRegion]) {
+    writeln!(
+        out,
+        "// X(name, addr, size) for each map of caliptra-fpga-uio-dev{dev}, in map order"
+    )
+    .unwrap();
+    write!(out, "#define FPGA_UIO{dev}_REGIONS(X)").unwrap();
+    for region in regions {
+        let prefix = macro_prefix(region);
+        write!(
+            out,
+            " \\\n    X(\"{}\", {prefix}_ADDR, {prefix}_SIZE)",
+            region.name
+        )
+        .unwrap();
+    }
+    writeln!(out, "\n").unwrap();
+}
+
+/// The C header of the FPGA regions used by the kernel modules.
+fn generate_header() -> String {
+    let mut out = String::new();
+    out.push_str(
+        "// Licensed under the Apache-2.0 license\n\
+         \n\
+         // Generated by `cargo xtask fpga-regions-autogen` from\n\
+         // platforms/fpga/config/src/regions.rs, do not edit.\n\
+         \n\
+         #ifndef FPGA_REGIONS_H\n\
+         #define FPGA_REGIONS_H\n\
+         \n",
+    );
+    for region in FPGA_REGIONS {
+        let prefix = macro_prefix(region);
+        writeln!(out, "#define {prefix}_ADDR {:#010x}", region.addr).unwrap();
+        writeln!(out, "#define {prefix}_SIZE {:#010x}", region.size).unwrap();
+    }
+    out.push('\n');
+    write_uio_list(&mut out, 0, FPGA_UIO0_REGIONS);
+    write_uio_list(&mut out, 1, FPGA_UIO1_REGIONS);
+    out.push_str("#endif\n");
+    out
+}
+
+/// Generate `fpga_regions.h`, or with `check` fail if it is out of date.
+pub(crate) fn autogen(check: bool) -> Result<()> {
+    let path = header_path();
+    let contents = generate_header();
+    if check {
+        println!("Checking file {path:?}");
+        if std::fs::read(&path)? != contents.as_bytes() {
+            bail!(
+                "{path:?} does not match the FPGA region map. Run \
+                \"cargo xtask fpga-regions-autogen\" to update this file."
+            );
+        }
+    } else {
+        println!("Writing to {path:?}");
+        std::fs::write(&path, contents)?;
+    }
+    Ok(())
+}
@@ -0,0 +1,29 @@
+// Licensed under the Apache-2.0 license
+
+use anyhow::{bail, Result};
+use mcu_testing_common::lockstep::{first_divergence, LockstepReader, LockstepRecord};
+use std::fs::File;
+use std::io::BufReader;
+use std::path::Path;
+
+fn read_log(path: &Path) -> Result<Vec<LockstepRecord>> {
+    let reader = LockstepReader::new(BufReader::new(File::open(path)?))?;
+    Ok(reader.collect::<std::io::Result<_>>()?)
+}
+
+pub(crate) fn diff(expected: &Path, actual: &Path) -> Result<()> {
+    let expected_records = read_log(expected)?;
+    let actual_records = read_log(actual)?;
+    println!(
+        "Comparing {} ({} records) with {} ({} records)",
+        expected.display(),
+        expected_records.len(),
+        actual.display(),
+        actual_records.len()
+    );
+    match first_divergence(expected_records, actual_records) {
+        Some(divergence) => bail!("{divergence}"),
+        None => println!("No divergence"),
+    }
+    Ok(())
+}
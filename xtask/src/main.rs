@@ -15,7 +15,9 @@ mod emulator_cbinding;
 mod format;
 #[cfg(feature = "fpga_realtime")]
 mod fpga;
+mod fpga_regions;
 mod header;
+mod lockstep;
 mod pldm_fw_pkg;
 mod precheckin;
 mod registers;
@@ -216,6 +218,19 @@ enum Commands {
         #[arg(short, long)]
         addrmap: Vec<String>,
     },
+    /// Generate the kernel module header of the FPGA region map
+    FpgaRegionsAutogen {
+        /// Check output only
+        #[arg(short, long, default_value_t = false)]
+        check: bool,
+    },
+    /// Compare two lockstep logs and report the first record that differs
+    LockstepDiff {
+        /// Lockstep log of the reference run
+        expected: PathBuf,
+        /// Lockstep log of the run to check
+        actual: PathBuf,
+    },
     /// Check dependencies
     Deps,
     /// Manage FPGA Life cycle
@@ -362,6 +377,15 @@ enum EmulatorCbindingCommands {
         #[arg(long, default_value_t = false)]
         release: bool,
     },
+    /// Build in release mode, boot to MCU runtime and write C API timings as JSON
+    Bench {
+        /// Path of the JSON results file
+        #[arg(long, default_value = "emulator-cbinding-bench.json")]
+        output: PathBuf,
+        /// Calls per timed loop (default: 1000000)
+        #[arg(long)]
+        iterations: Option<u64>,
+    },
     /// Clean all build artifacts
     Clean {
         /// Clean release mode artifacts (otherwise cleans debug artifacts)
@@ -469,6 +493,8 @@ fn main() {
             files,
             addrmap,
         } => registers::autogen(*check, files, addrmap),
+        Commands::FpgaRegionsAutogen { check } => fpga_regions::autogen(*check),
+        Commands::LockstepDiff { expected, actual } => lockstep::diff(expected, actual),
         Commands::Deps => deps::check(),
         #[cfg(feature = "fpga_realtime")]
         Commands::Fpga { subcommand } => fpga::fpga_entry(subcommand),
@@ -487,6 +513,9 @@ fn main() {
             EmulatorCbindingCommands::BuildEmulator { release } => {
                 emulator_cbinding::build_emulator(*release)
             }
+            EmulatorCbindingCommands::Bench { output, iterations } => {
+                emulator_cbinding::bench(output, *iterations)
+            }
             EmulatorCbindingCommands::Clean { release } => emulator_cbinding::clean(*release),
         },
         Commands::AuthManifest { subcommand } => match subcommand {
@@ -8,6 +8,7 @@ pub(crate) fn precheckin() -> Result<()> {
     crate::clippy::clippy()?;
     crate::header::check()?;
     crate::deps::check()?;
+    crate::fpga_regions::autogen(true)?;
     mcu_builder::runtime_build_with_apps_cached(
         &[],
         None,
@@ -6,7 +6,7 @@ use proc_macro2::{Ident, Literal, TokenStream};
 use quote::{format_ident, quote};
 use registers_generator::{
     camel_case, has_single_32_bit_field, hex_const, snake_case, Register, RegisterBlock,
-    RegisterBlockInstance, RegisterWidth, ValidatedRegisterBlock,
+    RegisterBlockInstance, RegisterSubBlock, RegisterWidth, ValidatedRegisterBlock,
 };
 use registers_systemrdl::ParentScope;
 use serde::Deserialize;
@@ -34,6 +34,13 @@ static SKIP_TYPES: LazyLock<HashSet<&str>> = LazyLock::new(|| {
     ])
 });
 
+/// Sub-blocks of a peripheral whose accesses are counted as a target of their own in the
+/// root bus statistics: (peripheral, sub-block, target name).
+const STATS_SUB_BLOCKS: &[(&str, &str, &str)] = &[
+    ("mci", "mcu_mbox0_csr", "mcu_mbox0"),
+    ("mci", "mcu_mbox1_csr", "mcu_mbox1"),
+];
+
 pub(crate) fn autogen(
     check: bool,
     extra_files: &[PathBuf],
@@ -461,6 +468,13 @@ fn emu_make_peripheral_trait(
             fn poll(&mut self) {}
             fn warm_reset(&mut self) {}
             fn update_reset(&mut self) {}
+            /// State to keep in an emulator snapshot, restored with `restore_state`.
+            fn save_state(&self) -> Vec<u8> {
+                vec![]
+            }
+            fn restore_state(&mut self, _state: &[u8]) -> std::io::Result<()> {
+                Ok(())
+            }
             #fn_tokens
         }
     });
@@ -670,6 +684,8 @@ fn emu_make_root_bus<'a>(
     let mut poll_tokens = TokenStream::new();
     let mut warm_reset_tokens = TokenStream::new();
     let mut update_reset_tokens = TokenStream::new();
+    let mut save_state_tokens = TokenStream::new();
+    let mut restore_state_tokens = TokenStream::new();
     let mut incoming_event_tokens = TokenStream::new();
     let mut register_outgoing_events_tokens = TokenStream::new();
     let mut field_tokens = TokenStream::new();
@@ -677,6 +693,7 @@ fn emu_make_root_bus<'a>(
     let mut constructor_params_tokens = TokenStream::new();
     let mut offset_fields = TokenStream::new();
     let mut offset_defaults = TokenStream::new();
+    let mut periph_names = vec![];
 
     let mut blocks_sorted = blocks.collect::<Vec<_>>();
     blocks_sorted.sort_by_key(|b| b.block().instances[0].address);
@@ -706,6 +723,38 @@ fn emu_make_root_bus<'a>(
         });
         let addr = hex_literal(rblock.instances[0].address as u64);
         let size = hex_literal(whole_width(rblock));
+        let stats_index = Literal::usize_unsuffixed(periph_names.len());
+        let periph_name = snake_base.to_string();
+        periph_names.push(periph_name.clone());
+        let mut stats_arms = TokenStream::new();
+        for sb in rblock.sub_blocks.iter() {
+            let Some((_, _, name)) = STATS_SUB_BLOCKS.iter().find(|(periph, sub_block, _)| {
+                *periph == periph_name && *sub_block == sb.block().name
+            }) else {
+                continue;
+            };
+            let width = match sb {
+                RegisterSubBlock::Single { block, .. } => whole_width(block),
+                RegisterSubBlock::Array {
+                    block, stride, len, ..
+                } => stride * (*len as u64 - 1) + whole_width(block),
+            };
+            let start = hex_literal(sb.start_offset());
+            let end = hex_literal(sb.start_offset() + width);
+            let index = Literal::usize_unsuffixed(periph_names.len());
+            periph_names.push(name.to_string());
+            stats_arms.extend(quote! { #start..#end => #index, });
+        }
+        let stats_target = if stats_arms.is_empty() {
+            quote! { #stats_index }
+        } else {
+            quote! {
+                match addr - self.offsets.#offset_field {
+                    #stats_arms
+                    _ => #stats_index,
+                }
+            }
+        };
 
         offset_fields.extend(quote! {
             pub #offset_field: u32,
@@ -719,13 +768,20 @@ fn emu_make_root_bus<'a>(
         read_tokens.extend(quote! {
             if addr >= self.offsets.#offset_field && addr < self.offsets.#offset_field + self.offsets.#size_field {
                 if let Some(periph) = self.#periph_field.as_mut() {
-                    return periph.read(size, addr - self.offsets.#offset_field);
+                    let result = periph.read(size, addr - self.offsets.#offset_field);
+                    if let Some(stats) = self.stats.as_mut() {
+                        stats.read(#stats_target, size, addr, &result);
+                    }
+                    return result;
                 }
             }
         });
         write_tokens.extend(quote! {
             if addr >= self.offsets.#offset_field && addr < self.offsets.#offset_field + self.offsets.#size_field {
                 if let Some(periph) = self.#periph_field.as_mut() {
+                    if let Some(stats) = self.stats.as_mut() {
+                        stats.write(#stats_target, size, addr, val);
+                    }
                     return periph.write(size, addr - self.offsets.#offset_field, val);
                 }
             }
@@ -745,6 +801,17 @@ fn emu_make_root_bus<'a>(
                 periph.update_reset();
             }
         });
+        save_state_tokens.extend(quote! {
+            if let Some(periph) = self.#periph_field.as_ref() {
+                let state = periph.periph.save_state();
+                if !state.is_empty() {
+                    states.push((#periph_name, state));
+                }
+            }
+        });
+        restore_state_tokens.extend(quote! {
+            #periph_name => self.#periph_field.as_mut().map(|periph| periph.periph.restore_state(state)),
+        });
         incoming_event_tokens.extend(quote! {
             if let Some(periph) = self.#periph_field.as_mut() {
                 periph.incoming_event(event.clone());
@@ -772,9 +839,116 @@ fn emu_make_root_bus<'a>(
             }
         }
 
+        /// RAM-backed region that is accessed directly instead of through the peripheral dispatch.
+        #[derive(Clone)]
+        pub struct AutoRootBusFastRegion {
+            /// Name of the region in the access statistics
+            pub name: &'static str,
+            pub start: u32,
+            pub len: u32,
+            pub ram: std::rc::Rc<std::cell::RefCell<caliptra_emu_bus::Ram>>,
+            /// Read-only regions only take the fast path for reads.
+            pub writable: bool,
+        }
+
+        /// Access counters of one peripheral or delegate of the root bus.
+        #[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+        pub struct AutoRootBusAccessStats {
+            pub reads: u64,
+            pub writes: u64,
+            pub bytes_read: u64,
+            pub bytes_written: u64,
+            /// Reads that returned the same value from the same address as the previous read
+            /// of this target, i.e. iterations of a polling loop.
+            pub poll_reads: u64,
+            /// Cycles between the repeated reads counted in `poll_reads`.
+            pub poll_cycles: u64,
+        }
+
+        /// An access to a peripheral or delegate of the root bus, as passed to the access
+        /// observer.
+        #[derive(Clone, Copy, Debug, PartialEq, Eq)]
+        pub struct AutoRootBusAccess {
+            /// Index of the target, in the order of `AutoRootBus::stats()`
+            pub target: usize,
+            pub write: bool,
+            pub size: caliptra_emu_types::RvSize,
+            pub addr: caliptra_emu_types::RvAddr,
+            /// The value written or read, `None` if the read faulted
+            pub val: Option<caliptra_emu_types::RvData>,
+        }
+
+        /// Callback of [`AutoRootBus::set_access_observer`].
+        pub type AutoRootBusObserver = Box<dyn FnMut(&AutoRootBusAccess)>;
+
+        struct AutoRootBusStats {
+            clock: std::rc::Rc<caliptra_emu_bus::Clock>,
+            targets: Vec<AutoRootBusAccessStats>,
+            /// Address, value and cycle of the last read of each target
+            last_reads: Vec<Option<(caliptra_emu_types::RvAddr, caliptra_emu_types::RvData, u64)>>,
+            /// Reads and writes served by each fast region, without polling or the observer
+            fast_regions: Vec<AutoRootBusAccessStats>,
+            observer: Option<AutoRootBusObserver>,
+        }
+        impl AutoRootBusStats {
+            fn access_bytes(size: caliptra_emu_types::RvSize) -> u64 {
+                match size {
+                    caliptra_emu_types::RvSize::Byte => 1,
+                    caliptra_emu_types::RvSize::HalfWord => 2,
+                    caliptra_emu_types::RvSize::Word => 4,
+                    _ => 0,
+                }
+            }
+
+            fn read(&mut self, target: usize, size: caliptra_emu_types::RvSize, addr: caliptra_emu_types::RvAddr, result: &Result<caliptra_emu_types::RvData, caliptra_emu_bus::BusError>) {
+                if let Some(observer) = self.observer.as_mut() {
+                    observer(&AutoRootBusAccess { target, write: false, size, addr, val: result.as_ref().ok().copied() });
+                }
+                let now = self.clock.now();
+                let stats = &mut self.targets[target];
+                stats.reads += 1;
+                stats.bytes_read += Self::access_bytes(size);
+                let Ok(val) = *result else {
+                    return;
+                };
+                if let Some((last_addr, last_val, last_cycle)) = self.last_reads[target] {
+                    if last_addr == addr && last_val == val {
+                        stats.poll_reads += 1;
+                        stats.poll_cycles += now - last_cycle;
+                    }
+                }
+                self.last_reads[target] = Some((addr, val, now));
+            }
+
+            #[inline(always)]
+            fn fast_access(&mut self, region: usize, size: caliptra_emu_types::RvSize, write: bool) {
+                let stats = &mut self.fast_regions[region];
+                if write {
+                    stats.writes += 1;
+                    stats.bytes_written += Self::access_bytes(size);
+                } else {
+                    stats.reads += 1;
+                    stats.bytes_read += Self::access_bytes(size);
+                }
+            }
+
+            fn write(&mut self, target: usize, size: caliptra_emu_types::RvSize, addr: caliptra_emu_types::RvAddr, val: caliptra_emu_types::RvData) {
+                if let Some(observer) = self.observer.as_mut() {
+                    observer(&AutoRootBusAccess { target, write: true, size, addr, val: Some(val) });
+                }
+                let stats = &mut self.targets[target];
+                stats.writes += 1;
+                stats.bytes_written += Self::access_bytes(size);
+                self.last_reads[target] = None;
+            }
+        }
+
         pub struct AutoRootBus {
             delegates: Vec<Box<dyn caliptra_emu_bus::Bus>>,
             offsets: AutoRootBusOffsets,
+            fast_regions: Vec<AutoRootBusFastRegion>,
+            last_fast_region: usize,
+            stats: Option<Box<AutoRootBusStats>>,
             #field_tokens
         }
         impl AutoRootBus {
@@ -787,26 +961,161 @@ fn emu_make_root_bus<'a>(
                 Self {
                     delegates,
                     offsets: offsets.unwrap_or_default(),
+                    fast_regions: vec![],
+                    last_fast_region: 0,
+                    stats: None,
                     #constructor_tokens
                 }
             }
+
+            /// Set the RAM-backed regions that are resolved before the peripherals and delegates.
+            ///
+            /// Misaligned accesses and accesses past the end of the backing RAM fall through to
+            /// the regular dispatch, so the regions must be the ones the delegates would serve
+            /// for the same addresses.
+            pub fn set_fast_regions(&mut self, regions: Vec<AutoRootBusFastRegion>) {
+                if let Some(stats) = self.stats.as_mut() {
+                    stats.fast_regions = vec![AutoRootBusAccessStats::default(); regions.len()];
+                }
+                self.fast_regions = regions;
+                self.last_fast_region = 0;
+            }
+
+            pub fn fast_regions(&self) -> &[AutoRootBusFastRegion] {
+                &self.fast_regions
+            }
+
+            /// Names of the peripherals, in the order of their counters in `stats()`.
+            pub const PERIPHERALS: &'static [&'static str] = &[#(#periph_names),*];
+
+            /// Start counting the accesses to each peripheral, delegate and fast region, timing
+            /// polling loops of the peripherals and delegates with `clock`.
+            pub fn enable_stats(&mut self, clock: std::rc::Rc<caliptra_emu_bus::Clock>) {
+                let targets = Self::PERIPHERALS.len() + self.delegates.len();
+                let observer = self.stats.take().and_then(|stats| stats.observer);
+                self.stats = Some(Box::new(AutoRootBusStats {
+                    clock,
+                    targets: vec![AutoRootBusAccessStats::default(); targets],
+                    last_reads: vec![None; targets],
+                    fast_regions: vec![AutoRootBusAccessStats::default(); self.fast_regions.len()],
+                    observer,
+                }));
+            }
+
+            /// Call `observer` on every access counted by the statistics, enabling them if
+            /// needed.
+            pub fn set_access_observer(&mut self, clock: std::rc::Rc<caliptra_emu_bus::Clock>, observer: AutoRootBusObserver) {
+                if self.stats.is_none() {
+                    self.enable_stats(clock);
+                }
+                if let Some(stats) = self.stats.as_mut() {
+                    stats.observer = Some(observer);
+                }
+            }
+
+            /// Access counters of the peripherals in `PERIPHERALS` order followed by those of
+            /// the delegates, if enabled.
+            pub fn stats(&self) -> Option<&[AutoRootBusAccessStats]> {
+                self.stats.as_ref().map(|stats| stats.targets.as_slice())
+            }
+
+            /// State of each peripheral with state to keep in an emulator snapshot, by name.
+            pub fn save_state(&self) -> Vec<(&'static str, Vec<u8>)> {
+                let mut states = vec![];
+                #save_state_tokens
+                states
+            }
+
+            /// Restore the state `save_state` returned for peripheral `name`. Fails if this bus
+            /// does not have that peripheral.
+            pub fn restore_state(&mut self, name: &str, state: &[u8]) -> std::io::Result<()> {
+                let restored = match name {
+                    #restore_state_tokens
+                    _ => None,
+                };
+                restored.unwrap_or_else(|| {
+                    Err(std::io::Error::new(
+                        std::io::ErrorKind::InvalidData,
+                        format!("no {} peripheral to restore", name),
+                    ))
+                })
+            }
+
+            /// Access counters of the fast regions in `fast_regions()` order, if enabled.
+            /// Polling is not tracked and the observer is not called for these accesses.
+            pub fn fast_region_stats(&self) -> Option<&[AutoRootBusAccessStats]> {
+                self.stats.as_ref().map(|stats| stats.fast_regions.as_slice())
+            }
+
+            /// Find the fast region serving an access, trying the last region hit first.
+            #[inline(always)]
+            fn fast_region(&mut self, size: caliptra_emu_types::RvSize, addr: caliptra_emu_types::RvAddr) -> Option<(&AutoRootBusFastRegion, std::ops::Range<usize>)> {
+                let width = match size {
+                    caliptra_emu_types::RvSize::Byte => 1,
+                    caliptra_emu_types::RvSize::HalfWord => 2,
+                    caliptra_emu_types::RvSize::Word => 4,
+                    _ => return None,
+                };
+                let contains = |region: &AutoRootBusFastRegion| addr.wrapping_sub(region.start) < region.len;
+                if !self.fast_regions.get(self.last_fast_region).is_some_and(contains) {
+                    self.last_fast_region = self.fast_regions.iter().position(contains)?;
+                }
+                let region = &self.fast_regions[self.last_fast_region];
+                let offset = (addr - region.start) as usize;
+                if offset % width != 0 {
+                    return None;
+                }
+                Some((region, offset..offset + width))
+            }
         }
         impl caliptra_emu_bus::Bus for AutoRootBus {
             fn read(&mut self, size: caliptra_emu_types::RvSize, addr: caliptra_emu_types::RvAddr) -> Result<caliptra_emu_types::RvData, caliptra_emu_bus::BusError> {
+                if let Some((region, range)) = self.fast_region(size, addr) {
+                    let val = region.ram.borrow().data().get(range).map(|bytes| {
+                        let mut val = [0u8; 4];
+                        val[..bytes.len()].copy_from_slice(bytes);
+                        u32::from_le_bytes(val)
+                    });
+                    if let Some(val) = val {
+                        if let Some(stats) = self.stats.as_mut() {
+                            stats.fast_access(self.last_fast_region, size, false);
+                        }
+                        return Ok(val);
+                    }
+                }
                 #read_tokens
-                for delegate in self.delegates.iter_mut() {
+                for (index, delegate) in self.delegates.iter_mut().enumerate() {
                     let result = delegate.read(size, addr);
                     if !matches!(result, Err(caliptra_emu_bus::BusError::LoadAccessFault)) {
+                        if let Some(stats) = self.stats.as_mut() {
+                            stats.read(Self::PERIPHERALS.len() + index, size, addr, &result);
+                        }
                         return result;
                     }
                 }
                 Err(caliptra_emu_bus::BusError::LoadAccessFault)
             }
             fn write(&mut self, size: caliptra_emu_types::RvSize, addr: caliptra_emu_types::RvAddr, val: caliptra_emu_types::RvData) -> Result<(), caliptra_emu_bus::BusError> {
+                if let Some((region, range)) = self.fast_region(size, addr) {
+                    let written = region.writable
+                        && region.ram.borrow_mut().data_mut().get_mut(range).map(|bytes| {
+                            let width = bytes.len();
+                            bytes.copy_from_slice(&val.to_le_bytes()[..width]);
+                        }).is_some();
+                    if written {
+                        if let Some(stats) = self.stats.as_mut() {
+                            stats.fast_access(self.last_fast_region, size, true);
+                        }
+                        return Ok(());
+                    }
+                }
                 #write_tokens
-                for delegate in self.delegates.iter_mut() {
+                for (index, delegate) in self.delegates.iter_mut().enumerate() {
                     let result = delegate.write(size, addr, val);
                     if !matches!(result, Err(caliptra_emu_bus::BusError::StoreAccessFault)) {
+                        if let Some(stats) = self.stats.as_mut() {
+                            stats.write(Self::PERIPHERALS.len() + index, size, addr, val);
+                        }
                         return result;
                     }
                 }